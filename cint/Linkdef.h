@@ -67,6 +67,7 @@ class TTree;
 
 #pragma link C++ class dragon::utils::AutoPtr<midas::Xml>+;
 #pragma link C++ class dragon::utils::AutoPtr<dragon::RossumData>+;
+#pragma link C++ class dragon::utils::AutoPtr<dragon::BusytimeSummary>+;
 #pragma link C++ class dragon::utils::AutoPtr<std::ifstream>+;
 
 #if ROOT_VERSION_CODE >= ROOT_VERSION(5,30,0)
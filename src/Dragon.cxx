@@ -186,13 +186,11 @@ void dragon::Bgo::calculate()
 	/*!
 	 * Does the following:
 	 */
-	/// - Pedestal subtract, zero suppress and calibrate energy values
-	dutils::pedestal_subtract(ecal, MAX_CHANNELS, variables.adc);
-	dutils::zero_suppress1(ecal, MAX_CHANNELS, 10.);
-	dutils::linear_calibrate(ecal, MAX_CHANNELS, variables.adc);
+	/// - Pedestal subtract, zero suppress and calibrate energy values (in one pass)
+	dutils::calibrate<dutils::CAL_PEDESTAL | dutils::CAL_THRESHOLD>(ecal, MAX_CHANNELS, variables.adc, 10.);
 
 	/// - Calibrate time values
-	dutils::linear_calibrate(tcal, MAX_CHANNELS, variables.tdc);
+	dutils::calibrate<dutils::CAL_LINEAR>(tcal, MAX_CHANNELS, variables.tdc);
 
 	/// - Calculate descending-order energy indices and map into \c esort[]
 	int isort[MAX_CHANNELS];
@@ -310,10 +308,10 @@ void dragon::Dsssd::calculate()
 	 * from variables.adc_slope and variables.adc_offset, respectively. Also calibrates the TDC
 	 * signal; calculates efront, hit_front, eback, and hit_back.
 	 *
-	 * Delegates the work to dutils::linear_calibrate
+	 * Delegates the work to dutils::calibrate() and dutils::linear_calibrate()
 	 * \note Do we want to add a zero suppression threshold here?
 	 */
-	dutils::linear_calibrate(ecal, MAX_CHANNELS, variables.adc);
+	dutils::calibrate<dutils::CAL_LINEAR>(ecal, MAX_CHANNELS, variables.adc);
 	dutils::linear_calibrate(tfront, variables.tdc_front);
 	dutils::linear_calibrate(tback,  variables.tdc_back);
 
@@ -423,8 +421,8 @@ void dragon::IonChamber::calculate()
 	/*!
 	 * Calibrates anode and time signals, calculates anode sum
 	 */
-	dutils::linear_calibrate(anode, MAX_CHANNELS, variables.adc);
-	dutils::linear_calibrate(tcal, MAX_TDC, variables.tdc);
+	dutils::calibrate<dutils::CAL_LINEAR>(anode, MAX_CHANNELS, variables.adc);
+	dutils::calibrate<dutils::CAL_LINEAR>(tcal, MAX_TDC, variables.tdc);
 
 	if(dutils::is_valid_any(anode, MAX_CHANNELS)) {
 		sum = dutils::calculate_sum(anode, anode + MAX_CHANNELS);
@@ -526,8 +524,8 @@ void dragon::Mcp::calculate()
 	 * <a href="http://dragon.triumf.ca/docs/Lamey_thesis.pdf">
 	 * dragon.triumf.ca/docs/Lamey_thesis.pdf</a>
 	 */
-	dutils::linear_calibrate(anode, MAX_CHANNELS, variables.adc);
-	dutils::linear_calibrate(tcal, NUM_DETECTORS, variables.tdc);
+	dutils::calibrate<dutils::CAL_LINEAR>(anode, MAX_CHANNELS, variables.adc);
+	dutils::calibrate<dutils::CAL_LINEAR>(tcal, NUM_DETECTORS, variables.tdc);
 	dutils::linear_calibrate(tac, variables.tac_adc);
 
 	dutils::calculate_sum(anode, anode + MAX_CHANNELS);
@@ -641,9 +639,9 @@ void dragon::SurfaceBarrier::calculate()
   /*!
 	 * Performs calibration of energies.
 	 *
-	 * Delegates work to dutils::linear_calibrate()
+	 * Delegates work to dutils::calibrate()
 	 */
-	dutils::linear_calibrate(ecal, MAX_CHANNELS, variables.adc);
+	dutils::calibrate<dutils::CAL_LINEAR>(ecal, MAX_CHANNELS, variables.adc);
 }
 
 
@@ -719,7 +717,7 @@ void dragon::NaI::read_data(const vme::V785 adcs[], const vme::V1190&)
 void dragon::NaI::calculate()
 {
 	/// Linear calibration of energies
-	dutils::linear_calibrate(ecal, MAX_CHANNELS, variables.adc);
+	dutils::calibrate<dutils::CAL_LINEAR>(ecal, MAX_CHANNELS, variables.adc);
 }
 
 
@@ -935,7 +933,7 @@ bool dragon::Head::set_variables(const midas::Database* db)
 	return success;
 }
 
-void dragon::Head::unpack(const midas::Event& event)
+void dragon::Head::unpack(const midas::EventView& event)
 {
 	/*!
 	 * \param [in] event Reference to a Midas event structure
@@ -1089,7 +1087,7 @@ void dragon::Tail::reset()
 	dutils::reset_data(tcalx, tcal0, tcal_rf);
 }
 
-void dragon::Tail::unpack(const midas::Event& event)
+void dragon::Tail::unpack(const midas::EventView& event)
 {
 	/*!
 	 * \param [in] event Reference to a Midas event structure
@@ -1328,7 +1326,7 @@ inline bool check_bank_len(int expected, int gotten, const char* bkname)
 	return retval;
 } }
 
-void dragon::Scaler::unpack(const midas::Event& event)
+void dragon::Scaler::unpack(const midas::EventView& event)
 {
 	/*!
 	 * Unpacks scaler data directly into the various array structures.
@@ -1577,7 +1575,7 @@ bool dragon::Epics::set_variables(const midas::Database* db)
 	return variables.set(db);
 }
 
-void dragon::Epics::unpack(const midas::Event& event)
+void dragon::Epics::unpack(const midas::EventView& event)
 {
   /// ::
 	bool report = true;
@@ -21,7 +21,7 @@ typedef const char Option_t;
 
 
 // Forward declare midas coincidence event //
-namespace midas { struct CoincEvent; class Database; }
+namespace midas { class EventView; struct CoincEvent; class Database; }
 
 // Forward declare vme classes //
 namespace vme {
@@ -551,7 +551,7 @@ public: // Methods
 	///  Reads all variable values from a constructed database
 	bool set_variables(const midas::Database* db);
 	/// Unpack raw data into VME modules
-	void unpack(const midas::Event& event);
+	void unpack(const midas::EventView& event);
 	/// Calculate higher-level data for each detector, or across detectors
 	void calculate();
 
@@ -641,7 +641,7 @@ public: // Methods
 	///  Reads all variable values from a constructed database
 	bool set_variables(const midas::Database* db);
 	/// Unpack raw data into VME modules
-	void unpack(const midas::Event& event);
+	void unpack(const midas::EventView& event);
 	/// Calculate higher-level data for each detector, or across detectors
 	void calculate();
 
@@ -806,7 +806,7 @@ public: // Methods
   /// Reset all data to zero
   void reset();
   /// Unpack Midas event data into scalar data structiures
-  void unpack(const midas::Event& event);
+  void unpack(const midas::EventView& event);
 	/// Returns the name of a given scaler channel
 	const std::string& channel_name(int ch) const;
 	///  Reads all variable values from an database (file or online)
@@ -872,7 +872,7 @@ public: // Methods
   /// Reset all data to zero
   void reset();
   /// Unpack Midas event data into scalar data structiures
-  void unpack(const midas::Event& event);
+  void unpack(const midas::EventView& event);
 	/// Returns the name of a given scaler channel
 	const std::string& channel_name(int ch) const;
 	///  Reads all variable values from an database (file or online)
@@ -0,0 +1,412 @@
+///
+/// \file Pipeline.cxx
+/// \author G. Christian
+/// \brief Implements Pipeline.hxx
+///
+#include <cassert>
+#include <sched.h>
+#include <unistd.h>
+#include "utils/definitions.h"
+#include "utils/ErrorDragon.hxx"
+#include "midas/libMidasInterface/TMidasFile.h"
+#include "Pipeline.hxx"
+
+
+namespace {
+
+/// Size of the reader -> sequencer ring (power of 2)
+const uint64_t kInputRingSize = 4096;
+
+/// Job slots per worker thread
+const int kJobsPerThread = 8;
+
+/// Back off while waiting on another stage: spin, then yield, then sleep
+inline void backoff(int& spins)
+{
+	if (++spins < 64) return;
+	if (spins < 128) sched_yield();
+	else usleep(50);
+}
+
+/// Read a value written by another thread
+template <class T>
+inline T load(const volatile T& t)
+{
+	T value = t;
+	__sync_synchronize();
+	return value;
+}
+
+/// Publish a value to other threads
+template <class T>
+inline void store(volatile T& t, T value)
+{
+	__sync_synchronize();
+	t = value;
+}
+
+}
+
+
+// ============ class dragon::UnpackPipeline::Job ================ //
+
+dragon::UnpackPipeline::Job::Job():
+	fSerial(-1),
+	fState(kFree),
+	fInput(0),
+	fUnpacker(&fHead, &fTail, &fCoinc, 0, 0, 0, 0, 0, 0, true)
+{
+	Clear();
+}
+
+dragon::UnpackPipeline::Job::~Job()
+{
+	delete fInput;
+}
+
+void dragon::UnpackPipeline::Job::Clear()
+{
+	delete fInput;
+	fInput = 0;
+	fWriterUnpack = false;
+	fCodes.clear();
+	fHeadSrc = 0;
+	fTailSrc = 0;
+	fHaveCoinc = false;
+}
+
+
+// ============ class dragon::UnpackPipeline ================ //
+
+dragon::UnpackPipeline::UnpackPipeline(dragon::Unpacker& unpacker, int nthreads):
+	fUnpacker(unpacker),
+	fNumThreads(nthreads > 0 ? nthreads : 1),
+	fFile(0),
+	fNumRead(0),
+	fInput(kInputRingSize, (midas::Event*)0),
+	fInputHead(0),
+	fInputTail(0),
+	fJobs(kJobsPerThread*fNumThreads + 2, (Job*)0),
+	fNumJobs(0),
+	fNextJob(0),
+	fSequenceDone(0),
+	fQueue(0),
+	fCurrent(0),
+	fHaveDiag(false)
+{
+	for (size_t i = 0; i < fJobs.size(); ++i)
+		fJobs[i] = new Job();
+}
+
+dragon::UnpackPipeline::~UnpackPipeline()
+{
+	for (size_t i = 0; i < fJobs.size(); ++i)
+		delete fJobs[i];
+	for (size_t i = 0; i < fInput.size(); ++i)
+		delete fInput[i];
+}
+
+int64_t dragon::UnpackPipeline::Run(TMidasFile& file, Output& output)
+{
+	/*!
+	 * Call after Unpacker::HandleBor() and after setting the unpacker's coincidence
+	 * parameters; the variables of the unpacker's head, tail and coinc classes are
+	 * copied to each job slot here. Returns after the end-of-run queue flush.
+	 *
+	 * \returns The number of events read from \e file
+	 */
+	fFile = &file;
+	fNumRead = 0;
+	fInputHead = fInputTail = 0;
+	fNumJobs = fNextJob = 0;
+	fSequenceDone = 0;
+	for (size_t i = 0; i < fJobs.size(); ++i) {
+		fJobs[i]->Clear();
+		fJobs[i]->fState = kFree;
+		fJobs[i]->fSerial = -1;
+		fJobs[i]->fHead  = *fUnpacker.fHead;
+		fJobs[i]->fTail  = *fUnpacker.fTail;
+		fJobs[i]->fCoinc = *fUnpacker.fCoinc;
+	}
+
+	/// - Set up a private timestamp queue matching the one of the unpacker
+	if (fUnpacker.IsSinglesMode()) {
+		fQueue.reset(0);
+	}
+	else if (fUnpacker.GetQueueType() == dragon::Unpacker::kRingQueue) {
+		fQueue.reset(tstamp::NewOwnedRingQueue(fUnpacker.GetQueue()->GetMaxDelta(), this));
+	}
+	else {
+		fQueue.reset(tstamp::NewOwnedQueue(fUnpacker.GetQueue()->GetMaxDelta(), this));
+	}
+	fDiag = *fUnpacker.fDiag;
+
+	/// - Start reader, sequencer and worker threads
+	std::vector<pthread_t> threads(fNumThreads + 2);
+	pthread_create(&threads[0], 0, ReaderThread, this);
+	pthread_create(&threads[1], 0, SequencerThread, this);
+	for (int i = 0; i < fNumThreads; ++i)
+		pthread_create(&threads[i + 2], 0, WorkerThread, this);
+
+	/// - Write events from the calling thread until the sequencer is done
+	WriteEvents(output);
+
+	for (size_t i = 0; i < threads.size(); ++i)
+		pthread_join(threads[i], 0);
+
+	fFile = 0;
+	fQueue.reset(0);
+	return fNumRead;
+}
+
+void* dragon::UnpackPipeline::ReaderThread(void* arg)
+{
+	static_cast<UnpackPipeline*>(arg)->ReadEvents();
+	return 0;
+}
+
+void* dragon::UnpackPipeline::SequencerThread(void* arg)
+{
+	static_cast<UnpackPipeline*>(arg)->SequenceEvents();
+	return 0;
+}
+
+void* dragon::UnpackPipeline::WorkerThread(void* arg)
+{
+	static_cast<UnpackPipeline*>(arg)->UnpackEvents();
+	return 0;
+}
+
+void dragon::UnpackPipeline::ReadEvents()
+{
+	/// Reads events in place and copies them into midas::Event objects, with
+	/// timestamp information for head and tail events in coincidence mode. A
+	/// NULL event marks the end of the file.
+	const bool coinc = !fUnpacker.IsSinglesMode();
+	const double window = fUnpacker.GetCoincWindow();
+	const char* bkHead = fUnpacker.fHead->variables.bk_tsc;
+	const char* bkTail = fUnpacker.fTail->variables.bk_tsc;
+
+	TMidasEvent temp;
+	bool more = true;
+	while (more) {
+		midas::Event* event = 0;
+		if (fFile->ReadInPlace(&temp)) {
+			const char* tsc = 0;
+			if (coinc && temp.GetEventId() == DRAGON_HEAD_EVENT) tsc = bkHead;
+			if (coinc && temp.GetEventId() == DRAGON_TAIL_EVENT) tsc = bkTail;
+			event = new midas::Event(temp.GetEventHeader(), temp.GetData(), temp.GetDataSize(), tsc, window);
+			++fNumRead;
+		}
+		else {
+			more = false;
+		}
+
+		const uint64_t head = fInputHead;
+		int spins = 0;
+		while (head - load(fInputTail) >= kInputRingSize)
+			backoff(spins);
+		fInput[head & (kInputRingSize - 1)] = event;
+		store(fInputHead, head + 1);
+	}
+}
+
+dragon::UnpackPipeline::Job* dragon::UnpackPipeline::NewJob()
+{
+	/// Waits until the writer has released the slot for the next serial number
+	const int64_t serial = fNumJobs;
+	Job* job = fJobs[serial % fJobs.size()];
+	int spins = 0;
+	while (load(job->fState) != kFree)
+		backoff(spins);
+	job->Clear();
+	job->fSerial = serial;
+	fCurrent = job;
+	fHaveDiag = false;
+	return job;
+}
+
+void dragon::UnpackPipeline::PublishJob(Job* job)
+{
+	if (fHaveDiag)
+		job->fDiag = fDiag;
+	fCurrent = 0;
+	store(job->fState, int(kPlanned));
+	store(fNumJobs, job->fSerial + 1);
+}
+
+void dragon::UnpackPipeline::SequenceEvents()
+{
+	/*!
+	 * Mirrors Unpacker::UnpackMidasEvent() and the end-of-run flush loop
+	 * (Unpacker::FlushQueueIterative()), recording into one job per step what
+	 * the serial unpacker would unpack:
+	 */
+	while (1) {
+		const uint64_t tail = fInputTail;
+		int spins = 0;
+		while (load(fInputHead) == tail)
+			backoff(spins);
+		midas::Event* event = fInput[tail & (kInputRingSize - 1)];
+		fInput[tail & (kInputRingSize - 1)] = 0;
+		store(fInputTail, tail + 1);
+		if (!event) break;
+
+		Job* job = NewJob();
+		job->fInput = event;
+		const uint16_t eid = event->GetEventId();
+
+		if (eid == DRAGON_HEAD_EVENT || eid == DRAGON_TAIL_EVENT) {
+			if (fQueue.get()) {
+				/// - Coincidence mode head & tail events: push into the queue, the
+				///   callbacks record popped singles and coincidences.
+				fQueue->Push(*event, &fDiag);
+			}
+			else if (eid == DRAGON_HEAD_EVENT) { /// - Singles mode: unpack directly
+				job->fHeadSrc = event;
+				job->fCodes.push_back(DRAGON_HEAD_EVENT);
+			}
+			else {
+				job->fTailSrc = event;
+				job->fCodes.push_back(DRAGON_TAIL_EVENT);
+			}
+		}
+		else {
+			/// - Everything else is unpacked by the writer, in order.
+			job->fWriterUnpack = true;
+		}
+		PublishJob(job);
+	}
+
+	/// - At the end of the file, flush the queue one event per job.
+	while (fQueue.get()) {
+		Job* job = NewJob();
+		if (fQueue->FlushIterative(&fDiag) == 0) {
+			fCurrent = 0;
+			break;
+		}
+		PublishJob(job);
+	}
+
+	store(fSequenceDone, 1);
+}
+
+void dragon::UnpackPipeline::Process(const midas::Event& event)
+{
+	/// Same logic as Unpacker::Process(const midas::Event&); only the last
+	/// head or tail event of a step needs unpacking as it overwrites the others.
+	switch (event.GetEventId())
+	{
+	case DRAGON_HEAD_EVENT:
+		fCurrent->fHeadEvent = event;
+		fCurrent->fHeadSrc = &fCurrent->fHeadEvent;
+		fCurrent->fCodes.push_back(DRAGON_HEAD_EVENT);
+		break;
+
+	case DRAGON_TAIL_EVENT:
+		fCurrent->fTailEvent = event;
+		fCurrent->fTailSrc = &fCurrent->fTailEvent;
+		fCurrent->fCodes.push_back(DRAGON_TAIL_EVENT);
+		break;
+
+	default:
+		utils::Error("utils::Unpacker::Process", __FILE__, __LINE__)
+			<< "Unknown event id: " << event.GetEventId() << ", skipping...\n";
+		break;
+	}
+}
+
+void dragon::UnpackPipeline::Process(const midas::Event& event1, const midas::Event& event2)
+{
+	/// Same logic as Unpacker::Process(const midas::Event&, const midas::Event&)
+	midas::CoincEvent coincEvent(event1, event2);
+
+	if (coincEvent.fHeavyIon == 0 ||	coincEvent.fGamma == 0) {
+		dragon::utils::Error("utils::unpacker::Process", __FILE__, __LINE__)
+			<< "Invalid coincidence event, skipping...\n";
+		return;
+	}
+
+	fCurrent->fGamma = *coincEvent.fGamma;
+	fCurrent->fHeavyIon = *coincEvent.fHeavyIon;
+	fCurrent->fHaveCoinc = true;
+	fCurrent->fCodes.push_back(DRAGON_COINC_EVENT);
+}
+
+void dragon::UnpackPipeline::Process(tstamp::Diagnostics*)
+{
+	/// Diagnostics are copied into the job when it is published
+	fHaveDiag = true;
+	fCurrent->fCodes.push_back(DRAGON_TSTAMP_DIAGNOSTICS);
+}
+
+void dragon::UnpackPipeline::UnpackEvents()
+{
+	/// Claims jobs in serial order and runs unpack() + calculate() into the job slot
+	while (1) {
+		const int64_t serial = __sync_fetch_and_add(&fNextJob, 1);
+		Job* job = fJobs[serial % fJobs.size()];
+
+		int spins = 0;
+		while (1) {
+			if (load(job->fSerial) == serial && load(job->fState) == kPlanned)
+				break;
+			if (load(fSequenceDone) && serial >= load(fNumJobs))
+				return;
+			backoff(spins);
+		}
+
+		job->fUnpacker.ClearUnpackedCodes();
+		if (job->fHeadSrc)
+			job->fUnpacker.UnpackHead(*job->fHeadSrc);
+		if (job->fTailSrc)
+			job->fUnpacker.UnpackTail(*job->fTailSrc);
+		if (job->fHaveCoinc)
+			job->fUnpacker.Process(job->fGamma, job->fHeavyIon);
+
+		store(job->fState, int(kDone));
+	}
+}
+
+int64_t dragon::UnpackPipeline::WriteEvents(Output& output)
+{
+	/// Consumes jobs in serial order, copying results into the unpacker's classes
+	std::vector<int32_t> codes;
+	int64_t serial = 0;
+	for (;; ++serial) {
+		Job* job = fJobs[serial % fJobs.size()];
+
+		int spins = 0;
+		while (1) {
+			if (load(job->fSerial) == serial && load(job->fState) == kDone)
+				break;
+			if (load(fSequenceDone) && serial >= load(fNumJobs))
+				return serial;
+			backoff(spins);
+		}
+
+		if (job->fWriterUnpack) {
+			codes = fUnpacker.UnpackMidasEvent(job->fInput->GetEventHeader(), job->fInput->GetData());
+		}
+		else {
+			codes = job->fCodes;
+			if (job->fHeadSrc)
+				*fUnpacker.fHead = job->fHead;
+			if (job->fTailSrc)
+				*fUnpacker.fTail = job->fTail;
+			if (job->fHaveCoinc)
+				*fUnpacker.fCoinc = job->fCoinc;
+			for (size_t i = 0; i < codes.size(); ++i) {
+				if (codes[i] == DRAGON_TSTAMP_DIAGNOSTICS) {
+					*fUnpacker.fDiag = job->fDiag;
+					break;
+				}
+			}
+		}
+
+		output.Fill(codes, job->fInput);
+
+		job->Clear();
+		store(job->fState, int(kFree));
+	}
+}
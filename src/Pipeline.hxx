@@ -0,0 +1,194 @@
+///
+/// \file Pipeline.hxx
+/// \author G. Christian
+/// \brief Defines a multithreaded read / unpack / match / fill pipeline
+///  built around dragon::Unpacker.
+///
+#ifndef DRAGON_PIPELINE_HXX
+#define DRAGON_PIPELINE_HXX
+#ifndef __MAKECINT__
+#include <vector>
+#include <pthread.h>
+#include "midas/Event.hxx"
+#include "TStamp.hxx"
+#include "Dragon.hxx"
+#include "Unpack.hxx"
+
+class TMidasFile;
+
+
+namespace dragon {
+
+///
+/// Multithreaded driver for dragon::Unpacker
+/*!
+ * Splits the serial "read event, UnpackMidasEvent(), fill trees" loop into
+ * four stages, each running in its own thread(s):
+ *
+ *  - Reader: reads events from a TMidasFile and copies them out of the read buffer.
+ *  - Sequencer: runs the (inherently ordered) timestamp queue and decides, for each
+ *    input event, which head, tail and coincidence events need to be unpacked.
+ *  - Workers: N threads running unpack() + calculate() on independent events.
+ *  - Writer: the calling thread; copies the results into the unpacker's external
+ *    classes, in input order, and hands them to an Output (e.g. to fill TTrees).
+ *
+ * Stages are connected by bounded, lock-free single-producer rings. The Output
+ * sees exactly the same sequence of event codes and class contents as the
+ * serial loop (including the end-of-run queue flush), so trees filled from it
+ * are identical entry for entry.
+ *
+ * Scaler, EPICS and run parameter events are stateful (scalers accumulate sums),
+ * so they are unpacked by the writer, in order, through the original unpacker.
+ */
+class UnpackPipeline {
+public:
+	///
+	/// Receives unpacked events from the pipeline
+	class Output {
+	public:
+		/// Empty
+		virtual ~Output() { }
+		///
+		/// Called once per unpacked event, in input order
+		/*!
+		 * When this is called, the external classes of the unpacker passed to
+		 * UnpackPipeline() contain the data for this event.
+		 * \param codes Event codes of the unpacked classes (what
+		 *  Unpacker::GetUnpackedCodes() returns in the serial loop)
+		 * \param event The MIDAS event read from file, or NULL for events
+		 *  coming out of the end-of-run queue flush
+		 */
+		virtual void Fill(const std::vector<int32_t>& codes, midas::Event* event) = 0;
+	};
+
+public:
+	///
+	/// Sets up the pipeline to drive \e unpacker with \e nthreads worker threads
+	UnpackPipeline(dragon::Unpacker& unpacker, int nthreads);
+	///
+	/// Frees job slots
+	~UnpackPipeline();
+	///
+	/// Unpacks all events in \e file, passing them to \e output
+	int64_t Run(TMidasFile& file, Output& output);
+	///
+	/// Returns the number of worker threads
+	int GetNumThreads() const { return fNumThreads; }
+
+private:
+	/// States of a job slot
+	enum SlotState_t { kFree, kPlanned, kDone };
+	///
+	/// Work needed for one step of the serial unpacking loop
+	struct Job {
+		/// Sequence number of this job
+		volatile int64_t fSerial;
+		/// State of the slot holding this job
+		volatile int fState;
+		/// Event read from file (owned), NULL for queue flush steps
+		midas::Event* fInput;
+		/// True if fInput is unpacked by the writer through the original unpacker
+		bool fWriterUnpack;
+		/// Event codes produced by the sequencer
+		std::vector<int32_t> fCodes;
+		/// Last head singles event of this step, or NULL
+		const midas::Event* fHeadSrc;
+		/// Last tail singles event of this step, or NULL
+		const midas::Event* fTailSrc;
+		/// True if this step has a (valid) coincidence
+		bool fHaveCoinc;
+		/// Copy of a head singles event popped from the queue
+		midas::Event fHeadEvent;
+		/// Copy of a tail singles event popped from the queue
+		midas::Event fTailEvent;
+		/// Copy of the head part of the last coincidence
+		midas::Event fGamma;
+		/// Copy of the tail part of the last coincidence
+		midas::Event fHeavyIon;
+		/// Snapshot of the timestamp diagnostics
+		tstamp::Diagnostics fDiag;
+		/// Unpacked head data
+		dragon::Head fHead;
+		/// Unpacked tail data
+		dragon::Tail fTail;
+		/// Unpacked coincidence data
+		dragon::Coinc fCoinc;
+		/// Singles-mode unpacker writing into fHead, fTail, fCoinc
+		dragon::Unpacker fUnpacker;
+		/// Initializes the slot unpacker
+		Job();
+		/// Frees fInput
+		~Job();
+		/// Reset for reuse
+		void Clear();
+	};
+
+private:
+	/// Reader thread body
+	void ReadEvents();
+	/// Sequencer thread body
+	void SequenceEvents();
+	/// Worker thread body
+	void UnpackEvents();
+	/// Writer (calling thread) body
+	int64_t WriteEvents(Output& output);
+	/// Grab the next free job slot (sequencer)
+	Job* NewJob();
+	/// Make a job available to the workers (sequencer)
+	void PublishJob(Job* job);
+	/// Thread entry points
+	static void* ReaderThread(void* arg);
+	static void* SequencerThread(void* arg);
+	static void* WorkerThread(void* arg);
+
+public:
+	/// Timestamp queue callback: records a singles event in the current job
+	void Process(const midas::Event& event);
+	/// Timestamp queue callback: records a coincidence in the current job
+	void Process(const midas::Event& event1, const midas::Event& event2);
+	/// Timestamp queue callback: records a diagnostics event in the current job
+	void Process(tstamp::Diagnostics*);
+
+private:
+	/// Disallow copy
+	UnpackPipeline(const UnpackPipeline&);
+	/// Disallow assign
+	UnpackPipeline& operator= (const UnpackPipeline&);
+
+private:
+	/// Unpacker being driven, owns the external classes filled by the writer
+	dragon::Unpacker& fUnpacker;
+	/// Number of worker threads
+	int fNumThreads;
+	/// Input file, valid during Run()
+	TMidasFile* fFile;
+	/// Number of events read
+	int64_t fNumRead;
+	/// Reader to sequencer ring
+	std::vector<midas::Event*> fInput;
+	/// Next fInput index to write (reader)
+	volatile uint64_t fInputHead;
+	/// Next fInput index to read (sequencer)
+	volatile uint64_t fInputTail;
+	/// Job slots, used as a ring indexed by job serial number
+	std::vector<Job*> fJobs;
+	/// Number of jobs published by the sequencer
+	volatile int64_t fNumJobs;
+	/// Next job to be claimed by a worker
+	volatile int64_t fNextJob;
+	/// Set by the sequencer once fNumJobs is final
+	volatile int fSequenceDone;
+	/// Timestamp queue used by the sequencer
+	std::auto_ptr<tstamp::Queue> fQueue;
+	/// Timestamp diagnostics updated by the sequencer
+	tstamp::Diagnostics fDiag;
+	/// Job being planned by the sequencer
+	Job* fCurrent;
+	/// Diagnostics were produced during the current job
+	bool fHaveDiag;
+};
+
+} // namespace dragon
+
+#endif // #ifndef __MAKECINT__
+#endif
@@ -0,0 +1,334 @@
+///
+/// \file Registry.cxx
+/// \author G. Christian
+/// \brief Implements Registry.hxx
+///
+#include <ctime>
+#include <limits>
+#include <memory>
+#include <sys/stat.h>
+#include "utils/ErrorDragon.hxx"
+#include "midas/Database.hxx"
+#include "Dragon.hxx"
+#include "Registry.hxx"
+
+
+namespace {
+
+/// Locks a mutex for the lifetime of the object
+class ScopedLock {
+public:
+	ScopedLock(pthread_mutex_t& mutex): fMutex(mutex) { pthread_mutex_lock(&fMutex); }
+	~ScopedLock() { pthread_mutex_unlock(&fMutex); }
+private:
+	pthread_mutex_t& fMutex;
+};
+
+}
+
+
+// ============ class dragon::CalibrationRegistry::Block ============ //
+
+dragon::CalibrationRegistry::Block::Block(const char* dir):
+	fDir(dir), fChecksum(0), fChanged(0), fPending(0), fKey(0)
+{
+	;
+}
+
+
+// ============ class dragon::CalibrationRegistry ============ //
+
+dragon::CalibrationRegistry::CalibrationRegistry():
+	fSource(kNone), fPending(0), fNextCheck(std::numeric_limits<time_t>::max())
+{
+	pthread_mutex_init(&fMutex, 0);
+	GetFileStamp(0, fFileStamp);
+}
+
+dragon::CalibrationRegistry::~CalibrationRegistry()
+{
+	Unwatch();
+	for(size_t i=0; i< fBlocks.size(); ++i)
+		delete fBlocks[i];
+	pthread_mutex_destroy(&fMutex);
+}
+
+void dragon::CalibrationRegistry::AddBlock(Block* block)
+{
+	/// \note Blocks added while watching the online ODB are only hotlinked at the
+	///  next call to WatchOnline().
+	ScopedLock lock(fMutex);
+	block->fPending = &fPending;
+	fBlocks.push_back(block);
+}
+
+void dragon::CalibrationRegistry::Add(dragon::Head* head)
+{
+	/// Registers the same variables as dragon::Head::set_variables()
+	Add(&head->bgo.variables, "/dragon/bgo/variables");
+	Add(&head->trf.variables, "/dragon/head/variables/rf_tdc", "/dragon/head/variables/rf_tdc");
+	Add(&head->variables,     "/dragon/head/variables");
+}
+
+void dragon::CalibrationRegistry::Add(dragon::Tail* tail)
+{
+	/// Registers the same variables as dragon::Tail::set_variables()
+#ifndef DRAGON_OMIT_DSSSD
+	Add(&tail->dsssd.variables, "/dragon/dsssd/variables");
+#endif
+#ifndef DRAGON_OMIT_IC
+	Add(&tail->ic.variables,    "/dragon/ic/variables");
+#endif
+	Add(&tail->mcp.variables,   "/dragon/mcp/variables");
+	Add(&tail->sb.variables,    "/dragon/sb/variables");
+#ifndef DRAGON_OMIT_NAI
+	Add(&tail->nai.variables,   "/dragon/nai/variables");
+#endif
+#ifndef DRAGON_OMIT_GE
+	Add(&tail->ge.variables,    "/dragon/ge/variables");
+#endif
+	Add(&tail->trf.variables, "/dragon/tail/variables/rf_tdc", "/dragon/tail/variables/rf_tdc");
+	Add(&tail->variables,     "/dragon/tail/variables");
+}
+
+void dragon::CalibrationRegistry::Add(dragon::Coinc* coinc)
+{
+	/// Registers the variables of the head and tail parts. The coincidence variables
+	/// (window, buffer_time) are not registered: they only configure the timestamp
+	/// queue when it is created, so changing them during a run would have no effect.
+	Add(&coinc->head);
+	Add(&coinc->tail);
+}
+
+bool dragon::CalibrationRegistry::WatchOnline()
+{
+	/// Registered variables are assumed to be in sync with the ODB at the time of
+	/// the call (e.g. read at the start of the run); only later changes are reloaded.
+	/// \returns true if hotlinks could be opened
+	ScopedLock lock(fMutex);
+	CloseHotlinks();
+	fSource = kNone;
+	fNextCheck = std::numeric_limits<time_t>::max();
+	if(!OpenHotlinks()) {
+		CloseHotlinks();
+		return false;
+	}
+	fSource = kOnline;
+	return true;
+}
+
+bool dragon::CalibrationRegistry::WatchFile(const char* filename)
+{
+	/// All registered variables are read from \e filename at the next call to
+	/// Update(), afterwards only when the file changes, and then only those
+	/// whose ODB directory is different.
+	/// \returns false if the file can't be accessed
+	ScopedLock lock(fMutex);
+	CloseHotlinks();
+	fSource = kNone;
+	fNextCheck = std::numeric_limits<time_t>::max();
+
+	FileStamp_t stamp;
+	if(!GetFileStamp(filename, stamp)) {
+		dragon::utils::Error("dragon::CalibrationRegistry::WatchFile", __FILE__, __LINE__)
+			<< "Cannot access file: \"" << filename << "\"";
+		return false;
+	}
+	fFilename = filename;
+	GetFileStamp(0, fFileStamp);
+	for(size_t i=0; i< fBlocks.size(); ++i) {
+		fBlocks[i]->fChecksum = 0;
+		fBlocks[i]->fChanged = 0;
+	}
+	fSource = kFile;
+	fNextCheck = 0;
+	return true;
+}
+
+void dragon::CalibrationRegistry::Unwatch()
+{
+	ScopedLock lock(fMutex);
+	CloseHotlinks();
+	fSource = kNone;
+	fNextCheck = std::numeric_limits<time_t>::max();
+}
+
+void dragon::CalibrationRegistry::Invalidate()
+{
+	/// Useful when the variables were overwritten from elsewhere, e.g. from the ODB
+	/// dump at the start of a run while watching a file.
+	ScopedLock lock(fMutex);
+	GetFileStamp(0, fFileStamp);
+	for(size_t i=0; i< fBlocks.size(); ++i) {
+		fBlocks[i]->fChecksum = 0;
+		fBlocks[i]->fChanged = (fSource == kOnline);
+	}
+	fPending = (fSource == kOnline);
+	if(fSource == kFile) fNextCheck = 0;
+}
+
+int dragon::CalibrationRegistry::Update()
+{
+	/// When nothing changed, this costs a flag check and a time() call, without taking
+	/// the lock, so it can be called before every event. A hotlink sets the flag; the
+	/// watched file is checked (with stat()) at most once every kFileCheckInterval seconds.
+	/// \returns The number of variable blocks reloaded, or -1 if reading failed; the
+	///  variables in use are then left unchanged.
+	if(!fPending && time(0) < fNextCheck)
+		return 0;
+
+	ScopedLock lock(fMutex);
+	fPending = 0; // before reading the block flags, so that later hotlinks set it again
+	switch(fSource) {
+	case kOnline:
+		for(size_t i=0; i< fBlocks.size(); ++i) {
+			if(fBlocks[i]->fChanged) {
+				midas::Database db("online");
+				return Reload(&db);
+			}
+		}
+		return 0;
+	case kFile:
+		{
+			fNextCheck = time(0) + kFileCheckInterval;
+			std::auto_ptr<midas::Database> db(CheckFile());
+			return db.get() ? Reload(db.get()) : 0;
+		}
+	default:
+		return 0;
+	}
+}
+
+midas::Database* dragon::CalibrationRegistry::CheckFile()
+{
+	/// \returns The parsed file if any block changed (owned by the caller), NULL otherwise
+	FileStamp_t stamp;
+	if(!GetFileStamp(fFilename.c_str(), stamp) || stamp == fFileStamp)
+		return 0;
+	fFileStamp = stamp;
+
+	std::auto_ptr<midas::Database> db(new midas::Database(fFilename.c_str()));
+	if(db->IsZombie())
+		return 0;
+
+	bool changed = false;
+	for(size_t i=0; i< fBlocks.size(); ++i) {
+		Block* block = fBlocks[i];
+		uint64_t sum = 0;
+		if(db->Checksum(block->fDir.c_str(), sum) && sum != block->fChecksum) {
+			block->fChecksum = sum;
+			block->fChanged = 1;
+			changed = true;
+		}
+	}
+	return changed ? db.release() : 0;
+}
+
+int dragon::CalibrationRegistry::Reload(const midas::Database* db)
+{
+	std::vector<Block*> changed;
+	for(size_t i=0; i< fBlocks.size(); ++i) {
+		if(fBlocks[i]->fChanged) {
+			fBlocks[i]->fChanged = 0;
+			changed.push_back(fBlocks[i]);
+		}
+	}
+	if(changed.empty())
+		return 0;
+
+	bool success = !db->IsZombie();
+	for(size_t i=0; i< changed.size() && success; ++i)
+		success = changed[i]->Read(db);
+	if(!success) {
+		dragon::utils::Error("dragon::CalibrationRegistry::Update", __FILE__, __LINE__)
+			<< "Failed reading changed variables, keeping the present values.";
+		return -1;
+	}
+
+	dragon::utils::Info info("dragon::CalibrationRegistry::Update");
+	info << "Reloaded variables:";
+	for(size_t i=0; i< changed.size(); ++i) {
+		changed[i]->Commit();
+		info << " " << changed[i]->fDir;
+	}
+	return changed.size();
+}
+
+bool dragon::CalibrationRegistry::GetFileStamp(const char* filename, FileStamp_t& stamp)
+{
+	/// \param filename File name, NULL to reset \e stamp
+	stamp.fTime = 0;
+	stamp.fSize = 0;
+	stamp.fInode = 0;
+	struct stat st;
+	if(!filename || stat(filename, &st) != 0)
+		return false;
+	stamp.fTime = st.st_mtime;
+	stamp.fSize = st.st_size;
+	stamp.fInode = st.st_ino;
+	return true;
+}
+
+#ifdef MIDASSYS
+
+bool dragon::CalibrationRegistry::OpenHotlinks()
+{
+	HNDLE hDB = midas::Odb::GetHandle();
+	if(hDB == 0)
+		return false;
+
+	for(size_t i=0; i< fBlocks.size(); ++i) {
+		Block* block = fBlocks[i];
+		HNDLE hKey = 0;
+		INT size = 0;
+		if(db_find_key(hDB, 0, (char*)block->fDir.c_str(), &hKey) != DB_SUCCESS ||
+			 db_get_record_size(hDB, hKey, 0, &size) != DB_SUCCESS) {
+			dragon::utils::Warning("dragon::CalibrationRegistry::WatchOnline", __FILE__, __LINE__)
+				<< "ODB directory \"" << block->fDir << "\" not found, it will not be watched.";
+			continue;
+		}
+		block->fRecord.resize(size > 0 ? size : 1);
+		if(db_open_record(hDB, hKey, &block->fRecord[0], size, MODE_READ, Hotlink, block) != DB_SUCCESS) {
+			dragon::utils::Error("dragon::CalibrationRegistry::WatchOnline", __FILE__, __LINE__)
+				<< "Cannot open hotlink on \"" << block->fDir << "\".";
+			return false;
+		}
+		block->fKey = hKey;
+		block->fChanged = 0;
+	}
+	return true;
+}
+
+void dragon::CalibrationRegistry::CloseHotlinks()
+{
+	HNDLE hDB = 0;
+	for(size_t i=0; i< fBlocks.size(); ++i) {
+		if(fBlocks[i]->fKey == 0) continue;
+		if(hDB == 0) hDB = midas::Odb::GetHandle();
+		if(hDB) db_close_record(hDB, fBlocks[i]->fKey);
+		fBlocks[i]->fKey = 0;
+		fBlocks[i]->fChanged = 0;
+	}
+}
+
+#else
+
+bool dragon::CalibrationRegistry::OpenHotlinks()
+{
+	dragon::utils::Error("dragon::CalibrationRegistry::WatchOnline", __FILE__, __LINE__)
+		<< "Online ODB access requires compiling with MIDAS libraries.";
+	return false;
+}
+
+void dragon::CalibrationRegistry::CloseHotlinks()
+{
+	;
+}
+
+#endif
+
+void dragon::CalibrationRegistry::Hotlink(int, int, void* block)
+{
+	static_cast<Block*>(block)->fChanged = 1;
+	*static_cast<Block*>(block)->fPending = 1;
+}
@@ -0,0 +1,237 @@
+///
+/// \file Registry.hxx
+/// \author G. Christian
+/// \brief Defines a registry of detector variables that can be reloaded
+///  while a run is in progress.
+///
+#ifndef DRAGON_REGISTRY_HXX
+#define DRAGON_REGISTRY_HXX
+#ifndef __MAKECINT__
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+#include "utils/IntTypes.h"
+
+namespace midas { class Database; }
+
+
+namespace dragon {
+
+class Head;
+class Tail;
+class Coinc;
+
+///
+/// Reloads detector variables (calibrations, channel maps) while a run is in progress
+/*!
+ * Each registered block is a detector Variables class, together with the ODB
+ * directory its set() function reads from. Only those directories are watched for
+ * changes, from one of two sources:
+ *
+ *  - WatchOnline(): a MIDAS hotlink on each directory flags its block as changed.
+ *  - WatchFile(): the modification time of an XML (or .mid) file is checked (at most
+ *    once every kFileCheckInterval seconds); when it changes, the file is parsed once and a block is flagged if the checksum of its
+ *    directory is different (see midas::Database::Checksum()).
+ *
+ * Update() reads the flagged blocks into spare copies, and only if all of them were
+ * read successfully copies them over the variables in use. Blocks which did not change
+ * are not read at all. Until a hotlink fires or the file is due to be checked again,
+ * Update() returns without taking the lock. Call it between events from the thread doing the unpacking, so
+ * that every event is calibrated with one consistent set of variables:
+ * \code
+ * dragon::CalibrationRegistry calibration;
+ * calibration.Add(&head);
+ * calibration.Add(&tail);
+ * calibration.WatchOnline();
+ * // event loop:
+ * calibration.Update();
+ * unpacker.HandleMidasEvent(header, data);
+ * \endcode
+ *
+ * \note Online hotlinks are dispatched from cm_yield(), as with any other MIDAS client.
+ */
+class CalibrationRegistry {
+public:
+	/// Source of variables being watched
+	enum Source_t {
+		kNone,   ///< Not watching, Update() does nothing
+		kOnline, ///< Online ODB (hotlinks)
+		kFile    ///< XML or .mid file (modification time)
+	};
+
+	/// Minimum time between checks of a watched file [seconds]
+	static const int kFileCheckInterval = 1;
+
+public:
+	///
+	/// Empty registry, not watching anything
+	CalibrationRegistry();
+	///
+	/// Closes hotlinks, frees blocks
+	~CalibrationRegistry();
+	///
+	/// Register variables read by <tt>variables->set(db)</tt> from ODB directory \e dir
+	template <class V> void Add(V* variables, const char* dir);
+	///
+	/// Register variables read by <tt>variables->set(db, arg)</tt> from ODB directory \e dir
+	template <class V> void Add(V* variables, const char* dir, const char* arg);
+	///
+	/// Register all detector variables of a head class
+	void Add(dragon::Head* head);
+	///
+	/// Register all detector variables of a tail class
+	void Add(dragon::Tail* tail);
+	///
+	/// Register the head and tail variables of a coincidence class
+	void Add(dragon::Coinc* coinc);
+	///
+	/// Watch the online ODB for changes
+	bool WatchOnline();
+	///
+	/// Watch an XML file for changes
+	bool WatchFile(const char* filename);
+	///
+	/// Stop watching
+	void Unwatch();
+	///
+	/// Read all variables from the watched source at the next Update()
+	void Invalidate();
+	///
+	/// Returns the source being watched
+	Source_t GetSource() const { return fSource; }
+	///
+	/// Returns the number of registered blocks
+	size_t GetNumBlocks() const { return fBlocks.size(); }
+	///
+	/// Reload variables which changed since the last call
+	int Update();
+
+private:
+	/// A block of variables and the ODB directory it is read from
+	class Block {
+	public:
+		/// Sets the directory
+		Block(const char* dir);
+		/// Empty
+		virtual ~Block() { }
+		/// Read from \e db into a spare copy of the variables
+		virtual bool Read(const midas::Database* db) = 0;
+		/// Copy the spare variables over the ones in use
+		virtual void Commit() = 0;
+
+	public:
+		/// ODB directory
+		std::string fDir;
+		/// Checksum of fDir when last read (file mode)
+		uint64_t fChecksum;
+		/// Set if the directory changed since the last read
+		volatile int fChanged;
+		/// Registry flag to set along with fChanged (CalibrationRegistry::fPending)
+		volatile int* fPending;
+		/// Hotlinked ODB key, 0 if none (online mode)
+		int fKey;
+		/// Record buffer of the hotlink
+		std::vector<char> fRecord;
+	};
+
+	/// Block read by V::set(db)
+	template <class V> class VariablesBlock: public Block {
+	public:
+		VariablesBlock(V* variables, const char* dir):
+			Block(dir), fVariables(variables) { }
+		bool Read(const midas::Database* db)
+			{ fSpare = *fVariables; return fSpare.set(db); }
+		void Commit()
+			{ *fVariables = fSpare; }
+	private:
+		V* fVariables;
+		V fSpare;
+	};
+
+	/// Block read by V::set(db, arg)
+	template <class V> class VariablesArgBlock: public Block {
+	public:
+		VariablesArgBlock(V* variables, const char* dir, const char* arg):
+			Block(dir), fVariables(variables), fArg(arg) { }
+		bool Read(const midas::Database* db)
+			{ fSpare = *fVariables; return fSpare.set(db, fArg.c_str()); }
+		void Commit()
+			{ *fVariables = fSpare; }
+	private:
+		V* fVariables;
+		std::string fArg;
+		V fSpare;
+	};
+
+	/// Identifies a version of a file
+	struct FileStamp_t {
+		time_t fTime;
+		off_t fSize;
+		ino_t fInode;
+		bool operator== (const FileStamp_t& other) const
+			{ return fTime == other.fTime && fSize == other.fSize && fInode == other.fInode; }
+	};
+
+private:
+	/// Add a block, taking ownership
+	void AddBlock(Block* block);
+	/// Flag blocks changed in the watched file, returns the database to read them from
+	midas::Database* CheckFile();
+	/// Read changed blocks from \e db and commit them
+	int Reload(const midas::Database* db);
+	/// Open a hotlink on the directory of each block
+	bool OpenHotlinks();
+	/// Close all hotlinks
+	void CloseHotlinks();
+	/// Get the stamp of \e filename, false if it can't be accessed
+	static bool GetFileStamp(const char* filename, FileStamp_t& stamp);
+	/// Hotlink callback, flags a block as changed
+	static void Hotlink(int hDB, int hKey, void* block);
+
+private:
+	/// Disallow copy
+	CalibrationRegistry(const CalibrationRegistry&);
+	/// Disallow assign
+	CalibrationRegistry& operator= (const CalibrationRegistry&);
+
+private:
+	/// Registered blocks (owned)
+	std::vector<Block*> fBlocks;
+	/// Source being watched
+	Source_t fSource;
+	/// Name of the watched file
+	std::string fFilename;
+	/// Stamp of the watched file when last read
+	FileStamp_t fFileStamp;
+	/// Set when a block may have changed, checked by Update() without locking
+	volatile int fPending;
+	/// Time of the next check of the watched file, checked by Update() without locking
+	volatile time_t fNextCheck;
+	/// Serializes Update() and the Watch functions
+	pthread_mutex_t fMutex;
+};
+
+} // namespace dragon
+
+
+template <class V>
+inline void dragon::CalibrationRegistry::Add(V* variables, const char* dir)
+{
+	/// \param variables Variables class, must remain valid for the lifetime of the registry
+	/// \param dir ODB directory containing all of the keys read by <tt>variables->set()</tt>,
+	///  e.g. "/dragon/bgo/variables"
+	AddBlock(new VariablesBlock<V>(variables, dir));
+}
+
+template <class V>
+inline void dragon::CalibrationRegistry::Add(V* variables, const char* dir, const char* arg)
+{
+	/// \param variables Variables class, must remain valid for the lifetime of the registry
+	/// \param dir ODB directory containing all of the keys read by <tt>variables->set()</tt>
+	/// \param arg Second argument passed to <tt>variables->set()</tt>
+	AddBlock(new VariablesArgBlock<V>(variables, dir, arg));
+}
+
+#endif // #ifndef __MAKECINT__
+#endif
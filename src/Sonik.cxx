@@ -107,7 +107,7 @@ void Sonik::calculate()
 	 * from variables.adc_slope and variables.adc_offset, respectively. Also calibrates the TDC
 	 * signal; calculates ehit, hit.
  	 */
-	dutils::linear_calibrate(ecal, MAX_CHANNELS, variables.adc);
+	dutils::calibrate<dutils::CAL_LINEAR>(ecal, MAX_CHANNELS, variables.adc);
 
 	dutils::linear_calibrate(thit, variables.tdc);
 	dutils::linear_calibrate(tcal0, variables.tdc0);
@@ -4,6 +4,7 @@
  * \brief Implements tstamp::Queue class
  */
 #include <ctime>
+#include <cmath>
 #include <cassert>
 #include <algorithm>
 #include "TStamp.hxx"
@@ -47,6 +48,31 @@ void tstamp::Queue::HandleDiagnostics(tstamp::Diagnostics* d) const
 }
 
 void tstamp::Queue::Push(const midas::Event& event, tstamp::Diagnostics* diagnostics)
+{
+	/*!
+	 * \param [in] event Event to insert into the queue.
+	 * \param [in] diagnostics Optional pointer to a Diagnostics class instance,
+	 *  to be filled with information from the push
+	 * \see DoPush()
+	 */
+	DoPush(event, diagnostics);
+}
+
+void tstamp::Queue::Push(const midas::EventView& event, tstamp::Diagnostics* diagnostics)
+{
+	/*!
+	 * Inserts a copy of the event into the queue; the buffer that \e event
+	 * points to doesn't need to stay valid after this call.
+	 * \param [in] event View of the event to insert into the queue.
+	 * \param [in] diagnostics Optional pointer to a Diagnostics class instance,
+	 *  to be filled with information from the push
+	 * \see DoPush()
+	 */
+	DoPush(event, diagnostics);
+}
+
+template <class E>
+void tstamp::Queue::DoPush(const E& event, tstamp::Diagnostics* diagnostics)
 {
 	/*!
 	 * First the function inserts \e event into the internal container. Then,
@@ -64,11 +90,11 @@ void tstamp::Queue::Push(const midas::Event& event, tstamp::Diagnostics* diagnos
 	 */
 
 	try { // insert event into the queue
-		fEvents.insert(event);
+		Insert(event);
 	}
 	catch (std::exception& e) { // try to handle exception gracefully
 		dragon::utils::Error("tstamp::Queue::Push", __FILE__, __LINE__)
-			<< "Caught an exception from std::multiset::insert: " << e.what()
+			<< "Caught an exception from Insert(): " << e.what()
 			<< " (note: size = " << Size() << ", max size = " << fEvents.max_size()
 			<< "). Clearing the Queue and trying again... WARNING: that this could cause "
 			<< "coincidences to be missed!";
@@ -77,11 +103,11 @@ void tstamp::Queue::Push(const midas::Event& event, tstamp::Diagnostics* diagnos
 
 		try { // try again to insert
 
-			fEvents.insert(event);
+			Insert(event);
 		}
 		catch (std::exception& e) { // give up
 			dragon::utils::Error("tstamp::Queue::Push", __FILE__, __LINE__)
-				<< "Caught a second exception from std::multiset::insert: " << e.what()
+				<< "Caught a second exception from Insert(): " << e.what()
 				<< ". Not sure what to do: rethrowing (likely fatal!)";
 			throw (e);
 		}
@@ -90,10 +116,10 @@ void tstamp::Queue::Push(const midas::Event& event, tstamp::Diagnostics* diagnos
   // Erase event from the front of the queue, but first collect some
 	// diagnostic info
 	
-	assert(fEvents.size() > 0);
+	assert(Size() > 0);
 	bool haveCoinc = false;
 	int32_t singlesId = -1;
-	double tdiff = event.TimeDiff(*fEvents.begin());
+	double tdiff = event.TriggerTime() - Front().TriggerTime();
 	if (IsFull()) Pop(singlesId, haveCoinc);
 
 	/// Update diagnostic info in diagnostics != NULL
@@ -147,13 +173,13 @@ void tstamp::Queue::Flush(int max_time, tstamp::Diagnostics* diagnostics)
 	 *  to be filled with information from the flushed event
 	 */
 	time_t t_begin = time(0);
-	while (!fEvents.empty()) {
+	while (Size() != 0) {
 		if ( max_time < 0 || (difftime(time(0), t_begin) < max_time) ) {
 			DoFlushEvent(diagnostics);
 		}
 		else {
 			FlushTimeoutMessage(max_time);
-			fEvents.clear();
+			Clear();
 		}
 	}
 }
@@ -167,7 +193,7 @@ size_t tstamp::Queue::FlushIterative(tstamp::Diagnostics* diagnostics)
 	 *  to be filled with information from the flushed event
 	 * \returns The size of the internal queue \e before performing a flush.
 	 */
-	size_t qsize = fEvents.size();
+	size_t qsize = Size();
 	if(qsize > 0) DoFlushEvent(diagnostics);
 	return qsize;
 }
@@ -177,7 +203,7 @@ void tstamp::Queue::DoFlushEvent(tstamp::Diagnostics* diagnostics)
 	/// Call Pop() on the front event
 	int32_t singlesId = -1;
 	bool haveCoinc = false;
-	uint32_t tfirst = fEvents.rbegin()->GetTimeStamp();
+	uint32_t tfirst = Back().GetTimeStamp();
 	Pop(singlesId, haveCoinc);
 
 	/// Update diagnostic info if diagnostics != NULL
@@ -197,7 +223,7 @@ void tstamp::Queue::FlushTimeoutMessage(int max_time) const
 	 */
 	dragon::utils::Warning("tstamp::Queue::Flush()", __FILE__, __LINE__)
 		<< "Maximum timeout of " << max_time << " seconds reached. Clearing event queue (skipping "
-		<< fEvents.size() << " events...).";
+		<< Size() << " events...).";
 }
 
 void tstamp::Queue::FillDiagnostics(tstamp::Diagnostics* d, double tdiff, bool have_coinc,
@@ -231,6 +257,415 @@ void tstamp::Queue::FillDiagnostics(tstamp::Diagnostics* d, double tdiff, bool h
 }
 
 
+// ========= Class tstamp::RingQueue ========= //
+
+namespace {
+
+// Helper class to sort coincidence matches by trigger time
+struct CompareTriggerTime {
+	bool operator() (const midas::Event* lhs, const midas::Event* rhs) const
+		{ return lhs->TriggerTime() < rhs->TriggerTime(); }
+};
+
+// Index of the lowest set bit in a (non-zero) word
+inline size_t lowest_bit(uint64_t word)
+{
+	return __builtin_ctzll(word);
+}
+
+// Size of a bitmap capable of holding 'nbits' bits
+inline size_t bitmap_size(size_t nbits)
+{
+	return (nbits + 63) / 64;
+}
+
+// Find the first set bit at or after 'bit', returns 'nbits' if there is none
+inline size_t find_bit(const std::vector<uint64_t>& bitmap, size_t bit, size_t nbits)
+{
+	size_t w = bit >> 6;
+	if (w >= bitmap.size()) return nbits;
+	uint64_t word = bitmap[w] & (~uint64_t(0) << (bit & 63));
+	while (!word) {
+		if (++w == bitmap.size()) return nbits;
+		word = bitmap[w];
+	}
+	return (w << 6) + lowest_bit(word);
+}
+
+}
+
+tstamp::RingQueue::RingQueue(double deltaMax):
+	Queue(deltaMax),
+	fBins(kInitialBins),
+	fOccupancy(bitmap_size(kInitialBins), 0),
+	fSummary(bitmap_size(bitmap_size(kInitialBins)), 0),
+	fBinWidth(1.),
+	fMinKey(0),
+	fMaxKey(0),
+	fNbinned(0)
+{
+	/*!
+	 * \param [in] deltaMax Maximum difference between timestamps before emptying
+	 */
+	;
+}
+
+tstamp::RingQueue::~RingQueue()
+{
+	/*! Deletes all events still stored in the queue, without handling them. */
+	Clear();
+}
+
+void tstamp::RingQueue::Clear()
+{
+	for (size_t slot = 0; slot< fBins.size(); ++slot) {
+		Bin& bin = fBins[slot];
+		for (size_t i = 0; i< bin.fEvents.size(); ++i)
+			delete bin.fEvents[i];
+		bin.fEvents.clear();
+	}
+	for (Overflow_t::iterator it = fOverflow.begin(); it != fOverflow.end(); ++it)
+		delete it->second;
+	fOverflow.clear();
+	std::fill(fOccupancy.begin(), fOccupancy.end(), 0);
+	std::fill(fSummary.begin(), fSummary.end(), 0);
+	fNbinned = 0;
+}
+
+void tstamp::RingQueue::SetOccupied(size_t slot, bool occupied)
+{
+	const size_t w = slot >> 6;
+	if (occupied) {
+		fOccupancy[w] |= uint64_t(1) << (slot & 63);
+		fSummary[w >> 6] |= uint64_t(1) << (w & 63);
+	}
+	else {
+		fOccupancy[w] &= ~(uint64_t(1) << (slot & 63));
+		if (fOccupancy[w] == 0)
+			fSummary[w >> 6] &= ~(uint64_t(1) << (w & 63));
+	}
+}
+
+size_t tstamp::RingQueue::FindSlot(size_t slot) const
+{
+	/*!
+	 * \returns The first non-empty slot >= \e slot (not wrapping around the
+	 *  end of the ring), or fBins.size() if there is none.
+	 */
+	const size_t w = slot >> 6;
+	const uint64_t word = fOccupancy[w] & (~uint64_t(0) << (slot & 63));
+	if (word) return (w << 6) + lowest_bit(word);
+
+	const size_t next = find_bit(fSummary, w + 1, fOccupancy.size());
+	if (next == fOccupancy.size()) return fBins.size();
+	return (next << 6) + lowest_bit(fOccupancy[next]);
+}
+
+int64_t tstamp::RingQueue::NextKey(int64_t key) const
+{
+	/*!
+	 * \attention There must be at least one non-empty bin with a key larger than
+	 *  \e key stored in the ring.
+	 */
+	const size_t mask = fBins.size() - 1;
+	const size_t start = (key + 1) & mask;
+	size_t slot = FindSlot(start);
+	if (slot == fBins.size()) slot = FindSlot(0); // wrap around
+	return key + 1 + ((slot - start) & mask);
+}
+
+bool tstamp::RingQueue::Grow(int64_t span)
+{
+	/*!
+	 * \param span Number of bins the ring needs to hold.
+	 * \returns true if successful, false if the required span is larger than kMaxBins
+	 */
+	size_t nbins = fBins.size();
+	while ((int64_t)nbins < span) nbins *= 2;
+	if (nbins > kMaxBins) return false;
+
+	std::vector<Bin> bins(nbins);
+	if (fNbinned) {
+		for (int64_t key = fMinKey; key <= fMaxKey; key = NextKey(key)) {
+			Bin& bin = GetBin(key);
+			Bin& newBin = bins[key & (nbins - 1)];
+			newBin.fKey = key;
+			newBin.fEvents.swap(bin.fEvents);
+			if (key == fMaxKey) break;
+		}
+	}
+	fBins.swap(bins);
+
+	fOccupancy.assign(bitmap_size(nbins), 0);
+	fSummary.assign(bitmap_size(fOccupancy.size()), 0);
+	for (size_t slot = 0; slot< nbins; ++slot) {
+		if (!fBins[slot].fEvents.empty()) SetOccupied(slot, true);
+	}
+	return true;
+}
+
+void tstamp::RingQueue::Insert(const midas::Event& event)
+{
+	InsertOwned(new midas::Event(event));
+}
+
+void tstamp::RingQueue::Insert(const midas::EventView& event)
+{
+	InsertOwned(new midas::Event(event));
+}
+
+void tstamp::RingQueue::InsertOwned(midas::Event* event)
+{
+	/*!
+	 * The bin width is taken from the coincidence window of the first event
+	 * inserted into an empty ring. The event is placed into the bin corresponding
+	 * to its trigger time, behind any events with an earlier or equal trigger time.
+	 */
+	const double time = event->TriggerTime();
+	if (fNbinned == 0) {
+		fBinWidth = event->CoincWindow() > 0 ? event->CoincWindow() : 1.;
+		fMinKey = fMaxKey = GetKey(time);
+	}
+
+	const int64_t key = GetKey(time);
+	const int64_t minKey = std::min(fMinKey, key), maxKey = std::max(fMaxKey, key);
+	if (maxKey - minKey >= (int64_t)fBins.size() && !Grow(maxKey - minKey + 1)) {
+		fOverflow.insert(std::make_pair(time, event));
+		return;
+	}
+
+	Bin& bin = GetBin(key);
+	bin.fKey = key;
+	if (bin.fEvents.empty()) SetOccupied(key & (fBins.size() - 1), true);
+	std::vector<midas::Event*>::iterator it = bin.fEvents.end();
+	while (it != bin.fEvents.begin() && (*(it-1))->TriggerTime() > time) --it;
+	bin.fEvents.insert(it, event);
+
+	fMinKey = minKey;
+	fMaxKey = maxKey;
+	++fNbinned;
+}
+
+bool tstamp::RingQueue::FrontIsOverflow() const
+{
+	if (fOverflow.empty()) return false;
+	if (fNbinned == 0) return true;
+	return fOverflow.begin()->first < GetBin(fMinKey).fEvents.front()->TriggerTime();
+}
+
+const midas::Event& tstamp::RingQueue::Front() const
+{
+	if (FrontIsOverflow()) return *(fOverflow.begin()->second);
+	return *(GetBin(fMinKey).fEvents.front());
+}
+
+const midas::Event& tstamp::RingQueue::Back() const
+{
+	if (fNbinned == 0) return *(fOverflow.rbegin()->second);
+	const midas::Event* back = GetBin(fMaxKey).fEvents.back();
+	if (!fOverflow.empty() && fOverflow.rbegin()->first >= back->TriggerTime())
+		return *(fOverflow.rbegin()->second);
+	return *back;
+}
+
+void tstamp::RingQueue::Pop(int32_t& singles_id, bool& found_coinc)
+{
+	/*!
+	 * Same as tstamp::Queue::Pop(), except coincidence matches are searched for
+	 * only in the bins that can contain them: since the front event is the earliest
+	 * in the queue, any matches must be in its own bin or the following one(s).
+	 *
+	 * \param [out] singles_id MIDAS event ID of the removed (handled) singles event.
+	 * A return value of -1 means the queue was empty (no event handled).
+	 * \param [out] found_coinc Set to true if a coincidence match was found, false
+	 *  otherwise.
+	 */
+	singles_id = -1;
+	found_coinc = false;
+	if (Size() == 0) return;
+
+	const bool isOverflow = FrontIsOverflow();
+	const midas::Event* front = &Front();
+	const double time = front->TriggerTime();
+
+	fMatches.clear();
+	if (fNbinned) {
+		const int64_t keyLow = std::max(GetKey(time), fMinKey);
+		const int64_t keyHigh = std::min(GetKey(time + front->CoincWindow()) + 1, fMaxKey);
+		for (int64_t key = keyLow; key <= keyHigh; ++key) {
+			const Bin& bin = GetBin(key);
+			for (size_t i = 0; i< bin.fEvents.size(); ++i) {
+				if (bin.fEvents[i] != front && front->IsCoinc(*bin.fEvents[i]))
+					fMatches.push_back(bin.fEvents[i]);
+			}
+		}
+	}
+	if (!fOverflow.empty()) {
+		Overflow_t::const_iterator it = fOverflow.lower_bound(time - front->CoincWindow());
+		for (; it != fOverflow.end() && it->first <= time + front->CoincWindow(); ++it) {
+			if (it->second != front && front->IsCoinc(*(it->second)))
+				fMatches.push_back(it->second);
+		}
+	}
+	if (!fOverflow.empty() && !fMatches.empty())
+		std::stable_sort(fMatches.begin(), fMatches.end(), CompareTriggerTime());
+
+	for (size_t i = 0; i< fMatches.size(); ++i) {
+		found_coinc = true;
+		HandleCoinc(*front, *fMatches[i]);
+	}
+
+	singles_id = front->GetEventId();
+	HandleSingle(*front);
+
+	if (isOverflow) {
+		fOverflow.erase(fOverflow.begin());
+	}
+	else {
+		Bin& bin = GetBin(fMinKey);
+		bin.fEvents.erase(bin.fEvents.begin());
+		--fNbinned;
+		if (bin.fEvents.empty()) {
+			SetOccupied(fMinKey & (fBins.size() - 1), false);
+			if (fNbinned) fMinKey = NextKey(fMinKey);
+		}
+	}
+	delete front;
+}
+
+
+// ========= Split points ========= //
+
+namespace {
+
+/// Stand-in for a queued event: trigger time and position in the run
+struct SplitEvent_t {
+	double fTime;
+	size_t fIndex;
+	SplitEvent_t(double time, size_t index): fTime(time), fIndex(index) { }
+};
+
+/// Same ordering as midas::Event::operator<
+struct SplitLess {
+	double fWindow;
+	SplitLess(double window): fWindow(window) { }
+	bool operator() (const SplitEvent_t& lhs, const SplitEvent_t& rhs) const
+		{
+			if (fabs(lhs.fTime - rhs.fTime) < fWindow) return false;
+			return lhs.fTime - rhs.fTime < 0.;
+		}
+};
+
+typedef std::multiset<SplitEvent_t, SplitLess> SplitSet_t;
+typedef std::pair<size_t, size_t> Match_t;
+
+// Same as tstamp::Queue::Pop(), recording (front, match) index pairs
+void split_pop(SplitSet_t& events, std::vector<Match_t>& matches)
+{
+	std::pair<SplitSet_t::iterator, SplitSet_t::iterator> range = events.equal_range(*events.begin());
+	for (SplitSet_t::iterator it = range.first; it != range.second; ++it) {
+		if (it != events.begin())
+			matches.push_back(Match_t(events.begin()->fIndex, it->fIndex));
+	}
+	matches.push_back(Match_t(events.begin()->fIndex, events.begin()->fIndex));
+	events.erase(events.begin());
+}
+
+// Replays tstamp::Queue::Push() and Flush() on events [begin, end)
+void split_replay(const std::vector<double>& times, size_t begin, size_t end,
+									double maxDelta, double coincWindow, std::vector<Match_t>& matches)
+{
+	SplitSet_t events((SplitLess(coincWindow)));
+	for (size_t i = begin; i < end; ++i) {
+		events.insert(SplitEvent_t(times[i], i));
+		if (events.rbegin()->fTime - events.begin()->fTime > maxDelta)
+			split_pop(events, matches);
+	}
+	while (!events.empty())
+		split_pop(events, matches);
+}
+
+}
+
+std::vector<size_t> tstamp::find_split_points(const std::vector<double>& triggerTimes,
+																							double maxDelta, double coincWindow, size_t nparts)
+{
+	/*!
+	 * A run can be split before an event if all of the events after it are later,
+	 * by more than \e maxDelta, than all of the events before it (i.e. a gap in trigger
+	 * times longer than the queue time). Up to \e nparts - 1 such gaps are picked, as
+	 * evenly spaced as possible in number of events. The queue is then replayed on the
+	 * trigger times alone, once for the whole run and once for each part with a flush
+	 * at its end; split points around any part whose singles and coincidence matches
+	 * are not exactly the same as in the whole run are dropped.
+	 *
+	 * \param triggerTimes Trigger times of the queued (head and tail) events, in the order
+	 *  they are read from the file
+	 * \param maxDelta Queue time, see tstamp::Queue::GetMaxDelta()
+	 * \param coincWindow Coincidence window
+	 * \param nparts Maximum number of parts
+	 * \returns Index in \e triggerTimes of the first event of each part; the first element
+	 *  is always zero (if there are any events), so a size of one means the run can't be split.
+	 * \note Replays the multiset implementation (tstamp::Queue), not tstamp::RingQueue.
+	 */
+	const size_t n = triggerTimes.size();
+	std::vector<size_t> splits;
+	if (n == 0) return splits;
+
+	// Latest time before each event, earliest time from each event on
+	std::vector<double> minAfter(n);
+	minAfter[n-1] = triggerTimes[n-1];
+	for (size_t i = n-1; i > 0; --i)
+		minAfter[i-1] = std::min(minAfter[i], triggerTimes[i-1]);
+
+	splits.push_back(0);
+	double maxBefore = triggerTimes[0];
+	size_t target = 1;
+	for (size_t i = 1; i < n && target < nparts; ++i) {
+		if (minAfter[i] - maxBefore > maxDelta && i >= target * n / nparts) {
+			splits.push_back(i);
+			while (target < nparts && i >= target * n / nparts) ++target;
+		}
+		maxBefore = std::max(maxBefore, triggerTimes[i]);
+	}
+	if (splits.size() < 2) return splits;
+
+	std::vector<Match_t> whole;
+	split_replay(triggerTimes, 0, n, maxDelta, coincWindow, whole);
+
+	// Part of each event, and its matches in the whole run
+	std::vector<std::vector<Match_t> > expected;
+	bool changed = true;
+	while (changed && splits.size() > 1) {
+		changed = false;
+		expected.assign(splits.size(), std::vector<Match_t>());
+		for (size_t i = 0; i < whole.size(); ++i) {
+			const size_t part = std::upper_bound(splits.begin(), splits.end(), whole[i].first) - splits.begin() - 1;
+			expected[part].push_back(whole[i]);
+		}
+
+		std::vector<bool> keep(splits.size(), true);
+		for (size_t part = 0; part < splits.size(); ++part) {
+			const size_t end = part + 1 < splits.size() ? splits[part+1] : n;
+			std::vector<Match_t> matches;
+			split_replay(triggerTimes, splits[part], end, maxDelta, coincWindow, matches);
+			if (matches != expected[part]) {
+				keep[part] = false;
+				if (part + 1 < splits.size()) keep[part+1] = false;
+				changed = true;
+			}
+		}
+		keep[0] = true;
+
+		std::vector<size_t> kept;
+		for (size_t part = 0; part < splits.size(); ++part)
+			if (keep[part]) kept.push_back(splits[part]);
+		splits.swap(kept);
+	}
+	return splits;
+}
+
+
 // ====== Class tstamp::Diagnostics ====== //
 
 tstamp::Diagnostics::Diagnostics()
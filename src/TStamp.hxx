@@ -7,6 +7,8 @@
 #define DRAGON_TSTAMP_HXX
 #include "utils/IntTypes.h"
 #include <set>
+#include <map>
+#include <vector>
 #include "midas/Event.hxx"
 
 
@@ -83,6 +85,9 @@ public:
 	/// Insert an element into the queue
 	virtual void Push(const midas::Event&, tstamp::Diagnostics* diagnostics = 0);
 
+	/// Insert an element into the queue, taking a copy of the data it views
+	virtual void Push(const midas::EventView&, tstamp::Diagnostics* diagnostics = 0);
+
 	/// Erase the earliest event in the queue, first searching for coincidences.
 	virtual void Pop(int32_t& singles_id, bool& found_coinc);
  
@@ -93,7 +98,7 @@ public:
 	virtual size_t FlushIterative(tstamp::Diagnostics* diagnostics = 0);
 
 	/// Returns total number of entries in the queue
-	size_t Size() const { return fEvents.size(); }
+	virtual size_t Size() const { return fEvents.size(); }
 
 	/// Set the maximum queue time to a new value
 	void SetMaxDelta(double delta) { fMaxDelta = delta; }
@@ -105,7 +110,7 @@ public:
 	virtual void FlushTimeoutMessage(int max_time) const;
 
 	/// Manually clear the event buffer
-	void Clear() { fEvents.clear(); }
+	virtual void Clear() { fEvents.clear(); }
 
 protected:
 	/// Check whether the maximum size has been reached
@@ -114,14 +119,25 @@ protected:
 	/// Get trigger time difference between earliest and latest event
 	double MaxTimeDiff() const
 		{
-			if (fEvents.empty()) return 0.;
-			return fEvents.rbegin()->TimeDiff(*fEvents.begin());
+			if (Size() == 0) return 0.;
+			return Back().TimeDiff(Front());
 		}
 
+	/// Insert an event into the internal container
+	virtual void Insert(const midas::Event& event) { fEvents.insert(event); }
+
+	/// Insert a copy of a viewed event into the internal container
+	virtual void Insert(const midas::EventView& event) { fEvents.insert(midas::Event(event)); }
+
+	/// Reference to the earliest event in the queue (must not be empty)
+	virtual const midas::Event& Front() const { return *fEvents.begin(); }
+
+	/// Reference to the latest event in the queue (must not be empty)
+	virtual const midas::Event& Back() const { return *fEvents.rbegin(); }
+
 	/// Fill diagnostic information after a push.
 	void FillDiagnostics(tstamp::Diagnostics* d, double tdiff, bool have_coinc, int32_t singles_id, uint32_t evt_time);
 
-private:
 	/// What to do in case of a coincidence event
 	virtual void HandleCoinc(const midas::Event& e1, const midas::Event& e2) const;
 
@@ -131,8 +147,152 @@ private:
 	/// What to do with a diagnostics event
 	virtual void HandleDiagnostics(tstamp::Diagnostics* diagnostics) const;
 
+private:
 	/// Internal helper function for flushing routines
 	void DoFlushEvent(tstamp::Diagnostics*);
+
+	/// Internal helper function for Push() routines
+	template <class E> void DoPush(const E& event, tstamp::Diagnostics* diagnostics);
+};
+
+
+/// Queue implementation using a time-binned ring buffer
+/*!
+ * Events are stored in bins of trigger time, with the bin width equal to the
+ * coincidence window of the events being inserted. Bins are arranged in a ring
+ * indexed directly by the bin number, so inserting an event, finding the earliest
+ * event, searching for its coincidence matches (which can only live in the same
+ * or the next bin), and removing it are all amortized O(1) operations, as opposed to
+ * O(log n) for the `std::multiset` used by the base class. Within a bin, events
+ * are kept sorted by trigger time.
+ *
+ * Occupied bins are flagged in a two-level bitmap, so that stepping from one non-empty bin
+ * to the next costs at most a few word operations, even across large gaps in time.
+ *
+ * The ring grows as needed to span the full time range of events in the queue, up
+ * to a maximum of kMaxBins bins. Any (pathological) events lying too far away in time
+ * to fit into the ring, e.g. from a corrupt TSC bank, are stored in a separate
+ * time-sorted overflow container and are still considered when matching.
+ *
+ * The handling of singles and coincidence events is identical to that of the base class,
+ * except that events whose trigger times lie within one coincidence window of each other
+ * are always handled in strict trigger time order (ties in time are handled in order of
+ * insertion). The `std::multiset` ordering treats such events as equivalent, and so
+ * handles them in order of insertion instead. Where more than two events overlap within
+ * one window, the equivalence is no longer transitive and std::multiset::equal_range()
+ * can miss pairs, or return events outside the window; the ring queue pairs the front
+ * event with exactly those events inside the window. Because of this it is only used when
+ * asked for (mid2root --ringqueue); test/queuetest.cxx compares the two implementations.
+ */
+class RingQueue: public Queue {
+public:
+	/// Initial number of bins in the ring
+	static const size_t kInitialBins = 1024;
+
+	/// Maximum number of bins in the ring
+	static const size_t kMaxBins = 1 << 21;
+
+private:
+	/// Time bin of the ring buffer
+	struct Bin {
+		/// Key (trigger time / bin width) of events stored in the bin
+		int64_t fKey;
+		/// Events in the bin, sorted by trigger time
+		std::vector<midas::Event*> fEvents;
+	};
+
+	/// Time-sorted container for events that don't fit into the ring
+	typedef std::multimap<double, midas::Event*> Overflow_t;
+
+	/// Ring buffer of time bins, size is always a power of two
+	std::vector<Bin> fBins;
+
+	/// Bitmap of non-empty bins (one bit per element of fBins)
+	std::vector<uint64_t> fOccupancy;
+
+	/// Bitmap of non-zero words in fOccupancy
+	std::vector<uint64_t> fSummary;
+
+	/// Events that don't fit into the ring
+	Overflow_t fOverflow;
+
+	/// Scratch container for coincidence matches of the front event
+	std::vector<const midas::Event*> fMatches;
+
+	/// Width of a time bin in microseconds
+	double fBinWidth;
+
+	/// Key of the earliest non-empty bin
+	int64_t fMinKey;
+
+	/// Key of the latest non-empty bin
+	int64_t fMaxKey;
+
+	/// Number of events stored in the ring
+	size_t fNbinned;
+
+public:
+	/// Sets the maximum container size (fMaxDelta), allocates initial bins
+	RingQueue(double deltaMax);
+
+	/// Deletes all stored events
+	virtual ~RingQueue();
+
+	/// Erase the earliest event in the queue, first searching for coincidences.
+	virtual void Pop(int32_t& singles_id, bool& found_coinc);
+
+	/// Returns total number of entries in the queue
+	virtual size_t Size() const { return fNbinned + fOverflow.size(); }
+
+	/// Manually clear the event buffer
+	virtual void Clear();
+
+protected:
+	/// Insert a copy of an event into the appropriate bin
+	virtual void Insert(const midas::Event& event);
+
+	/// Insert a copy of a viewed event into the appropriate bin
+	virtual void Insert(const midas::EventView& event);
+
+	/// Reference to the earliest event in the queue
+	virtual const midas::Event& Front() const;
+
+	/// Reference to the latest event in the queue
+	virtual const midas::Event& Back() const;
+
+private:
+	/// Calculate the bin key for a given trigger time
+	int64_t GetKey(double time) const { return static_cast<int64_t>(time / fBinWidth); }
+
+	/// Get the bin corresponding to a given key
+	Bin& GetBin(int64_t key) { return fBins[key & (fBins.size() - 1)]; }
+
+	/// Get the bin corresponding to a given key (const version)
+	const Bin& GetBin(int64_t key) const { return fBins[key & (fBins.size() - 1)]; }
+
+	/// Insert an event into the appropriate bin, taking ownership
+	void InsertOwned(midas::Event* event);
+
+	/// Check if the earliest event lives in the overflow container
+	bool FrontIsOverflow() const;
+
+	/// Resize the ring to span a given number of bins
+	bool Grow(int64_t span);
+
+	/// Flag a ring slot as being (non) empty
+	void SetOccupied(size_t slot, bool occupied);
+
+	/// Find the first non-empty ring slot at or after a given slot
+	size_t FindSlot(size_t slot) const;
+
+	/// Find the key of the first non-empty bin after a given key
+	int64_t NextKey(int64_t key) const;
+
+	/// Disallow copy
+	RingQueue(const RingQueue&): Queue(0) { }
+
+	/// Disallow assign
+	RingQueue& operator= (const RingQueue&) { return *this; }
 };
 
 
@@ -148,9 +308,10 @@ private:
  * - <tt> void Process(tstamp::Diagnostics*); </tt>
  * 
  * to handle singles and coincidence events, respectively.
+ * \tparam Q The queue implementation to use, either tstamp::Queue or tstamp::RingQueue
  */
-template <class T>
-class OwnedQueue: public Queue {
+template <class T, class Q = tstamp::Queue>
+class OwnedQueue: public Q {
 private:
 	/// Reference to the class "owning" the queue
 	T& fOwner;
@@ -158,7 +319,7 @@ private:
 public:
 	/// Calls base constructor with maxDelta argument; sets fOwner
 	OwnedQueue(double maxDelta, T* owner):
-		tstamp::Queue(maxDelta), fOwner(*owner) { }
+		Q(maxDelta), fOwner(*owner) { }
 	
 	/// Empty
 	~OwnedQueue() { }
@@ -188,6 +349,21 @@ inline OwnedQueue<T>* NewOwnedQueue(double maxDelta, T* owner)
 	return new OwnedQueue<T> (maxDelta, owner);
 }
 
+/// "Creation" function for OwnedQueue<T, RingQueue>
+template <class T>
+inline OwnedQueue<T, RingQueue>* NewOwnedRingQueue(double maxDelta, T* owner)
+{
+	/*!
+	 * Same as NewOwnedQueue(), but using the time-binned ring buffer
+	 * (tstamp::RingQueue) as the underlying queue implementation.
+	 */
+	return new OwnedQueue<T, RingQueue> (maxDelta, owner);
+}
+
+/// Finds where a run can be split into parts that are queued independently
+std::vector<size_t> find_split_points(const std::vector<double>& triggerTimes,
+																			double maxDelta, double coincWindow, size_t nparts);
+
 
 /// Class to store diagnostic information about coincidence matching
 class Diagnostics {
@@ -3,6 +3,8 @@
 /// \author G. Christian
 /// \brief Implements Unpack.hxx
 ///
+#include <ctime>
+#include <algorithm>
 #include "utils/definitions.h"
 #include "midas/Event.hxx"
 #include "midas/Database.hxx"
@@ -27,6 +29,7 @@ dragon::Unpacker::Unpacker(dragon::Head* head,
 													 bool singlesMode):
 	fCoincWindow(kCoincWindowDefault),
 	fQueue(0),
+	fQueueType(kMultisetQueue),
 	fHead(head),
 	fTail(tail),
 	fCoinc(coinc),
@@ -37,6 +40,7 @@ dragon::Unpacker::Unpacker(dragon::Head* head,
 	fRunpar(runpar),
 	fDiag(tsdiag)
 {
+	std::fill(fSinks, fSinks + kNumSinks, (Sink*)0);
 	if(!singlesMode)
 		fQueue.reset(new tstamp::OwnedQueue<dragon::Unpacker>(kQueueTimeDefault*1e6, this));
 }
@@ -70,22 +74,35 @@ void dragon::Unpacker::HandleBor(const char* dbname)
 	/// - Read variables from the database corresponding to \e dbname (skip if dbname is NULL)
 	if (dbname) {
 		midas::Database db(dbname);
-		if(!db.IsZombie()) {
-			fHead->set_variables(&db);
-			fTail->set_variables(&db);
-			fCoinc->set_variables(&db);
-			fEpics->set_variables(&db);
-			fHeadScaler->set_variables(&db, "head");
-			fTailScaler->set_variables(&db, "tail");
-
-			// Set sux scaler only if it's in the file
-			if(db.CheckPath("/Equipment/AuxScaler/Settings/Route"))
-				 fAuxScaler->set_variables (&db, "aux" );
-		}
+		SetVariables(db);
+	}
+}
+
+void dragon::Unpacker::HandleBor(const midas::Database& db)
+{
+	/// Same as HandleBor(const char*), but reads variables from an already opened database.
+	HandleBor((const char*)0);
+	SetVariables(db);
+}
+
+void dragon::Unpacker::SetVariables(const midas::Database& db)
+{
+	/// Skipped if \e db is a zombie
+	if(!db.IsZombie()) {
+		fHead->set_variables(&db);
+		fTail->set_variables(&db);
+		fCoinc->set_variables(&db);
+		fEpics->set_variables(&db);
+		fHeadScaler->set_variables(&db, "head");
+		fTailScaler->set_variables(&db, "tail");
+
+		// Set sux scaler only if it's in the file
+		if(db.CheckPath("/Equipment/AuxScaler/Settings/Route"))
+			 fAuxScaler->set_variables (&db, "aux" );
 	}
 }
 
-void dragon::Unpacker::UnpackHead(const midas::Event& event)
+void dragon::Unpacker::UnpackHead(const midas::EventView& event)
 {
 	fHead->reset();       /// - Reset the class to default values.
 	fHead->unpack(event); /// - Read raw data from the MIDAS event.
@@ -93,7 +110,7 @@ void dragon::Unpacker::UnpackHead(const midas::Event& event)
 	fUnpacked.push_back(DRAGON_HEAD_EVENT);
 }
 
-void dragon::Unpacker::UnpackTail(const midas::Event& event)
+void dragon::Unpacker::UnpackTail(const midas::EventView& event)
 {
 	fTail->reset();       /// - Reset the class to default values.
 	fTail->unpack(event); /// - Read raw data from the MIDAS event.
@@ -109,26 +126,26 @@ void dragon::Unpacker::UnpackCoinc(const midas::CoincEvent& event)
 	fUnpacked.push_back(DRAGON_COINC_EVENT);
 }
 
-void dragon::Unpacker::UnpackEpics(const midas::Event& event)
+void dragon::Unpacker::UnpackEpics(const midas::EventView& event)
 {
 	fEpics->reset();       /// - Reset the class to default values.
 	fEpics->unpack(event); /// - Read raw data from the MIDAS event.
 	fUnpacked.push_back(DRAGON_EPICS_EVENT);
 }
 
-void dragon::Unpacker::UnpackHeadScaler(const midas::Event& event)
+void dragon::Unpacker::UnpackHeadScaler(const midas::EventView& event)
 {
 	fHeadScaler->unpack(event); /// - Read scaler data from the midas event
 	fUnpacked.push_back(DRAGON_HEAD_SCALER);
 }
 
-void dragon::Unpacker::UnpackTailScaler(const midas::Event& event)
+void dragon::Unpacker::UnpackTailScaler(const midas::EventView& event)
 {
 	fTailScaler->unpack(event); /// - Read scaler data from the midas event
 	fUnpacked.push_back(DRAGON_TAIL_SCALER);
 }
 
-void dragon::Unpacker::UnpackAuxScaler(const midas::Event& event)
+void dragon::Unpacker::UnpackAuxScaler(const midas::EventView& event)
 {
 	fAuxScaler->unpack(event); /// - Read scaler data from the midas event
 	fUnpacked.push_back(DRAGON_AUX_SCALER);
@@ -142,6 +159,75 @@ void dragon::Unpacker::UnpackRunParameters(const midas::Database& db)
 
 std::vector<int32_t> dragon::Unpacker::UnpackMidasEvent(void* header, char* data)
 {
+	DoUnpack(header, data);
+	/// \returns The result of GetUnpackedCodes() after this event
+	return fUnpacked;
+}
+
+void dragon::Unpacker::HandleMidasEvent(void* header, char* data)
+{
+	/// Same as UnpackMidasEvent(), but passes the unpacked events to Dispatch() instead
+	/// of returning (a copy of) their codes.
+	DoUnpack(header, data);
+	Dispatch();
+}
+
+bool dragon::Unpacker::HandleEor(int flushTime)
+{
+	/// Flushes the timestamp queue one event at a time with FlushQueueIterative(),
+	/// calling Dispatch() after each.
+	/// \param flushTime Maximum time in seconds to spend flushing, negative for no limit.
+	///  Events left in the queue after this time are discarded.
+	/// \returns false if the flush was stopped by the time limit, true otherwise
+	if (IsSinglesMode()) return true;
+
+	time_t t_begin = time(0);
+	while (1) {
+		if (flushTime >= 0 && difftime(time(0), t_begin) > flushTime) {
+			fQueue->FlushTimeoutMessage(flushTime);
+			fQueue->Clear();
+			return false;
+		}
+		if (FlushQueueIterative() == 0) break;
+		Dispatch();
+	}
+	return true;
+}
+
+void dragon::Unpacker::SetSink(int32_t code, Sink* sink)
+{
+	/// \param code Event code (DRAGON_HEAD_EVENT, etc.)
+	/// \param sink Sink to receive events of type \e code; NULL removes the present sink.
+	///  Not owned by the unpacker.
+	if (code < 0 || code >= kNumSinks) {
+		utils::Error("dragon::Unpacker::SetSink", __FILE__, __LINE__)
+			<< "Invalid event code: " << code << ", valid codes are 0 <= code < " << kNumSinks;
+		return;
+	}
+	fSinks[code] = sink;
+}
+
+void dragon::Unpacker::Dispatch(const std::vector<int32_t>& codes) const
+{
+	/// Each sink is called at most once, even if an event type was unpacked
+	/// more than once (e.g. several coincidences popped from the queue at the
+	/// same time); the external class only holds the last of them anyway.
+	uint32_t done = 0;
+	for (size_t i = 0; i < codes.size(); ++i) {
+		const int32_t code = codes[i];
+		if (code < 0 || code >= kNumSinks || (done & (1U << code)))
+			continue;
+		done |= (1U << code);
+		if (fSinks[code])
+			fSinks[code]->Fill(code);
+	}
+}
+
+void dragon::Unpacker::DoUnpack(void* header, char* data)
+{
+	/// Events are unpacked directly from the buffers pointed to by \e header and \e data,
+	/// through a non-owning midas::EventView. A copy of the data is only made when a
+	/// head or tail event needs to be buffered in the timestamp queue.
 	fUnpacked.clear();
 	midas::Event::Header* evtHeader = reinterpret_cast<midas::Event::Header*>(header);
 	switch (evtHeader->fEventId)
@@ -149,11 +235,11 @@ std::vector<int32_t> dragon::Unpacker::UnpackMidasEvent(void* header, char* data
 	case DRAGON_HEAD_EVENT:
 		{
 			if(IsSinglesMode()) {
-				midas::Event event(header, data, evtHeader->fDataSize);
+				midas::EventView event(header, data);
 				UnpackHead(event);
 			}
 			else {
-				midas::Event event(header, data, evtHeader->fDataSize, fHead->variables.bk_tsc, GetCoincWindow());
+				midas::EventView event(header, data, fHead->variables.bk_tsc, GetCoincWindow());
 				fQueue->Push(event, fDiag);
 			}
 			break;
@@ -161,36 +247,36 @@ std::vector<int32_t> dragon::Unpacker::UnpackMidasEvent(void* header, char* data
 	case DRAGON_TAIL_EVENT:
 		{
 			if(IsSinglesMode()) {
-				midas::Event event(header, data, evtHeader->fDataSize);
+				midas::EventView event(header, data);
 				UnpackTail(event);
 			}
 			else {
-				midas::Event event(header, data, evtHeader->fDataSize, fTail->variables.bk_tsc, GetCoincWindow());
+				midas::EventView event(header, data, fTail->variables.bk_tsc, GetCoincWindow());
 				fQueue->Push(event, fDiag);
 			}
 			break;
 		}
 	case DRAGON_HEAD_SCALER:
 		{
-			midas::Event event(header, data, evtHeader->fDataSize);
+			midas::EventView event(header, data);
 			UnpackHeadScaler(event);
 			break;
 		}
 	case DRAGON_TAIL_SCALER:		
 		{
-			midas::Event event(header, data, evtHeader->fDataSize);
+			midas::EventView event(header, data);
 			UnpackTailScaler(event);
 			break;
 		}
 	case DRAGON_AUX_SCALER:		
 		{
-			midas::Event event(header, data, evtHeader->fDataSize);
+			midas::EventView event(header, data);
 			UnpackAuxScaler(event);
 			break;
 		}
 	case DRAGON_EPICS_EVENT:
 		{
-			midas::Event event(header, data, evtHeader->fDataSize);
+			midas::EventView event(header, data);
 			UnpackEpics(event);
 			break;
 		}
@@ -213,8 +299,6 @@ std::vector<int32_t> dragon::Unpacker::UnpackMidasEvent(void* header, char* data
 			break;
 		}
 	}
-	/// \returns The result of GetUnpackedCodes() after this event
-	return fUnpacked;
 }
 
 
@@ -26,6 +26,27 @@ namespace dragon {
 /// Handles unpacking event data
 class Unpacker {
 public:
+	///
+	/// Receives unpacked events of a given type
+	/*!
+	 * Register with SetSink() for one or more DRAGON_* event codes. Dispatch()
+	 * then calls Fill() once for each event type unpacked in the last call to
+	 * UnpackMidasEvent() or FlushQueueIterative(), after all unpacking is done,
+	 * so the external classes hold the same data as seen through GetUnpackedCodes().
+	 */
+	class Sink {
+	public:
+		/// Empty
+		virtual ~Sink() { }
+		/// Called with the code of an unpacked event
+		virtual void Fill(int32_t code) = 0;
+	};
+	///
+	/// Timestamp queue implementations available for coincidence matching
+	enum QueueType_t {
+		kMultisetQueue, ///< tstamp::Queue (std::multiset based)
+		kRingQueue      ///< tstamp::RingQueue (time-binned ring buffer), opt-in: see its notes on event order
+	};
 	///
 	/// Sets pointers to container classes, initializes fQueue
 	Unpacker(dragon::Head* head,
@@ -68,6 +89,24 @@ public:
   ///
   /// Perform actions at the beginning of a run
 	void HandleBor(const char* dbname);
+  ///
+  /// Perform actions at the beginning of a run, with an already opened database
+	void HandleBor(const midas::Database& db);
+	///
+	/// Flush the timestamp queue at the end of a run, dispatching each event
+	bool HandleEor(int flushTime = -1);
+	///
+	/// Unpack a midas event and pass the results to the sinks
+	void HandleMidasEvent(void* header, char* data);
+	///
+	/// Set the sink receiving events with code \e code
+	void SetSink(int32_t code, Sink* sink);
+	///
+	/// Pass the events in \e codes to their sinks
+	void Dispatch(const std::vector<int32_t>& codes) const;
+	///
+	/// Pass the events unpacked by the last call to UnpackMidasEvent() or FlushQueueIterative() to their sinks
+	void Dispatch() const;
 	///
 	/// Process function to handle singles events popped from the queue
 	void Process(const midas::Event& event);
@@ -79,7 +118,10 @@ public:
 	void Process(tstamp::Diagnostics*);
 	///
   /// Switch over to coincidence mode
-	void SetCoincMode();
+	void SetCoincMode(QueueType_t type = kMultisetQueue);
+	///
+	/// Returns the type of queue used for coincidence matching
+	QueueType_t GetQueueType() const;
 	///
 	/// Set the coincidence matching window
 	void SetCoincWindow(double window);
@@ -91,25 +133,25 @@ public:
 	void SetQueueTime(double t);
   ///
   /// Unpack a head event into fHead
-	void UnpackHead(const midas::Event& event);
+	void UnpackHead(const midas::EventView& event);
   ///
   /// Unpack a tail event into fTail
-	void UnpackTail(const midas::Event& event);
+	void UnpackTail(const midas::EventView& event);
   ///
   /// Unpack a coincidence event into fCoinc
 	void UnpackCoinc(const midas::CoincEvent& event);
   ///
   /// Unpack a head scaler event into fHeadScaler;
-	void UnpackHeadScaler(const midas::Event& event);
+	void UnpackHeadScaler(const midas::EventView& event);
   ///
   /// Unpack a tail scaler event into fTailScaler
-	void UnpackTailScaler(const midas::Event& event);
+	void UnpackTailScaler(const midas::EventView& event);
   ///
   /// Unpack a aux scaler event into fAuxScaler;
-	void UnpackAuxScaler(const midas::Event& event);
+	void UnpackAuxScaler(const midas::EventView& event);
 	///
   /// Unpack an EPICS event into fEpics
-	void UnpackEpics(const midas::Event& event);
+	void UnpackEpics(const midas::EventView& event);
   ///
   /// Unpack run parameters into fRunpar
 	void UnpackRunParameters(const midas::Database& db);
@@ -120,6 +162,12 @@ public:
 	/// Unpack a generic midas event (from header + data)
 	std::vector<int32_t> UnpackMidasEvent(void* header, char* data);
 private:
+	/// Set variables of the external classes from a database
+	void SetVariables(const midas::Database& db);
+	/// Unpack into the external classes, setting fUnpacked
+	void DoUnpack(void* header, char* data);
+	/// Size of the sink table, event codes must be smaller
+	static const int kNumSinks = 32;
 	/// Default queue time in seconds
 	static const int kQueueTimeDefault = 4;
 	/// Default coincidence window in usec
@@ -128,8 +176,12 @@ private:
 	double fCoincWindow;
 	///	Timestamp queue for coincidence matching
 	std::auto_ptr<tstamp::Queue> fQueue;
+	/// Type of fQueue
+	QueueType_t fQueueType;
 	/// Container of event codes of unpacked events
 	std::vector<int32_t> fUnpacked;
+	/// Sinks indexed by event code
+	Sink* fSinks[kNumSinks];
 	/// Pointer to _external_ head class
 	dragon::Head* fHead;
 	/// Pointer to _external_ tail class
@@ -148,6 +200,8 @@ private:
 	dragon::RunParameters* fRunpar;
 	/// Pointer to _external_ timestamp diagnostics class
 	tstamp::Diagnostics* fDiag;
+	/// Multithreaded driver, fills the external classes directly
+	friend class UnpackPipeline;
 };
 
 } // namespace dragon
@@ -191,15 +245,34 @@ inline void dragon::Unpacker::SetSinglesMode(int qFlush)
 	fQueue.reset(0);
 }
 
-inline void dragon::Unpacker::SetCoincMode()
+inline void dragon::Unpacker::SetCoincMode(QueueType_t type)
 {
 	/// If in singles mode when called, it switches over to coincidence
 	/// mode with default coincidence window and queue time. To change
 	/// these values, use SetCoincWindow() and SetQueueTime().
 	/// 
-	/// If we are already in coincidence mode, this has no effect.
-	if(!IsSinglesMode())
-		fQueue.reset(new tstamp::OwnedQueue<Unpacker>(kQueueTimeDefault*1e6, this));
+	/// If we are already in coincidence mode with the same queue type, this has
+	/// no effect. If the queue type is different, events in the present queue are
+	/// flushed before switching over, and the queue time is kept the same.
+	/// \param type Specifies the queue implementation to use for timestamp matching
+	if(!IsSinglesMode() && type == fQueueType)
+		return;
+
+	double queueTime = kQueueTimeDefault*1e6;
+	if(!IsSinglesMode()) {
+		FlushQueue();
+		queueTime = fQueue->GetMaxDelta();
+	}
+	fQueueType = type;
+	if(type == kRingQueue)
+		fQueue.reset(tstamp::NewOwnedRingQueue(queueTime, this));
+	else
+		fQueue.reset(tstamp::NewOwnedQueue(queueTime, this));
+}
+
+inline dragon::Unpacker::QueueType_t dragon::Unpacker::GetQueueType() const
+{
+	return fQueueType;
 }
 
 inline std::vector<int32_t> dragon::Unpacker::UnpackMidasEvent(char* databuf)
@@ -236,4 +309,9 @@ dragon::Unpacker::GetQueue() const
 	return fQueue.get();
 }
 
+inline void dragon::Unpacker::Dispatch() const
+{
+	Dispatch(fUnpacked);
+}
+
 #endif
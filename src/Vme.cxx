@@ -9,6 +9,12 @@
 #include "midas/Event.hxx"
 #include "Vme.hxx"
 
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define DRAGON_VME_SIMD
+#include <immintrin.h>
+#endif
+
 namespace dutils = dragon::utils;
 
 
@@ -32,7 +38,7 @@ void vme::Io32::reset()
 	}
 }
 
-bool vme::Io32::unpack(const midas::Event& event, const char* bankName, bool reportMissing)
+bool vme::Io32::unpack(const midas::EventView& event, const char* bankName, bool reportMissing)
 {
 	/*! Here is the portion of the MIDAS frontent where values are written to the "main" bank:
 	 * \code
@@ -92,41 +98,30 @@ vme::V1190::V1190():
 	reset();
 }
 
-namespace { inline void reset_channel(vme::V1190::Channel* channel)
-{
-  ///
-	channel->nleading  = 0;
-	channel->ntrailing = 0;
-	channel->fLeading.clear();
-	channel->fTrailing.clear();
-}
-
-template <class T> class hitmatch {
-public:
-	hitmatch(const T& t, int16_t n):
-		fT(t), fN(n) { }
-	bool operator()(const T& t)
-		{ return t == fT && fN-- == 0; }
-private:
-	T fT;
-	int16_t fN;
-};
-
-template <class ch_t, class hit_t, class vch_t, class vmeas_t>
-int32_t get_hit_edge(ch_t ch, hit_t hit, const vch_t& vch, const vmeas_t& vmeas) {
-	typename vch_t::const_iterator ich =
-		std::find_if (vch.begin(), vch.end(), hitmatch<ch_t> (ch, hit));
-	return ich != vch.end() ? *(vmeas.begin() + (ich - vch.begin())) : -1;
-} }
-
 int32_t vme::V1190::get_leading(int16_t ch, int16_t hit) const
 {
-	return ::get_hit_edge(ch, hit, fifo0.channel, fifo0.measurement);
+	/*!
+	 * \param ch Channel number
+	 * \param hit Hit number, 0 being the first hit read out
+	 * \returns The leading edge time value of hit \e hit on channel \e ch, or -1
+	 *  if there is no such hit
+	 */
+	if (ch < 0 || ch >= MAX_CHANNELS || hit < 0 || hit >= channel[ch].nleading)
+		return -1;
+	return fHits[channel[ch].fLeading + hit];
 }
 
 int32_t vme::V1190::get_trailing(int16_t ch, int16_t hit) const
 {
-	return ::get_hit_edge(ch, hit, fifo1.channel, fifo1.measurement);
+	/*!
+	 * \param ch Channel number
+	 * \param hit Hit number, 0 being the first hit read out
+	 * \returns The trailing edge time value of hit \e hit on channel \e ch, or -1
+	 *  if there is no such hit
+	 */
+	if (ch < 0 || ch >= MAX_CHANNELS || hit < 0 || hit >= channel[ch].ntrailing)
+		return -1;
+	return fHits[channel[ch].fTrailing + hit];
 }
 
 void vme::V1190::Fifo::push_back(int32_t measurement_, int16_t channel_, int16_t number_)
@@ -148,9 +143,16 @@ void vme::V1190::Fifo::clear()
 void vme::V1190::reset()
 {
   ///
-	for (int ch = 0; ch < MAX_CHANNELS; ++ch)
-		::reset_channel( &(channel[ch]) );
-	
+	/// \note Only the hit counts are reset, fHits is overwritten by the next unpack().
+	for (int ch = 0; ch < MAX_CHANNELS; ++ch) {
+		channel[ch].nleading  = 0;
+		channel[ch].ntrailing = 0;
+		channel[ch].fLeading  = 0;
+		channel[ch].fTrailing = 0;
+	}
+	fNumHits = 0;
+	fNumDropped = 0;
+
 	fifo0.clear();
 	fifo1.clear();
 
@@ -169,8 +171,8 @@ int32_t vme::V1190::get_data(int16_t ch) const
 	 */
 
 	if (ch >= 0 && ch < MAX_CHANNELS) {
-		if(!channel[ch].fLeading.empty())
-			return channel[ch].fLeading[0];
+		if(channel[ch].nleading)
+			return fHits[channel[ch].fLeading];
 		else
 			return dragon::NoData<int32_t>::value();
 	}
@@ -209,24 +211,44 @@ bool vme::V1190::unpack_data_buffer(const uint32_t* const pbuffer)
 		return false;
 	}
 
-	int32_t measurement = (*pbuffer >> 0) & READ19; /// - Bits 0 - 18 encode the measurement value
-
-	if (type == 0) // leading edge
-	{
-		channel[ch].fLeading.push_back(measurement);
+	if (fifo0.measurement.size() + fifo1.measurement.size() >= MAX_HITS) {
+		++fNumDropped; /// - Hits beyond MAX_HITS are dropped, and reported once per event by unpack()
+		return false;
 	}
-	else // trailing edge
-		channel[ch].fTrailing.push_back(measurement);
-	
-	channel[ch].nleading  = channel[ch].fLeading.size();
-	channel[ch].ntrailing = channel[ch].fTrailing.size();
 
-	if(type == 0) fifo0.push_back(measurement, ch, channel[ch].nleading);
-	else          fifo1.push_back(measurement, ch, channel[ch].ntrailing);
+	int32_t measurement = (*pbuffer >> 0) & READ19; /// - Bits 0 - 18 encode the measurement value
+
+	/// - Measurements are stored in the fifos here; fill_hits() sorts them by channel once the whole bank is read
+	if(type == 0) fifo0.push_back(measurement, ch, ++channel[ch].nleading);
+	else          fifo1.push_back(measurement, ch, ++channel[ch].ntrailing);
 
 	return true;
 }
 
+void vme::V1190::fill_hits()
+{
+	/*!
+	 * Counting sort of the fifo contents into fHits: the offsets of each channel
+	 * follow from the hit counts, and the \e number stored with each fifo entry
+	 * gives its position within the channel.
+	 */
+	uint16_t offset = 0;
+	for (int ch = 0; ch < MAX_CHANNELS; ++ch) {
+		channel[ch].fLeading = offset;
+		offset += channel[ch].nleading;
+	}
+	for (int ch = 0; ch < MAX_CHANNELS; ++ch) {
+		channel[ch].fTrailing = offset;
+		offset += channel[ch].ntrailing;
+	}
+	fNumHits = offset;
+
+	for (size_t i = 0; i < fifo0.measurement.size(); ++i)
+		fHits[channel[fifo0.channel[i]].fLeading + fifo0.number[i] - 1] = fifo0.measurement[i];
+	for (size_t i = 0; i < fifo1.measurement.size(); ++i)
+		fHits[channel[fifo1.channel[i]].fTrailing + fifo1.number[i] - 1] = fifo1.measurement[i];
+}
+
 void vme::V1190::unpack_footer_buffer(const uint32_t* const pbuffer, const char* bankName)
 {
   /*!
@@ -239,7 +261,6 @@ void vme::V1190::unpack_footer_buffer(const uint32_t* const pbuffer, const char*
 	word_count = (*pbuffer >> 0) & READ12; /// Bits 0 - 11 are the event counter (word_count)
 	int16_t evtId = (*pbuffer >> 12) & READ12; 
 	if(evtId != event_id) { /// Bits 12 - 23 are the event id (event_id), check for consistency w/ header
-		std::cerr << DRAGON_ERR_FILE_LINE;
 		dutils::Warning("vme::V1190::unpack_footer_buffer")
 			<< DRAGON_ERR_FILE_LINE << "Bank name: \"" << bankName << "\": "
 			<< "Trailer event id (" << evtId << ") != header event Id (" << event_id << ")\n";
@@ -277,6 +298,7 @@ void vme::V1190::handle_error_buffer(const uint32_t* const pbuffer, const char*
 		if((*pbuffer >> i) & READ1) {
 			error = i; // set error code
 
+			dutils::gDelayedMessageFactory.Lock(); // may be unpacking in several threads
 			dutils::ADelayedMessagePrinter* msg = dutils::gDelayedMessageFactory.Get(this, i);
 			if(!msg) {
 				std::stringstream temp;
@@ -286,6 +308,7 @@ void vme::V1190::handle_error_buffer(const uint32_t* const pbuffer, const char*
 			}
 
 			if(msg) msg->Incr();
+			dutils::gDelayedMessageFactory.Unlock();
 		}
 	}
 }
@@ -338,7 +361,7 @@ bool vme::V1190::unpack_buffer(const uint32_t* const pbuffer, const char* bankNa
 	return success;
 }
 
-bool vme::V1190::unpack(const midas::Event& event, const char* bankName, bool reportMissing)
+bool vme::V1190::unpack(const midas::EventView& event, const char* bankName, bool reportMissing)
 {
 	/*!
 	 * \param [in] event The midas event to unpack
@@ -357,6 +380,13 @@ bool vme::V1190::unpack(const midas::Event& event, const char* bankName, bool re
 		bool success = unpack_buffer(pbank32++, bankName);
 		if(!success) ret = false;
 	}
+	fill_hits();
+
+	if (fNumDropped) {
+		dutils::Error("vme::V1190::unpack", __FILE__, __LINE__)
+			<< DRAGON_ERR_FILE_LINE << "Bank name: \"" << bankName << "\": Number of hits exceeds the maximum ("
+			<< MAX_HITS << "). Skipped the last " << fNumDropped << " hits.\n";
+	}
 
 	return ret;
 }
@@ -364,6 +394,137 @@ bool vme::V1190::unpack(const midas::Event& event, const char* bankName, bool re
 
 // ================ Class vme::V792 ================ //
 
+namespace {
+
+/// Decodes a run of ADC data words into \e data
+/*!
+ * \param p Pointer to the first word
+ * \param n Number of words available
+ * \param data ADC data array, indexed by channel
+ * \returns The number of words decoded, always a multiple of the block
+ *  size. Decoding stops at the first block containing a word that is not
+ *  a data word (header, footer, invalid), which is left to the scalar decoder.
+ */
+typedef int (*decode_t)(const uint32_t* p, int n, int16_t* data);
+
+/// Scalar "kernel": leaves every word to vme::V792::unpack_buffer()
+int decode_scalar(const uint32_t*, int, int16_t*)
+{
+	return 0;
+}
+
+#ifdef DRAGON_VME_SIMD
+
+__attribute__((target("sse2")))
+int decode_sse2(const uint32_t* p, int n, int16_t* data)
+{
+	const __m128i typeMask = _mm_set1_epi32(READ3 << 24);
+	const __m128i chMask   = _mm_set1_epi32(READ5);
+	const __m128i valMask  = _mm_set1_epi32(READ12);
+	const __m128i zero     = _mm_setzero_si128();
+
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+		__m128i isData = _mm_cmpeq_epi32(_mm_and_si128(w, typeMask), zero);
+		if (_mm_movemask_epi8(isData) != 0xffff)
+			break;
+
+		int32_t ch[4], val[4];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(ch),  _mm_and_si128(_mm_srli_epi32(w, 16), chMask));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(val), _mm_and_si128(w, valMask));
+		for (int j = 0; j < 4; ++j) // in order, later hits on a channel win
+			data[ch[j]] = val[j];
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+int decode_avx2(const uint32_t* p, int n, int16_t* data)
+{
+	const __m256i typeMask = _mm256_set1_epi32(READ3 << 24);
+	const __m256i chMask   = _mm256_set1_epi32(READ5);
+	const __m256i valMask  = _mm256_set1_epi32(READ12);
+
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+		__m256i type = _mm256_and_si256(w, typeMask);
+		if (!_mm256_testz_si256(type, type))
+			break;
+
+		int32_t ch[8], val[8];
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(ch),  _mm256_and_si256(_mm256_srli_epi32(w, 16), chMask));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(val), _mm256_and_si256(w, valMask));
+		for (int j = 0; j < 8; ++j) // in order, later hits on a channel win
+			data[ch[j]] = val[j];
+	}
+	return i + decode_sse2(p + i, n - i, data); // remaining 4 - 7 words
+}
+
+#endif // #ifdef DRAGON_VME_SIMD
+
+decode_t get_kernel(vme::V792::Decoder_t decoder)
+{
+#ifdef DRAGON_VME_SIMD
+	switch (decoder) {
+	case vme::V792::SSE2: return decode_sse2;
+	case vme::V792::AVX2: return decode_avx2;
+	default: break;
+	}
+#endif
+	return decode_scalar;
+}
+
+vme::V792::Decoder_t best_decoder()
+{
+	/// Picks the widest decoder supported by the CPU we are running on
+	if (vme::V792::have_decoder(vme::V792::AVX2)) return vme::V792::AVX2;
+	if (vme::V792::have_decoder(vme::V792::SSE2)) return vme::V792::SSE2;
+	return vme::V792::SCALAR;
+}
+
+vme::V792::Decoder_t gDecoder = best_decoder();
+decode_t gDecode = get_kernel(gDecoder);
+
+}
+
+bool vme::V792::have_decoder(Decoder_t decoder)
+{
+	switch (decoder) {
+	case SCALAR:
+		return true;
+#ifdef DRAGON_VME_SIMD
+	case SSE2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+	case AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+bool vme::V792::set_decoder(Decoder_t decoder)
+{
+	/*!
+	 * The default is the fastest decoder supported by the CPU; all decoders
+	 * give identical results, so this is only useful for testing and benchmarking.
+	 * \returns false if \e decoder is not supported (and the decoder is left unchanged)
+	 */
+	if (!have_decoder(decoder)) return false;
+	gDecoder = decoder;
+	gDecode = get_kernel(decoder);
+	return true;
+}
+
+vme::V792::Decoder_t vme::V792::get_decoder()
+{
+	return gDecoder;
+}
+
 vme::V792::V792()
 {
   ///
@@ -456,7 +617,7 @@ bool vme::V792::unpack_buffer(const uint32_t* const pbuffer, const char* bankNam
 	return success;
 }
 
-bool vme::V792::unpack(const midas::Event& event, const char* bankName, bool reportMissing)
+bool vme::V792::unpack(const midas::EventView& event, const char* bankName, bool reportMissing)
 {
 	/*!
 	 * Searches for a bank tagged by \e bankName and then proceeds to loop over the data contained
@@ -472,11 +633,20 @@ bool vme::V792::unpack(const midas::Event& event, const char* bankName, bool rep
 	uint32_t* pbank32 =
 		event.GetBankPointer<uint32_t>(bankName, &bank_len, reportMissing, true);
 
-	// Loop over all data words in the bank
+	// Loop over all data words in the bank: runs of data words go through
+	// the vectorized decoder, everything else through unpack_buffer()
 	bool ret = true;
-	for (int i=0; i< bank_len; ++i) {
-		bool success = unpack_buffer(pbank32++, bankName);
-		if(!success) ret = false;
+	for (int i=0; i< bank_len; ) {
+		int ndata = gDecode(pbank32 + i, bank_len - i, data);
+		if (ndata) {
+			i += ndata;
+			overflow  = (pbank32[i-1] >> 12) & READ1;
+			underflow = (pbank32[i-1] >> 13) & READ1;
+		}
+		if (i < bank_len) {
+			bool success = unpack_buffer(pbank32 + i++, bankName);
+			if(!success) ret = false;
+		}
 	}
 	return ret;
 }
@@ -11,7 +11,7 @@
 #include "utils/Valid.hxx"
 
 
-namespace midas { class Event; }
+namespace midas { class EventView; }
 
 
 /// Encloses all VME module classes
@@ -25,7 +25,7 @@ public: // Methods
 	/// Calls reset()
 	Io32();
 	/// Unpack all data from the io32 main bank
-	bool unpack(const midas::Event& event, const char* bankName, bool reportMissing = false);
+	bool unpack(const midas::EventView& event, const char* bankName, bool reportMissing = false);
 	/// Set all data fields to default values (== 0).
 	void reset();
 
@@ -91,6 +91,8 @@ public: // Constants
 	static const uint16_t EXTENDED_TRIGGER_TIME = 0x11;
 	/// Number of data channels available in the TDC
 	static const uint16_t MAX_CHANNELS          = 64;
+	/// Maximum number of hits (leading + trailing) stored per event
+	static const uint16_t MAX_HITS              = 1024;
 
 	/// Hit types (leading or trailing edge)
 	enum HitType { LEADING, TRAILING };
@@ -99,7 +101,7 @@ public: // Methods
 	/// Calls reset()
 	V1190();
 	/// Unpack TDC data from a MIDAS event
-	bool unpack(const midas::Event& event, const char* bankName, bool reportMissing = false);
+	bool unpack(const midas::EventView& event, const char* bankName, bool reportMissing = false);
 	/// Reset data fields to default values
 	void reset();
 	/// Get a data value, with bounds checking
@@ -144,6 +146,8 @@ private: // Internal routines
 	void handle_error_buffer(const uint32_t* const pbuffer, const char* bankName);
 	/// Unpack event data buffer
 	bool unpack_data_buffer(const uint32_t* const pbuffer);
+	/// Sort the hits read from the fifos into fHits
+	void fill_hits();
 
 public: // Subclasses
 /// Encloses measurement data for a single v1190 TDC channel
@@ -152,10 +156,10 @@ public: // Subclasses
 		int32_t nleading;
     /// Number of trailing-edge hits in the current event
 		int32_t ntrailing;
-		/// Temporary storage of leading edge hits
-		std::vector<int32_t> fLeading;  //!
-		/// Temporary storage of trailing edge hits
-		std::vector<int32_t> fTrailing; //!
+		/// Index of the first leading edge hit in fHits
+		uint16_t fLeading;  //!
+		/// Index of the first trailing edge hit in fHits
+		uint16_t fTrailing; //!
 	};
 
 
@@ -182,6 +186,15 @@ public: // Subclasses
 public: // Subclass instances
 	/// Array of all measurement channels (not transient)
 	Channel channel[MAX_CHANNELS]; //!
+	/// \brief Hits of the current event, grouped by channel
+	/// \details Leading edges of all channels first, then trailing edges; the hits
+	///  of channel \e ch are fHits[channel[ch].fLeading] ... fHits[channel[ch].fLeading + nleading - 1],
+	///  in the order they were read out (same for trailing).
+	int32_t fHits[MAX_HITS]; //!
+	/// Total number of hits in the current event
+	uint16_t fNumHits; //!
+	/// Number of hits of the current event dropped for exceeding MAX_HITS
+	uint16_t fNumDropped; //!
 	/// Leading edge measurements
 	Fifo fifo0;
 	/// Trailing edge measurements
@@ -204,15 +217,28 @@ public: // Constants
  	/// Number of data channels availible in the ADC
 	static const uint16_t MAX_CHANNELS = 32;
 
+	/// Implementations of the data word decoding loop
+	enum Decoder_t {
+		SCALAR, ///< One word at a time, through unpack_buffer()
+		SSE2,   ///< Runs of data words, 4 at a time
+		AVX2    ///< Runs of data words, 8 at a time
+	};
+
 public: // Methods
 	/// Calls reset(),
 	V792();
 	/// Unpack ADC data from a midas event
-	bool unpack(const midas::Event& event, const char* bankName, bool reportMissing = false);
+	bool unpack(const midas::EventView& event, const char* bankName, bool reportMissing = false);
 	/// Reset data fields to default values
 	void reset();
 	/// Get a data value, with bounds checking
 	int32_t get_data(int16_t ch) const;
+	/// Select the decoder used by unpack() (all modules)
+	static bool set_decoder(Decoder_t decoder);
+	/// Get the decoder used by unpack()
+	static Decoder_t get_decoder();
+	/// Check if a decoder is supported by the compiler and CPU
+	static bool have_decoder(Decoder_t decoder);
 
 public: // Class data
   /// Number of channels present in an event
@@ -10,20 +10,31 @@
 #include <string>
 #include <memory>
 #include <cassert>
+#include <map>
 #include <algorithm>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <TTree.h>
 #include <TFile.h>
 #include <TROOT.h>
 #include <TError.h>
 #include <TString.h>
 #include <TSystem.h>
+#include <TThread.h>
+#include <TClass.h>
+#include <TRealData.h>
+#include <TDataMember.h>
+#include <TDataType.h>
+#include <TStopwatch.h>
 #include "midas/libMidasInterface/TMidasFile.h"
 #include "midas/Database.hxx"
 #include "utils/definitions.h"
+#include "utils/Valid.hxx"
 #include "Unpack.hxx"
 #include "Dragon.hxx"
 #include "Sonik.hxx"
+#include "Pipeline.hxx"
 
 
 #ifndef DOXYGEN_SKIP
@@ -31,7 +42,10 @@ namespace {
 bool arg_return = false;
 const char* const msg_use = 
 	"usage: mid2root <input file> [-o <output file>] [-v <xml odb>] [-histos <*.xml> ] "
-	"[--singles] [--overwrite] [--quiet <n>] [--help]\n";
+	"[--singles] [--ringqueue] [--threads <n>] [--xml-odb] [--flat] [--columns <list>] "
+	"[--compression <alg>[:<level>]] [--basket [<branch>=]<bytes>] [--cluster <n>] [--report] "
+	"[--events <first>:<last>] [--time <start>:<stop>] [--sample <k>[:<seconds>]] [--overwrite] [--quiet <n>] [--help]\n"
+	"       mid2root --batch <run list> [-j <n>] [-v <xml odb>] [options]\n";
 }
 
 //
@@ -118,6 +132,13 @@ int GetQuietLevel()
 
 #endif
 
+/// Column written in --flat mode
+struct Column_t {
+	std::string fBranch; // event branch name ("head", "tail", ...)
+	std::string fPath;   // data member path in the event class ("bgo.ecal", ...)
+	bool fDense;         // store arrays in full instead of index + value
+};
+
 /// Program options
 struct Options_t {
 	std::string fIn;
@@ -127,7 +148,29 @@ struct Options_t {
 	bool fOverwrite;
 	bool fSingles;
 	bool fSonik;
-	Options_t(): fOverwrite(false), fSingles(false), fSonik(false) {}
+	bool fRingQueue;
+	int fThreads;
+	std::string fBatch;
+	int fJobs;
+	bool fXmlOdb;
+	bool fFlat;
+	std::string fColumnList;
+	std::vector<Column_t> fColumns;
+	int fCompression;                      // TFile compression settings, -1 for default
+	std::map<std::string, Int_t> fBaskets; // basket size by branch name, "*" for all
+	Long64_t fCluster;                     // TTree::SetAutoFlush() argument, 0 for default
+	bool fReport;
+	bool fSaveIndex;                       // --save-index
+	Long64_t fFirstEvent, fLastEvent;      // --events range, -1 for open ends
+	Double_t fStartTime, fStopTime;        // --time range in seconds after the BOR, -1 for open ends
+	Int_t fSample;                         // --sample: convert one slice in fSample, 0 for all
+	Int_t fSampleSlice;                    // --sample slice length in seconds
+	Options_t(): fOverwrite(false), fSingles(false), fSonik(false), fRingQueue(false), fThreads(0), fJobs(1),
+							 fXmlOdb(false), fFlat(false), fCompression(-1), fCluster(0), fReport(false),
+							 fSaveIndex(false), fFirstEvent(-1), fLastEvent(-1), fStartTime(-1), fStopTime(-1), fSample(0), fSampleSlice(1) {}
+	/// Is any of --events, --time or --sample given?
+	bool IsSelecting() const
+		{ return fFirstEvent >= 0 || fLastEvent >= 0 || fStartTime >= 0 || fStopTime >= 0 || fSample > 0; }
 };
 
 
@@ -160,6 +203,408 @@ void save_histos(TDirectory*, TDirectory*);
 /// Read histograms from xml file
 void read_histos(const std::string&);
 
+/// Pack the valid elements of an array, returns how many there are
+template <class T>
+Int_t pack_sparse(const void* array, Int_t length, Short_t* index, void* values)
+{
+	const T* in = static_cast<const T*>(array);
+	T* out = static_cast<T*>(values);
+	Int_t n = 0;
+	for(Int_t i=0; i< length; ++i) {
+		if(!dragon::utils::is_valid(in[i])) continue;
+		index[n] = i;
+		out[n++] = in[i];
+	}
+	return n;
+}
+
+/// Flat branches made from individual data members of an event class (--flat mode)
+/*!
+ * Scalars and dense arrays are branched directly at the address of the data member.
+ * Sparse arrays are written as three leaves: the number of valid elements,
+ * their indices and their values, e.g. for "bgo.ecal": bgo_ecal_n/I,
+ * bgo_ecal_i[bgo_ecal_n]/S and bgo_ecal[bgo_ecal_n]/D. The leaves are filled
+ * by Pack(), which has to be called before each TTree::Fill().
+ */
+class FlatColumns {
+public:
+	FlatColumns() {}
+	~FlatColumns()
+		{ for(size_t i=0; i< fSparse.size(); ++i) delete fSparse[i]; }
+	/// Branch data member \e path of \e object (an instance of \e cl) in \e tree
+	bool Add(TTree* tree, TClass* cl, void* object, const std::string& path, bool dense);
+	/// Copy the valid elements of sparse arrays into their leaves
+	void Pack()
+		{ for(size_t i=0; i< fSparse.size(); ++i) fSparse[i]->Pack(); }
+private:
+	typedef Int_t (*PackFunc_t)(const void*, Int_t, Short_t*, void*);
+	struct Sparse_t {
+		const void* fArray;
+		Int_t fLength;
+		PackFunc_t fPack;
+		Int_t fCount;
+		std::vector<Short_t> fIndex;
+		std::vector<Double_t> fValues; // storage for any basic type
+		void Pack() { fCount = fPack(fArray, fLength, &fIndex[0], &fValues[0]); }
+	};
+	FlatColumns(const FlatColumns&);
+	FlatColumns& operator= (const FlatColumns&);
+	std::vector<Sparse_t*> fSparse;
+};
+
+/// Fills a tree (and histograms) with one type of event, see dragon::Unpacker::SetSink()
+class TreeSink: public dragon::Unpacker::Sink {
+public:
+	TreeSink(): fTree(0), fAddr(0), fFillHistos(0), fColumns(0) {}
+	/// Set the tree, data address, (pointer to the) histogram flag and flat columns, if any
+	void Set(TTree* tree, void* addr, const bool* fillHistos, FlatColumns* columns = 0)
+		{ fTree = tree; fAddr = addr; fFillHistos = fillHistos; fColumns = columns; }
+	/// Fill tree and histograms
+	void Fill(int32_t code)
+		{
+			if(fColumns) fColumns->Pack();
+			if(fTree) fTree->Fill();
+			if(*fFillHistos) fill_histos(code, fAddr);
+		}
+protected:
+	TTree* fTree;
+	void* fAddr;
+	const bool* fFillHistos;
+	FlatColumns* fColumns;
+};
+
+/// Tail sink for SONIK mode, also calculates SONIK data from the tail and fills its tree
+class SonikSink: public TreeSink {
+public:
+	SonikSink(): fSonikTree(0), fSonik(0), fTail(0) {}
+	/// Set the SONIK tree, SONIK data and tail data to read from
+	void SetSonik(TTree* tree, Sonik* sonik, const dragon::Tail* tail)
+		{ fSonikTree = tree; fSonik = sonik; fTail = tail; }
+	/// Fill tail tree and histograms, then SONIK
+	void Fill(int32_t code)
+		{
+			TreeSink::Fill(code);
+			fSonik->reset();
+			fSonik->read_data(fTail->v785, fTail->v1190);
+			fSonik->calculate();
+			fSonikTree->Fill();
+			if(*fFillHistos) fill_histos(0, fSonik);
+		}
+private:
+	TTree* fSonikTree;
+	Sonik* fSonik;
+	const dragon::Tail* fTail;
+};
+
+/// Passes events coming out of a dragon::UnpackPipeline to the unpacker's sinks
+struct TreeFiller: public dragon::UnpackPipeline::Output {
+	dragon::Unpacker* fUnpacker;
+	bool* fFillHistos;
+	bool fHaveHistos;
+	std::auto_ptr<midas::Database>* fDb0;
+	std::auto_ptr<midas::Database>* fDb1;
+	int fNumEvents;
+	bool fProgress;
+
+	/// Same as the body of the serial loop in convert()
+	void Fill(const std::vector<int32_t>& which, midas::Event* event)
+		{
+			if (event && event->GetEventId() == MIDAS_BOR) {
+				fDb0->reset(new midas::Database(event->GetData(), event->GetDataSize()));
+			}
+			else if (event && event->GetEventId() == MIDAS_EOR) {
+				fDb1->reset(new midas::Database(event->GetData(), event->GetDataSize()));
+			}
+			*fFillHistos = fHaveHistos && event != 0; // no histos during the queue flush
+			fUnpacker->Dispatch(which);
+			if (event && fProgress) m2r::static_counter (fNumEvents, 1000, false);
+			if (event) ++fNumEvents;
+		}
+};
+
+/// Columns written by --flat if no --columns list is given: the calibrated
+/// quantities of each detector
+const char* const default_columns[] = {
+	"head.header.fTimeStamp",
+	"head.bgo.ecal",
+	"head.bgo.tcal",
+	"head.bgo.sum",
+	"head.bgo.hit0",
+	"head.bgo.x0",
+	"head.bgo.y0",
+	"head.bgo.z0",
+	"head.bgo.t0",
+	"head.tcal0",
+	"head.tcalx",
+	"head.tcal_rf",
+	"tail.header.fTimeStamp",
+#ifndef DRAGON_OMIT_DSSSD
+	"tail.dsssd.ecal",
+	"tail.dsssd.efront",
+	"tail.dsssd.eback",
+	"tail.dsssd.hit_front",
+	"tail.dsssd.hit_back",
+	"tail.dsssd.tfront",
+	"tail.dsssd.tback",
+#endif
+#ifndef DRAGON_OMIT_IC
+	"tail.ic.anode",
+	"tail.ic.tcal",
+	"tail.ic.sum",
+#endif
+#ifndef DRAGON_OMIT_NAI
+	"tail.nai.ecal",
+#endif
+#ifndef DRAGON_OMIT_GE
+	"tail.ge.ecal",
+#endif
+	"tail.mcp.anode",
+	"tail.mcp.tcal",
+	"tail.mcp.esum",
+	"tail.mcp.tac",
+	"tail.mcp.x",
+	"tail.mcp.y",
+	"tail.sb.ecal",
+	"tail.tof.mcp",
+	"tail.tof.mcp_dsssd",
+	"tail.tof.mcp_ic",
+	"tail.tcal0",
+	"tail.tcalx",
+	"tail.tcal_rf",
+	"coinc.xtrig",
+	"coinc.xtofh",
+	"coinc.xtoft",
+	"coinc.head.bgo.ecal",
+	"coinc.head.bgo.sum",
+	"coinc.head.bgo.hit0",
+#ifndef DRAGON_OMIT_DSSSD
+	"coinc.tail.dsssd.efront",
+	"coinc.tail.dsssd.hit_front",
+#endif
+#ifndef DRAGON_OMIT_IC
+	"coinc.tail.ic.anode",
+	"coinc.tail.ic.sum",
+#endif
+	"coinc.tail.mcp.tac",
+	"coinc.tail.mcp.x",
+	"coinc.tail.mcp.y",
+	"coinc.tail.sb.ecal",
+	"coinc.tail.tof.mcp",
+	"coinc.tail.tof.mcp_dsssd",
+	"coinc.tail.tof.mcp_ic"
+};
+
+//
+/// Split "<branch>.<member path>" into a column
+bool parse_column(const std::string& spec, bool dense, Column_t* column)
+{
+	const std::string::size_type dot = spec.find('.');
+	if (dot == std::string::npos || dot == 0 || dot+1 == spec.size())
+		return false;
+	column->fBranch = spec.substr(0, dot);
+	column->fPath = spec.substr(dot+1);
+	column->fDense = dense;
+	return true;
+}
+
+//
+/// Fill options->fColumns from options->fColumnList, or with the default columns
+bool read_columns(Options_t* options)
+{
+	options->fColumns.clear();
+	if (options->fColumnList.empty()) {
+		const size_t n = sizeof(default_columns) / sizeof(default_columns[0]);
+		for (size_t i=0; i< n; ++i) {
+			Column_t column;
+			parse_column(default_columns[i], false, &column);
+			options->fColumns.push_back(column);
+		}
+		return true;
+	}
+
+	std::ifstream list(options->fColumnList.c_str());
+	if (!list.good()) {
+		m2r::cerr << "Error: Couldn't open the column list \'" << options->fColumnList << "\'.\n\n";
+		return false;
+	}
+	//
+	// One column per line: "<branch>.<member path> [dense]", anything after a '#' is ignored
+	std::string line;
+	while (std::getline(list, line)) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream iss(line);
+		std::string spec, flag;
+		if (!(iss >> spec)) continue; // empty line
+		iss >> flag;
+		Column_t column;
+		if (!parse_column(spec, flag == "dense", &column) || !(flag.empty() || flag == "dense")) {
+			m2r::cerr << "Error: Invalid column \'" << line << "\' in \'" << options->fColumnList
+								<< "\', expected \"<branch>.<member> [dense]\".\n\n";
+			return false;
+		}
+		options->fColumns.push_back(column);
+	}
+	if (options->fColumns.empty()) {
+		m2r::cerr << "Error: No columns found in \'" << options->fColumnList << "\'.\n\n";
+		return false;
+	}
+	return true;
+}
+
+//
+/// Convert "<algorithm>[:<level>]" into TFile compression settings, -1 if invalid
+int parse_compression(const std::string& spec)
+{
+	/// Algorithm numbers are those of ROOT::ECompressionAlgorithm; the default level
+	/// of each is the one ROOT recommends for it.
+	static const struct { const char* fName; int fAlgorithm; int fLevel; } algorithms[] = {
+		{ "zlib", 1, 1 },
+		{ "lzma", 2, 7 },
+		{ "lz4",  4, 4 },
+		{ "zstd", 5, 5 }
+	};
+	if (spec == "none")
+		return 0;
+
+	const std::string::size_type colon = spec.find(':');
+	const std::string name = spec.substr(0, colon);
+	for (size_t i=0; i< sizeof(algorithms) / sizeof(algorithms[0]); ++i) {
+		if (name != algorithms[i].fName) continue;
+		int level = algorithms[i].fLevel;
+		if (colon != std::string::npos) {
+			TString lstr = spec.substr(colon+1).c_str();
+			if (lstr.IsDigit() == false || lstr.Atoi() < 1 || lstr.Atoi() > 9)
+				return -1;
+			level = lstr.Atoi();
+		}
+		return 100*algorithms[i].fAlgorithm + level;
+	}
+	return -1;
+}
+
+//
+/// Convert "<n>" (entries) or "<n>MB" (megabytes) into a TTree::SetAutoFlush() argument, 0 if invalid
+Long64_t parse_cluster(const std::string& spec)
+{
+	const bool mb = spec.size() > 2 && spec.substr(spec.size() - 2) == "MB";
+	TString nstr = spec.substr(0, mb ? spec.size() - 2 : spec.size()).c_str();
+	if (nstr.IsDigit() == false || nstr.Atoi() < 1)
+		return 0;
+	return mb ? -Long64_t(nstr.Atoi())*1024*1024 : Long64_t(nstr.Atoi());
+}
+
+//
+/// Fill tree layout settings not given on the command line from /dragon/mid2root in \e db
+void read_layout(const midas::Database& db, int* compression, std::map<std::string, Int_t>* baskets, Long64_t* cluster)
+{
+	std::string spec;
+	if (*compression < 0 && db.CheckPath("/dragon/mid2root/compression") &&
+			db.ReadValue("/dragon/mid2root/compression", spec)) {
+		*compression = parse_compression(spec);
+		if (*compression < 0)
+			m2r::cwar << "Warning: Invalid compression \'" << spec << "\' in /dragon/mid2root, using the default.\n";
+	}
+	Int_t size = 0;
+	if (baskets->empty() && db.CheckPath("/dragon/mid2root/basket_size") &&
+			db.ReadValue("/dragon/mid2root/basket_size", size) && size > 0) {
+		(*baskets)["*"] = size;
+	}
+	Int_t n = 0;
+	if (*cluster == 0 && db.CheckPath("/dragon/mid2root/cluster_size") &&
+			db.ReadValue("/dragon/mid2root/cluster_size", n)) {
+		*cluster = n;
+	}
+}
+
+//
+/// Set the basket size (by branch name) and cluster size of a tree
+void set_layout(TTree* tree, const std::string& branch, const std::map<std::string, Int_t>& baskets, Long64_t cluster)
+{
+	std::map<std::string, Int_t>::const_iterator it = baskets.find(branch);
+	if (it == baskets.end())
+		it = baskets.find("*");
+	if (it != baskets.end())
+		tree->SetBasketSize("*", it->second);
+	if (cluster != 0)
+		tree->SetAutoFlush(cluster);
+}
+
+//
+/// Print bytes written and compression ratio of a tree and each of its branches
+void report_tree(TTree* tree)
+{
+	char buf[256];
+	sprintf(buf, "  %-32s %10lld %14lld %14lld %7.2f\n", tree->GetName(), tree->GetEntries(),
+					tree->GetTotBytes(), tree->GetZipBytes(),
+					tree->GetZipBytes() > 0 ? double(tree->GetTotBytes()) / tree->GetZipBytes() : 0.);
+	m2r::cout << buf;
+	TObjArray* branches = tree->GetListOfBranches();
+	for (Int_t i=0; i< branches->GetEntriesFast(); ++i) {
+		TBranch* branch = static_cast<TBranch*>(branches->At(i));
+		const Long64_t tot = branch->GetTotBytes("*"), zip = branch->GetZipBytes("*");
+		sprintf(buf, "    %-30s %10lld %14lld %14lld %7.2f\n", branch->GetName(), branch->GetEntries(),
+						tot, zip, zip > 0 ? double(tot) / zip : 0.);
+		m2r::cout << buf;
+	}
+}
+
+/// Selects the events converted with --events, --time and --sample
+/*!
+ * Run start and stop events (ODB dumps) are always selected. Other events are
+ * selected by their number in the file, counting from 0, and their MIDAS time
+ * stamp relative to the run start event, so that the same events are selected
+ * each time, whether they are found through the file index or by reading all
+ * events.
+ */
+class EventSelector {
+public:
+	EventSelector(const Options_t& options): fOptions(options), fStart(0), fHaveStart(false) {}
+	/// Is event number \e n, with id \e id and time stamp \e timestamp, selected?
+	bool Select(Long64_t n, UInt_t id, UInt_t timestamp)
+		{
+			if(!fHaveStart && (id == MIDAS_BOR || !(id & 0x8000))) { // n.b. in case there is no BOR event
+				fStart = timestamp;
+				fHaveStart = true;
+			}
+			if(id == MIDAS_BOR || id == MIDAS_EOR)
+				return true;
+			if(fOptions.fFirstEvent >= 0 && n < fOptions.fFirstEvent) return false;
+			if(fOptions.fLastEvent  >= 0 && n >= fOptions.fLastEvent) return false;
+			const Long64_t t = Long64_t(timestamp) - Long64_t(fStart);
+			if(fOptions.fStartTime >= 0 && t < fOptions.fStartTime) return false;
+			if(fOptions.fStopTime  >= 0 && t >= fOptions.fStopTime) return false;
+			if(fOptions.fSample > 0) {
+				const Long64_t slice = (t >= 0 ? t : t - fOptions.fSampleSlice + 1) / fOptions.fSampleSlice;
+				if(slice % fOptions.fSample != 0) return false;
+			}
+			return true;
+		}
+private:
+	const Options_t& fOptions;
+	UInt_t fStart;
+	bool fHaveStart;
+};
+
+//
+/// Parse "<first>:<last>" (either may be omitted) into non-negative numbers, -1 for omitted
+bool parse_range(const std::string& spec, Double_t* first, Double_t* last)
+{
+	const std::string::size_type colon = spec.find(':');
+	if (colon == std::string::npos)
+		return false;
+	const std::string str[2] = { spec.substr(0, colon), spec.substr(colon+1) };
+	Double_t* value[2] = { first, last };
+	for (int i=0; i< 2; ++i) {
+		*value[i] = -1;
+		if (str[i].empty()) continue;
+		char* end = 0;
+		*value[i] = strtod(str[i].c_str(), &end);
+		if (*end != '\0' || *value[i] < 0)
+			return false;
+	}
+	return !(*first >= 0 && *last >= 0 && *last <= *first);
+}
+
 /// Print a usage message
 int usage(const char* what = 0)
 {
@@ -206,6 +651,87 @@ int help()
 		"\t                  event only. In this mode, the buffering in a queue and timestamp matching routines are\n"
 		"\t                  skipped completely.\n"
 		"\n"
+		"\t--ringqueue:      Use the time-binned ring buffer implementation of the timestamp matching queue, which\n"
+		"\t                  performs better than the default (std::multiset) implementation at high event rates.\n"
+		"\t                  NOTE: the output is not always identical to the default. Events closer together than\n"
+		"\t                  the coincidence window are handled in trigger time order rather than in the order\n"
+		"\t                  they were read, so the two events of a coincidence may be written in the opposite\n"
+		"\t                  order. Where more than two events overlap within one window, coincidence pairs can\n"
+		"\t                  differ: the ring queue pairs every event with all others inside the window, while\n"
+		"\t                  the default can miss some pairs or match events slightly outside of it.\n"
+		"\n"
+		"\t--threads <n>:    Unpack using a multithreaded pipeline with <n> worker threads, plus one thread each for\n"
+		"\t                  reading the input file and timestamp matching. The output trees are identical to those\n"
+		"\t                  produced by the default (single threaded) unpacking.\n"
+		"\n"
+		"\t--batch <list>:   Convert all runs listed in the text file <list>, one per line, in a single program. Each\n"
+		"\t                  line contains an input file, optionally followed by an output file; empty lines and\n"
+		"\t                  anything after a '#' are ignored. Existing output files are skipped unless --overwrite\n"
+		"\t                  is given. If -v is specified, the variables file is parsed once and used for all runs.\n"
+		"\t                  Not available together with -o or -histos.\n"
+		"\n"
+		"\t-j <n>:           With --batch, convert <n> runs at a time in parallel threads (default 1).\n"
+		"\n"
+		"\t--xml-odb:        Store the ODB trees (\"odbstart\", \"odbstop\" and \"variables\") in the output file as\n"
+		"\t                  XML text, readable by older versions. The default is a binary snapshot, which is smaller\n"
+		"\t                  and faster to read; midas::Database::Dump() gives the same XML for both.\n"
+		"\n"
+		"\t--flat:           Write the head, tail and coincidence trees as flat columns of the calibrated detector\n"
+		"\t                  quantities, instead of the full event classes (raw VME data, etc.). Arrays are stored\n"
+		"\t                  sparsely: e.g. \"bgo.ecal\" becomes the leaves bgo_ecal_n (number of valid channels),\n"
+		"\t                  bgo_ecal_i[bgo_ecal_n] (channel numbers) and bgo_ecal[bgo_ecal_n] (values), so that\n"
+		"\t                  t1->Draw(\"bgo_ecal\", \"bgo_ecal_i == 0\") draws channel 0. Scalars keep their name, with\n"
+		"\t                  '.' replaced by '_' (e.g. \"bgo_sum\"). The other trees are written as usual.\n"
+		"\n"
+		"\t--columns <list>: Write the columns listed in the text file <list> in --flat mode, instead of the default\n"
+		"\t                  ones. Each line is \"<branch>.<member> [dense]\", e.g. \"tail.dsssd.efront\" or\n"
+		"\t                  \"head.bgo.esort dense\", where <branch> is the branch name of the usual output (head, tail,\n"
+		"\t                  coinc, sch, ...). Any tree with a column listed is written flat. Arrays marked \"dense\" are\n"
+		"\t                  stored in full. Empty lines and anything after a '#' are ignored. Implies --flat.\n"
+		"\n"
+		"\t--compression <alg>[:<level>]:\n"
+		"\t                  Compression of the output file: zlib, lzma, lz4 or zstd, optionally followed by a level\n"
+		"\t                  from 1 to 9 (default levels: zlib 1, lzma 7, lz4 4, zstd 5), or none. For example, lz4 is\n"
+		"\t                  fastest to read back, lzma:9 gives the smallest files for archiving. Defaults to the value\n"
+		"\t                  of /dragon/mid2root/compression in the variables ODB if present, otherwise ROOT's default.\n"
+		"\n"
+		"\t--basket [<branch>=]<bytes>:\n"
+		"\t                  Basket size of the tree with event branch <branch> (head, tail, coinc, sch, ..., or sonik),\n"
+		"\t                  or of all trees if no branch is given. May be given several times. Defaults to\n"
+		"\t                  /dragon/mid2root/basket_size for all trees if present, otherwise ROOT's default.\n"
+		"\n"
+		"\t--cluster <n>:    Cluster size of all trees, i.e. how often baskets are flushed to the file: either <n> entries,\n"
+		"\t                  or <n>MB megabytes of (uncompressed) data. Defaults to /dragon/mid2root/cluster_size\n"
+		"\t                  (entries if positive, bytes if negative) if present, otherwise ROOT's default.\n"
+		"\n"
+		"\t--report:         Print the entries, bytes, compressed bytes and compression ratio of each tree and branch\n"
+		"\t                  written.\n"
+		"\n"
+		"\t--events <first>:<last>:\n"
+		"\t                  Only convert events number <first> (counting from 0, in the order they are in the file)\n"
+		"\t                  up to, but not including, <last>. Either may be left out, e.g. \"--events :100000\".\n"
+		"\n"
+		"\t--time <start>:<stop>:\n"
+		"\t                  Only convert events with a MIDAS time stamp from <start> up to, but not including, <stop>\n"
+		"\t                  seconds after the start of the run. Either may be left out, e.g. \"--time :600\" for the\n"
+		"\t                  first 10 minutes.\n"
+		"\n"
+		"\t--sample <k>[:<seconds>]:\n"
+		"\t                  Only convert the events of one time slice in <k>, i.e. those with a MIDAS time stamp in\n"
+		"\t                  the first <seconds> (default 1) of every <k>*<seconds> seconds after the start of the run.\n"
+		"\t                  Whole time slices are taken so that most coincidences are kept; those spanning the edge\n"
+		"\t                  of a slice are lost.\n"
+		"\n"
+		"\t                  With --events, --time or --sample, the run start and stop (ODB) events are always\n"
+		"\t                  converted, and the same events are selected every time. The events are found from an\n"
+		"\t                  index of the input file, which is built by reading all event headers unless it was saved\n"
+		"\t                  before (see --save-index). Pipes and remote files can't be indexed and are read in full.\n"
+		"\t                  Not available with --threads.\n"
+		"\n"
+		"\t--save-index:     Save the index of the events in the input file next to it, as <input file>.midx (if the\n"
+		"\t                  directory is writable), so later conversions with --events, --time or --sample jump\n"
+		"\t                  directly to the selected events. An index saved before is always used if it is up to date.\n"
+		"\n"
 		"\t--overwrite:      Overwrite any existing output files without asking the user.\n"
 		"\n"
 		"\t--quiet <n>:      Suppress program output messages. Followed by a numeral specifying the level of\n"
@@ -230,9 +756,13 @@ int process_args(int argc, char** argv, Options_t* options)
 	//
 	// Look for input file
 	for(; iarg != args.end(); ++iarg) {
-		if(iarg->substr(0, 2) == "--")
+		if(iarg->substr(0, 2) == "--" || *iarg == "-j")
 			continue;
-		if((iarg-1 >= args.begin()) && *(iarg-1) == "--quiet")
+		if((iarg-1 >= args.begin()) &&
+			 (*(iarg-1) == "--quiet" || *(iarg-1) == "--threads" || *(iarg-1) == "--batch" || *(iarg-1) == "-j" ||
+				*(iarg-1) == "--columns" || *(iarg-1) == "--compression" || *(iarg-1) == "--basket" ||
+				*(iarg-1) == "--cluster" || *(iarg-1) == "--events" || *(iarg-1) == "--time" ||
+				*(iarg-1) == "--sample"))
 				continue;
 		options->fIn = *iarg;
 		break;
@@ -265,9 +795,115 @@ int process_args(int argc, char** argv, Options_t* options)
 		else if (*iarg == "--singles") { // Singles mode
 			options->fSingles = true;
 		}
+		else if (*iarg == "--ringqueue") { // Ring buffer queue
+			options->fRingQueue = true;
+		}
 		else if (*iarg == "--sonik") { // SONIK mode
 			options->fSonik = true;
 		}
+		else if (*iarg == "--threads") { // Multithreaded unpacking
+			if (++iarg == args.end()) return usage("number of threads not specified");
+			TString nstr = iarg->c_str();
+			if (nstr.IsDigit() == false || nstr.Atoi() < 1) {
+				TString error ("Number of threads \'");
+				error += nstr; error += "\' is not a positive integer";
+				return usage(error.Data());
+			}
+			options->fThreads = nstr.Atoi();
+		}
+		else if (*iarg == "--batch") { // Batch mode
+			if (++iarg == args.end()) return usage("run list not specified");
+			options->fBatch = *iarg;
+		}
+		else if (*iarg == "-j") { // Parallel batch jobs
+			if (++iarg == args.end()) return usage("number of jobs not specified");
+			TString nstr = iarg->c_str();
+			if (nstr.IsDigit() == false || nstr.Atoi() < 1) {
+				TString error ("Number of jobs \'");
+				error += nstr; error += "\' is not a positive integer";
+				return usage(error.Data());
+			}
+			options->fJobs = nstr.Atoi();
+		}
+		else if (*iarg == "--xml-odb") { // Keep ODB as XML text
+			options->fXmlOdb = true;
+		}
+		else if (*iarg == "--flat") { // Flat output
+			options->fFlat = true;
+		}
+		else if (*iarg == "--columns") { // Flat output columns
+			if (++iarg == args.end()) return usage("column list not specified");
+			options->fColumnList = *iarg;
+			options->fFlat = true;
+		}
+		else if (*iarg == "--compression") { // Compression settings
+			if (++iarg == args.end()) return usage("compression not specified");
+			options->fCompression = parse_compression(*iarg);
+			if (options->fCompression < 0) {
+				TString error ("Invalid compression \'");
+				error += iarg->c_str(); error += "\', expected zlib, lzma, lz4 or zstd [:<level 1-9>], or none";
+				return usage(error.Data());
+			}
+		}
+		else if (*iarg == "--basket") { // Basket size
+			if (++iarg == args.end()) return usage("basket size not specified");
+			const std::string::size_type eq = iarg->find('=');
+			const std::string branch = eq == std::string::npos ? "*" : iarg->substr(0, eq);
+			TString nstr = (eq == std::string::npos ? *iarg : iarg->substr(eq+1)).c_str();
+			if (branch.empty() || nstr.IsDigit() == false || nstr.Atoi() < 1) {
+				TString error ("Invalid basket size \'");
+				error += iarg->c_str(); error += "\', expected [<branch>=]<bytes>";
+				return usage(error.Data());
+			}
+			options->fBaskets[branch] = nstr.Atoi();
+		}
+		else if (*iarg == "--cluster") { // Cluster size
+			if (++iarg == args.end()) return usage("cluster size not specified");
+			options->fCluster = parse_cluster(*iarg);
+			if (options->fCluster == 0) {
+				TString error ("Invalid cluster size \'");
+				error += iarg->c_str(); error += "\', expected <entries> or <megabytes>MB";
+				return usage(error.Data());
+			}
+		}
+		else if (*iarg == "--report") { // Compression report
+			options->fReport = true;
+		}
+		else if (*iarg == "--save-index") { // Save the event index
+			options->fSaveIndex = true;
+		}
+		else if (*iarg == "--events") { // Event number range
+			if (++iarg == args.end()) return usage("event range not specified");
+			Double_t first, last;
+			if (!parse_range(*iarg, &first, &last) || first != Long64_t(first) || last != Long64_t(last)) {
+				TString error ("Invalid event range \'");
+				error += iarg->c_str(); error += "\', expected <first>:<last>";
+				return usage(error.Data());
+			}
+			options->fFirstEvent = Long64_t(first);
+			options->fLastEvent = Long64_t(last);
+		}
+		else if (*iarg == "--time") { // Time range
+			if (++iarg == args.end()) return usage("time range not specified");
+			if (!parse_range(*iarg, &options->fStartTime, &options->fStopTime)) {
+				TString error ("Invalid time range \'");
+				error += iarg->c_str(); error += "\', expected <start>:<stop> in seconds";
+				return usage(error.Data());
+			}
+		}
+		else if (*iarg == "--sample") { // Sampling
+			if (++iarg == args.end()) return usage("sampling not specified");
+			const std::string::size_type colon = iarg->find(':');
+			TString kstr = iarg->substr(0, colon).c_str();
+			TString sstr = colon == std::string::npos ? "1" : iarg->substr(colon+1).c_str();
+			if (kstr.IsDigit() == false || kstr.Atoi() < 1 || sstr.IsDigit() == false || sstr.Atoi() < 1) {
+				TString error ("Invalid sampling \'");
+				error += iarg->c_str(); error += "\', expected <k>[:<seconds>]";
+				return usage(error.Data());
+			}
+			options->fSample = kstr.Atoi();
+			options->fSampleSlice = sstr.Atoi();
+		}
 		else if (*iarg == "--overwrite") { // Overwrite flag
 			options->fOverwrite = true;
 		}
@@ -289,6 +925,27 @@ int process_args(int argc, char** argv, Options_t* options)
 		}
 	}
 
+	if (options->IsSelecting() && options->fThreads > 0)
+		return usage("--events, --time and --sample are not available with --threads");
+
+	if (options->fFlat && !read_columns(options)) {
+		arg_return = true;
+		return 1;
+	}
+
+	if (!options->fBatch.empty()) { // Batch mode
+		if (!options->fIn.empty())
+			return usage("an input file can't be specified together with --batch");
+		if (!options->fOut.empty())
+			return usage("-o can't be used with --batch, give output files in the run list instead");
+		if (!options->fHistos.empty())
+			return usage("-histos is not available with --batch");
+		return 0;
+	}
+
+	if (options->fJobs != 1)
+		return usage("-j is only available with --batch");
+
 	if (options->fIn.empty()) // Didn't find input file
 		return usage("no input file specified");
 
@@ -296,29 +953,13 @@ int process_args(int argc, char** argv, Options_t* options)
 }
 
 //
-/// The main function implementation
-int main_(int argc, char** argv)
+/// Get the output file name for \e in
+TString output_name(const std::string& in, const std::string& outspec)
 {
-	m2r::Options_t options;
-	int arg_result = m2r::process_args(argc, argv, &options);
-	if(arg_return) return arg_result;
-
-	//
-	// Open input file
-	TMidasFile fin;
-	if (fin.Open(options.fIn.c_str()) == false) {
-		m2r::cerr
-			<< "Error: Couldn't open the file \'" << options.fIn
-			<< "\': \"" << fin.GetLastError() << ".\"\n\n";
-		return 1;
-	}
-
-	//
-	// Get output file name
-	TString out = options.fOut.empty() ? options.fIn.c_str() : options.fOut.c_str();
+	TString out = outspec.empty() ? in.c_str() : outspec.c_str();
 	//
 	// If no output specified, create file name from input
-	if (options.fOut.empty()) {
+	if (outspec.empty()) {
 		//
 		// Strip '.mid' extension if it's there
 		if(out.Contains(".mid"))
@@ -351,37 +992,169 @@ int main_(int argc, char** argv)
 		else outdir = ".";
 
 		gSystem->PrependPathName(outdir.Data(), out);
-	} // if (options.fOut.empty()) {
+	} // if (outspec.empty()) {
 
-	//
-	// Handle odb variables file
-	if (options.fOdb.empty()) {
-		options.fOdb = options.fIn; // No file specified, use ODB dump in midas file
+	return out;
+}
+
+//
+/// Check that a variables file given with -v exists
+bool check_odb(const std::string& odb)
+{
+	FileStat_t dummy;
+	if(gSystem->GetPathInfo(odb.c_str(), dummy) != 0) { // no file
+		m2r::cerr
+			<< "Error: The specified variables file \'" << odb
+			<< "\' does not exist.\n\n";
+		return false;
 	}
-	else { // Check if it exists
-		FileStat_t dummy;
-		if(gSystem->GetPathInfo(options.fOdb.c_str(), dummy) != 0) { // no file
-			m2r::cerr
-				<< "Error: The specified variables file \'" << options.fOdb
-				<< "\' does not exist.\n\n";
-			return 1;
-		}
+	return true;
+}
+
+//
+/// Find the real data (member and offset) of data member \e path in \e cl
+TRealData* find_real_data(TClass* cl, void* object, const std::string& path)
+{
+	/// Real data names include array dimensions, e.g. "bgo.ecal[30]"
+	cl->BuildRealData(object);
+	TIter next(cl->GetListOfRealData());
+	while (TRealData* rd = static_cast<TRealData*>(next())) {
+		const std::string name = rd->GetName();
+		if (name.substr(0, name.find('[')) == path)
+			return rd;
+	}
+	return 0;
+}
+
+//
+/// Get the leaf type code and sparse packing function of a basic type
+bool basic_type(Int_t type, char* code, Int_t* size, Int_t (**pack)(const void*, Int_t, Short_t*, void*))
+{
+	switch (type) {
+	case kChar_t:    *code = 'B'; *size = sizeof(Char_t);    *pack = pack_sparse<Char_t>;    return true;
+	case kUChar_t:   *code = 'b'; *size = sizeof(UChar_t);   *pack = pack_sparse<UChar_t>;   return true;
+	case kShort_t:   *code = 'S'; *size = sizeof(Short_t);   *pack = pack_sparse<Short_t>;   return true;
+	case kUShort_t:  *code = 's'; *size = sizeof(UShort_t);  *pack = pack_sparse<UShort_t>;  return true;
+	case kInt_t:     *code = 'I'; *size = sizeof(Int_t);     *pack = pack_sparse<Int_t>;     return true;
+	case kUInt_t:    *code = 'i'; *size = sizeof(UInt_t);    *pack = pack_sparse<UInt_t>;    return true;
+	case kLong64_t:  *code = 'L'; *size = sizeof(Long64_t);  *pack = pack_sparse<Long64_t>;  return true;
+	case kULong64_t: *code = 'l'; *size = sizeof(ULong64_t); *pack = pack_sparse<ULong64_t>; return true;
+	case kFloat_t:   *code = 'F'; *size = sizeof(Float_t);   *pack = pack_sparse<Float_t>;   return true;
+	case kDouble_t:  *code = 'D'; *size = sizeof(Double_t);  *pack = pack_sparse<Double_t>;  return true;
+	default: return false;
+	}
+}
+
+bool FlatColumns::Add(TTree* tree, TClass* cl, void* object, const std::string& path, bool dense)
+{
+	/// \returns false if \e path is not a data member of a supported type; nothing is
+	///  branched then
+	TRealData* rd = find_real_data(cl, object, path);
+	TDataMember* dm = rd ? rd->GetDataMember() : 0;
+	if (!dm) {
+		m2r::cwar << "Warning: " << cl->GetName() << " has no data member \'" << path << "\', skipping column.\n";
+		return false;
+	}
+	char code;
+	Int_t size;
+	PackFunc_t pack;
+	TDataType* type = dm->IsaPointer() ? 0 : dm->GetDataType();
+	if (!type || !basic_type(type->GetType(), &code, &size, &pack)) {
+		m2r::cwar << "Warning: " << cl->GetName() << "::" << path
+							<< " is not a basic numeric type, skipping column.\n";
+		return false;
+	}
+
+	Int_t length = 1;
+	for (Int_t i=0; i< dm->GetArrayDim(); ++i)
+		length *= dm->GetMaxIndex(i);
+	char* addr = static_cast<char*>(object) + rd->GetThisOffset();
+	std::string name = path;
+	std::replace(name.begin(), name.end(), '.', '_');
+
+	std::ostringstream leaf;
+	if (dm->GetArrayDim() == 0 || dense) {
+		leaf << name;
+		if (dm->GetArrayDim()) leaf << "[" << length << "]";
+		leaf << "/" << code;
+		tree->Branch(name.c_str(), addr, leaf.str().c_str());
+		return true;
+	}
+	if (length > 0x7fff) {
+		m2r::cwar << "Warning: " << cl->GetName() << "::" << path
+							<< " is too long to store sparsely, skipping column (use \"dense\").\n";
+		return false;
+	}
+
+	Sparse_t* sparse = new Sparse_t();
+	sparse->fArray = addr;
+	sparse->fLength = length;
+	sparse->fPack = pack;
+	sparse->fCount = 0;
+	sparse->fIndex.resize(length);
+	sparse->fValues.resize((length*size + sizeof(Double_t) - 1) / sizeof(Double_t));
+	fSparse.push_back(sparse);
+
+	const std::string nname = name + "_n", iname = name + "_i";
+	tree->Branch(nname.c_str(), &sparse->fCount, (nname + "/I").c_str());
+	tree->Branch(iname.c_str(), &sparse->fIndex[0], (iname + "[" + nname + "]/S").c_str());
+	leaf << name << "[" << nname << "]/" << code;
+	tree->Branch(name.c_str(), &sparse->fValues[0], leaf.str().c_str());
+	return true;
+}
+
+/// Results of converting one run
+struct RunStats_t {
+	Long64_t fEvents;
+	Double_t fTime;
+	RunStats_t(): fEvents(0), fTime(0) {}
+};
+
+//
+/// Convert a single MIDAS file
+/*!
+ * \param options Program options, with fIn set to the file to convert
+ * \param out Output file name
+ * \param variables Variables database (-v file, or the ODB dump of the input file),
+ *  named "variables". Only read, so it may be shared between threads.
+ * \param [out] stats Number of events converted and time taken
+ */
+int convert(const Options_t& options, const TString& out,
+						const midas::Database& variables, RunStats_t* stats)
+{
+	//
+	// In batch mode, per-run messages and the event counter are suppressed;
+	// the batch driver prints a summary line for each run instead.
+	const bool batch = !options.fBatch.empty();
+	m2r::strm_ref info = batch ? m2r::strm_ref(m2r::cnul) : m2r::cout;
+
+	//
+	// Open input file
+	TMidasFile fin;
+	if (fin.Open(options.fIn.c_str()) == false) {
+		m2r::cerr
+			<< "Error: Couldn't open the file \'" << options.fIn
+			<< "\': \"" << fin.GetLastError() << ".\"\n\n";
+		return 1;
 	}
 
 	//
-	// Open output TFile
+	// Get output file title
 	std::string ftitle;
 	{
-		midas::Database db(options.fOdb.c_str());
-		bool success = db.ReadValue("/Experiment/Run Parameters/Comment", ftitle);
+		bool success = variables.ReadValue("/Experiment/Run Parameters/Comment", ftitle);
 		if(!success) {
-			m2r::cerr << "Error: Invalid database file \"" << options.fOdb << "\".\n\n";
+			m2r::cerr << "Error: Invalid database file \"" << (options.fOdb.empty() ? options.fIn : options.fOdb) << "\".\n\n";
 			return 1;
 		}
 	}
 	if (options.fOverwrite == false) {
 		FileStat_t dummy;
 		if(gSystem->GetPathInfo(out.Data(), dummy) == 0) { // file exists
+			if (batch) {
+				m2r::cwar << "Warning: " << out.Data() << " exists, skipping (use --overwrite to replace it).\n";
+				return 0;
+			}
 			m2r::cerr << "\noverwrite " << out.Data() << "? (y/n [n])\n";
 			std::string answer;
 			answer = std::cin.get();
@@ -402,16 +1175,29 @@ int main_(int argc, char** argv)
 		read_histos(options.fHistos);
 	}
 
-	m2r::cout
+	info
 		<< "\nConverting MIDAS file\n\t\'" << options.fIn << "\'\n"
 		<< "into ROOT file\n\t\'" << out.Data() << "\'\n";
 
+	TStopwatch timer;
+	timer.Start();
+
 	TFile fout (out.Data(), "RECREATE", ftitle.c_str());
 	if (fout.IsZombie()) {
 		m2r::cerr << "Error: Couldn't open the file \'" << out.Data()
 							<< "\' for writing.\n\n";
 		return 1;
 	}
+
+	//
+	// Compression and tree layout: from the command line, otherwise from the ODB.
+	// n.b. branches take the compression settings of the file when created
+	int compression = options.fCompression;
+	std::map<std::string, Int_t> baskets = options.fBaskets;
+	Long64_t cluster = options.fCluster;
+	read_layout(variables, &compression, &baskets, &cluster);
+	if (compression >= 0)
+		fout.SetCompressionSettings(compression);
 	
 	//
 	// Create TTrees, set branches, etc.
@@ -491,9 +1277,25 @@ int main_(int argc, char** argv)
 	TTree* t0 = 0;
 	if(options.fSonik) {
 		t0 = new TTree("t0", "Sonik Events");
+		t0->SetDirectory(&fout);
 		t0->Branch("sonik", "Sonik", &psonik);
 	}
 
+	//
+	// In flat mode, trees with columns in the list get flat branches instead of the event class
+	m2r::FlatColumns columns[nIds];
+	bool flat[nIds];
+	for(int i=0; i< nIds; ++i) {
+		flat[i] = false;
+		for(size_t j=0; j< options.fColumns.size(); ++j)
+			flat[i] = flat[i] || options.fColumns[j].fBranch == branchNames[i];
+	}
+	for(size_t j=0; j< options.fColumns.size(); ++j) {
+		if(std::find(branchNames, branchNames + nIds, options.fColumns[j].fBranch) == branchNames + nIds)
+			m2r::cwar << "Warning: No event branch \'" << options.fColumns[j].fBranch << "\', skipping column \'"
+								<< options.fColumns[j].fBranch << "." << options.fColumns[j].fPath << "\'.\n";
+	}
+
 	// Normal trees
 	for(int i=0; i< nIds; ++i) {
 		char buf[256];
@@ -502,57 +1304,165 @@ int main_(int argc, char** argv)
 		bool makeTree = true; // always make all trees
 		if (makeTree) {
 			trees[i] = new TTree(buf, eventTitles[i].c_str());
-			trees[i]->Branch(branchNames[i].c_str(), classNames[i].c_str(), &(addr[i]));
+			trees[i]->SetDirectory(&fout); // n.b. gDirectory may be changed by other batch jobs
+			if(flat[i]) {
+				TClass* cl = TClass::GetClass(classNames[i].c_str());
+				TThread::Lock(); // n.b. building the real data of a class is not thread safe
+				for(size_t j=0; j< options.fColumns.size(); ++j) {
+					const m2r::Column_t& column = options.fColumns[j];
+					if(column.fBranch == branchNames[i])
+						columns[i].Add(trees[i], cl, addr[i], column.fPath, column.fDense);
+				}
+				TThread::UnLock();
+			}
+			else {
+				trees[i]->Branch(branchNames[i].c_str(), classNames[i].c_str(), &(addr[i]));
+			}
 		} else {
 			trees [i] = 0;
 		}
+		if (trees[i])
+			set_layout(trees[i], branchNames[i], baskets, cluster);
 	}
+	if (t0)
+		set_layout(t0, "sonik", baskets, cluster);
 
 	dragon::Unpacker
 		unpack (&head, &tail, &coinc, &epics, &head_scaler, &tail_scaler, &aux_scaler, &runpar, &tsdiag, options.fSingles);
+
+	//
+	// Send each type of event straight to its tree (and histograms)
+	m2r::TreeSink sinks[nIds];
+	m2r::SonikSink sonikSink;
+	for(int i=0; i< nIds; ++i) {
+		m2r::TreeSink* sink = &sinks[i];
+		if(options.fSonik && eventIds[i] == DRAGON_TAIL_EVENT) {
+			sonikSink.SetSonik(t0, &sonik, &tail);
+			sink = &sonikSink;
+		}
+		sink->Set(trees[i], addr[i], &fillHistos, flat[i] ? &columns[i] : 0);
+		unpack.SetSink(eventIds[i], sink);
+	}
 	
 	//
 	// Set coincidence variables
 	if(!options.fSingles) {
+		if (options.fRingQueue)
+			unpack.SetCoincMode(dragon::Unpacker::kRingQueue);
+
 		bool coincSuccess;
 		double coincWindow = 10, queueTime = 4;
-		{
-			midas::Database db (options.fOdb.c_str());
-			coincSuccess = db.ReadValue("/dragon/coinc/variables/window", coincWindow);
-			if (coincSuccess)
-				coincSuccess = db.ReadValue("/dragon/coinc/variables/buffer_time", queueTime);
-		}
+		coincSuccess = variables.ReadValue("/dragon/coinc/variables/window", coincWindow);
+		if (coincSuccess)
+			coincSuccess = variables.ReadValue("/dragon/coinc/variables/buffer_time", queueTime);
 		if (coincSuccess) {
 			unpack.SetCoincWindow(coincWindow);
 			unpack.SetQueueTime(queueTime);
 		}
-		m2r::cout
+		info
 			<< "\nUnpacker parameters: coincidence window = " << unpack.GetCoincWindow() << " usec., "
 			<< "queue time = " << unpack.GetQueueTime() << " sec.\n\n";
 	}
 	else {
-		m2r::cout << "\nRunning in singles mode.\n\n";
+		info << "\nRunning in singles mode.\n\n";
 	}
 	
 	//
 	// Begin-of-run initialization
-	unpack.HandleBor(options.fOdb.c_str());
+	unpack.HandleBor(variables);
+
+	//
+	// Index the input file with the TSC trigger times of head and tail events. With
+	// --save-index, when converting everything, the index is recorded while reading and
+	// saved at the end of the file, so that later jobs can select events without reading
+	// the whole run.
+	midas::TscBankMap tscBanks;
+	tscBanks[DRAGON_HEAD_EVENT] = head.variables.bk_tsc;
+	tscBanks[DRAGON_TAIL_EVENT] = tail.variables.bk_tsc;
+	fin.SetTriggerTimeFunc(midas::tsc_trigger_time, &tscBanks);
+	if (options.fSaveIndex && !options.IsSelecting())
+		fin.RecordIndex(true);
 
 	//
 	// ODB parameters
 	std::auto_ptr<midas::Database> db0(0); // run start
 	std::auto_ptr<midas::Database> db1(0); // run stop
 	
+	//
+	// Multithreaded unpacking: the pipeline does the equivalent of the
+	// loop and queue flush below, calling filler.Fill() in the same order.
+	if(options.fThreads > 0) {
+		m2r::TreeFiller filler;
+		filler.fUnpacker = &unpack;
+		filler.fFillHistos = &fillHistos;
+		filler.fHaveHistos = fillHistos;
+		filler.fDb0 = &db0;
+		filler.fDb1 = &db1;
+		filler.fNumEvents = 0;
+		filler.fProgress = !batch;
+
+		info << "Unpacking with " << options.fThreads << " worker threads.\n\n";
+		dragon::UnpackPipeline pipeline(unpack, options.fThreads);
+		pipeline.Run(fin, filler);
+
+		if (!batch) m2r::static_counter (filler.fNumEvents, 1000, true);
+		if (stats) stats->fEvents = filler.fNumEvents;
+		info << "\nRead " << fin.GetBytesRead() / (1024.*1024.) << " MB in "
+							<< fin.GetElapsedTime() << " sec. (" << fin.GetThroughput() << " MB/s"
+							<< (fin.IsMapped() ? ", memory mapped" : "") << ").\n";
+	}
+
+	//
+	// Event selection: if the file can be indexed, make a list of the selected
+	// events to seek to, otherwise all events are read and checked in the loop below
+	const bool select = options.IsSelecting();
+	bool havePlan = false;
+	std::vector<size_t> plan;
+	if (select) {
+		if (fin.OpenIndex(options.fSaveIndex)) {
+			m2r::EventSelector planner(options);
+			for (size_t i=0; i< fin.GetIndexSize(); ++i) {
+				const TMidasFile::IndexEntry& entry = fin.GetIndexEntry(i);
+				if (planner.Select(i, entry.fEventId, entry.fTimeStamp))
+					plan.push_back(i);
+			}
+			havePlan = true;
+			info << "Converting " << plan.size() << " of " << fin.GetIndexSize() << " events.\n\n";
+		}
+		else {
+			m2r::cwar << "Warning: Couldn't index \'" << options.fIn << "\' (" << fin.GetLastError()
+								<< "), reading all events to select from.\n\n";
+		}
+	}
+
 	//
 	// Loop over events in the midas file
 	int nnn = 0;
-	while (1) {
+	size_t iplan = 0;
+	Long64_t nread = 0;
+	m2r::EventSelector selector(options);
+	TMidasEvent temp;
+	while (options.fThreads == 0) {
+		//
+		// Jump to the next selected event
+		if (havePlan) {
+			if (iplan == plan.size()) break;
+			const TMidasFile::IndexEntry& entry = fin.GetIndexEntry(plan[iplan++]);
+			if (fin.Tell() != entry.fOffset && !fin.Seek(entry.fOffset)) {
+				m2r::cerr << "Error: Couldn't seek in \'" << options.fIn << "\': " << fin.GetLastError() << "\n";
+				break;
+			}
+		}
+
 		//
-		// Read event from MIDAS file
-		TMidasEvent temp;
-		bool success = fin.Read(&temp);
+		// Read event from MIDAS file; the data stay in the file's read buffer
+		// and are only copied if the timestamp queue needs to keep them.
+		bool success = fin.ReadInPlace(&temp);
 		if (!success) break;
 
+		if (select && !havePlan && !selector.Select(nread++, temp.GetEventId(), temp.GetTimeStamp()))
+			continue;
+
 		//
 		// Read ODB tree if MIDAS_EOR buffer
 		if (temp.GetEventId() == MIDAS_BOR) {
@@ -563,62 +1473,30 @@ int main_(int argc, char** argv)
 		}
 
 		//
-		// Unpack into our classes
-		std::vector<Int_t> which =
-			unpack.UnpackMidasEvent(temp.GetEventHeader(), temp.GetData());
+		// Unpack into our classes, the sinks fill trees for those that
+		// have data (and histograms if appropriate)
+		unpack.HandleMidasEvent(temp.GetEventHeader(), temp.GetData());
 
-		//
-		// Check which classes have data, fill trees for those that do
-		// Also fill histograms if appropriate
-		for (int i=0; i< nIds; ++i) {
-			std::vector<Int_t>::iterator it =
-				std::find(which.begin(), which.end(), eventIds[i]);
-			if(it != which.end()) {
-				if(trees[i]) {
-					trees[i]->Fill();
-				}
-				if(fillHistos) fill_histos(*it, addr[i]);
-				if(options.fSonik && eventIds[i] == DRAGON_TAIL_EVENT) {
-					sonik.reset();
-					sonik.read_data(tail.v785, tail.v1190);
-					sonik.calculate();
-					t0->Fill();
-					if(fillHistos) fill_histos(0, psonik);
-				}
-			}
-		}
-		m2r::static_counter (nnn++, 1000, false);
+		if (!batch) m2r::static_counter (nnn, 1000, false);
+		++nnn;
 	} // while (1) {
 
-	m2r::static_counter (nnn, 1000, true);
-
-	if(!options.fSingles) { // Flush the queue
-		size_t qsize;
-		while (1) {
-			qsize = unpack.FlushQueueIterative(); // Fills classes implicitly
-			if (qsize == 0) break;
-			
-			// Explicitly fill TTrees
-			std::vector<Int_t> which = unpack.GetUnpackedCodes();
-			for (int i=0; i< nIds; ++i) {
-				std::vector<Int_t>::iterator it =
-					std::find(which.begin(), which.end(), eventIds[i]);
-				if(it != which.end()) {
-					if(trees[i]) {
-						trees[i]->Fill();
-					}
-					if(options.fSonik && eventIds[i] == DRAGON_TAIL_EVENT) {
-						sonik.reset();
-						sonik.read_data(tail.v785, tail.v1190);
-						sonik.calculate();
-						t0->Fill();
-					}
-				}
-			}
-		} 
+	if(options.fThreads == 0) {
+		if (!batch) m2r::static_counter (nnn, 1000, true);
+		if (stats) stats->fEvents = nnn;
+		info << "\nRead " << fin.GetBytesRead() / (1024.*1024.) << " MB in "
+							<< fin.GetElapsedTime() << " sec. (" << fin.GetThroughput() << " MB/s"
+							<< (fin.IsMapped() ? ", memory mapped" : "") << ").\n";
+
+		//
+		// Flush the queue, filling trees (but not histograms) with the remaining events
+		const bool haveHistos = fillHistos;
+		fillHistos = false;
+		unpack.HandleEor();
+		fillHistos = haveHistos;
 	}
 
-	m2r::cout << "\nDone!\n\n";
+	info << "\nDone!\n\n";
 
 	//
 	// Write trees to file.
@@ -635,6 +1513,22 @@ int main_(int argc, char** argv)
 		}
 	}
 	//
+	// Print bytes written per branch if requested
+	if(options.fReport) {
+		char header[256];
+		sprintf(header, "  %-32s %10s %14s %14s %7s\n", "tree / branch", "entries", "bytes", "compressed", "ratio");
+		TThread::Lock(); // n.b. keeps the reports of parallel batch jobs apart
+		m2r::cout << "\nBytes written to \'" << out.Data() << "\' (compression settings "
+							<< fout.GetCompressionSettings() << "):\n" << header;
+		if(t0) report_tree(t0);
+		for (int i=0; i< nIds; ++i) {
+			if(trees[i]) report_tree(trees[i]);
+		}
+		m2r::cout << "\n";
+		m2r::flush(m2r::cout);
+		TThread::UnLock();
+	}
+	//
 	// Write histograms to file if requested
 	if(fillHistos) {
 		save_histos(gROOT, &fout);
@@ -644,13 +1538,15 @@ int main_(int argc, char** argv)
 	// Write run start ODB variables
 	if(db0.get()) {
 		db0->SetNameTitle("odbstart", "ODB tree at run start.");
-		db0->Write("odbstart");
+		if(!options.fXmlOdb) db0->MakeSnapshot();
+		fout.WriteTObject(db0.get(), "odbstart");
 	}
 	//
 	// Write run stop ODB variables
 	if(db1.get()) {
 		db1->SetNameTitle("odbstop", "ODB tree at run stop.");
-		db1->Write("odbstop");
+		if(!options.fXmlOdb) db1->MakeSnapshot();
+		fout.WriteTObject(db1.get(), "odbstop");
 
 		std::string ftitle;
 		bool success = db1->ReadValue("/Experiment/Run Parameters/Comment", ftitle);
@@ -658,18 +1554,201 @@ int main_(int argc, char** argv)
 	}
 	//
 	// Write variables actually used in analysis
-	midas::Database db(options.fOdb.c_str());
-	db.SetNameTitle("variables", "ODB tree used in analysis.");
-	db.Write("variables");
+	fout.WriteTObject(&variables, "variables");
 	//
-	// Print delayed error messages
-	dragon::utils::gDelayedMessageFactory.Flush();
+	// Print delayed error messages (batch mode prints them once all runs are done)
+	if (!batch) dragon::utils::gDelayedMessageFactory.Flush();
 	//
 	// Close output file
 	fout.Close();
+
+	timer.Stop();
+	if (stats) stats->fTime = timer.RealTime();
+	return 0;
+}
+
+/// One entry in a batch run list
+struct BatchRun_t {
+	std::string fIn;
+	TString fOut;
+	int fStatus;
+	RunStats_t fStats;
+};
+
+/// Run list shared by the batch worker threads
+struct BatchQueue_t {
+	const Options_t* fOptions;
+	const midas::Database* fVariables; // shared -v database, or NULL
+	std::vector<BatchRun_t>* fRuns;
+	size_t fNext;
+	size_t fDone;
+};
+
+//
+/// Batch worker, converts runs from the list until none are left
+void* batch_worker(void* arg)
+{
+	BatchQueue_t* queue = static_cast<BatchQueue_t*>(arg);
+	while (1) {
+		TThread::Lock();
+		size_t irun = queue->fNext++;
+		TThread::UnLock();
+		if (irun >= queue->fRuns->size()) break;
+
+		BatchRun_t& run = queue->fRuns->at(irun);
+		Options_t options = *(queue->fOptions);
+		options.fIn = run.fIn;
+
+		//
+		// Use the shared variables database if there is one, otherwise
+		// read the ODB dump in the input file
+		std::auto_ptr<midas::Database> own(0);
+		const midas::Database* variables = queue->fVariables;
+		if (!variables) {
+			own.reset(new midas::Database(run.fIn.c_str()));
+			own->SetNameTitle("variables", "ODB tree used in analysis.");
+			if (!options.fXmlOdb) own->MakeSnapshot();
+			variables = own.get();
+		}
+		run.fStatus = convert(options, run.fOut, *variables, &run.fStats);
+
+		TThread::Lock();
+		const size_t ndone = ++queue->fDone;
+		m2r::cout << "[" << ndone << "/" << queue->fRuns->size() << "] " << run.fIn << " -> " << run.fOut.Data();
+		if (run.fStatus == 0)
+			m2r::cout << ": " << run.fStats.fEvents << " events in " << run.fStats.fTime << " sec. ("
+								<< (run.fStats.fTime > 0 ? run.fStats.fEvents / run.fStats.fTime : 0) << " events/s)\n";
+		else
+			m2r::cout << ": FAILED\n";
+		m2r::flush(m2r::cout);
+		TThread::UnLock();
+	}
 	return 0;
 }
 
+//
+/// Convert all runs listed in options.fBatch
+int run_batch(const Options_t& options)
+{
+	std::ifstream list(options.fBatch.c_str());
+	if (!list.good()) {
+		m2r::cerr << "Error: Couldn't open the run list \'" << options.fBatch << "\'.\n\n";
+		return 1;
+	}
+
+	//
+	// Read run list; output names are figured out here since
+	// output_name() is not thread safe.
+	std::vector<BatchRun_t> runs;
+	std::string line;
+	while (std::getline(list, line)) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream iss(line);
+		BatchRun_t run;
+		std::string outspec;
+		if (!(iss >> run.fIn)) continue; // empty line
+		iss >> outspec;
+		run.fOut = output_name(run.fIn, outspec);
+		run.fStatus = 1;
+		runs.push_back(run);
+	}
+	if (runs.empty()) {
+		m2r::cerr << "Error: No runs found in \'" << options.fBatch << "\'.\n\n";
+		return 1;
+	}
+
+	//
+	// Parse a shared variables file only once
+	std::auto_ptr<midas::Database> variables(0);
+	if (!options.fOdb.empty()) {
+		if (!check_odb(options.fOdb)) return 1;
+		variables.reset(new midas::Database(options.fOdb.c_str()));
+		variables->SetNameTitle("variables", "ODB tree used in analysis.");
+		if (!options.fXmlOdb) variables->MakeSnapshot();
+	}
+
+	const int njobs = std::min<int>(options.fJobs, runs.size());
+	m2r::cout << "\nConverting " << runs.size() << " runs from \'" << options.fBatch
+						<< "\' with " << njobs << " parallel job" << (njobs > 1 ? "s" : "") << ".\n\n";
+
+	BatchQueue_t queue;
+	queue.fOptions = &options;
+	queue.fVariables = variables.get();
+	queue.fRuns = &runs;
+	queue.fNext = 0;
+	queue.fDone = 0;
+
+	TStopwatch timer;
+	timer.Start();
+	if (njobs == 1) {
+		batch_worker(&queue);
+	}
+	else {
+		TThread::Initialize();
+		std::vector<TThread*> threads;
+		for (int i=0; i< njobs; ++i) {
+			threads.push_back(new TThread(batch_worker, &queue));
+			threads.back()->Run();
+		}
+		for (size_t i=0; i< threads.size(); ++i) {
+			threads[i]->Join();
+			delete threads[i];
+		}
+	}
+	timer.Stop();
+
+	//
+	// Aggregate statistics
+	Long64_t nevents = 0;
+	size_t nfailed = 0;
+	for (size_t i=0; i< runs.size(); ++i) {
+		if (runs[i].fStatus == 0) nevents += runs[i].fStats.fEvents;
+		else ++nfailed;
+	}
+	m2r::cout << "\nConverted " << runs.size() - nfailed << " of " << runs.size() << " runs, "
+						<< nevents << " events in " << timer.RealTime() << " sec. ("
+						<< (timer.RealTime() > 0 ? nevents / timer.RealTime() : 0) << " events/s)\n\n";
+	if (nfailed) {
+		m2r::cerr << "Error: the following runs failed:\n";
+		for (size_t i=0; i< runs.size(); ++i)
+			if (runs[i].fStatus) m2r::cerr << "\t" << runs[i].fIn << "\n";
+		m2r::cerr << "\n";
+	}
+
+	//
+	// Print delayed error messages
+	dragon::utils::gDelayedMessageFactory.Flush();
+	return nfailed ? 1 : 0;
+}
+
+//
+/// The main function implementation
+int main_(int argc, char** argv)
+{
+	m2r::Options_t options;
+	int arg_result = m2r::process_args(argc, argv, &options);
+	if(arg_return) return arg_result;
+
+	if (!options.fBatch.empty())
+		return run_batch(options);
+
+	TString out = output_name(options.fIn, options.fOut);
+
+	//
+	// Handle odb variables file
+	if (options.fOdb.empty()) {
+		options.fOdb = options.fIn; // No file specified, use ODB dump in midas file
+	}
+	else if (!check_odb(options.fOdb)) {
+		return 1;
+	}
+	midas::Database variables(options.fOdb.c_str());
+	variables.SetNameTitle("variables", "ODB tree used in analysis.");
+	if (!options.fXmlOdb) variables.MakeSnapshot();
+
+	return convert(options, out, variables, 0);
+}
+
 } // namespace m2r
 
 #ifndef USE_ROOTBEER
@@ -128,6 +128,16 @@ public:
 	/// Default dump to std::cout
 	void Dump() const { Dump(std::cout); }
 
+	/// Store as a binary snapshot when written to a ROOT file, see midas::Xml::MakeSnapshot()
+	bool MakeSnapshot()
+		{
+			/*!
+			 * \returns true if successful, false if zombie or in online mode
+			 */
+			if(fIsZombie || fIsOnline || !fXml.get()) return false;
+			return fXml->MakeSnapshot();
+		}
+
 	/// Read a single value
 	template <typename T> bool ReadValue(const char* path, T& value) const
 		{
@@ -205,7 +215,7 @@ public:
 		}
 
 	/// Check if a path exists
-	bool CheckPath(const char* path)
+	bool CheckPath(const char* path) const
 		{
 			if(fIsZombie) return false;
 			if (fIsOnline) {
@@ -213,13 +223,25 @@ public:
 				return (arrlen != -1);
 			}
 			else if (fXml.get()) {
-				midas::Xml::Node node = fXml->FindKey(path, true);
-				if(!node) node = fXml->FindKeyArray(path, true);
-				return (node != 0);
+				return fXml->HasKey(path);
 			}
 			else return false;
 		}
 
+	/// Checksum of the keys in a directory
+	bool Checksum(const char* dir, uint64_t& sum) const
+		{
+			/*!
+			 * \param [in] dir ODB directory, e.g. "/dragon/bgo/variables"
+			 * \param [out] sum Checksum of the names and values of all keys below \e dir,
+			 *  which changes if any of them does (see midas::Xml::Checksum())
+			 * \returns false if zombie or in online mode (not supported)
+			 */
+			if(fIsZombie || fIsOnline || !fXml.get()) return false;
+			sum = fXml->Checksum(dir);
+			return true;
+		}
+
 #ifdef USE_ROOT
 	ClassDef(midas::Database, MIDAS_XML_CLASS_VERSION);
 #endif
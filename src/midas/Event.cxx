@@ -17,6 +17,22 @@
 
 namespace {
 
+// Size in bytes of MIDAS data types, indexed by TID
+const unsigned TID_SIZE[] = {0, 1, 1, 1, 2, 2, 4, 4, 4, 4, 8, 1, 0, 0, 0, 0, 0};
+
+// Number of array elements in a bank
+inline int bank_length(uint32_t type, uint32_t size)
+{
+	const unsigned tidSize = TID_SIZE[type & 0xF];
+	return tidSize == 0 ? size : size / tidSize;
+}
+
+// Check for MIDAS system events (BOR, EOR, message), which contain no banks
+inline bool is_system_event(uint16_t id)
+{
+	return (id & 0xFFF0) == 0x8000;
+}
+
 // Helper function to calculate full timestamp values
 inline uint64_t read_timestamp (uint32_t tscl, uint32_t tsch)
 {
@@ -34,6 +50,266 @@ inline uint64_t read_timestamp (uint32_t tscl, uint32_t tsch)
 	return tscfull;
 }
 
+// Check the TSC firmware version
+void check_tsc_version(uint32_t version, const midas::EventView::Header* header)
+{
+	uint32_t versions[] =
+		{ 0x01130215, 0x01121212, 0x01120925, 0x01120809, 0x01120810, 0x01120910 };
+
+	for(uint32_t v=0; v< sizeof(versions)/sizeof(uint32_t); ++v) {
+		if(version == versions[v]) return;
+	}
+	dragon::utils::Warning("midas::Event::Init") <<
+		"Unknown TSC version 0x" << std::hex << version << std::dec << " (id, serial #: " << header->fEventId <<
+		", " << header->fSerialNumber << ")" << DRAGON_ERR_FILE_LINE;
+}
+
+// Read TSC4 fifo values from a TSC bank
+// Returns the first trigger channel value, or max uint64_t if there is none.
+// If pfifo is non-NULL, all fifo values are appended to it.
+uint64_t read_tsc (const uint32_t* ptsc, std::vector<uint64_t>* pfifo)
+{
+	uint64_t clock = std::numeric_limits<uint64_t>::max();
+
+	// Skip: firmware revision, write timestamp, routing
+	ptsc += 3;
+
+	// Get TSC4 info
+	uint32_t ctrl = *ptsc++, roll = *ptsc++;
+	uint32_t nch  = ctrl & READ14; // number of channels
+	uint32_t tsch = (ctrl>>16) & READ8; // upper tsc bits 35..28
+
+	for(uint32_t i=0; i< nch; ++i) {
+		uint32_t tscl = *ptsc++, ch = (tscl>>30) & READ2;
+		assert(ch< midas::Event::MAX_FIFO);
+
+		uint64_t tscfull = read_timestamp(tscl, tsch | (roll<<8));
+		if(pfifo) pfifo[ch].push_back(tscfull);
+
+		if(ch == midas::Event::TRIGGER_CHANNEL && clock == std::numeric_limits<uint64_t>::max()) {
+			clock = tscfull;
+			if(!pfifo) break;
+		}
+	}
+	return clock;
+}
+
+}
+
+
+// ========= Class midas::BankIndex ========= //
+
+void midas::BankIndex::Copy(const BankIndex& other)
+{
+	fNumBanks = other.fNumBanks;
+	fComplete = other.fComplete;
+	std::copy(other.fName,   other.fName   + fNumBanks, fName);
+	std::copy(other.fOffset, other.fOffset + fNumBanks, fOffset);
+	std::copy(other.fLength, other.fLength + fNumBanks, fLength);
+	std::copy(other.fType,   other.fType   + fNumBanks, fType);
+}
+
+void midas::BankIndex::Add(BankId_t name, const void* pbank, const char* data, int length, int type)
+{
+	if (fNumBanks == MAX_BANKS) {
+		fComplete = false;
+		return;
+	}
+	fName[fNumBanks]   = name;
+	fOffset[fNumBanks] = reinterpret_cast<const char*>(pbank) - data;
+	fLength[fNumBanks] = length;
+	fType[fNumBanks]   = type;
+	++fNumBanks;
+}
+
+void midas::BankIndex::Build(const char* data)
+{
+	/*!
+	 * \param data Pointer to the data portion of the event (bank header)
+	 *
+	 * Walks the bank list once, in the same way as TMidasEvent::IterateBank(), stopping
+	 * at the end of the event data or at the first bank running past it.
+	 */
+	fNumBanks = 0;
+	fComplete = true;
+
+	const TMidas_BANK_HEADER* pbkh = reinterpret_cast<const TMidas_BANK_HEADER*>(data);
+	const char* pend = data + pbkh->fDataSize + sizeof(TMidas_BANK_HEADER);
+
+	if ((pbkh->fFlags & (1<<4)) > 0) { // 32-bit banks
+		const TMidas_BANK32* pbk32 = reinterpret_cast<const TMidas_BANK32*>(pbkh + 1);
+		while (reinterpret_cast<const char*>(pbk32 + 1) <= pend) {
+			const char* pbkdata = reinterpret_cast<const char*>(pbk32 + 1);
+			if (pbkdata + pbk32->fDataSize > pend) break;
+			Add(bank_id(pbk32->fName), pbkdata, data, bank_length(pbk32->fType, pbk32->fDataSize), pbk32->fType);
+			pbk32 = reinterpret_cast<const TMidas_BANK32*>(pbkdata + ((pbk32->fDataSize + 7) & ~7));
+		}
+	}
+	else { // 16-bit banks
+		const TMidas_BANK* pbk = reinterpret_cast<const TMidas_BANK*>(pbkh + 1);
+		while (reinterpret_cast<const char*>(pbk + 1) <= pend) {
+			const char* pbkdata = reinterpret_cast<const char*>(pbk + 1);
+			if (pbkdata + pbk->fDataSize > pend) break;
+			Add(bank_id(pbk->fName), pbkdata, data, bank_length(pbk->fType, pbk->fDataSize), pbk->fType);
+			pbk = reinterpret_cast<const TMidas_BANK*>(pbkdata + ((pbk->fDataSize + 7) & ~7));
+		}
+	}
+}
+
+int midas::BankIndex::Find(BankId_t name, const char* data, int* bklen, int* bktype, void** pdata) const
+{
+	/*!
+	 * \param [in] name Packed name of the bank to look for
+	 * \param [in] data Pointer to the data portion of the event the index was built from (or a copy of it)
+	 * \param [out] bklen Number of array elements in this bank (0 if not found)
+	 * \param [out] bktype Bank data type (MIDAS TID_xxx)
+	 * \param [out] pdata Pointer to bank data, NULL if not found
+	 * \returns 1 if bank found, 0 otherwise
+	 */
+	for (int i = 0; i < fNumBanks; ++i) {
+		if (fName[i] == name) {
+			*pdata  = const_cast<char*>(data + fOffset[i]);
+			*bklen  = fLength[i];
+			*bktype = fType[i];
+			return 1;
+		}
+	}
+	*pdata = 0;
+	*bklen = 0;
+	return 0;
+}
+
+
+// ========= Class midas::EventView ========= //
+
+midas::EventView::EventView(const void* header, const void* data, const char* tsbank, double coinc_window):
+	fHeader(reinterpret_cast<const Header*>(header)),
+	fData(reinterpret_cast<const char*>(data)),
+	fTsc(0),
+	fCoincWindow(coinc_window),
+	fClock(std::numeric_limits<uint64_t>::max()),
+	fTriggerTime(0.),
+	fBanks(&fOwnBanks)
+{
+	/*!
+	 * \param header Pointer to event header (midas::Event::Header struct)
+	 * \param data Pointer to the data portion of an event
+	 * \param tsbank Bank name of the TSC4 data; if NULL, tsc features are ignored
+	 * \param coinc_window Desired window to be considered a coincidence match w/ another event.
+	 */
+	Init(tsbank);
+}
+
+midas::EventView::EventView(const char* buf, const char* tsbank, double coinc_window):
+	fHeader(reinterpret_cast<const Header*>(buf)),
+	fData(buf + sizeof(Header)),
+	fTsc(0),
+	fCoincWindow(coinc_window),
+	fClock(std::numeric_limits<uint64_t>::max()),
+	fTriggerTime(0.),
+	fBanks(&fOwnBanks)
+{
+	/*!
+	 * \param buf Buffer containing the entirity of the event data (header + actual data)
+	 * \param tsbank Bank name of the TSC4 data; if NULL, tsc features are ignored
+	 * \param coinc_window Desired window to be considered a coincidence match w/ another event.
+	 */
+	Init(tsbank);
+}
+
+void midas::EventView::Init(const char* tsbank)
+{
+	/*!
+	 * Indexes the banks, then locates the TSC bank and reads the trigger time;
+	 * fifo values are only decoded on demand, in CopyFifo().
+	 */
+	if (!is_system_event(fHeader->fEventId))
+		fOwnBanks.Build(fData);
+
+	if (tsbank == 0) return;
+
+	int tsclength;
+	uint32_t* ptsc = GetBankPointer<uint32_t> (tsbank, &tsclength, true, true);
+	if (!ptsc) throw(std::invalid_argument(tsbank));
+
+	check_tsc_version(*ptsc, fHeader);
+	fTsc = ptsc;
+	fClock = read_tsc(fTsc, 0);
+	if(fClock != std::numeric_limits<uint64_t>::max())
+		fTriggerTime = fClock / DRAGON_TSC_FREQ;
+}
+
+void midas::EventView::CopyFifo(std::vector<uint64_t>* pfifo) const
+{
+	/*!
+	 * Decodes the fifo values from the TSC bank directly into the external
+	 * vectors, which are cleared first (retaining their capacity).
+	 * \attention Input pointer must point to an array w/ length >= 4.
+	 */
+	for(uint32_t i=0; i< Event::MAX_FIFO; ++i)
+		pfifo[i].clear();
+	if(fTsc) read_tsc(fTsc, pfifo);
+}
+
+int midas::EventView::ScanBank(BankId_t name, int* bklen, int* bktype, void** pdata) const
+{
+	/*!
+	 * Same as TMidasEvent::FindBank(), but operating on the external buffer.
+	 * Only used for events which could not be (completely) indexed.
+	 * \param [in] name Packed name of the data bank to look for.
+	 * \param [out] bklen Number of array elements in this bank (0 if not found).
+	 * \param [out] bktype Bank data type (MIDAS TID_xxx).
+	 * \param [out] pdata Pointer to bank data, Returns NULL if bank not found.
+	 * \returns 1 if bank found, 0 otherwise.
+	 */
+	const TMidas_BANK_HEADER* pbkh = reinterpret_cast<const TMidas_BANK_HEADER*>(fData);
+	const char* pend = fData + pbkh->fDataSize + sizeof(TMidas_BANK_HEADER);
+
+	if ((pbkh->fFlags & (1<<4)) > 0) { // 32-bit banks
+		const TMidas_BANK32* pbk32 = reinterpret_cast<const TMidas_BANK32*>(pbkh + 1);
+		while (reinterpret_cast<const char*>(pbk32) < pend) {
+			if (bank_id(pbk32->fName) == name) {
+				*pdata = const_cast<TMidas_BANK32*>(pbk32 + 1);
+				*bklen = bank_length(pbk32->fType, pbk32->fDataSize);
+				*bktype = pbk32->fType;
+				return 1;
+			}
+			pbk32 = reinterpret_cast<const TMidas_BANK32*>
+				(reinterpret_cast<const char*>(pbk32 + 1) + ((pbk32->fDataSize + 7) & ~7));
+		}
+	}
+	else { // 16-bit banks
+		const TMidas_BANK* pbk = reinterpret_cast<const TMidas_BANK*>(pbkh + 1);
+		do {
+			if (bank_id(pbk->fName) == name) {
+				*pdata = const_cast<TMidas_BANK*>(pbk + 1);
+				*bklen = bank_length(pbk->fType, pbk->fDataSize);
+				*bktype = pbk->fType;
+				return 1;
+			}
+			pbk = reinterpret_cast<const TMidas_BANK*>
+				(reinterpret_cast<const char*>(pbk + 1) + ((pbk->fDataSize + 7) & ~7));
+		} while (reinterpret_cast<const char*>(pbk) < pend);
+	}
+
+	*pdata = 0;
+	*bklen = 0;
+	return 0;
+}
+
+int midas::EventView::FindBank(BankId_t name, int* bklen, int* bktype, void** pdata) const
+{
+	/*!
+	 * Looks up the bank in the directory built at construction.
+	 * \param [in] name Packed name of the data bank to look for, see bank_id().
+	 * \param [out] bklen Number of array elements in this bank (0 if not found).
+	 * \param [out] bktype Bank data type (MIDAS TID_xxx).
+	 * \param [out] pdata Pointer to bank data, Returns NULL if bank not found.
+	 * \returns 1 if bank found, 0 otherwise.
+	 */
+	if (fBanks->Find(name, fData, bklen, bktype, pdata))
+		return 1;
+	return fBanks->IsComplete() ? 0 : ScanBank(name, bklen, bktype, pdata);
 }
 
 
@@ -42,6 +318,7 @@ inline uint64_t read_timestamp (uint32_t tscl, uint32_t tsch)
 midas::Event::Event(const void* header, const void* data, int size, const Bank_t tsbank, double coinc_window):
 	fCoincWindow(coinc_window),
 	fClock (std::numeric_limits<uint64_t>::max()),
+	fTscOffset(-1),
 	fTriggerTime(0.)
 {
 	/*!
@@ -57,6 +334,7 @@ midas::Event::Event(const void* header, const void* data, int size, const Bank_t
 midas::Event::Event(char* buf, int size, const Bank_t tsbank, double coinc_window):
 	fCoincWindow(coinc_window),
  	fClock (std::numeric_limits<uint64_t>::max()),
+	fTscOffset(-1),
 	fTriggerTime(0.)
 {
 	/*!
@@ -71,6 +349,7 @@ midas::Event::Event(char* buf, int size, const Bank_t tsbank, double coinc_windo
 midas::Event::Event(char* buf, int size):
 	fCoincWindow(0),
  	fClock (std::numeric_limits<uint64_t>::max()),
+	fTscOffset(-1),
 	fTriggerTime(0.)
 {
 	/*!
@@ -83,6 +362,7 @@ midas::Event::Event(char* buf, int size):
 midas::Event::Event(const void* header, const void* data, int size):
 	fCoincWindow(0),
 	fClock (std::numeric_limits<uint64_t>::max()),
+	fTscOffset(-1),
 	fTriggerTime(0.)
 {
 	/*!
@@ -93,6 +373,24 @@ midas::Event::Event(const void* header, const void* data, int size):
 	Init(0, header, data, size);
 }
 
+midas::Event::Event(const EventView& view):
+	fCoincWindow(view.CoincWindow()),
+	fClock (view.ClockTime()),
+	fTscOffset(-1),
+	fTriggerTime(view.TriggerTime())
+{
+	/*!
+	 * Copies the header and data from the view's buffer; the TSC information
+	 * already parsed by the view is re-used.
+	 * \param view View of the event to take a copy of
+	 */
+	memcpy(GetEventHeader(), view.GetEventHeader(), sizeof(midas::Event::Header));
+	memcpy(GetData(), view.GetData(), GetDataSize());
+	fBanks = view.GetBankIndex();
+	if (view.GetTscPointer())
+		fTscOffset = reinterpret_cast<const char*>(view.GetTscPointer()) - view.GetData();
+}
+
 void midas::Event::CopyDerived(const midas::Event& other)
 {
 	/*!
@@ -101,20 +399,29 @@ void midas::Event::CopyDerived(const midas::Event& other)
 	fClock       = other.fClock;
 	fTriggerTime = other.fTriggerTime;
 	fCoincWindow = other.fCoincWindow;
-	other.CopyFifo(fFifo);
+	fTscOffset   = other.fTscOffset;
+	fBanks       = other.fBanks;
 	TMidasEvent::Copy(other);
 }
 
+void midas::Event::BuildBankIndex()
+{
+	/*!
+	 * Replaces TMidasEvent::SetBankList(), which is no longer called when constructing
+	 * an event (call it explicitly to use GetBankList() or Print()).
+	 */
+	if (is_system_event(GetEventId()))
+		fBanks.Clear();
+	else
+		fBanks.Build(fData);
+}
+
 void midas::Event::CopyFifo(std::vector<uint64_t>* pfifo) const
 {
 	/*!
 	 * \attention Input pointer must point to an array w/ length >= 4.
 	 */
-	for(uint32_t i=0; i< MAX_FIFO; ++i) {
-		(pfifo+i)->clear();
-		(pfifo+i)->resize(fFifo[i].size());
-		std::copy(fFifo[i].begin(), fFifo[i].end(), pfifo[i].begin());
-	}
+	EventView(*this).CopyFifo(pfifo);
 }
 
 void midas::Event::PrintSingle(FILE* where) const
@@ -140,59 +447,13 @@ void midas::Event::Init(const char* tsbank, const void* header, const void* addr
 {
 	memcpy(GetEventHeader(), header, sizeof(midas::Event::Header));
 	memcpy(GetData(), addr, GetDataSize());
-	SetBankList();
+	BuildBankIndex();
 
 	if (tsbank != 0) {
-		int tsclength;
-		uint32_t* ptsc = GetBankPointer<uint32_t> (tsbank, &tsclength, true, true);
-		if (!ptsc) throw(std::invalid_argument(tsbank));
-
-		// Read: firmware revision, write timestamp, routing, sync number
-		uint32_t version = *ptsc++;
-		uint32_t bkts    = *ptsc++;
-		uint32_t route   = *ptsc++;
-
-		// Suppress compiler warning about unused values
-		if (version && bkts && route)
-			;
-
-		// Check version
-		uint32_t versions[] =
-			{ 0x01130215, 0x01121212, 0x01120925, 0x01120809, 0x01120810, 0x01120910 };
-
-		bool okVersion = false;
-		for(uint32_t v=0; v< sizeof(versions)/sizeof(uint32_t); ++v) {
-			if(version == versions[v]) { okVersion = true; break; }
-		}
-		if(okVersion == false) {
-			dragon::utils::Warning("midas::Event::Init") <<
-				"Unknown TSC version 0x" << std::hex << version << std::dec << " (id, serial #: " << GetEventId() <<
-				", " << GetSerialNumber() << ")" << DRAGON_ERR_FILE_LINE;
-		}
-
-		// Get TSC4 info
-		uint32_t ctrl = *ptsc++, roll = *ptsc++;
-		uint32_t nch  = ctrl & READ14; // number of channels
-		bool overflow = (ctrl>>15) & READ1; // overflow flag
-		uint32_t tsch = (ctrl>>16) & READ8; // upper tsc bits 35..28
-
-		if (overflow && false) {
-			dragon::utils::Warning("midas::Event::Init") <<
-				"IO32 TSC in overflow condition. Event Serial #, Id: " << GetSerialNumber() << ", " << GetEventId() << "\n";
-		}
-
-		for(uint32_t i=0; i< nch; ++i) {
-			uint32_t tscl = *ptsc++, ch = (tscl>>30) & READ2;
-			assert(ch< MAX_FIFO);
-
-			uint64_t tscfull = read_timestamp(tscl, tsch | (roll<<8));
-			fFifo[ch].push_back(tscfull);
-
-			if(ch == TRIGGER_CHANNEL && fClock == std::numeric_limits<uint64_t>::max()) {
-				fClock = tscfull;
-				fTriggerTime = fClock / DRAGON_TSC_FREQ;
-			}
-		}
+		EventView view(&fEventHeader, fData, tsbank, fCoincWindow);
+		fClock = view.ClockTime();
+		fTriggerTime = view.TriggerTime();
+		fTscOffset = reinterpret_cast<const char*>(view.GetTscPointer()) - fData;
 	} // if tsbank != 0
 }
 
@@ -205,6 +466,33 @@ double midas::Event::TimeDiff(const Event& other) const
 	return fTriggerTime - other.fTriggerTime;
 }
 
+double midas::tsc_trigger_time(const void* header, const void* data, void* banks)
+{
+	/*!
+	 * Decodes only the bank index and the first trigger channel value, without the
+	 * TSC version check or warnings of EventView, as it is called for every event
+	 * while indexing a file.
+	 * \param header Pointer to event header (midas::Event::Header struct)
+	 * \param data Pointer to the data portion of an event
+	 * \param banks Pointer to a midas::TscBankMap, e.g. DRAGON_HEAD_EVENT and DRAGON_TAIL_EVENT
+	 *  mapped to the \c bk_tsc variable of dragon::Head and dragon::Tail
+	 * \returns Trigger time in microseconds (as from EventView::TriggerTime()), or -1 if the
+	 *  event has no TSC bank or no trigger channel value
+	 */
+	const Event::Header* evtHeader = reinterpret_cast<const Event::Header*>(header);
+	const TscBankMap* tscBanks = reinterpret_cast<const TscBankMap*>(banks);
+	TscBankMap::const_iterator it = tscBanks->find(evtHeader->fEventId);
+	if (it == tscBanks->end()) return -1;
+
+	EventView event(header, data);
+	int length = 0, type = 0;
+	void* ptsc = 0;
+	if (!event.FindBank(it->second.c_str(), &length, &type, &ptsc) || length < 5) return -1;
+
+	const uint64_t clock = read_tsc(reinterpret_cast<const uint32_t*>(ptsc), 0);
+	return clock == std::numeric_limits<uint64_t>::max() ? -1 : clock / DRAGON_TSC_FREQ;
+}
+
 midas::CoincEvent::CoincEvent(const Event& event1, const Event& event2):
 	fGamma(0), fHeavyIon(0)
 {
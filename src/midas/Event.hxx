@@ -7,8 +7,10 @@
 #ifndef DRAGON_MIDAS_EVENT_HXX
 #define DRAGON_MIDAS_EVENT_HXX
 #include <set>
+#include <map>
 #include <cmath>
 #include <cstdio>
+#include <string>
 #include <vector>
 #include <cassert>
 #include <cstring>
@@ -24,10 +26,248 @@ namespace midas {
 /// Typedef for a MIDAS bank name
 typedef char Bank_t[5];
 
+/// Typedef for a MIDAS bank name packed into a 32-bit integer
+typedef uint32_t BankId_t;
+
+/// Packs the 4 characters of a bank name into a BankId_t
+inline BankId_t bank_id(const char* name)
+{
+	BankId_t id;
+	memcpy(&id, name, sizeof(id));
+	return id;
+}
+
+class Event;
+
+/// Directory of the data banks in a MIDAS event
+/*!
+ * Built in a single pass over the bank list, it stores the name of each bank
+ * as a BankId_t, along with its offset from the start of the event data, length
+ * and type. Finding a bank is then a scan of (typically < 10) integers, instead
+ * of a walk through the event data comparing names. Since offsets are relative,
+ * the index stays valid for copies of the event data.
+ *
+ * Events with more than MAX_BANKS banks are only partially indexed; IsComplete()
+ * tells the caller to search the event data for banks not found in the index.
+ */
+class BankIndex {
+public:
+	/// Maximum number of banks in the index
+	static const int MAX_BANKS = 32;
+
+	/// Constructs an empty (incomplete) index
+	BankIndex(): fNumBanks(0), fComplete(false) { }
+
+	/// Copy constructor, copies only the used entries
+	BankIndex(const BankIndex& other) { Copy(other); }
+
+	/// Assignment operator, copies only the used entries
+	BankIndex& operator= (const BankIndex& other) { Copy(other); return *this; }
+
+	/// Index the banks of an event
+	void Build(const char* data);
+
+	/// Clear the index (marking it incomplete)
+	void Clear() { fNumBanks = 0; fComplete = false; }
+
+	/// Look up a bank
+	int Find(BankId_t name, const char* data, int* bklen, int* bktype, void** pdata) const;
+
+	/// Returns the number of indexed banks
+	int GetNumBanks() const { return fNumBanks; }
+
+	/// Returns true if all banks of the event are indexed
+	bool IsComplete() const { return fComplete; }
+
+private:
+	/// Helper for copy constructor / assignment operator
+	void Copy(const BankIndex& other);
+
+	/// Add a bank to the index
+	void Add(BankId_t name, const void* pbank, const char* data, int length, int type);
+
+private:
+	/// Number of indexed banks
+	int fNumBanks;
+	/// True if all banks of the event are indexed
+	bool fComplete;
+	/// Bank names
+	BankId_t fName[MAX_BANKS];
+	/// Offset of the bank data from the start of the event data
+	uint32_t fOffset[MAX_BANKS];
+	/// Number of array elements in the bank
+	int32_t fLength[MAX_BANKS];
+	/// Bank data type (MIDAS TID_xxx)
+	int32_t fType[MAX_BANKS];
+};
+
+/// Non-owning view of a MIDAS event residing in an external buffer
+/*!
+ * Stores pointers to the event header and data, together with the trigger
+ * time parsed from the TSC bank (if requested). No data are copied, and no heap
+ * memory is allocated when constructing a view; the buffer the view points to
+ * must stay valid for as long as the view is in use. To keep an event around
+ * longer than that (e.g. to buffer it for timestamp matching), construct a
+ * midas::Event from the view, which takes a copy of the data.
+ *
+ * A view can also be constructed (implicitly) from a midas::Event, pointing into
+ * the event's own buffers and bank directory. This allows all of the unpacking
+ * routines to take a `const EventView&` argument, accepting either type.
+ */
+class EventView {
+public:
+	/// Event header typedef, see midas::Event::Header
+	typedef TMidas_EVENT_HEADER Header;
+
+private:
+	/// Pointer to the event header
+	const Header* fHeader;
+
+	/// Pointer to the event data (bank header)
+	const char* fData;
+
+	/// Pointer to the TSC bank data (NULL if none)
+	const uint32_t* fTsc;
+
+	/// Coincidence window (in us)
+	double fCoincWindow;
+
+	/// Timestamp value in clock cycles since BOR
+	uint64_t fClock;
+
+	/// Timestamp value in uSec
+	double fTriggerTime;
+
+	/// Directory of the banks in the event, built by the view itself
+	BankIndex fOwnBanks;
+
+	/// Directory in use: &fOwnBanks, or that of the midas::Event viewed
+	const BankIndex* fBanks;
+
+public:
+	/// Construct from event header and data pointers, optionally with TSC handling
+	EventView(const void* header, const void* data, const char* tsbank = 0, double coinc_window = 0);
+
+	/// Construct from full data buffer (header + data), optionally with TSC handling
+	EventView(const char* buf, const char* tsbank = 0, double coinc_window = 0);
+
+	/// Construct a view of an owned midas::Event
+	EventView(const Event& event);
+
+	/// Copy constructor
+	EventView(const EventView& other);
+
+	/// Assignment operator
+	EventView& operator= (const EventView& other);
+
+	/// Returns pointer to the event header
+	const Header* GetEventHeader() const { return fHeader; }
+
+	/// Returns pointer to the data portion of the event
+	const char* GetData() const { return fData; }
+
+	/// Returns pointer to the TSC bank data, or NULL if there is no TSC information
+	const uint32_t* GetTscPointer() const { return fTsc; }
+
+	/// Returns the event id
+	uint16_t GetEventId() const { return fHeader->fEventId; }
+
+	/// Returns the trigger mask
+	uint16_t GetTriggerMask() const { return fHeader->fTriggerMask; }
+
+	/// Returns the serial number
+	uint32_t GetSerialNumber() const { return fHeader->fSerialNumber; }
+
+	/// Returns the system time stamp (unix time in seconds)
+	uint32_t GetTimeStamp() const { return fHeader->fTimeStamp; }
+
+	/// Returns the size of the data portion of the event in bytes
+	uint32_t GetDataSize() const { return fHeader->fDataSize; }
+
+	/// Copies event header information into another one
+	void CopyHeader(Header& destination) const
+		{ memcpy (&destination, fHeader, sizeof(Header)); }
+
+	/// Returns trigger time in uSec
+	double TriggerTime() const { return fTriggerTime; }
+
+	/// Returns the trigger time in clock cycles
+	uint64_t ClockTime() const { return fClock; }
+
+	/// Returns the coincidence window in uSec
+	double CoincWindow() const { return fCoincWindow; }
+
+	/// Copy fifo values to an external vector array
+	void CopyFifo(std::vector<uint64_t>* pfifo) const;
+
+	/// Returns the bank directory
+	const BankIndex& GetBankIndex() const { return *fBanks; }
+
+	/// Find a data bank
+	int FindBank(const char* name, int* bklen, int* bktype, void** pdata) const
+		{ return FindBank(bank_id(name), bklen, bktype, pdata); }
+
+	/// Find a data bank from its packed name
+	int FindBank(BankId_t name, int* bklen, int* bktype, void** pdata) const;
+
+	/// Bank finding routine (templated)
+	template <typename T>
+	T* GetBankPointer(const Bank_t name, int* length, bool reportMissing = false, bool checkType = false) const
+		{
+			/*!
+			 * \param [in] name Name of the bank to search for
+			 * \param [out] Length of the returned bank
+			 * \param [in] reportMissing True means a warning message is printed if the bank is absent
+			 * \param [in] checkType Specifies whether or not to check that the template parameter
+			 *  matches the TID of the bank. If this parameter is set to true and the types do
+			 *  not match, the error is fatal.
+			 * \returns Pointer to the beginning of the bank
+			 */
+			void *pbk;
+			int type;
+			int bkfound = FindBank(name, length, &type, &pbk);
+
+			if(!bkfound && reportMissing) {
+				dragon::utils::Warning("midas::Event::GetBankPointer<T>", __FILE__, __LINE__)
+					<< "Couldn't find the MIDAS bank \"" << name  << "\". Skipping...\n";
+			}
+			if (bkfound && checkType) {
+				switch (type) {
+				case 1:  assert (typeid(T) == typeid(unsigned char)); break; // TID_BYTE   1	
+				case 2:  assert (typeid(T) == typeid(char));          break; // TID_SBYTE  2	
+				case 3:  assert (typeid(T) == typeid(unsigned char)); break; // TID_CHAR   3	
+				case 4:  assert (typeid(T) == typeid(uint16_t));      break; // TID_WORD   4	
+				case 5:  assert (typeid(T) == typeid(int16_t));       break; // TID_SHORT  5	
+				case 6:  assert (typeid(T) == typeid(uint32_t));      break; // TID_DWORD  6	
+				case 7:  assert (typeid(T) == typeid(int32_t));       break; // TID_INT    7	
+				case 8:  assert (typeid(T) == typeid(bool));          break; // TID_BOOL   8	
+				case 9:  assert (typeid(T) == typeid(float));         break; // TID_FLOAT  9	
+				case 10: assert (typeid(T) == typeid(double));        break; // TID_DOUBLE 10
+				default:
+					fprintf(stderr, "Unknown type id: %i\n", type);
+					assert(false); break;
+				}
+			}
+			return bkfound ? reinterpret_cast<T*>(pbk) : 0;
+		}
+
+private:
+	/// Helper function for constructors
+	void Init(const char* tsbank);
+
+	/// Helper for copy constructor / assignment operator
+	void Copy(const EventView& other);
+
+	/// Search the event data for a bank not in fBanks
+	int ScanBank(BankId_t name, int* bklen, int* bktype, void** pdata) const;
+};
+
+
 /// Derived class of TMidasEvent for timestamped dragon events
 /*!
  * Stores timestamp values as fields for easy access. Also provides
  * constructors to set an event from the addresses returned by polling.
+ * Unlike midas::EventView, this class owns a copy of the event data.
  */
 class Event: public TMidasEvent {
 
@@ -59,15 +299,18 @@ private:
 	/// Timestamp value in clock cycles since BOR
 	uint64_t fClock;
 
-	/// TSC4 fifo values
-	std::vector<uint64_t> fFifo[MAX_FIFO];
+	/// Offset of the TSC bank data from the start of fData (-1 if none)
+	int32_t fTscOffset;
 
 	/// Timestamp value in uSec
 	double fTriggerTime;
 
+	/// Directory of the banks in the event
+	BankIndex fBanks;
+
 public:
 	/// Empty constructor
-	Event(): TMidasEvent() { }
+	Event(): TMidasEvent(), fCoincWindow(0), fClock(0), fTscOffset(-1), fTriggerTime(0) { }
 
 	/// Construct from event callback parameters, with TSC handling
 	Event(const void* header, const void* data, int size, const Bank_t tsbank, double coinc_window);
@@ -81,12 +324,15 @@ public:
 	/// Construct from direct polling parameters, _without_ TSC handling
 	Event(char* buf, int size);
 
+	/// Construct from a view, taking ownership of a copy of the data
+	explicit Event(const EventView& view);
+
 	/// Copy constructor
-	Event(const Event& other) { CopyDerived(other); }
+	Event(const Event& other): TMidasEvent() { CopyDerived(other); }
 
 	/// Assignment operator
 	Event& operator= (const Event& other)
-		{ CopyDerived(other); return *this; }
+		{ if (&other != this) { Clear(); CopyDerived(other); } return *this; }
 
 	/// Copies event header information into another one
 	void CopyHeader(Header& destination) const
@@ -94,7 +340,20 @@ public:
 
 	/// Read an event from a TMidasFile
 	bool ReadFromFile(TMidasFile& file)
-		{	Clear(); return file.Read(this); }
+		{	Clear(); fBanks.Clear(); if (!file.Read(this)) return false; BuildBankIndex(); return true; }
+
+	/// Returns pointer to the event header
+	const Header* GetHeaderPointer() const { return &fEventHeader; }
+
+	/// Returns pointer to the data portion of the event
+	const char* GetDataPointer() const { return fData; }
+
+	/// Returns pointer to the TSC bank data, or NULL if there is no TSC information
+	const uint32_t* GetTscPointer() const
+		{ return fTscOffset < 0 ? 0 : reinterpret_cast<const uint32_t*>(fData + fTscOffset); }
+
+	/// Returns the bank directory
+	const BankIndex& GetBankIndex() const { return fBanks; }
 
 	/// Returns trigger time in uSec
 	double TriggerTime() const { return fTriggerTime; }
@@ -102,6 +361,9 @@ public:
 	/// Returns the trigger time in clock cycles
 	uint64_t ClockTime() const { return fClock; }
 
+	/// Returns the coincidence window in uSec
+	double CoincWindow() const { return fCoincWindow; }
+
 	/// Copy fifo values to an external vector array
 	void CopyFifo(std::vector<uint64_t>* pfifo) const;
 
@@ -132,50 +394,18 @@ public:
 	virtual ~Event() { }
 
 	/// Bank finding routine (templated)
+	/*! \see EventView::GetBankPointer(); the temporary view borrows fBanks */
 	template <typename T>
 	T* GetBankPointer(const Bank_t name, int* length, bool reportMissing = false, bool checkType = false) const
-		{
-			/*!
-			 * \param [in] name Name of the bank to search for
-			 * \param [out] Length of the returned bank
-			 * \param [in] reportMissing True means a warning message is printed if the bank is absent
-			 * \param [in] checkType Specifies whether or not to check that the template parameter
-			 *  matches the TID of the bank. If this parameter is set to true and the types do
-			 *  not match, the error is fatal.
-			 * \returns Pointer to the beginning of the bank
-			 */
-			void *pbk;
-			int type;
-			int bkfound = FindBank(name, length, &type, &pbk);
-
-			if(!bkfound && reportMissing) {
-				dragon::utils::Warning("midas::Event::GetBankPointer<T>", __FILE__, __LINE__)
-					<< "Couldn't find the MIDAS bank \"" << name  << "\". Skipping...\n";
-			}
-			if (bkfound && checkType) {
-				switch (type) {
-				case 1:  assert (typeid(T) == typeid(unsigned char)); break; // TID_BYTE   1	
-				case 2:  assert (typeid(T) == typeid(char));          break; // TID_SBYTE  2	
-				case 3:  assert (typeid(T) == typeid(unsigned char)); break; // TID_CHAR   3	
-				case 4:  assert (typeid(T) == typeid(uint16_t));      break; // TID_WORD   4	
-				case 5:  assert (typeid(T) == typeid(int16_t));       break; // TID_SHORT  5	
-				case 6:  assert (typeid(T) == typeid(uint32_t));      break; // TID_DWORD  6	
-				case 7:  assert (typeid(T) == typeid(int32_t));       break; // TID_INT    7	
-				case 8:  assert (typeid(T) == typeid(bool));          break; // TID_BOOL   8	
-				case 9:  assert (typeid(T) == typeid(float));         break; // TID_FLOAT  9	
-				case 10: assert (typeid(T) == typeid(double));        break; // TID_DOUBLE 10
-				default:
-					fprintf(stderr, "Unknown type id: %i\n", type);
-					assert(false); break;
-				}
-			}
-			return bkfound ? reinterpret_cast<T*>(pbk) : 0;
-		}
+		{ return EventView(*this).GetBankPointer<T>(name, length, reportMissing, checkType); }
 
 private:
 	/// Helper function for copy constructor / assignment operator
 	void CopyDerived(const Event& other);
 
+	/// Index the banks in fData
+	void BuildBankIndex();
+
 	/// Helper function for constructors
 	void Init(const char* tsbank, const void* header, const void* addr, int size);
 
@@ -235,7 +465,58 @@ private:
 	CoincEvent operator= (const CoincEvent) { return *this; }
 };
 
+/// Event ids mapped to the name of their TSC bank, see tsc_trigger_time()
+typedef std::map<uint16_t, std::string> TscBankMap;
+
+/// Reads the trigger time of an event from its TSC bank, for TMidasFile::SetTriggerTimeFunc()
+double tsc_trigger_time(const void* header, const void* data, void* banks);
+
 } // namespace midas
 
 
+inline midas::EventView::EventView(const Event& event):
+	fHeader(event.GetHeaderPointer()),
+	fData(event.GetDataPointer()),
+	fTsc(event.GetTscPointer()),
+	fCoincWindow(event.CoincWindow()),
+	fClock(event.ClockTime()),
+	fTriggerTime(event.TriggerTime()),
+	fBanks(&event.GetBankIndex())
+{
+	/// Points to the header, data buffers and bank directory owned by \e event;
+	/// no copying is done, so this is cheap enough to do for every bank lookup.
+	;
+}
+
+inline midas::EventView::EventView(const EventView& other)
+{
+	/// Copies the bank directory only if \e other owns it
+	Copy(other);
+}
+
+inline midas::EventView& midas::EventView::operator= (const EventView& other)
+{
+	/// Copies the bank directory only if \e other owns it
+	if (&other != this) Copy(other);
+	return *this;
+}
+
+inline void midas::EventView::Copy(const EventView& other)
+{
+	fHeader      = other.fHeader;
+	fData        = other.fData;
+	fTsc         = other.fTsc;
+	fCoincWindow = other.fCoincWindow;
+	fClock       = other.fClock;
+	fTriggerTime = other.fTriggerTime;
+	if (other.fBanks == &other.fOwnBanks) {
+		fOwnBanks = other.fOwnBanks;
+		fBanks = &fOwnBanks;
+	}
+	else {
+		fBanks = other.fBanks;
+	}
+}
+
+
 #endif // #ifndef DRAGON_MIDAS_EVENT_HXX
@@ -9,7 +9,9 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <map>
 #include <iostream>
+#include <cctype>
 #include "Xml.hxx"
 
 #ifdef USE_ROOT
@@ -17,8 +19,514 @@
 #include <TString.h>
 #endif
 
+
+namespace midas {
+
+/// Binary snapshot of an ODB tree
+/*!
+ * Layout of a snapshot buffer (native byte order):
+ *  - Header
+ *  - Node records, depth first (each node is followed by its children)
+ *  - Attribute records, in node order
+ *  - String pool: null terminated strings, each one stored only once
+ *
+ * Records refer to strings by their offset in the pool. An XmlSnapshot is a read-only
+ * view of a snapshot buffer, Write() creates a buffer from an mxml tree.
+ */
+class XmlSnapshot {
+public:
+	/// Snapshot header
+	struct Header {
+		uint32_t fMagic;         ///< kMagic
+		uint32_t fVersion;       ///< kVersion
+		uint32_t fNumNodes;      ///< Number of node records
+		uint32_t fNumAttributes; ///< Number of attribute records
+		uint32_t fPoolSize;      ///< Size of the string pool in bytes
+	};
+	/// Node record
+	struct NodeRecord {
+		uint32_t fName;          ///< Element name
+		uint32_t fValue;         ///< Element value, kNoValue if none
+		uint32_t fNumAttributes; ///< Number of attributes
+		uint32_t fNumChildren;   ///< Number of direct children
+	};
+	/// Attribute record
+	struct AttributeRecord {
+		uint32_t fName;          ///< Attribute name
+		uint32_t fValue;         ///< Attribute value
+	};
+	/// Identifies a snapshot ("ODBS")
+	static const uint32_t kMagic = 0x5342444f;
+	/// Format version
+	static const uint32_t kVersion = 1;
+	/// Value of NodeRecord::fValue for nodes without a value
+	static const uint32_t kNoValue = 0xffffffff;
+
+	/// Tree node, the record number
+	typedef uint32_t Node_t;
+
+public:
+	/// Check if \e buf starts with a snapshot header
+	static bool IsSnapshot(const char* buf, size_t length);
+	/// Write a snapshot of the tree starting at \e root
+	static void Write(Xml::Node root, std::vector<char>& out);
+
+public:
+	/// Set up a view of the snapshot in \e buf, which must stay valid
+	XmlSnapshot(const char* buf, size_t length);
+	/// Returns false if the buffer is not a valid snapshot
+	bool IsValid() const { return fValid; }
+	/// Write the tree as XML text, formatted by mxml
+	void WriteXml(std::string& out) const;
+
+	/// Tree access (same interface as MxmlTree)
+	Node_t Root() const { return 0; }
+	Node_t FirstChild(Node_t node) const { return node + 1; }
+	Node_t NextSibling(Node_t node) const { return fEnd[node]; }
+	Node_t EndChildren(Node_t node) const { return fEnd[node]; }
+	const char* Name(Node_t node) const { return fPool + fNodes[node].fName; }
+	const char* Value(Node_t node) const;
+	const char* Attribute(Node_t node, const char* name) const;
+	Xml::Node GetNode(Node_t) const { return 0; }
+
+private:
+	/// Check the subtree starting at \e node and fill fFirstAttribute, fEnd
+	Node_t Scan(Node_t node, uint32_t& attribute);
+	/// Check that \e offset points into the string pool
+	bool CheckString(uint32_t offset) { return offset < fPoolSize || offset == kNoValue; }
+	/// Write the subtree starting at \e node
+	void WriteXml(MXML_WRITER* writer, Node_t node, bool indent) const;
+
+private:
+	/// Node records
+	const NodeRecord* fNodes;
+	/// Attribute records
+	const AttributeRecord* fAttributes;
+	/// String pool
+	const char* fPool;
+	/// Number of node records
+	uint32_t fNumNodes;
+	/// Number of attribute records
+	uint32_t fNumAttributes;
+	/// Size of the string pool
+	uint32_t fPoolSize;
+	/// First attribute record of each node
+	std::vector<uint32_t> fFirstAttribute;
+	/// One past the last node of each subtree
+	std::vector<Node_t> fEnd;
+	/// Validity flag
+	bool fValid;
+};
+
+/// Tree access to an mxml tree (same interface as XmlSnapshot)
+struct MxmlTree {
+	typedef Xml::Node Node_t;
+	Node_t FirstChild(Node_t node) const { return node->child; }
+	Node_t NextSibling(Node_t node) const { return node + 1; }
+	Node_t EndChildren(Node_t node) const { return node->child + node->n_children; }
+	const char* Name(Node_t node) const { return node->name; }
+	const char* Value(Node_t node) const { return node->value; }
+	const char* Attribute(Node_t node, const char* name) const { return mxml_get_attribute(node, name); }
+	Xml::Node GetNode(Node_t node) const { return node; }
+};
+
+/// Flat index of the keys in an ODB XML tree
+/*!
+ * Built once, when the XML is parsed: every key and keyarray is stored under its full
+ * path (without leading '/', e.g. "dragon/bgo/variables/adc/slope") in an open addressing
+ * hash table, with the text of all of its values decoded up front. Lookups are then a
+ * single hash of the path, with no XPath formatting or tree walks.
+ *
+ * Can be built from either an mxml tree or an XmlSnapshot.
+ */
+class XmlIndex {
+public:
+	/// Index entry for one key or keyarray
+	struct Key {
+		/// Full path of the key
+		std::string fPath;
+		/// Key node in the XML tree, NULL if built from a snapshot
+		Xml::Node fNode;
+		/// True for keyarray nodes
+		bool fIsArray;
+		/// Number of elements, -1 if a keyarray has no "num_values" attribute
+		int fNumValues;
+		/// Position of the first element in fElements
+		size_t fFirst;
+	};
+
+public:
+	/// Index all keys below \e root of \e tree
+	template <class Tree> XmlIndex(const Tree& tree, typename Tree::Node_t root);
+	/// Find the entry for \e path, NULL if not present
+	const Key* Find(const char* path) const;
+	/// Returns a pointer to the elements of \e key
+	const Xml::Element* GetElements(const Key& key) const { return &fElements[key.fFirst]; }
+	/// Returns the number of indexed keys
+	size_t GetNumKeys() const { return fKeys.size(); }
+	/// Checksum of the keys below \e dir
+	uint64_t Checksum(const char* dir) const;
+
+private:
+	/// Recursively add the keys below \e dir, whose path is \e path
+	template <class Tree>
+	void AddDirectory(const Tree& tree, typename Tree::Node_t dir, std::string& path);
+	/// Add a key or keyarray node
+	template <class Tree>
+	void AddKey(const Tree& tree, typename Tree::Node_t node, const std::string& path, bool isArray);
+	/// Add the value of a node to fElements
+	void AddElement(const char* text);
+	/// Fill fTable from fKeys
+	void BuildTable();
+	/// FNV-1a hash of a path
+	static uint32_t Hash(const char* path);
+
+private:
+	/// All keys, in file order
+	std::vector<Key> fKeys;
+	/// Decoded values of all keys
+	std::vector<Xml::Element> fElements;
+	/// Hash table, each slot is an index into fKeys plus one (zero for empty slots)
+	std::vector<uint32_t> fTable;
+};
+
+}
+
+
+// ============ class midas::XmlSnapshot ================ //
+
+namespace {
+
+/// Collects the records and string pool of a snapshot
+struct SnapshotWriter {
+	std::vector<midas::XmlSnapshot::NodeRecord> fNodes;
+	std::vector<midas::XmlSnapshot::AttributeRecord> fAttributes;
+	std::string fPool;
+	std::map<std::string, uint32_t> fOffsets;
+
+	uint32_t AddString(const char* str)
+		{
+			std::pair<std::map<std::string, uint32_t>::iterator, bool> it =
+				fOffsets.insert(std::make_pair(std::string(str), (uint32_t)fPool.size()));
+			if(it.second) fPool.append(str, strlen(str) + 1);
+			return it.first->second;
+		}
+
+	void AddNode(midas::Xml::Node node)
+		{
+			midas::XmlSnapshot::NodeRecord record;
+			record.fName = AddString(node->name);
+			record.fValue = node->value ? AddString(node->value) : midas::XmlSnapshot::kNoValue;
+			record.fNumAttributes = node->n_attributes;
+			record.fNumChildren = node->n_children;
+			fNodes.push_back(record);
+
+			for(int i=0; i< node->n_attributes; ++i) {
+				midas::XmlSnapshot::AttributeRecord attribute;
+				attribute.fName = AddString(node->attribute_name + i*MXML_NAME_LENGTH);
+				attribute.fValue = AddString(node->attribute_value[i]);
+				fAttributes.push_back(attribute);
+			}
+			for(int i=0; i< node->n_children; ++i)
+				AddNode(node->child + i);
+		}
+};
+
+template <class T> void append_records(std::vector<char>& out, const std::vector<T>& records)
+{
+	if(!records.empty())
+		out.insert(out.end(), (const char*)&records[0], (const char*)&records[0] + records.size()*sizeof(T));
+}
+
+}
+
+bool midas::XmlSnapshot::IsSnapshot(const char* buf, size_t length)
+{
+	uint32_t magic;
+	if(length < sizeof(Header)) return false;
+	memcpy(&magic, buf, sizeof(magic));
+	return magic == kMagic;
+}
+
+void midas::XmlSnapshot::Write(Xml::Node root, std::vector<char>& out)
+{
+	SnapshotWriter writer;
+	writer.AddNode(root);
+
+	Header header;
+	header.fMagic = kMagic;
+	header.fVersion = kVersion;
+	header.fNumNodes = writer.fNodes.size();
+	header.fNumAttributes = writer.fAttributes.size();
+	header.fPoolSize = writer.fPool.size();
+
+	out.clear();
+	out.reserve(sizeof(header) + header.fNumNodes*sizeof(NodeRecord) +
+							header.fNumAttributes*sizeof(AttributeRecord) + header.fPoolSize);
+	out.insert(out.end(), (const char*)&header, (const char*)&header + sizeof(header));
+	append_records(out, writer.fNodes);
+	append_records(out, writer.fAttributes);
+	out.insert(out.end(), writer.fPool.begin(), writer.fPool.end());
+}
+
+midas::XmlSnapshot::XmlSnapshot(const char* buf, size_t length):
+	fNodes(0), fAttributes(0), fPool(0), fNumNodes(0), fNumAttributes(0), fPoolSize(0), fValid(false)
+{
+	/// The buffer needs to be aligned for 32-bit access (true for buffers from new[]).
+	if(!IsSnapshot(buf, length)) return;
+	Header header;
+	memcpy(&header, buf, sizeof(header));
+	if(header.fVersion != kVersion || header.fNumNodes == 0) return;
+
+	const uint64_t size = sizeof(header) + (uint64_t)header.fNumNodes*sizeof(NodeRecord) +
+		(uint64_t)header.fNumAttributes*sizeof(AttributeRecord) + header.fPoolSize;
+	if(size > length) return;
+
+	fNumNodes = header.fNumNodes;
+	fNumAttributes = header.fNumAttributes;
+	fPoolSize = header.fPoolSize;
+	fNodes = reinterpret_cast<const NodeRecord*>(buf + sizeof(header));
+	fAttributes = reinterpret_cast<const AttributeRecord*>(fNodes + fNumNodes);
+	fPool = reinterpret_cast<const char*>(fAttributes + fNumAttributes);
+	if(fPoolSize == 0 || fPool[fPoolSize - 1] != 0) return;
+
+	fFirstAttribute.resize(fNumNodes);
+	fEnd.resize(fNumNodes);
+	uint32_t attribute = 0;
+	fValid = true;
+	fValid = Scan(Root(), attribute) == fNumNodes && attribute == fNumAttributes;
+}
+
+midas::XmlSnapshot::Node_t midas::XmlSnapshot::Scan(Node_t node, uint32_t& attribute)
+{
+	/// \returns One past the last node of the subtree, fNumNodes + 1 on error
+	const Node_t bad = fNumNodes + 1;
+	if(node >= fNumNodes) return bad;
+
+	const NodeRecord& record = fNodes[node];
+	if(!CheckString(record.fName) || record.fName == kNoValue || !CheckString(record.fValue)) return bad;
+	if(record.fNumAttributes > fNumAttributes - attribute) return bad;
+	fFirstAttribute[node] = attribute;
+	for(uint32_t i=0; i< record.fNumAttributes; ++i, ++attribute) {
+		if(fAttributes[attribute].fName >= fPoolSize || fAttributes[attribute].fValue >= fPoolSize) return bad;
+	}
+
+	Node_t child = node + 1;
+	for(uint32_t i=0; i< record.fNumChildren; ++i) {
+		child = Scan(child, attribute);
+		if(child == bad) return bad;
+	}
+	fEnd[node] = child;
+	return child;
+}
+
+const char* midas::XmlSnapshot::Value(Node_t node) const
+{
+	const uint32_t value = fNodes[node].fValue;
+	return value == kNoValue ? 0 : fPool + value;
+}
+
+const char* midas::XmlSnapshot::Attribute(Node_t node, const char* name) const
+{
+	const AttributeRecord* attribute = fAttributes + fFirstAttribute[node];
+	for(uint32_t i=0; i< fNodes[node].fNumAttributes; ++i, ++attribute) {
+		if(!strcmp(fPool + attribute->fName, name))
+			return fPool + attribute->fValue;
+	}
+	return 0;
+}
+
+void midas::XmlSnapshot::WriteXml(std::string& out) const
+{
+	/// Same output as mxml_write_tree(), starting at the root element (no XML declaration).
+	/// \note The mxml writer uses static buffers, so this is not thread safe.
+	out.clear();
+	if(!fValid) return;
+
+	MXML_WRITER* writer = mxml_open_buffer();
+	WriteXml(writer, Root(), true);
+	char* buf = mxml_close_buffer(writer);
+
+	const std::string start = std::string("<") + Name(Root());
+	const char* pstart = strstr(buf, start.c_str());
+	if(pstart) out.assign(pstart);
+	if(!out.empty() && out[out.size() - 1] == '\n') // mxml ends with a newline, fBuffer doesn't
+		out.resize(out.size() - 1);
+	free(buf);
+}
+
+void midas::XmlSnapshot::WriteXml(MXML_WRITER* writer, Node_t node, bool indent) const
+{
+	/// Follows mxml_write_subtree()
+	if(indent) mxml_start_element(writer, Name(node));
+	else       mxml_start_element_noindent(writer, Name(node));
+
+	const AttributeRecord* attribute = fAttributes + fFirstAttribute[node];
+	for(uint32_t i=0; i< fNodes[node].fNumAttributes; ++i, ++attribute)
+		mxml_write_attribute(writer, fPool + attribute->fName, fPool + attribute->fValue);
+
+	const char* value = Value(node);
+	if(value)
+		mxml_write_value(writer, value);
+
+	int i = 0;
+	for(Node_t child = FirstChild(node); child != EndChildren(node); child = NextSibling(child), ++i)
+		WriteXml(writer, child, value == 0 || i > 0);
+
+	mxml_end_element(writer);
+}
+
+
+// ============ class midas::XmlIndex ================ //
+
+template <class Tree>
+midas::XmlIndex::XmlIndex(const Tree& tree, typename Tree::Node_t root)
+{
+	std::string path;
+	AddDirectory(tree, root, path);
+	AddElement(0); // so GetElements() is valid for empty arrays at the end
+	BuildTable();
+}
+
+template <class Tree>
+void midas::XmlIndex::AddDirectory(const Tree& tree, typename Tree::Node_t dir, std::string& path)
+{
+	const size_t length = path.size();
+	for(typename Tree::Node_t child = tree.FirstChild(dir); child != tree.EndChildren(dir); child = tree.NextSibling(child)) {
+		const char* name = tree.Attribute(child, "name");
+		if(!name) continue;
+
+		path.append(name);
+		if(!strcmp(tree.Name(child), "dir")) {
+			path.append("/");
+			AddDirectory(tree, child, path);
+		}
+		else if(!strcmp(tree.Name(child), "key")) {
+			AddKey(tree, child, path, false);
+		}
+		else if(!strcmp(tree.Name(child), "keyarray")) {
+			AddKey(tree, child, path, true);
+		}
+		path.resize(length);
+	}
+}
+
+template <class Tree>
+void midas::XmlIndex::AddKey(const Tree& tree, typename Tree::Node_t node, const std::string& path, bool isArray)
+{
+	Key key;
+	key.fPath = path;
+	key.fNode = tree.GetNode(node);
+	key.fIsArray = isArray;
+	key.fFirst = fElements.size();
+
+	if(!isArray) {
+		key.fNumValues = 1;
+		AddElement(tree.Value(node));
+	}
+	else {
+		const char* pAttribute = tree.Attribute(node, "num_values");
+		key.fNumValues = pAttribute ? atoi(pAttribute) : -1;
+
+		int nvalues = 0;
+		for(typename Tree::Node_t child = tree.FirstChild(node);
+				child != tree.EndChildren(node) && nvalues < key.fNumValues; child = tree.NextSibling(child)) {
+			if(!strcmp(tree.Name(child), "value")) {
+				AddElement(tree.Value(child));
+				++nvalues;
+			}
+		}
+		for(; nvalues < key.fNumValues; ++nvalues)
+			AddElement(0);
+	}
+
+	fKeys.push_back(key);
+}
+
+void midas::XmlIndex::AddElement(const char* text)
+{
+	Xml::Element element = { text, 0, 0, 0. };
+	if(text) {
+		const char* p = text;
+		while(isspace(*p)) ++p;
+		if(*p == '-') {
+			element.fInteger = strtoll(p, 0, 10);
+		}
+		else {
+			element.fUnsigned = strtoull(p, 0, 10);
+			element.fInteger = element.fUnsigned > (uint64_t)std::numeric_limits<int64_t>::max() ?
+				std::numeric_limits<int64_t>::max() : (int64_t)element.fUnsigned;
+		}
+		element.fReal = strtod(p, 0);
+	}
+	fElements.push_back(element);
+}
+
+uint32_t midas::XmlIndex::Hash(const char* path)
+{
+	uint32_t h = 2166136261u;
+	for(; *path; ++path) {
+		h ^= (unsigned char)*path;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+void midas::XmlIndex::BuildTable()
+{
+	size_t size = 16;
+	while(size < 2*fKeys.size()) size <<= 1;
+	fTable.assign(size, 0);
+
+	for(size_t i=0; i< fKeys.size(); ++i) {
+		size_t slot = Hash(fKeys[i].fPath.c_str()) & (size - 1);
+		while(fTable[slot]) slot = (slot + 1) & (size - 1);
+		fTable[slot] = i + 1;
+	}
+}
+
+uint64_t midas::XmlIndex::Checksum(const char* dir) const
+{
+	/// FNV-1a over the paths and value texts of all keys in \e dir (or its subdirectories)
+	if(dir[0] == '/') ++dir;
+	const size_t length = strlen(dir) - (dir[0] && dir[strlen(dir) - 1] == '/');
+	uint64_t h = 14695981039346656037ULL;
+	for(size_t i=0; i< fKeys.size(); ++i) {
+		const Key& key = fKeys[i];
+		if(key.fPath.compare(0, length, dir, length) != 0) continue;
+		if(length && key.fPath.size() > length && key.fPath[length] != '/') continue;
+
+		for(size_t j=0; j<= key.fPath.size(); ++j) {
+			h ^= (unsigned char)key.fPath.c_str()[j];
+			h *= 1099511628211ULL;
+		}
+		const Xml::Element* element = GetElements(key);
+		for(int j=0; j< key.fNumValues; ++j, ++element) {
+			for(const char* c = element->fText ? element->fText : ""; ; ++c) {
+				h ^= (unsigned char)*c;
+				h *= 1099511628211ULL;
+				if(!*c) break;
+			}
+		}
+	}
+	return h;
+}
+
+const midas::XmlIndex::Key* midas::XmlIndex::Find(const char* path) const
+{
+	if(path[0] == '/') ++path;
+	const size_t mask = fTable.size() - 1;
+	for(size_t slot = Hash(path) & mask; fTable[slot]; slot = (slot + 1) & mask) {
+		const Key& key = fKeys[fTable[slot] - 1];
+		if(key.fPath == path) return &key;
+	}
+	return 0;
+}
+
+
 midas::Xml::Xml(const char* filename):
-	fTree(0), fOdb(0), fIsZombie(false), fLength(0), fBuffer(0)
+	fTree(0), fOdb(0), fIndex(0), fIsZombie(false), fLength(0), fBuffer(0),
+	fSnapshotLength(0), fSnapshot(0)
 {
 #ifdef USE_ROOT
 	TString fnameExp (filename);
@@ -44,11 +552,25 @@ midas::Xml::Xml(const char* filename):
 		fIsZombie = true;
 		return;
 	}
+	BuildIndex();
 }
 
 midas::Xml::Xml(char* buf, int length):
-	fTree(0), fOdb(0), fIsZombie(false), fLength(0), fBuffer(0)
+	fTree(0), fOdb(0), fIndex(0), fIsZombie(false), fLength(0), fBuffer(0),
+	fSnapshotLength(0), fSnapshot(0)
 {
+	if(XmlSnapshot::IsSnapshot(buf, length)) {
+		fSnapshotLength = length;
+		fSnapshot = new char[fSnapshotLength];
+		memcpy(fSnapshot, buf, length);
+		if(!LoadSnapshot()) {
+			dragon::utils::Error("midas::Xml::Xml")
+				<< "Bad ODB snapshot buffer.";
+			fIsZombie = true;
+		}
+		return;
+	}
+
 	char err[256]; int err_line;
 	fTree = ParseBuffer(buf, length, err, sizeof(err), &err_line);
 	if(!fTree) {
@@ -65,10 +587,12 @@ midas::Xml::Xml(char* buf, int length):
 		fIsZombie = true;
 		return;
 	}
+	BuildIndex();
 }
 
 midas::Xml::Xml():
-	fTree(0), fOdb(0), fIsZombie(false), fLength(0), fBuffer(0)
+	fTree(0), fOdb(0), fIndex(0), fIsZombie(false), fLength(0), fBuffer(0),
+	fSnapshotLength(0), fSnapshot(0)
 {
 	;
 }
@@ -91,20 +615,29 @@ void midas::Xml::InitFromStreamer()
 			fIsZombie = true;
 			return;
 		}
+		BuildIndex();
+	}
+	else if (fSnapshot && !fIndex) { // Snapshot from ROOT I/O
+		if(!LoadSnapshot()) {
+			dragon::utils::Error("midas::Xml::InitFromStreamer")
+				<< "Bad ODB snapshot buffer.";
+			fIsZombie = true;
+		}
 	}
 }
 
 midas::Xml::~Xml()
 {
+	delete fIndex;
 	if(fTree) mxml_free_tree(fTree);
 	if(fBuffer) delete fBuffer;
+	delete[] fSnapshot;
 }
 
 
 midas::Xml::Node midas::Xml::ParseFile(const char* file_name, char *error, int error_size, int *error_line)
 {
 	char line[1000];
-	int length = 0;
 	PMXML_NODE root;
 	FILE* f;
 
@@ -120,61 +653,49 @@ midas::Xml::Node midas::Xml::ParseFile(const char* file_name, char *error, int e
 		return NULL;
 	}
 
-	fpos_t startPos;
-	int start_found(0);
-	while(1) {
-		if(!start_found) {
-			char str[256];
-			size_t nRead = fread(str, 1, strlen("<odb"), f);
-			fseek(f, -1*(strlen("<odb")-1), SEEK_CUR);
-			if(nRead != strlen("<odb")) {
-				sprintf(error, "Could not find \"<odb\"");
-				*error_line = __LINE__;
-				fclose(f);
-				return NULL;
-			}
-			if(!memcmp(str, "<odb", strlen("<odb"))) {
-				fseek(f, -1, SEEK_CUR);
-				fgetpos(f, &startPos);
-				start_found = 1;
-			}
+	/* read the file in blocks until the <odb ... </odb> section is in memory;
+		 nothing before "<odb" is kept, so only the ODB part of a .mid file is stored */
+	const std::string odbBegin("<odb"), odbEnd("</odb>");
+	std::string odb;
+	std::string::size_type endPos = std::string::npos, searchPos = 0;
+	bool start_found = false;
+	std::vector<char> block(65536);
+	while(endPos == std::string::npos) {
+		size_t nRead = fread(&block[0], 1, block.size(), f);
+		if(nRead == 0) {
+			sprintf(error, start_found ? "Could not find \"</odb>\"" : "Could not find \"<odb\"");
+			*error_line = __LINE__;
+			fclose(f);
+			return NULL;
 		}
-		else {
-			char str[256];
-			size_t nRead = fread(str, 1, strlen("</odb>"), f);
-			fseek(f, -1*(strlen("</odb>")-1), SEEK_CUR);
-			length++;
-			if(nRead != strlen("</odb>")) {
-				sprintf(error, "Could not find \"</odb>\"");
-				*error_line = __LINE__;
-				fclose(f);
-				return NULL;
-			}
-			if(!memcmp(str, "</odb>", strlen("</odb>"))) {
-				break;
+		odb.append(&block[0], nRead);
+		if(!start_found) {
+			std::string::size_type startPos = odb.find(odbBegin);
+			if(startPos == std::string::npos) { // keep a possible partial match
+				odb.erase(0, odb.size() > odbBegin.size() ? odb.size() - odbBegin.size() + 1 : 0);
+				continue;
 			}
+			odb.erase(0, startPos);
+			start_found = true;
 		}
+		endPos = odb.find(odbEnd, searchPos);
+		searchPos = odb.size() > odbEnd.size() ? odb.size() - odbEnd.size() + 1 : 0;
 	}
+	fclose(f);
 
-	length += strlen("</odb>");
-	fsetpos(f, &startPos);
-
+	size_t length = endPos + odbEnd.size();
 	fLength = length + 1; // buffer size
 	try {
 		fBuffer = new char[fLength];
 	} catch (std::bad_alloc& e) {
-		delete[] fBuffer;
-		fclose(f);
 		sprintf(line, "Cannot allocate buffer: ");
 		strlcat(line, strerror(errno), sizeof(line));
 		strlcpy(error, line, error_size);
 		return NULL;
 	}
 
-  /* read odb portion of the file */
-	length = (int)fread(fBuffer, 1, length, f);
+	memcpy(fBuffer, odb.data(), length);
 	fBuffer[length] = 0;
-	fclose(f);
 
 	// The following lines leak memory and I am not sure why they were ever there!!
 	// if (mxml_parse_entity(&fBuffer, file_name, error, error_size, error_line) != 0) {
@@ -191,15 +712,23 @@ midas::Xml::Node midas::Xml::ParseFile(const char* file_name, char *error, int e
 void midas::Xml::Dump(std::ostream& strm) const
 {
 	strm << "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n"
-			 << "<!-- created by midas::Xml::Dump -->\n"
-			 << fBuffer;
+			 << "<!-- created by midas::Xml::Dump -->\n";
+	if(fBuffer) {
+		strm << fBuffer;
+	}
+	else if(fSnapshot) {
+		std::string xml;
+		XmlSnapshot(fSnapshot, fSnapshotLength).WriteXml(xml);
+		strm << xml;
+	}
 }
 
 midas::Xml::Node midas::Xml::ParseBuffer(char* buf, int length, char *error, int error_size, int *error_line)
 {
-	fLength = length;
+	fLength = length + 1; // mxml needs a null terminated buffer
 	fBuffer = new char[fLength];
 	memcpy(fBuffer, buf, length);
+	fBuffer[length] = 0;
 
 	PMXML_NODE root;
 
@@ -207,12 +736,12 @@ midas::Xml::Node midas::Xml::ParseBuffer(char* buf, int length, char *error, int
 		 error[0] = 0;
 
 	int startPos = 0, lodb = (int)strlen("<odb");
-	while(startPos < length + lodb) {
+	while(startPos + lodb <= length) {
 		if(!memcmp(&fBuffer[startPos], "<odb", strlen("<odb")))
 			break;
 		++startPos;
 	}
-	if(startPos == length + lodb) {
+	if(startPos + lodb > length) {
 		sprintf(error, "Could not find \"<odb\"");
 		*error_line = __LINE__;
 		return NULL;
@@ -232,58 +761,143 @@ midas::Xml::Node midas::Xml::ParseBuffer(char* buf, int length, char *error, int
 
 bool midas::Xml::Check()
 {
-	if(fTree && fOdb) return true; // okay
+	if(fIndex) return true; // okay
 	InitFromStreamer(); // try to initialize from streamer
-	if(fTree && fOdb) return true; // okay now
+	if(fIndex) return true; // okay now
 	dragon::utils::Warning("midas::Xml::Check")
 		<< "midas::Xml object was initialized with a bad XML file, "
 		<<"cannot perform any further operations.";
 	return false; // not okay
 }
 
-namespace {
-inline std::vector<std::string> path_tokenize(const char* path) {
-	std::string strPath(path);
-	std::vector<std::string> nodes;
-	long posn (0);
-	while(strPath.find("/") < strPath.size()) {
-		posn = strPath.find("/");
-		nodes.push_back(strPath.substr(0, posn));
-		strPath = strPath.substr(posn+1);
+void midas::Xml::BuildIndex()
+{
+	delete fIndex;
+	fIndex = new XmlIndex(MxmlTree(), fOdb);
+}
+
+bool midas::Xml::LoadSnapshot()
+{
+	XmlSnapshot snapshot(fSnapshot, fSnapshotLength);
+	if(!snapshot.IsValid()) return false;
+	delete fIndex;
+	fIndex = new XmlIndex(snapshot, snapshot.Root());
+	return true;
+}
+
+bool midas::Xml::MakeSnapshot()
+{
+	/// Replaces the XML text (fBuffer) by a binary snapshot of the ODB tree (fSnapshot),
+	/// which is what gets written by ROOT I/O from then on. The snapshot is about half
+	/// the size of the text, and reading it back does not involve any XML parsing:
+	/// keys are indexed straight from the snapshot buffer. The full tree is only rebuilt
+	/// (from XML text generated out of the snapshot) if FindKey() or FindKeyArray() is called.
+	/// Dump() writes the same XML as before.
+	/// \returns true if successful (or if already a snapshot), false otherwise
+	if(fSnapshot) return true;
+	if(!Check() || !fOdb) return false;
+
+	std::vector<char> snapshot;
+	XmlSnapshot::Write(fOdb, snapshot);
+	fSnapshotLength = snapshot.size();
+	fSnapshot = new char[fSnapshotLength];
+	memcpy(fSnapshot, &snapshot[0], fSnapshotLength);
+
+	delete[] fBuffer;
+	fBuffer = 0;
+	fLength = 0;
+	return true;
+}
+
+bool midas::Xml::MaterializeTree()
+{
+	if(fTree) return true;
+	if(!fSnapshot) return false;
+
+	std::string xml;
+	XmlSnapshot(fSnapshot, fSnapshotLength).WriteXml(xml);
+
+	char err[256]; int err_line;
+	fTree = ParseBuffer(&xml[0], xml.size(), err, sizeof(err), &err_line);
+	delete[] fBuffer; // keep only the snapshot for ROOT I/O
+	fBuffer = 0;
+	fLength = 0;
+	if(!fTree) {
+		dragon::utils::Error("midas::Xml::MaterializeTree")
+			<< "Bad XML from snapshot, error message: " << err << ", error line: " << err_line;
+		return false;
+	}
+	fOdb = mxml_find_node(fTree, "/odb");
+	if(!fOdb) {
+		dragon::utils::Error("midas::Xml::MaterializeTree")
+			<< "no odb tag found in snapshot.";
+		return false;
 	}
-	nodes.push_back(strPath);
-	return nodes;
-}
-std::string get_xml_path(const char* path, const char* node_type) {
-	const char* pPath = path[0] == '/' ? &path[1] : &path[0];
-	std::vector<std::string> nodes = path_tokenize(pPath);
-	std::stringstream xmlPath;
-	for(std::vector<std::string>::iterator it = nodes.begin(); it != nodes.end(); ++it) {
-		if(it != nodes.end() - 1) xmlPath << "/dir[@name=" << *it << "]";
-		else xmlPath << "/" << node_type << "[@name=" << *it << "]";
+	BuildIndex();
+	return true;
+}
+
+uint64_t midas::Xml::Checksum(const char* dir)
+{
+	/// \returns A checksum of the names and values of all keys below \e dir, which changes
+	///  if any of them changes; 0 if the tree is invalid
+	if(!Check()) return 0;
+	return fIndex->Checksum(dir);
+}
+
+bool midas::Xml::HasKey(const char* path)
+{
+	/// \returns true if \e path is a key or key array, without printing any errors
+	if(!Check()) return false;
+	return fIndex->Find(path) != 0;
+}
+
+const midas::Xml::Element* midas::Xml::FindElements(const char* path, bool array, int* length, bool silent)
+{
+	if(!Check()) return 0;
+	const XmlIndex::Key* key = fIndex->Find(path);
+	if(!key || key->fIsArray != array) {
+		if(!silent) {
+			dragon::utils::Error("midas::Xml::FindKey")
+				<< "Error: XML path: " << path << " was not found.";
+		}
+		return 0;
+	}
+	if(key->fNumValues < 0) {
+		dragon::utils::Error("midas::Xml::GetArray", __FILE__, __LINE__)
+			<< "\"num_values\" attribute not found for array: " << path;
+		return 0;
 	}
-	return xmlPath.str();
-} }
+	if(length) *length = key->fNumValues;
+	return fIndex->GetElements(*key);
+}
 
 midas::Xml::Node midas::Xml::FindKey(const char* path, bool silent)
 {
 	if(!Check()) return 0;
-	Node out = mxml_find_node(fOdb, get_xml_path(path, "key").c_str());
-	if(!out && !silent) {
-		dragon::utils::Error("midas::Xml::FindKey")
-			<< "Error: XML path: " << path << " was not found.";
+	if(!fTree && !MaterializeTree()) return 0;
+	const XmlIndex::Key* key = fIndex->Find(path);
+	if(!key || key->fIsArray) {
+		if(!silent) {
+			dragon::utils::Error("midas::Xml::FindKey")
+				<< "Error: XML path: " << path << " was not found.";
+		}
+		return 0;
 	}
-	return out;
+	return key->fNode;
 }
 
 midas::Xml::Node midas::Xml::FindKeyArray(const char* path, bool silent)
 {
 	if(!Check()) return 0;
-	Node out = mxml_find_node(fOdb, get_xml_path(path, "keyarray").c_str());
-	if(!out && !silent) {
-		dragon::utils::Error("midas::Xml::FindKey")
-			<< "Error: XML path: " << path << " was not found.";
+	if(!fTree && !MaterializeTree()) return 0;
+	const XmlIndex::Key* key = fIndex->Find(path);
+	if(!key || !key->fIsArray) {
+		if(!silent) {
+			dragon::utils::Error("midas::Xml::FindKey")
+				<< "Error: XML path: " << path << " was not found.";
+		}
+		return 0;
 	}
-	return out;
+	return key->fNode;
 }
-
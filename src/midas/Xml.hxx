@@ -7,6 +7,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <vector>
+#include <limits>
 #include <sstream>
 #include <typeinfo>
 #ifndef __MAKECINT__
@@ -24,6 +25,8 @@
 
 namespace midas {
 
+class XmlIndex;
+
 /// Class to parse MIDAS ODB XML files.
 /*!
  * \attention If you want to be able to cleanly read from either the
@@ -41,17 +44,35 @@ public:
 	/// Pointer to an XML node.
 	typedef PMXML_NODE Node;
 
+	/// Value of a key (or of one element of a keyarray), decoded when the XML is parsed
+	struct Element {
+		/// Text of the value node, NULL if the node is missing
+		const char* fText;
+		/// fText decoded as a signed integer, saturated to the int64_t range
+		int64_t fInteger;
+		/// fText decoded as an unsigned integer (for non-negative values), saturated to the uint64_t range
+		uint64_t fUnsigned;
+		/// fText decoded as a floating point number
+		double fReal;
+	};
+
 public:// private:
 	/// Pointer to the entire XML tree contained within a file
 	Node fTree; //!
 	/// Pointer to the ODB portion of fTree
 	Node fOdb;  //!
+	/// Index of all keys in fOdb, by full path
+	XmlIndex* fIndex; //!
 	/// Flag specifying if the file was invalid
 	bool fIsZombie;
 	/// Length of fBuffer
 	uint32_t fLength;
 	/// Buffer containing all of the XML data
 	char* fBuffer; //[fLength]
+	/// Length of fSnapshot
+	uint32_t fSnapshotLength;
+	/// Binary snapshot of the ODB tree, replaces fBuffer after MakeSnapshot()
+	char* fSnapshot; //[fSnapshotLength]
 
 public:
 	/// \brief Default constructor for ROOTCINT
@@ -66,6 +87,7 @@ public:
 	Xml(const char* filename);
 
 	/// \brief Read data from a buffer w/ XML data
+	/// \details The buffer can also contain a binary snapshot, as stored by MakeSnapshot().
 	Xml(char* buf, int length);
 
 	/// Frees resources allocated to fTree
@@ -74,6 +96,23 @@ public:
 	/// Returns fIsZombie
 	bool IsZombie() { return fIsZombie; }
 
+	/// Returns true if the ODB is stored as a binary snapshot
+	bool IsSnapshot() const { return fSnapshot != 0; }
+
+	/// \brief Store the ODB as a binary snapshot instead of XML text
+	/// \details The snapshot holds the ODB tree as a table of nodes and attributes plus a pool
+	/// of (unique) strings. It is what gets written to ROOT files after calling this, and is
+	/// loaded without parsing any XML. The XML text is regenerated from it on demand (e.g. by Dump()),
+	/// with the same tree as the original.
+	/// \returns false if there is no valid ODB tree
+	bool MakeSnapshot();
+
+	/// Check if a key or keyarray exists
+	bool HasKey(const char* path);
+
+	/// Checksum of the keys in a directory
+	uint64_t Checksum(const char* dir);
+
 	/// Dump buffer to an output stream
 	void Dump(std::ostream& strm) const;
 	
@@ -118,12 +157,12 @@ public:
 			 *  Passing a NULL value to the function disables the error reporting
 			 */
 			if(success) *success = true;
-			Node node = FindKey(path);
-			if(!node) {
+			const Element* element = FindElements(path, false);
+			if(!element) {
 				if(success) *success = false;
 				return;
 			}
-			value = ConvertNode<T>(node);
+			value = ConvertElement<T>(*element);
 		}
 
 public:
@@ -155,41 +194,21 @@ public:
 			 *  Passing a NULL value to the function disables the error reporting
 			 */
 			if(success) *success = true;
-			Node node = FindKeyArray(path);
-			if(!node) {
+			int size = 0;
+			const Element* elements = FindElements(path, true, &size);
+			if(!elements) {
 				if(success) *success = false;
 				return;
 			}
 			array.clear();
-			char* pAttribute = mxml_get_attribute(node, "num_values");
-			if(!pAttribute) {
-				dragon::utils::Error("midas::Xml::GetArray", __FILE__, __LINE__)
-					<< "\"num_values\" attribute not found for array: " << path;
-				if(success) *success = false;
-				return;
-			}
-			int size = atoi(pAttribute);
+			array.reserve(size);
 			for(int i=0; i< size; ++i) {
-				std::stringstream valPath;
-				valPath << "/value[" << i+1 << "]";
-				Node valNode = mxml_find_node(node, valPath.str().c_str());
-				if(!valNode) {
+				if(!elements[i].fText) {
 					dragon::utils::Error("midas::Xml::GetArray", __FILE__, __LINE__)
 						<< "Unable to find value node for array index " << i;
 					continue;
 				}
-
-				T value;
-				if(typeid(T) != typeid(bool)) {
-					std::stringstream val;
-					val << valNode->value;
-					val >> value;
-				}
-				else {
-					value = (!strcmp("y", valNode->value)) ? true : false;
-				}
-				array.push_back(value);
-
+				array.push_back(ConvertArrayElement<T>(elements[i]));
 			}
 		}
 
@@ -201,15 +220,8 @@ public:
 			 * "Equipment/gTrigger/Variables/Pedestals"
 			 * \returns Length of the array if valid, -1 if error.
 			 */
-			Node node = FindKeyArray(path);
-			if(!node) return -1;
-			char* pAttribute = mxml_get_attribute(node, "num_values");
-			if(!pAttribute) {
-				dragon::utils::Error("midas::Xml::GetArrayLength", __FILE__, __LINE__)
-					<< "\"num_values\" attribute not found for array: " << path;
-				return -1;
-			}
-			int size = atoi(pAttribute);
+			int size = 0;
+			if(!FindElements(path, true, &size)) return -1;
 			return size;
 		}
 
@@ -226,19 +238,12 @@ public:
 			 *  Passing a NULL value to the function disables the error reporting
 			 */
 			if(success) *success = true;
-			Node node = FindKeyArray(path);
-			if(!node) {
+			int size = 0;
+			const Element* elements = FindElements(path, true, &size);
+			if(!elements) {
 				if(success) *success = false;
 				return;
 			}
-			char* pAttribute = mxml_get_attribute(node, "num_values");
-			if(!pAttribute) {
-				dragon::utils::Error("midas::Xml::GetArray", __FILE__, __LINE__)
-					<< "\"num_values\" attribute not found for array: " << path;
-				if(success) *success = false;
-				return;
-			}
-			int size = atoi(pAttribute);
 			if(size != length) {
 				dragon::utils::Error("midas::Xml::GetArray", __FILE__, __LINE__)
 					<< "size of the ODB array " << path << ": " << size
@@ -248,53 +253,30 @@ public:
 			}
 
 			for(int i=0; i< size; ++i) {
-				std::stringstream valPath;
-				valPath << "/value[" << i+1 << "]";
-				Node valNode = mxml_find_node(node, valPath.str().c_str());
-				if(!valNode) {
+				if(!elements[i].fText) {
 					dragon::utils::Error("midas::Xml::GetArray", __FILE__, __LINE__)
 						<< "Unable to find value node for array index " << i;
 					continue;
 				}
-
-				T value;
-				if(typeid(T) != typeid(bool)) {
-					std::stringstream val;
-					val << valNode->value;
-					val >> value;
-				}
-				else {
-					value = (!strcmp("y", valNode->value)) ? true : false;
-				}
-				array[i] = value;
-
+				array[i] = ConvertArrayElement<T>(elements[i]);
 			}
 		}
 
 	/// Print an array
 	bool PrintArray(const char* path)
 		{
-			Node node = FindKeyArray(path, true);
-			if(!node) {
-				return false;
-			}
-			char* pAttribute = mxml_get_attribute(node, "num_values");
-			if(!pAttribute) {
-				dragon::utils::Error("midas::Xml::GetArray", __FILE__, __LINE__)
-					<< "\"num_values\" attribute not found for array: " << path;
+			int size = 0;
+			const Element* elements = FindElements(path, true, &size, true);
+			if(!elements) {
 				return false;
 			}
-			int size = atoi(pAttribute);
 			for(int i=0; i< size; ++i) {
-				std::stringstream valPath;
-				valPath << "/value[" << i+1 << "]";
-				Node valNode = mxml_find_node(node, valPath.str().c_str());
-				if(!valNode) {
+				if(!elements[i].fText) {
 					dragon::utils::Error("midas::Xml::GetArray", __FILE__, __LINE__)
 						<< "Unable to find value node for array index " << i;
 					continue;
 				}
-				std::cout << path << "[" << i << "] = " << valNode->value << "\n";
+				std::cout << path << "[" << i << "] = " << elements[i].fText << "\n";
 			}
 			return true;
 		}
@@ -302,11 +284,11 @@ public:
 	/// Print a value
 	bool PrintValue(const char* path)
 		{
-			Node node = FindKey(path, true);
-			if(!node) {
+			const Element* element = FindElements(path, false, 0, true);
+			if(!element) {
 				return false;
 			}
-			std::cout << path << " = " << node->value << "\n";
+			std::cout << path << " = " << (element->fText ? element->fText : "") << "\n";
 			return true;
 		}
 
@@ -337,25 +319,72 @@ private:
 	/// \brief Check if fTree and fOdb are non-null
 	bool Check();
 
+	/// \brief Build fIndex from the contents of fOdb
+	void BuildIndex();
+
+	/// \brief Build fIndex from the contents of fSnapshot
+	bool LoadSnapshot();
+
+	/// \brief Regenerate fTree and fOdb from fSnapshot
+	/// \details Only needed for direct access to the tree nodes, i.e. FindKey() and FindKeyArray().
+	bool MaterializeTree();
+
+	/// \brief Look up the value(s) of a key or keyarray in fIndex
+	/// \param [in] path ODB path of the key, e.g. "Equipment/gTrigger/Variables/Pedestals"
+	/// \param [in] array Look for a keyarray if true, a single key if false
+	/// \param [out] length Set to the number of elements (optional)
+	/// \param [in] silent Don't report paths that are not found
+	/// \returns Pointer to the first element, NULL if not found
+	const Element* FindElements(const char* path, bool array, int* length = 0, bool silent = false);
+
 	/// Disable copy
 	Xml(const Xml&) { }
 
 	/// Disable assign
 	Xml& operator= (const Xml&) { return *this; }
 
-	/// Convert node->value into template class
-	template <typename T> T ConvertNode(Node& node)
-		{	
+	/// Convert an element into template class
+	/*!
+	 * The generic version streams the element text, specializations for
+	 * bool, std::string and the arithmetic types use the pre-decoded values.
+	 */
+	template <typename T> T ConvertElement(const Element& element) const
+		{
 			T value;
 			std::stringstream val;
-			val << node->value;
+			val << element.fText;
 			val >> value;
 			return value;
 		}
 
+	/// Convert an array element into template class
+	/*! Same as ConvertElement(), except for strings, see the std::string specialization. */
+	template <typename T> T ConvertArrayElement(const Element& element) const
+		{
+			return ConvertElement<T>(element);
+		}
+
+	/// Convert an element into an integer type
+	/*!
+	 * Out of range values are handled the same way as when streaming the text:
+	 * they saturate, except for negative values read into unsigned types, which wrap around.
+	 */
+	template <typename T> T ConvertInteger(const Element& element) const
+		{
+			if(std::numeric_limits<T>::is_signed) {
+				if(element.fInteger > (int64_t)std::numeric_limits<T>::max()) return std::numeric_limits<T>::max();
+				if(element.fInteger < (int64_t)std::numeric_limits<T>::min()) return std::numeric_limits<T>::min();
+				return static_cast<T>(element.fInteger);
+			}
+			const bool negative = element.fInteger < 0;
+			const uint64_t magnitude = negative ? 0 - (uint64_t)element.fInteger : element.fUnsigned;
+			if(magnitude > (uint64_t)std::numeric_limits<T>::max()) return std::numeric_limits<T>::max();
+			return negative ? static_cast<T>(0 - magnitude) : static_cast<T>(magnitude);
+		}
+
 public:
 #ifdef USE_ROOT
-	ClassDef(midas::Xml, 1);
+	ClassDef(midas::Xml, 2);
 #endif
 };
 
@@ -363,18 +392,62 @@ public:
 
 /// Template specialization for bool
 template <>
-inline bool midas::Xml::ConvertNode<bool>(Node& node)
+inline bool midas::Xml::ConvertElement<bool>(const Element& element) const
 {
-	return (!strcmp("y", node->value)) ? true : false;
+	return (!strcmp("y", element.fText)) ? true : false;
 }
 
 /// Template specialization for std::string
 template <>
-inline std::string midas::Xml::ConvertNode<std::string>(Node& node)
+inline std::string midas::Xml::ConvertElement<std::string>(const Element& element) const
 {
-	return node->value;
+	return element.fText;
 }
 
+/// Template specialization for std::string array elements
+/*! These have always been streamed, i.e. read only up to the first whitespace. */
+template <>
+inline std::string midas::Xml::ConvertArrayElement<std::string>(const Element& element) const
+{
+	std::string value;
+	std::stringstream val;
+	val << element.fText;
+	val >> value;
+	return value;
+}
+
+/// Template specialization for float
+/*! Decoded from the text, since rounding the pre-decoded double could differ in the last bit */
+template <>
+inline float midas::Xml::ConvertElement<float>(const Element& element) const
+{
+	return strtof(element.fText, 0);
+}
+
+/// Template specialization for double
+template <>
+inline double midas::Xml::ConvertElement<double>(const Element& element) const
+{
+	return element.fReal;
+}
+
+#define MIDAS_XML_CONVERT_INTEGER(T)                                                \
+	template <>                                                                       \
+	inline T midas::Xml::ConvertElement<T>(const Element& element) const             \
+	{ return ConvertInteger<T>(element); }
+
+/// Template specializations for integer types (char types keep the generic version)
+MIDAS_XML_CONVERT_INTEGER(short)
+MIDAS_XML_CONVERT_INTEGER(unsigned short)
+MIDAS_XML_CONVERT_INTEGER(int)
+MIDAS_XML_CONVERT_INTEGER(unsigned int)
+MIDAS_XML_CONVERT_INTEGER(long)
+MIDAS_XML_CONVERT_INTEGER(unsigned long)
+MIDAS_XML_CONVERT_INTEGER(long long)
+MIDAS_XML_CONVERT_INTEGER(unsigned long long)
+
+#undef MIDAS_XML_CONVERT_INTEGER
+
 #endif
 
 } // namespace midas
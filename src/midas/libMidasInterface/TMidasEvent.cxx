@@ -37,8 +37,11 @@ void TMidasEvent::Copy(const TMidasEvent& rhs)
   fAllocatedByUs = true;
 
   fBanksN      = rhs.fBanksN;
-  fBankList    = strdup(rhs.fBankList);
-  assert(fBankList);
+  fBankList    = NULL;
+  if (rhs.fBankList) { // only set by SetBankList()
+    fBankList  = strdup(rhs.fBankList);
+    assert(fBankList);
+  }
 }
 
 TMidasEvent::TMidasEvent(const TMidasEvent &rhs)
@@ -3,9 +3,13 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <assert.h>
@@ -17,6 +21,34 @@
 #include "TMidasFile.h"
 #include "TMidasEvent.h"
 
+const size_t TMidasFile::kDefaultBlockSize;
+
+/// Mapped pages behind the read position are released in chunks of this size
+static const size_t kReleaseChunk = 64*1024*1024;
+
+/// Header of an index (sidecar) file, followed by the entries
+struct IndexFileHeader {
+  char     fMagic[4];   ///< "MIDX"
+  uint32_t fVersion;    ///< format version, kIndexVersion
+  uint32_t fEntrySize;  ///< sizeof(TMidasFile::IndexEntry), also detects foreign-endian files
+  uint32_t fFlags;      ///< kIndexTriggerTimes
+  uint64_t fFileSize;   ///< size of the indexed file
+  int64_t  fFileTime;   ///< modification time of the indexed file
+  uint64_t fNumEntries; ///< number of entries following the header
+};
+
+static const uint32_t kIndexVersion = 2;
+
+/// Index file flag: the trigger times were read with a TriggerTimeFunc_t
+static const uint32_t kIndexTriggerTimes = 0x1;
+
+static double wallTime()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
 TMidasFile::TMidasFile()
 {
   uint32_t endian = 0x12345678;
@@ -26,6 +58,27 @@ TMidasFile::TMidasFile()
   fPoFile = NULL;
   fLastErrno = 0;
 
+  fMapBase = NULL;
+  fMapSize = 0;
+  fMapReleased = 0;
+  fPos = 0;
+  fBuffer = NULL;
+  fBufferSize = 0;
+  fBufferEnd = 0;
+  fBlockSize = kDefaultBlockSize;
+  fEof = false;
+  fBytesRead = 0;
+  fOpenTime = 0;
+  fOffset = 0;
+  fIndexComplete = false;
+  fIndexTriggerTimes = false;
+  fRecordIndex = false;
+  fSaveIndex = false;
+  fIndexFileSize = 0;
+  fIndexFileTime = 0;
+  fTriggerTimeFunc = NULL;
+  fTriggerTimeArg = NULL;
+
   fOutFile = -1;
   fOutGzFile = NULL;
 
@@ -64,6 +117,11 @@ bool TMidasFile::Open(const char *filename)
   /// - ./event_dump.exe pipein://"gzip -dc /ladd/data9/t2km11/data/run02696.mid.gz" - another way to read compressed files
   /// - ./event_dump.exe dccp:///pnfs/triumf.ca/data/t2km11/aug2008/run02837.mid.gz - read file directly from a dcache pool (note triple "/")
   ///
+  /// Uncompressed local files are memory mapped, with sequential readahead
+  /// requested from the kernel. Everything else (pipes, compressed files, or
+  /// files that cannot be mapped) is read through a buffer of SetBlockSize()
+  /// bytes, refilled one block at a time.
+  ///
   /// \param [in] filename The file to open.
   /// \returns "true" for succes, "false" for error, use GetLastError() to see why
 
@@ -71,6 +129,14 @@ bool TMidasFile::Open(const char *filename)
     Close();
 
   fFilename = filename;
+  fPos = 0;
+  fBufferEnd = 0;
+  fMapReleased = 0;
+  fEof = false;
+  fBytesRead = 0;
+  fOpenTime = wallTime();
+  fOffset = 0;
+  ResetIndex();
 
   std::string pipe;
 
@@ -185,6 +251,23 @@ bool TMidasFile::Open(const char *filename)
           return false;
 #endif
         }
+      else
+        {
+          struct stat st;
+          if (fstat(fFile, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+            {
+              // Private, writable mapping: SwapBytes() may need to modify
+              // the data of foreign-endian files in place.
+              void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fFile, 0);
+              if (map != MAP_FAILED)
+                {
+                  fMapBase = (char*)map;
+                  fMapSize = st.st_size;
+                  madvise(fMapBase, fMapSize, MADV_SEQUENTIAL);
+                }
+              // otherwise fall back to buffered reads
+            }
+        }
     }
 
   return true;
@@ -252,61 +335,116 @@ bool TMidasFile::OutOpen(const char *filename)
 }
 
 
-static int readpipe(int fd, char* buf, int length)
+bool TMidasFile::FillBuffer(size_t need)
 {
-  int count = 0;
-  while (length > 0)
+  /// Makes sure at least "need" contiguous bytes starting at fPos are
+  /// present in fBuffer. Unconsumed bytes are moved to the front of the
+  /// buffer before refilling, so any pointers into it handed out by an
+  /// earlier read become invalid.
+  /// \returns "true" if the bytes are available, "false" on EOF or error
+
+  if (fBufferEnd - fPos >= need)
+    return true;
+
+  if (fPos > 0)
     {
-      int rd = read(fd, buf, length);
-      if (rd > 0)
+      memmove(fBuffer, fBuffer + fPos, fBufferEnd - fPos);
+      fBufferEnd -= fPos;
+      fPos = 0;
+    }
+
+  if (need > fBufferSize || fBuffer == NULL)
+    {
+      size_t size = fBlockSize > need ? fBlockSize : need;
+      char* buffer = (char*)realloc(fBuffer, size);
+      if (buffer == NULL)
         {
-          buf += rd;
-          length -= rd;
-          count += rd;
+          fLastErrno = errno;
+          fLastError = strerror(errno);
+          return false;
         }
+      fBuffer = buffer;
+      fBufferSize = size;
+    }
+
+  while (fBufferEnd < need && !fEof)
+    {
+      int rd = 0;
+
+      if (fGzFile)
+#ifdef HAVE_ZLIB
+        rd = gzread(*(gzFile*)fGzFile, fBuffer + fBufferEnd, fBufferSize - fBufferEnd);
+#else
+        assert(!"Cannot get here");
+#endif
+      else
+        rd = read(fFile, fBuffer + fBufferEnd, fBufferSize - fBufferEnd);
+
+      if (rd > 0)
+        fBufferEnd += rd;
       else if (rd == 0)
-        {
-          return count;
-        }
+        fEof = true;
       else
         {
-          return -1;
+          fLastErrno = errno;
+          fLastError = strerror(errno);
+          return false;
         }
     }
-  return count;
+
+  return fBufferEnd >= need;
 }
 
-bool TMidasFile::Read(TMidasEvent *midasEvent)
+char* TMidasFile::NextEvent(TMidasEvent *midasEvent)
 {
-  /// \param [in] midasEvent Pointer to an empty TMidasEvent 
-  /// \returns "true" for success, "false" for failure, see GetLastError() to see why
+  /// Copies the header of the next event into midasEvent and advances past
+  /// the event.
+  /// \returns pointer to the event data inside the mapped region or
+  /// read-ahead buffer, or NULL on EOF or error
 
-  midasEvent->Clear();
+  const size_t hsize = sizeof(TMidas_EVENT_HEADER);
+  char* base = NULL;
+  size_t avail = 0;
 
-  int rd = 0;
+  fLastErrno = 0;
 
-  if (fGzFile)
-#ifdef HAVE_ZLIB
-    rd = gzread(*(gzFile*)fGzFile, (char*)midasEvent->GetEventHeader(), sizeof(TMidas_EVENT_HEADER));
-#else
-    assert(!"Cannot get here");
-#endif
+  if (fMapBase)
+    {
+      base = fMapBase;
+      avail = fMapSize - fPos;
+    }
   else
-    rd = readpipe(fFile, (char*)midasEvent->GetEventHeader(), sizeof(TMidas_EVENT_HEADER));
+    {
+      if (!FillBuffer(hsize) && fLastErrno != 0)
+        return NULL; // read error
+      base = fBuffer;
+      avail = fBufferEnd - fPos;
+    }
 
-  if (rd == 0)
+  if (avail == 0)
     {
       fLastErrno = 0;
       fLastError = "EOF";
-      return false;
+      if (fRecordIndex)
+        {
+          // Every event was read in order: the index is complete
+          fRecordIndex = false;
+          fIndexComplete = true;
+          fIndexTriggerTimes = (fTriggerTimeFunc != NULL);
+          if (fSaveIndex)
+            SaveIndex();
+        }
+      return NULL;
     }
-  else if (rd != sizeof(TMidas_EVENT_HEADER))
+  else if (avail < hsize)
     {
-      fLastErrno = errno;
-      fLastError = strerror(errno);
-      return false;
+      fLastErrno = -1;
+      fLastError = "Truncated event header";
+      return NULL;
     }
 
+  memcpy(midasEvent->GetEventHeader(), base + fPos, hsize);
+
   if (fDoByteSwap)
     midasEvent->SwapBytesEventHeader();
 
@@ -314,30 +452,421 @@ bool TMidasFile::Read(TMidasEvent *midasEvent)
     {
       fLastErrno = -1;
       fLastError = "Invalid event size";
-      return false;
+      return NULL;
+    }
+
+  const size_t start = fPos;
+  const size_t total = hsize + midasEvent->GetDataSize();
+
+  if (fMapBase)
+    {
+      if (fMapSize - start < total)
+        {
+          fLastErrno = -1;
+          fLastError = "Truncated event data";
+          return NULL;
+        }
+    }
+  else if (!FillBuffer(total))
+    {
+      if (fLastErrno == 0)
+        {
+          fLastErrno = -1;
+          fLastError = "Truncated event data";
+        }
+      return NULL;
+    }
+
+  // FillBuffer() may have moved the event to the front of the buffer
+  char* event = fMapBase ? fMapBase + start : fBuffer + fPos;
+  fPos = (event - (fMapBase ? fMapBase : fBuffer)) + total;
+  fBytesRead += total;
+
+  if (fRecordIndex)
+    {
+      IndexEntry entry;
+      entry.fOffset = fOffset;
+      entry.fTriggerTime = fTriggerTimeFunc ?
+        fTriggerTimeFunc(midasEvent->GetEventHeader(), event + hsize, fTriggerTimeArg) : -1;
+      entry.fDataSize = midasEvent->GetDataSize();
+      entry.fTimeStamp = midasEvent->GetTimeStamp();
+      entry.fSerialNumber = midasEvent->GetSerialNumber();
+      entry.fEventId = midasEvent->GetEventId();
+      entry.fTriggerMask = midasEvent->GetTriggerMask();
+      fIndex.push_back(entry);
+    }
+
+  fOffset += total;
+
+  if (fMapBase)
+    {
+      // Drop pages of events already consumed, keeping the current one
+      size_t keep = start & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+      if (keep - fMapReleased >= kReleaseChunk)
+        {
+          madvise(fMapBase + fMapReleased, keep - fMapReleased, MADV_DONTNEED);
+          fMapReleased = keep;
+        }
+    }
+
+  return event + hsize;
+}
+
+bool TMidasFile::Read(TMidasEvent *midasEvent)
+{
+  /// \param [in] midasEvent Pointer to an empty TMidasEvent 
+  /// \returns "true" for success, "false" for failure, see GetLastError() to see why
+
+  midasEvent->Clear();
+
+  char* data = NextEvent(midasEvent);
+  if (data == NULL)
+    return false;
+
+  memcpy(midasEvent->GetData(), data, midasEvent->GetDataSize());
+
+  midasEvent->SwapBytes(false);
+
+  return true;
+}
+
+bool TMidasFile::ReadInPlace(TMidasEvent *midasEvent)
+{
+  /// Same as Read(), but instead of allocating and copying, the event's data
+  /// pointer is set to the event inside the mapped file or read-ahead buffer.
+  /// The data remain valid only until the next call to Read(), ReadInPlace()
+  /// or Close(); copy the event to keep it longer.
+  ///
+  /// \param [in] midasEvent Pointer to an empty TMidasEvent 
+  /// \returns "true" for success, "false" for failure, see GetLastError() to see why
+
+  midasEvent->Clear();
+
+  char* data = NextEvent(midasEvent);
+  if (data == NULL)
+    return false;
+
+  midasEvent->SetData(midasEvent->GetDataSize(), data);
+
+  return true;
+}
+
+bool TMidasFile::Seek(uint64_t offset)
+{
+  /// Memory mapped files, and files read through a buffer, can be positioned
+  /// anywhere (backwards seeks in compressed files re-read them from the start).
+  /// Pipes can only skip forward, by reading and discarding data.
+  ///
+  /// \param [in] offset Offset of an event header, e.g. IndexEntry::fOffset or a
+  ///  value returned by Tell()
+  /// \returns "true" for success, "false" for error, use GetLastError() to see why
+
+  fLastErrno = 0;
+
+  // Skipping events stops recording the index
+  if (fRecordIndex && offset != fOffset)
+    ResetIndex();
+
+  if (fMapBase)
+    {
+      if (offset > fMapSize)
+        {
+          fLastErrno = -1;
+          fLastError = "Seek past the end of file";
+          return false;
+        }
+      fPos = offset;
+      fOffset = offset;
+      size_t keep = fPos & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+      if (keep < fMapReleased)
+        fMapReleased = keep;
+      return true;
+    }
+
+  // Still in the read-ahead buffer
+  if (offset >= fOffset && offset - fOffset <= fBufferEnd - fPos)
+    {
+      fPos += offset - fOffset;
+      fOffset = offset;
+      return true;
+    }
+
+  if (fPoFile)
+    {
+      if (offset < fOffset)
+        {
+          fLastErrno = -1;
+          fLastError = "Cannot seek backwards in a pipe";
+          return false;
+        }
+      while (fOffset < offset)
+        {
+          if (fPos == fBufferEnd && !FillBuffer(1))
+            {
+              if (fLastErrno == 0)
+                {
+                  fLastErrno = -1;
+                  fLastError = "Seek past the end of file";
+                }
+              return false;
+            }
+          size_t n = fBufferEnd - fPos;
+          if (n > offset - fOffset)
+            n = offset - fOffset;
+          fPos += n;
+          fOffset += n;
+        }
+      return true;
     }
 
+  off_t pos = -1;
   if (fGzFile)
 #ifdef HAVE_ZLIB
-    rd = gzread(*(gzFile*)fGzFile, midasEvent->GetData(), midasEvent->GetDataSize());
+    pos = gzseek(*(gzFile*)fGzFile, offset, SEEK_SET);
 #else
     assert(!"Cannot get here");
 #endif
   else
-    rd = readpipe(fFile, midasEvent->GetData(), midasEvent->GetDataSize());
+    pos = lseek(fFile, offset, SEEK_SET);
 
-  if (rd != (int)midasEvent->GetDataSize())
+  if (pos < 0 || (uint64_t)pos != offset)
     {
-      fLastErrno = errno;
-      fLastError = strerror(errno);
+      fLastErrno = errno ? errno : -1;
+      fLastError = errno ? strerror(errno) : "Seek failed";
       return false;
     }
 
-  midasEvent->SwapBytes(false);
+  fPos = 0;
+  fBufferEnd = 0;
+  fEof = false;
+  fOffset = offset;
+  return true;
+}
+
+std::string TMidasFile::GetIndexFilename(const char* filename)
+{
+  /// \returns "filename" with ".midx" appended
+  return std::string(filename) + ".midx";
+}
+
+void TMidasFile::SetTriggerTimeFunc(TriggerTimeFunc_t func, void* arg)
+{
+  /// The function is called for every event added to the index, with pointers
+  /// to the event header and data; it returns the trigger time to store in
+  /// IndexEntry::fTriggerTime, or -1 if the event has none. Call before
+  /// OpenIndex() or RecordIndex(); a saved index without trigger times is then
+  /// rebuilt.
+  ///
+  /// \param [in] func Trigger time function, NULL for none
+  /// \param [in] arg Argument passed to "func", must stay valid while reading
+
+  fTriggerTimeFunc = func;
+  fTriggerTimeArg = arg;
+}
+
+bool TMidasFile::OpenIndex(bool save)
+{
+  /// Makes the offset, id, serial number, time stamp and trigger time of every
+  /// event in the input file available through GetIndexEntry(), to find events
+  /// to Seek() to without reading everything before them.
+  ///
+  /// The index is read from the sidecar file GetIndexFilename(), if that exists
+  /// and matches the size and modification time of the input file. Otherwise,
+  /// it is built by reading the headers of all events (compressed files have to
+  /// be decompressed), and saved to the sidecar file for the next time only if
+  /// "save" is set and the directory is writable. The read position is not changed.
+  ///
+  /// Not available for pipes and remote files, which can only be read once.
+  ///
+  /// \param [in] save Save a newly built index (off by default: writing next to
+  ///  the input file should be asked for by the user)
+  /// \returns "true" for success, "false" for error, use GetLastError() to see why
+
+  if (fIndexComplete)
+    return true;
+
+  ResetIndex();
+  if (!StatIndex())
+    return false;
+  if (LoadIndex())
+    return true;
+
+  const uint64_t position = fOffset;
+  const double bytesRead = fBytesRead;
+  if (!Seek(0))
+    return false;
+
+  fRecordIndex = true;
+  fSaveIndex = save;
+  TMidasEvent event;
+  while (NextEvent(&event) != NULL)
+    ;
 
+  // A truncated last event (e.g. a run still being written) leaves the index
+  // incomplete; it is discarded
+  const bool complete = fIndexComplete;
+  if (!complete)
+    ResetIndex();
+
+  fBytesRead = bytesRead;
+  if (!Seek(position))
+    {
+      ResetIndex();
+      return false;
+    }
+  if (!complete)
+    {
+      fLastErrno = -1;
+      fLastError = "Cannot index a truncated file";
+    }
+  return complete;
+}
+
+bool TMidasFile::RecordIndex(bool save)
+{
+  /// Instead of reading the whole file right away like OpenIndex(), the index
+  /// is built from the events read from now on. It becomes available (and is
+  /// saved if "save" is set) when Read() or ReadInPlace() reach the end of the
+  /// file, provided that all events were read in order from the start. This
+  /// way, the index of a run is made at little extra cost the first time it is
+  /// processed in full. Nothing is done if a valid index is saved already (it
+  /// is not loaded, call OpenIndex() for that).
+  ///
+  /// \param [in] save Save the index once it is complete
+  /// \returns "true" if the index is saved already or being recorded, "false" if
+  ///  the file can't be indexed (pipe, remote file, or not at the start of the file)
+
+  if (fIndexComplete || fRecordIndex)
+    return true;
+
+  ResetIndex();
+  if (!StatIndex())
+    return false;
+  if (LoadIndex(false))
+    return true;
+
+  if (fOffset != 0)
+    {
+      fLastErrno = -1;
+      fLastError = "Can only record the index from the start of the file";
+      return false;
+    }
+
+  fRecordIndex = true;
+  fSaveIndex = save;
+  return true;
+}
+
+void TMidasFile::ResetIndex()
+{
+  fIndex.clear();
+  fIndexComplete = false;
+  fIndexTriggerTimes = false;
+  fRecordIndex = false;
+  fSaveIndex = false;
+}
+
+bool TMidasFile::StatIndex()
+{
+  /// \returns "false" for pipes and remote files
+
+  struct stat st;
+  if (fPoFile || fFile < 0 || fstat(fFile, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+      fLastErrno = -1;
+      fLastError = "Cannot index a pipe or remote file";
+      return false;
+    }
+
+  fIndexFileSize = st.st_size;
+  fIndexFileTime = st.st_mtime;
   return true;
 }
 
+bool TMidasFile::LoadIndex(bool entries)
+{
+  /// \param [in] entries Read the entries into fIndex, otherwise only check the header
+  /// \returns "true" if the saved index is valid for the input file (and was read)
+
+  FILE* fp = fopen(GetIndexFilename(fFilename.c_str()).c_str(), "rb");
+  if (fp == NULL)
+    return false;
+
+  IndexFileHeader header;
+  bool good = fread(&header, sizeof(header), 1, fp) == 1 &&
+    memcmp(header.fMagic, "MIDX", 4) == 0 &&
+    header.fVersion == kIndexVersion &&
+    header.fEntrySize == sizeof(IndexEntry) &&
+    header.fFileSize == fIndexFileSize &&
+    header.fFileTime == fIndexFileTime &&
+    (fTriggerTimeFunc == NULL || (header.fFlags & kIndexTriggerTimes));
+
+  if (good && entries)
+    {
+      fIndex.resize(header.fNumEntries);
+      good = header.fNumEntries == 0 ||
+        fread(&fIndex[0], sizeof(IndexEntry), header.fNumEntries, fp) == header.fNumEntries;
+    }
+
+  fclose(fp);
+
+  if (good && entries)
+    {
+      fIndexComplete = true;
+      fIndexTriggerTimes = (header.fFlags & kIndexTriggerTimes) != 0;
+    }
+  else
+    fIndex.clear();
+  return good;
+}
+
+bool TMidasFile::SaveIndex()
+{
+  /// Written to a temporary file first, then renamed, so that other programs
+  /// reading the same run never see a partial index.
+  /// \returns "true" if the index was saved
+
+  const std::string filename = GetIndexFilename(fFilename.c_str());
+  char tmpname[16];
+  snprintf(tmpname, sizeof(tmpname), ".%d", (int)getpid());
+  const std::string tmpfile = filename + tmpname;
+
+  FILE* fp = fopen(tmpfile.c_str(), "wb");
+  if (fp == NULL)
+    return false; // e.g. read-only directory, the index is just not saved
+
+  IndexFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.fMagic, "MIDX", 4);
+  header.fVersion = kIndexVersion;
+  header.fEntrySize = sizeof(IndexEntry);
+  header.fFlags = fIndexTriggerTimes ? kIndexTriggerTimes : 0;
+  header.fFileSize = fIndexFileSize;
+  header.fFileTime = fIndexFileTime;
+  header.fNumEntries = fIndex.size();
+
+  bool good = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+    (fIndex.empty() || fwrite(&fIndex[0], sizeof(IndexEntry), fIndex.size(), fp) == fIndex.size());
+  good = (fclose(fp) == 0) && good;
+
+  if (good)
+    good = rename(tmpfile.c_str(), filename.c_str()) == 0;
+  if (!good)
+    unlink(tmpfile.c_str());
+  return good;
+}
+
+double TMidasFile::GetElapsedTime() const
+{
+  return fOpenTime > 0 ? wallTime() - fOpenTime : 0;
+}
+
+double TMidasFile::GetThroughput() const
+{
+  double elapsed = GetElapsedTime();
+  return elapsed > 0 ? fBytesRead / (1024.*1024.) / elapsed : 0;
+}
+
 bool TMidasFile::Write(TMidasEvent *midasEvent)
 {
   int wr = -2;
@@ -373,6 +902,18 @@ bool TMidasFile::Write(TMidasEvent *midasEvent)
 
 void TMidasFile::Close()
 {
+  if (fMapBase)
+    munmap(fMapBase, fMapSize);
+  fMapBase = NULL;
+  fMapSize = 0;
+  if (fBuffer)
+    free(fBuffer);
+  fBuffer = NULL;
+  fBufferSize = 0;
+  fBufferEnd = 0;
+  fPos = 0;
+  fOffset = 0;
+  ResetIndex();
   if (fPoFile)
     pclose((FILE*)fPoFile);
   fPoFile = NULL;
@@ -6,6 +6,9 @@
 #define TMIDASFILE_H
 
 #include <string>
+#include <vector>
+#include <stddef.h>
+#include "utils/IntTypes.h"
 
 class TMidasEvent;
 
@@ -24,12 +27,46 @@ public:
   void OutClose(); ///< Close output file
 
   bool Read(TMidasEvent *event); ///< Read one event from the file
+  bool ReadInPlace(TMidasEvent *event); ///< Read one event without copying its data out of the read buffer
   bool Write(TMidasEvent *event); ///< Write one event to the output file
 
   const char* GetFilename()  const { return fFilename.c_str();  } ///< Get the name of this file
   int         GetLastErrno() const { return fLastErrno; }         ///< Get error value for the last file error
   const char* GetLastError() const { return fLastError.c_str(); } ///< Get error text for the last file error
 
+  void   SetBlockSize(size_t size) { fBlockSize = size; } ///< Set read-ahead block size for pipes and compressed files (takes effect at next Open())
+  bool   IsMapped() const { return fMapBase != NULL; } ///< "true" if the input file is memory mapped
+  double GetBytesRead() const { return fBytesRead; } ///< Get number of bytes handed out since Open()
+  double GetElapsedTime() const; ///< Get wall-clock seconds since Open()
+  double GetThroughput() const;  ///< Get average read rate since Open(), in MB/s
+
+  static const size_t kDefaultBlockSize = 16*1024*1024; ///< default read-ahead block size
+
+  /// Entry of the event index, see OpenIndex()
+  struct IndexEntry {
+    uint64_t fOffset;       ///< offset of the event header in the (uncompressed) file
+    double   fTriggerTime;  ///< trigger time (usually in microseconds) from the TriggerTimeFunc_t, or -1 if none
+    uint32_t fDataSize;     ///< event data size, not including the header
+    uint32_t fTimeStamp;    ///< MIDAS system time stamp (unix time in seconds)
+    uint32_t fSerialNumber; ///< MIDAS serial number
+    uint16_t fEventId;      ///< MIDAS event id
+    uint16_t fTriggerMask;  ///< MIDAS trigger mask
+  };
+
+  /// Function reading the trigger time of an event for the index, see SetTriggerTimeFunc()
+  typedef double (*TriggerTimeFunc_t)(const void* header, const void* data, void* arg);
+
+  void     SetTriggerTimeFunc(TriggerTimeFunc_t func, void* arg = NULL); ///< Set function reading trigger times for the index
+  bool     OpenIndex(bool save = false); ///< Load the event index of the input file, or build it
+  bool     RecordIndex(bool save = false); ///< Load the event index of the input file, or build it while reading
+  bool     HasIndex() const { return fIndexComplete; } ///< "true" if the index of all events is loaded
+  bool     HasTriggerTimes() const { return fIndexTriggerTimes; } ///< "true" if the index has trigger times
+  size_t   GetIndexSize() const { return fIndex.size(); } ///< Get number of events in the index
+  const IndexEntry& GetIndexEntry(size_t i) const { return fIndex[i]; } ///< Get an entry of the index
+  bool     Seek(uint64_t offset); ///< Continue reading at the event starting at "offset"
+  uint64_t Tell() const { return fOffset; } ///< Get offset of the next event
+  static std::string GetIndexFilename(const char* filename); ///< Get name of the index (sidecar) file of "filename"
+
 protected:
 
   std::string fFilename; ///< name of the currently open file
@@ -43,6 +80,35 @@ protected:
   int         fFile; ///< open input file descriptor
   void*       fGzFile; ///< zlib compressed input file reader
   void*       fPoFile; ///< popen() input file reader
+  char*       fMapBase;     ///< mmap()'ed input file, or NULL if not mapped
+  size_t      fMapSize;     ///< length of the mapped region
+  size_t      fMapReleased; ///< offset up to which mapped pages have been released
+  size_t      fPos;         ///< offset of the next event in fMapBase or fBuffer
+  char*       fBuffer;      ///< read-ahead buffer for pipes and compressed files
+  size_t      fBufferSize;  ///< allocated size of fBuffer
+  size_t      fBufferEnd;   ///< number of valid bytes in fBuffer
+  size_t      fBlockSize;   ///< size of each read into fBuffer
+  bool        fEof;         ///< "true" once the underlying reader has returned EOF
+  double      fBytesRead;   ///< bytes handed out since Open()
+  double      fOpenTime;    ///< wall-clock time of Open()
+  uint64_t    fOffset;      ///< offset of the next event in the (uncompressed) file
+  std::vector<IndexEntry> fIndex; ///< event index, see OpenIndex() and RecordIndex()
+  bool        fIndexComplete;     ///< "true" once fIndex has all events of the file
+  bool        fIndexTriggerTimes; ///< "true" if fIndex has trigger times
+  bool        fRecordIndex;       ///< "true" while adding the events read to fIndex
+  bool        fSaveIndex;         ///< save fIndex when recording reaches the end of the file
+  uint64_t    fIndexFileSize;     ///< size of the input file when indexing started
+  int64_t     fIndexFileTime;     ///< modification time of the input file when indexing started
+  TriggerTimeFunc_t fTriggerTimeFunc; ///< reads trigger times for the index, or NULL
+  void*       fTriggerTimeArg;    ///< argument of fTriggerTimeFunc
+
+  char* NextEvent(TMidasEvent *event); ///< Read the header of the next event and locate its data
+  bool  FillBuffer(size_t need); ///< Make "need" contiguous bytes available at fPos in fBuffer
+  bool  StatIndex(); ///< Check that the input file can be indexed, and set fIndexFileSize, fIndexFileTime
+  bool  LoadIndex(bool entries = true); ///< Read fIndex from the sidecar file
+  bool  SaveIndex(); ///< Write fIndex to the sidecar file
+  void  ResetIndex(); ///< Discard fIndex and stop recording
+
   int         fOutFile; ///< open output file descriptor
   void*       fOutGzFile; ///< zlib compressed output file reader
 };
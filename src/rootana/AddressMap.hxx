@@ -0,0 +1,66 @@
+/*!
+ * \file AddressMap.hxx
+ * \author G. Christian
+ * \brief Defines a class relocating addresses into copies of objects.
+ */
+#ifndef ROOTANA_ADDRESS_MAP_HXX
+#define ROOTANA_ADDRESS_MAP_HXX
+#include <vector>
+#include <cstddef>
+
+namespace rootana {
+
+/// Relocates addresses within objects to the same offset in copies of them
+/*!
+ * Histogram parameters and cuts hold the addresses of members of the global
+ * event classes (rootana::gHead, etc.). To fill copies of the histograms from
+ * other instances of those classes (e.g. one per worker thread), their addresses
+ * are relocated through an AddressMap:
+ * \code
+ * rootana::AddressMap map;
+ * map.Add(rootana::gHead, myHead);
+ * const double& e0 = map.Relocate(rootana::gHead.bgo.ecal[0]); // myHead.bgo.ecal[0]
+ * \endcode
+ * Addresses outside of all mapped objects are left as they are.
+ */
+class AddressMap {
+public:
+	/// Maps the \e size bytes starting at \e from onto \e to
+	void Add(const void* from, void* to, size_t size)
+		{
+			Range_t range = { static_cast<const char*>(from), static_cast<char*>(to), size };
+			fRanges.push_back(range);
+		}
+	/// Maps an object onto a copy of it
+	template <class T>
+	void Add(const T& from, T& to)
+		{ Add(&from, &to, sizeof(T)); }
+	/// Returns the relocated address
+	void* Map(const void* address) const
+		{
+			const char* p = static_cast<const char*>(address);
+			for (size_t i = 0; i < fRanges.size(); ++i) {
+				if (p >= fRanges[i].fFrom && p < fRanges[i].fFrom + fRanges[i].fSize)
+					return fRanges[i].fTo + (p - fRanges[i].fFrom);
+			}
+			return const_cast<char*>(p);
+		}
+	/// Returns the relocated variable
+	template <class T>
+	T& Relocate(const T& value) const
+		{ return *static_cast<T*>(Map(&value)); }
+
+private:
+	/// Object and its copy
+	struct Range_t {
+		const char* fFrom; ///< Start of the original
+		char* fTo;         ///< Start of the copy
+		size_t fSize;      ///< Size of both
+	};
+	/// Mapped objects
+	std::vector<Range_t> fRanges;
+};
+
+} // namespace rootana
+
+#endif
@@ -7,6 +7,10 @@
 #include <cassert>
 #include <vector>
 #include <string>
+#include <set>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
 
 #include <TROOT.h>
 #include <TFile.h>
@@ -20,11 +24,13 @@
 
 #include "midas/Database.hxx"
 #include "utils/Functions.hxx"
+#include "Registry.hxx"
 #include "Timer.hxx"
 #include "Histos.hxx"
 #include "HistParser.hxx"
 #include "Callbacks.hxx"
 #include "Directory.hxx"
+#include "AddressMap.hxx"
 
 #include "Globals.h"
 
@@ -32,13 +38,40 @@ namespace {
 
 const uint32_t TS_DIAGNOSTICS_EVENT = 6;
 
+/// Seconds between publishing the histograms filled by fill plans and worker threads
+const double PUBLISH_PERIOD = 1.;
+
+inline double get_time()
+{
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
 template <class T, class E>
 inline void unpack_event(T& data, const E& buf)
 {
 	data.reset();
 	data.unpack(buf);
 	data.calculate();
-} }
+}
+
+/// Calls rootana::App::publish_hists() from the ROOT event loop
+class PublishTimer: public TTimer {
+public:
+	PublishTimer(rootana::App* app):
+		TTimer(Long_t(PUBLISH_PERIOD * 1000), kTRUE), fApp(app) { TurnOn(); }
+	~PublishTimer()
+		{ TurnOff(); }
+	Bool_t Notify()
+		{
+			fApp->publish_hists();
+			Reset();
+			return true;
+		}
+private:
+	rootana::App* fApp;
+}; }
 
 
 // RAII wrapper for TMidasOnline //
@@ -65,6 +98,226 @@ private:
 	const char* fClient;
 };
 
+/// Processes chunks of an offline file in a thread of its own
+/*!
+ * Each worker has its own head, tail and coincidence classes and timestamp queue,
+ * and fills buffers of the histograms (rootana::DirectoryShard) whose parameters
+ * point into those classes instead of the globals. Chunks are taken in turn from
+ * a list shared by all workers. See rootana::App::midas_file_chunks().
+ *
+ * \attention Workers print only through dragon::utils::Info, Warning and Error, which
+ *  serialize their output; anything else printed while they run must take
+ *  dragon::utils::LockMessages().
+ */
+class ChunkWorker {
+public:
+	/// Part of the file: [fBegin, fEnd) offsets
+	struct Chunk_t {
+		uint64_t fBegin;
+		uint64_t fEnd;
+	};
+
+	/// List of chunks shared by all workers
+	struct Chunks_t {
+		std::string fFilename;        ///< MIDAS file name
+		double fCoincWindow;          ///< Coincidence window
+		double fQueueTime;            ///< Queue time
+		std::vector<Chunk_t> fChunks; ///< All chunks, in file order
+		size_t fNext;                 ///< Next chunk to process
+		pthread_mutex_t fMutex;       ///< Guards fNext
+	};
+
+public:
+	/// Copies the global event classes and the histograms of the event types in the queue
+	ChunkWorker(Chunks_t* chunks, rootana::Directory* output, rootana::Directory* online);
+	/// Joins the thread if needed
+	~ChunkWorker() { Join(); }
+	/// Starts processing chunks in a new thread
+	void Start();
+	/// Waits for the thread to finish
+	void Join();
+	/// Adds the histogram buffers handed over so far to the histograms
+	void Publish();
+	/// Adds all of the histogram buffers to the histograms, after Join()
+	void Merge();
+	/// Returns true once all chunks are processed
+	bool IsDone() const { __sync_synchronize(); return fDone; }
+	/// Returns the number of events read
+	size_t GetNumEvents() const { return fNumEvents; }
+	/// Returns the error message, empty if none
+	const std::string& GetError() const { return fError; }
+
+	/// Singles event from the queue
+	void Process(const midas::EventView& event);
+	/// Coincidence event from the queue
+	void Process(const midas::Event& event1, const midas::Event& event2);
+	/// Timestamp diagnostics from the queue
+	void Process(tstamp::Diagnostics* diagnostics);
+
+private:
+	/// Thread function
+	static void* Run(void* worker);
+	/// Processes chunks until there are none left
+	void DoRun();
+	/// Reads and queues the head and tail events of a chunk
+	void ProcessChunk(TMidasFile& file, const Chunk_t& chunk);
+	/// Fills the histogram copies
+	void Fill(uint16_t id);
+
+private:
+	Chunks_t* fChunks;                ///< Chunks shared by all workers
+	dragon::Head fHead;               ///< Head event class, copy of rootana::gHead
+	dragon::Tail fTail;               ///< Tail event class, copy of rootana::gTail
+	dragon::Coinc fCoinc;             ///< Coincidence event class, copy of rootana::gCoinc
+	tstamp::Diagnostics fDiagnostics; ///< Timestamp diagnostics of the chunks processed
+	std::auto_ptr<rootana::DirectoryShard> fOutput; ///< Buffers of the output file histograms
+	std::auto_ptr<rootana::DirectoryShard> fOnline; ///< Buffers of the online-only histograms
+	pthread_t fThread;                ///< Worker thread
+	bool fRunning;                    ///< Set while fThread is joinable
+	volatile int fDone;               ///< Set when all chunks are processed
+	size_t fNumEvents;                ///< Number of head and tail events read
+	std::string fError;               ///< Error message, empty if none
+
+private:
+	/// Disallow copy
+	ChunkWorker(const ChunkWorker&);
+	/// Disallow assign
+	ChunkWorker& operator= (const ChunkWorker&);
+};
+
+}
+
+rootana::ChunkWorker::ChunkWorker(Chunks_t* chunks, rootana::Directory* output, rootana::Directory* online):
+	fChunks(chunks),
+	fHead(rootana::gHead),
+	fTail(rootana::gTail),
+	fCoinc(rootana::gCoinc),
+	fDiagnostics(),
+	fOutput(0),
+	fOnline(0),
+	fRunning(false),
+	fDone(0),
+	fNumEvents(0)
+{
+	/*! \attention Call from the main thread, which owns the histograms. */
+	rootana::AddressMap map;
+	map.Add(rootana::gHead, fHead);
+	map.Add(rootana::gTail, fTail);
+	map.Add(rootana::gCoinc, fCoinc);
+	map.Add(rootana::gDiagnostics, fDiagnostics);
+
+	std::set<uint16_t> ids;
+	ids.insert(DRAGON_HEAD_EVENT);
+	ids.insert(DRAGON_TAIL_EVENT);
+	ids.insert(DRAGON_COINC_EVENT);
+	ids.insert(TS_DIAGNOSTICS_EVENT);
+	if (output) fOutput.reset(new rootana::DirectoryShard(*output, map, ids));
+	if (online) fOnline.reset(new rootana::DirectoryShard(*online, map, ids));
+}
+
+void rootana::ChunkWorker::Start()
+{
+	/*! If the thread can't be created, the chunks are processed right away in the calling thread. */
+	fRunning = (pthread_create(&fThread, 0, Run, this) == 0);
+	if (!fRunning) DoRun();
+}
+
+void rootana::ChunkWorker::Join()
+{
+	if (fRunning) pthread_join(fThread, 0);
+	fRunning = false;
+}
+
+void rootana::ChunkWorker::Publish()
+{
+	if (fOutput.get()) fOutput->Publish();
+	if (fOnline.get()) fOnline->Publish();
+}
+
+void rootana::ChunkWorker::Merge()
+{
+	if (fOutput.get()) fOutput->Merge();
+	if (fOnline.get()) fOnline->Merge();
+}
+
+void* rootana::ChunkWorker::Run(void* worker)
+{
+	static_cast<ChunkWorker*>(worker)->DoRun();
+	return 0;
+}
+
+void rootana::ChunkWorker::DoRun()
+{
+	TMidasFile file;
+	if (!file.Open(fChunks->fFilename.c_str()))
+		fError = file.GetLastError();
+	while (fError.empty()) {
+		Chunk_t chunk;
+		pthread_mutex_lock(&fChunks->fMutex);
+		const bool haveChunk = fChunks->fNext < fChunks->fChunks.size();
+		if (haveChunk) chunk = fChunks->fChunks[fChunks->fNext++];
+		pthread_mutex_unlock(&fChunks->fMutex);
+		if (!haveChunk) break;
+		ProcessChunk(file, chunk);
+	}
+	__sync_synchronize();
+	fDone = 1;
+}
+
+void rootana::ChunkWorker::ProcessChunk(TMidasFile& file, const Chunk_t& chunk)
+{
+	/*!
+	 * Same as the serial loop in rootana::App::midas_file() and rootana::App::handle_event()
+	 * for head and tail events, with the queue flushed at the end of the chunk; all other
+	 * events are skipped (they are processed by the main thread).
+	 */
+	if (!file.Seek(chunk.fBegin)) {
+		fError = file.GetLastError();
+		return;
+	}
+	tstamp::OwnedQueue<ChunkWorker> queue(fChunks->fQueueTime, this);
+	TMidasEvent event;
+	while (file.Tell() < chunk.fEnd && file.ReadInPlace(&event)) {
+		const uint16_t eventId = event.GetEventId();
+		if (eventId != DRAGON_HEAD_EVENT && eventId != DRAGON_TAIL_EVENT)
+			continue;
+		midas::EventView view(event.GetEventHeader(), event.GetData(),
+													eventId == DRAGON_HEAD_EVENT ? "TSCH" : "TSCT", fChunks->fCoincWindow);
+		queue.Push(view, &fDiagnostics);
+		++fNumEvents;
+	}
+	queue.Flush(-1, &fDiagnostics);
+}
+
+void rootana::ChunkWorker::Process(const midas::EventView& event)
+{
+	const uint16_t EID = event.GetEventId();
+	if (EID == DRAGON_HEAD_EVENT) unpack_event(fHead, event);
+	else unpack_event(fTail, event);
+	Fill(EID);
+}
+
+void rootana::ChunkWorker::Process(const midas::Event& event1, const midas::Event& event2)
+{
+	midas::CoincEvent coincEvent(event1, event2);
+	if (coincEvent.fHeavyIon == 0 ||	coincEvent.fGamma == 0) {
+		dragon::utils::Error("rootana::ChunkWorker::Process")
+			<< "Invalid coincidence event, skipping...\n";
+		return;
+	}
+	unpack_event(fCoinc, coincEvent);
+	Fill(DRAGON_COINC_EVENT);
+}
+
+void rootana::ChunkWorker::Process(tstamp::Diagnostics*)
+{
+	Fill(TS_DIAGNOSTICS_EVENT);
+}
+
+void rootana::ChunkWorker::Fill(uint16_t id)
+{
+	if (fOutput.get()) fOutput->Fill(id);
+	if (fOnline.get()) fOnline->Fill(id);
 }
 
 // APPLICATION CLASS //
@@ -76,6 +329,8 @@ rootana::App::App(const char* appClassName, Int_t* argc, char** argv):
 	fCutoff(0),
 	fReturn(0),
 	fTcp(9091),
+	fThreads(0),
+	fSaveIndex(false),
 	fCoincWindow(10.),
 	fFilename(""),
 	fHost(""),
@@ -85,12 +340,16 @@ rootana::App::App(const char* appClassName, Int_t* argc, char** argv):
 	fOutputFile(0),
 	fOnlineHists(0),
 	fOdb(0),
-	fMidasOnline(0)
+	fMidasOnline(0),
+	fCalibration(new dragon::CalibrationRegistry())
 { 
 /*!
  *  Also: process command line arguments, starts histogram server if appropriate.
  */
 	process_argv (*argc, argv);
+	fCalibration->Add(&rootana::gHead);
+	fCalibration->Add(&rootana::gTail);
+	fCalibration->Add(&rootana::gCoinc);
 	if (!fQueue.get()) fQueue.reset(tstamp::NewOwnedQueue(4e6, this));
 	if (fMode == ONLINE) {
 		gROOT->cd();
@@ -121,6 +380,10 @@ void rootana::App::process_argv(int argc, char** argv)
 			fCutoff =  atoi (iarg->substr(2).c_str() );
 		else if ( iarg->compare(0, 2, "-P") == 0 )
 			fTcp  = atoi (iarg->substr(2).c_str() );
+		else if ( iarg->compare(0, 2, "-j") == 0 )
+			fThreads = atoi (iarg->substr(2).c_str() );
+		else if ( iarg->compare("-index") == 0 )
+			fSaveIndex = true;
 		else if ( iarg->compare(0, 2, "-H") == 0 )
 			fHost = iarg->substr(2);
 		else if ( iarg->compare(0, 2, "-E") == 0 )
@@ -142,19 +405,23 @@ void rootana::App::process_argv(int argc, char** argv)
 	}
 }
 
-void rootana::App::handle_event(midas::Event& event)
+void rootana::App::handle_event(const midas::EventView& event)
 {
 	/*!
 	 * Handles various types of events in the following ways:
 	 */
+	/// - First, apply any variables changed in the ODB since the last event
+	fCalibration->Update();
+
 	const uint16_t EID = event.GetEventId();
 	if (EID == DRAGON_HEAD_EVENT || EID == DRAGON_TAIL_EVENT) {
 		/// - Head and tail events: insert into queue; call to Process() is delayed
-		///   until it's at the front of the queue.
+		///   until it's at the front of the queue. This is the only place the
+		///   event buffer gets copied.
 		fQueue->Push(event, &gDiagnostics);
 	}
 	else {
-		/// - All others: call Process() directly.
+		/// - All others: call Process() directly on the view.
 		Process(event);
 	}
 }
@@ -166,7 +433,7 @@ IT FindSerial(IT begin_, IT end_, uint32_t value)
 	return begin_;
 }
 
-void rootana::App::Process(const midas::Event& event)
+void rootana::App::Process(const midas::EventView& event)
 {
 	const uint16_t EID = event.GetEventId();
 	switch (EID) {
@@ -268,6 +535,8 @@ int rootana::App::midas_file(const char* fname)
 	if (fCutoff) printf (" (%i events)\n", fCutoff);
 	else printf("\n");
 
+	if (!fOutputFile.get()) fOutputFile.reset(new rootana::OfflineDirectory("."));
+
   TMidasFile f;
   bool tryOpen = f.Open(fname);
   if (!tryOpen) {
@@ -275,11 +544,20 @@ int rootana::App::midas_file(const char* fname)
 		return -1;
 	}
 
+	// With -index, index the file while reading it and save the index, with the
+	// trigger times from the same TSC banks as in rootana_handle_event()
+	midas::TscBankMap tscBanks;
+	tscBanks[DRAGON_HEAD_EVENT] = "TSCH";
+	tscBanks[DRAGON_TAIL_EVENT] = "TSCT";
+	f.SetTriggerTimeFunc(midas::tsc_trigger_time, &tscBanks);
+	if (fSaveIndex) f.RecordIndex(true);
+
   int i=0;
+	double published = get_time();
+	TMidasEvent event;
   while (1) {
 
-		TMidasEvent event;
-		if (!f.Read(&event)) break;
+		if (!f.ReadInPlace(&event)) break;
 
 		int eventId = event.GetEventId();
 
@@ -290,6 +568,9 @@ int rootana::App::midas_file(const char* fname)
 			fOdb.reset(new midas::Database(fname));
 
 			rootana_run_start(0, event.GetSerialNumber(), 0);
+
+			if (fThreads > 0 && fCutoff == 0 && midas_file_chunks(f, fname) >= 0)
+				break;
 		}
 
 		else if ((eventId & 0xFFFF) == 0x8001) { // end run
@@ -303,6 +584,11 @@ int rootana::App::midas_file(const char* fname)
       
 		if((i%500)==0)
 			printf("Processing event %d\n",i);
+
+		if (get_time() - published > PUBLISH_PERIOD) {
+			publish_hists();
+			published = get_time();
+		}
 		
 		i++;
 
@@ -312,10 +598,156 @@ int rootana::App::midas_file(const char* fname)
 		}
 	}
   
+	printf("Read %.1f MB at %.1f MB/s\n", f.GetBytesRead() / (1024.*1024.), f.GetThroughput());
   f.Close();
   return 0;
 }
 
+int rootana::App::midas_file_chunks(TMidasFile& f, const char* fname)
+{
+	/*!
+	 * Splits the file after the present position (the begin-of-run event) into chunks
+	 * at gaps in trigger time longer than the queue time, which are then processed
+	 * by fThreads worker threads (rootana::ChunkWorker), each with its own event classes,
+	 * timestamp queue and copies of the histograms. The split points are checked by
+	 * replaying the queue on the trigger times from the file index, so the singles and
+	 * coincidences found are exactly those of a serial run (see tstamp::find_split_points()).
+	 * Unless the file has a saved index (see -index), indexing it reads all of its event
+	 * headers once before the chunks are processed.
+	 * Scaler and EPICS events are processed in the main thread, in file order, while
+	 * the workers run. The workers fill dense buffers of the histograms, which the main
+	 * thread adds to the histograms every PUBLISH_PERIOD seconds (see publish_hists()),
+	 * and once more at the end.
+	 *
+	 * \returns The number of events processed, or -1 if the file can't be split; in that
+	 *  case nothing is processed, and the position in \e f is unchanged.
+	 *
+	 * \note Bin contents are the same as from a serial run; histogram statistics (mean,
+	 *  RMS) are summed per chunk, so may differ in rounding. Timestamp diagnostics
+	 *  histograms are filled per chunk. Cuts on head, tail or coincidence histograms
+	 *  should not use scaler or EPICS parameters, which are updated by the main thread.
+	 */
+	const uint64_t start = f.Tell();
+	if (!f.OpenIndex(fSaveIndex)) {
+		dragon::utils::Warning("rootana::App::midas_file_chunks")
+			<< "Can't index \"" << fname << "\" (" << f.GetLastError() << "), processing serially.";
+		return -1;
+	}
+
+	std::vector<size_t> queued;
+	std::vector<double> times;
+	for (size_t i = 0; i < f.GetIndexSize(); ++i) {
+		const TMidasFile::IndexEntry& entry = f.GetIndexEntry(i);
+		if (entry.fOffset < start) continue;
+		if (entry.fEventId != DRAGON_HEAD_EVENT && entry.fEventId != DRAGON_TAIL_EVENT) continue;
+		if (entry.fTriggerTime < 0) {
+			dragon::utils::Warning("rootana::App::midas_file_chunks")
+				<< "No trigger time in event " << entry.fSerialNumber << " (id " << entry.fEventId
+				<< "), processing serially.";
+			return -1;
+		}
+		queued.push_back(i);
+		times.push_back(entry.fTriggerTime);
+	}
+
+	std::vector<size_t> splits =
+		tstamp::find_split_points(times, fQueue->GetMaxDelta(), fCoincWindow, 4 * fThreads);
+	if (splits.size() < 2) {
+		dragon::utils::Info("rootana::App::midas_file_chunks")
+			<< "No gaps in trigger time longer than the queue time, processing serially.";
+		return -1;
+	}
+
+	rootana::ChunkWorker::Chunks_t chunks;
+	chunks.fFilename = fname;
+	chunks.fCoincWindow = fCoincWindow;
+	chunks.fQueueTime = fQueue->GetMaxDelta();
+	chunks.fNext = 0;
+	pthread_mutex_init(&chunks.fMutex, 0);
+	for (size_t i = 0; i < splits.size(); ++i) {
+		rootana::ChunkWorker::Chunk_t chunk;
+		chunk.fBegin = f.GetIndexEntry(queued[splits[i]]).fOffset;
+		chunk.fEnd = i + 1 < splits.size() ? f.GetIndexEntry(queued[splits[i+1]]).fOffset : (uint64_t)-1;
+		chunks.fChunks.push_back(chunk);
+	}
+	printf("Processing %d chunks with %d threads\n", (int)chunks.fChunks.size(), fThreads);
+
+	std::vector<rootana::ChunkWorker*> workers;
+	for (int i = 0; i < fThreads; ++i)
+		workers.push_back(new rootana::ChunkWorker(&chunks, fOutputFile.get(), fOnlineHists.get()));
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i]->Start();
+
+	int nevents = 0;
+	double published = get_time();
+	TMidasEvent event;
+	for (size_t i = 0; i < f.GetIndexSize(); ++i) {
+		if (get_time() - published > PUBLISH_PERIOD) {
+			publish_hists();
+			published = get_time();
+		}
+		const TMidasFile::IndexEntry& entry = f.GetIndexEntry(i);
+		if (entry.fOffset < start) continue;
+		if (entry.fEventId == DRAGON_HEAD_EVENT || entry.fEventId == DRAGON_TAIL_EVENT) continue;
+		if (!f.Seek(entry.fOffset) || !f.ReadInPlace(&event)) {
+			dragon::utils::Error("rootana::App::midas_file_chunks")
+				<< "Failed reading event " << entry.fSerialNumber << ": " << f.GetLastError();
+			break;
+		}
+		if ((event.GetEventId() & 0xFFFF) == 0x8001) {
+			dragon::utils::LockMessages(); // the workers are printing too
+			printf("---- END RUN ---- \n");
+			fflush(stdout);
+			dragon::utils::UnlockMessages();
+		}
+		else if ((event.GetEventId() & 0xFFFF) != 0x8000) {
+			event.SetBankList();
+			rootana_handle_event(event.GetEventHeader(), event.GetData(), event.GetDataSize());
+		}
+		++nevents;
+	}
+
+	for (size_t i = 0; i < workers.size(); ++i) {
+		while (!workers[i]->IsDone()) {
+			usleep(10000);
+			if (get_time() - published > PUBLISH_PERIOD) {
+				publish_hists();
+				published = get_time();
+			}
+		}
+	}
+	for (size_t i = 0; i < workers.size(); ++i) {
+		workers[i]->Join();
+		workers[i]->Merge();
+		nevents += workers[i]->GetNumEvents();
+		if (!workers[i]->GetError().empty())
+			dragon::utils::Error("rootana::App::midas_file_chunks")
+				<< "Worker " << i << ": " << workers[i]->GetError();
+		delete workers[i];
+	}
+	pthread_mutex_destroy(&chunks.fMutex);
+
+	printf("Processed %d events\n", nevents);
+	return nevents;
+}
+
+void rootana::App::publish_hists()
+{
+	/*!
+	 * Adds the bins filled by the fill plans of the directories (see rootana::Directory::Fill())
+	 * since the last call, then the histogram buffers handed over by the worker threads
+	 * of midas_file_chunks(), and asks the workers to hand over the next ones. Never waits
+	 * for the workers, so the histograms lag behind them by up to one call.
+	 *
+	 * \note The TNetDirectory server (-P) answers roody in a thread of its own, with no
+	 *  hook for the analyzer to run before a request, so histograms viewed online are
+	 *  those of the last call: up to PUBLISH_PERIOD old. Writing a directory publishes it
+	 *  first (see rootana::Directory::Write()).
+	 */
+	if (fOutputFile.get()) fOutputFile->Publish();
+	if (fOnlineHists.get()) fOnlineHists->Publish();
+}
+
 int rootana::App::midas_online(const char* host, const char* experiment)
 {
 	/*!
@@ -386,6 +818,7 @@ int rootana::App::midas_online(const char* host, const char* experiment)
 
 	/*! - Enter event loop and run until told to exit */
 	rootana::Timer tm(100);
+	PublishTimer publish(this);
 	TApplication::Run(kTRUE);
 
 	// /*! - (Upon exit:) disconnect from experiment */
@@ -424,6 +857,7 @@ void rootana::App::Run(Bool_t)
 void rootana::App::Terminate(Int_t status)
 {
 	do_exit();
+	fCalibration->Unwatch();
 	if (fMidasOnline->Connected()) fMidasOnline.reset(0);
 	TApplication::Terminate(status);
 }
@@ -457,6 +891,9 @@ void rootana::App::run_start(int runnum)
 	rootana::gHeadScaler.set_variables("online", "head");
 	rootana::gTailScaler.set_variables("online", "tail");
 
+	/// Watch the ODB for variables changed during the run
+	if (fMode == ONLINE) fCalibration->WatchOnline();
+
 	bool opened = fOutputFile->Open(runnum, fHistos.c_str());
 	if(!opened) Terminate(1);
 
@@ -471,20 +908,21 @@ void rootana::App::run_stop(int runnum)
 	 */
   fRunNumber = runnum;
 	fQueue->Flush(30, &gDiagnostics);
+	fCalibration->Unwatch();
 	fOutputFile->Close();
 	dragon::utils::Info("rootana") << "End of run " << runnum;
 }
 
 void rootana::App::fill_hists(uint16_t eid)
 {
-	fOutputFile->CallForAll(&rootana::HistBase::fill, eid);
-	fOnlineHists->CallForAll(&rootana::HistBase::fill, eid);
+	fOutputFile->Fill(eid);
+	if (fOnlineHists.get()) fOnlineHists->Fill(eid);
 }
 
 void rootana::App::help()
 {
   printf("\nUsage:\n");
-  printf("\n./anaDragon [-h] [-histos <histogram file>] [-histos0 <histogram file>] [-Qtime] [-Ctime] [-Hhostname] [-Eexptname] [-eMaxEvents] [-P9091] [file1 file2 ...]\n");
+  printf("\n./anaDragon [-h] [-histos <histogram file>] [-histos0 <histogram file>] [-Qtime] [-Ctime] [-Hhostname] [-Eexptname] [-eMaxEvents] [-jThreads] [-index] [-P9091] [file1 file2 ...]\n");
   printf("\n");
   printf("\t-h: print this help message\n");
   printf("\t-T: test mode - start and serve a test histogram\n");
@@ -496,6 +934,9 @@ void rootana::App::help()
 	printf("\t-Ctime: Set coincidence matching window in microseconds (default: 10.0)\n");
   printf("\t-P: Start the TNetDirectory server on specified tcp port (for use with roody -Plocalhost:9091)\n");
   printf("\t-e: Number of events to read from input data files\n");
+  printf("\t-jN: Process offline files in chunks with N threads, where gaps in trigger time allow it\n");
+  printf("\t     (reads the event headers of each file once more to find the gaps, unless it has an index)\n");
+  printf("\t-index: Save an index of each offline file next to it (<file>.midx), used by later -j runs\n");
   printf("\n");
   exit(1);
 }
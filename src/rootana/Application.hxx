@@ -14,8 +14,10 @@
 
 class TFile;
 class TDirectory;
+class TMidasFile;
 namespace midas  { class Event; class Database; }
 namespace tstamp { class Queue; class Diagnostics; }
+namespace dragon { class CalibrationRegistry; }
 
 namespace rootana {
 
@@ -33,6 +35,8 @@ private:
 	int fCutoff;    ///< Event cutoff (offline only)
 	int fReturn;    ///< Return value
 	int fTcp;       ///< TCP port value
+	int fThreads;   ///< Worker threads for offline files (0: process serially)
+	bool fSaveIndex; ///< Save the index of offline files next to them (<file>.midx)
 	double fCoincWindow;        ///< Coincidence window for timestamping
 	std::string fFilename;      ///< Offline file name
 	std::string fHost;          ///< Online host name
@@ -46,6 +50,7 @@ private:
 	std::auto_ptr<MidasOnline> fMidasOnline;    ///< "Online midas" instance
 	std::list<dragon::Head> fHeadProcessed;     ///< Head events already unpacked
 	std::list<dragon::Tail> fTailProcessed;     ///< Tail events already unpacked
+	std::auto_ptr<dragon::CalibrationRegistry> fCalibration; ///< Reloads variables changed during a run
 
 public:
 	/// Calls TApplication constructor
@@ -70,10 +75,10 @@ public:
 	void run_stop(int runnum);
 
 	/// Handle a midas event
-	void handle_event(midas::Event& event);
+	void handle_event(const midas::EventView& event);
 
 	/// Tells how to handle a singles event from the beginning of fQueue
-	void Process(const midas::Event& event);
+	void Process(const midas::EventView& event);
 
 	/// Tells how to handle a coincidence event from the beginning of fQueue
 	void Process(const midas::Event& event1, const midas::Event& event2);
@@ -87,6 +92,12 @@ public:
 	/// Process an offline MIDAS file
 	int midas_file(const char* fname);
 
+	/// Process the rest of an offline MIDAS file in independent chunks
+	int midas_file_chunks(TMidasFile& file, const char* fname);
+
+	/// Adds what the fill plans and worker threads filled so far to the histograms
+	void publish_hists();
+
 	/// Process online MIDAS data
 	int midas_online(const char* host = "", const char* experiment = "dragon");
 
@@ -39,6 +39,8 @@
 #include <TCutG.h>
 #include "utils/ErrorDragon.hxx"
 #include "utils/Functions.hxx"
+#include "AddressMap.hxx"
+#include "FillPlan.hxx"
 
 /// Point-by-point arguments for use with rootana::Condition2D
 #define ROOTANA_CUT2D_POINT_ARGS double x0 = 0, double y0 = 0, double x1 = 0, double y1 = 0, double x2 = 0, double y2 = 0, double x3 = 0, double y3 = 0, double x4 = 0, double y4 = 0, double x5 = 0, double y5 = 0, double x6 = 0, double y6 = 0, double x7 = 0, double y7 = 0, double x8 = 0, double y8 = 0, double x9 = 0, double y9 = 0, double x10 = 0, double y10 = 0, double x11 = 0, double y11 = 0, double x12 = 0, double y12 = 0, double x13 = 0, double y13 = 0
@@ -55,6 +57,19 @@ public:
 	/*! Derived classes should return a \c new instance of themselves */
 	virtual Condition* clone() const = 0;
 
+	/// Virtual "clone" method, relocating the parameters
+	/*! Derived classes should return a \c new instance of themselves, with the
+	 *  addresses of their parameters relocated by \e map (see rootana::AddressMap) */
+	virtual Condition* clone(const AddressMap& map) const = 0;
+
+#ifndef __MAKECINT__
+	/// Appends the instructions evaluating \c this to a FillPlan
+	/*! Returns false if the condition can't be compiled (the default), in which case
+	 *  histograms using it are filled through operator() */
+	virtual bool compile(FillPlan&) const
+		{ return false; }
+#endif
+
 	/// Defines the "cut" logical condition
 	virtual bool operator() () const = 0;
 
@@ -95,6 +110,20 @@ public:
 	/// Returns \c new copy of \c this
 	Condition* clone() const
 		{ return new Equivalency(*this); }
+	/// Returns \c new copy of \c this, comparing the relocated values
+	Condition* clone(const AddressMap& map) const
+		{ return new Equivalency(map.Relocate(fV1), map.Relocate(fV2)); }
+#ifndef __MAKECINT__
+	/// Appends the comparison of fV1 and fV2
+	bool compile(FillPlan& plan) const
+		{
+			FillPlan::Source_t a, b;
+			FillPlan::MakeSource(fV1, a);
+			FillPlan::MakeSource(fV2, b);
+			plan.AddOp(FillPlan::CompareOf<F>::value, &a, &b);
+			return true;
+		}
+#endif
 	/// Applies comparison class's operator() to fV1 and fV2, each converted to double.
 	bool operator() () const
 		{ return F()( fV1, fV2 ); }
@@ -117,6 +146,19 @@ public:
 	/// Returns \c new copy of \c this
 	Condition* clone() const
 		{ return new Validity(*this); }
+	/// Returns \c new copy of \c this, checking the relocated value
+	Condition* clone(const AddressMap& map) const
+		{ return new Validity(map.Relocate(fV1)); }
+#ifndef __MAKECINT__
+	/// Appends the validity check of fV1
+	bool compile(FillPlan& plan) const
+		{
+			FillPlan::Source_t a;
+			FillPlan::MakeSource(fV1, a);
+			plan.AddOp(FillPlan::kValid, &a);
+			return true;
+		}
+#endif
 	/// Checks if fV1 is valid
 	bool operator() () const
 		{ return dragon::utils::is_valid(fV1); }
@@ -151,6 +193,20 @@ public:
 	/// Returns \c new copy of \c this
 	Condition* clone() const
 		{ return new Condition2D(*this); }
+	/// Returns \c new copy of \c this, with relocated parameters
+	Condition* clone(const AddressMap& map) const
+		{ return new Condition2D(*this, map); }
+#ifndef __MAKECINT__
+	/// Appends the polygon check of fXpar, fYpar
+	bool compile(FillPlan& plan) const
+		{
+			FillPlan::Source_t x, y;
+			FillPlan::MakeSource(fXpar, x);
+			FillPlan::MakeSource(fYpar, y);
+			plan.AddInside(x, y, fXpoints, fYpoints);
+			return true;
+		}
+#endif
 
 	/// Checks if parameter points are inside the polygon
 	bool operator() () const
@@ -160,6 +216,10 @@ public:
 		}
 
 private:
+	/// Copy with relocated parameters
+	Condition2D(const Condition2D& other, const AddressMap& map):
+		fXpar(map.Relocate(other.fXpar)), fYpar(map.Relocate(other.fYpar)),
+		fXpoints(other.fXpoints), fYpoints(other.fYpoints) { }
 	/// Checks if the points are inside the polygon
 	template <typename T>
 	bool inside(T xp, T yp, Int_t np, const T* x, const T* y) const
@@ -235,6 +295,9 @@ public:
 	/// Re-asigns fCondition as a deep copy of another Cut
 	void reset(const Cut& other)
 		{ free_(); fCondition = other.fCondition->clone(); }
+	/// Re-asigns fCondition as a deep copy of another Cut, with relocated parameters
+	void reset(const Cut& other, const AddressMap& map)
+		{ free_(); fCondition = other.fCondition ? other.fCondition->clone(map) : 0; }
 
 	/// "Cut" operator, forwards to fCondition->operator()
 	bool operator() () const
@@ -271,6 +334,18 @@ public:
 	/// Returns \c new instance of \c this
 	Condition* clone() const
 		{ return new NegatedCondition(*this); }
+	/// Returns \c new instance of \c this, with relocated parameters
+	Condition* clone(const AddressMap& map) const
+		{ NegatedCondition* c = new NegatedCondition(*this); c->fCut.reset(fCut, map); return c; }
+#ifndef __MAKECINT__
+	/// Appends fCut, then its negation
+	bool compile(FillPlan& plan) const
+		{
+			if (!fCut.get() || !fCut->compile(plan)) return false;
+			plan.AddOp(FillPlan::kNot);
+			return true;
+		}
+#endif
 
 	/// Returns the logical NOT of fCut().
 	bool operator() () const
@@ -296,6 +371,24 @@ public:
 	/// Returns \c new instance of \c this
 	Condition* clone() const
 		{ return new LogicalCondition(*this); }
+	/// Returns \c new instance of \c this, with relocated parameters
+	Condition* clone(const AddressMap& map) const
+		{
+			LogicalCondition* c = new LogicalCondition(*this);
+			c->fCut1.reset(fCut1, map);
+			c->fCut2.reset(fCut2, map);
+			return c;
+		}
+#ifndef __MAKECINT__
+	/// Appends fCut1, fCut2, then the operator
+	bool compile(FillPlan& plan) const
+		{
+			if (!fCut1.get() || !fCut1->compile(plan)) return false;
+			if (!fCut2.get() || !fCut2->compile(plan)) return false;
+			plan.AddOp(FillPlan::LogicalOf<L>::value);
+			return true;
+		}
+#endif
 
 	/// Applies the operator() of template parameter L.
 	bool operator() () const
@@ -311,6 +404,14 @@ public:
 	/// Returns \c new instance of \c this
 	Condition* clone() const
 		{ return new TrueCondition(*this); }
+	/// Returns \c new instance of \c this
+	Condition* clone(const AddressMap&) const
+		{ return new TrueCondition(*this); }
+#ifndef __MAKECINT__
+	/// Appends \c true
+	bool compile(FillPlan& plan) const
+		{ plan.AddOp(FillPlan::kTrue); return true; }
+#endif
 
 	/// Returns \c true
 	bool operator() () const
@@ -326,6 +427,14 @@ public:
 	/// Returns \c new instance of \c this
 	Condition* clone() const
 		{ return new FalseCondition(*this); }
+	/// Returns \c new instance of \c this
+	Condition* clone(const AddressMap&) const
+		{ return new FalseCondition(*this); }
+#ifndef __MAKECINT__
+	/// Appends \c false
+	bool compile(FillPlan& plan) const
+		{ plan.AddOp(FillPlan::kFalse); return true; }
+#endif
 
 	/// Returns \c false
 	bool operator() () const
@@ -6,6 +6,8 @@
 #ifndef ROOTANA_DATA_POINTER_HXX
 #define ROOTANA_DATA_POINTER_HXX
 #include <cassert>
+#include "AddressMap.hxx"
+#include "FillPlan.hxx"
 
 namespace rootana {
 
@@ -29,6 +31,12 @@ public:
 	virtual double get (unsigned index = 0) const = 0;
 	/// Returns array length
 	virtual unsigned length() const = 0;
+	/// Returns a \c new instance pointing to the relocated data
+	virtual DataPointer* clone(const AddressMap& map) const = 0;
+#ifndef __MAKECINT__
+	/// Sets the address, type and length of the data in a FillPlan, false if not supported
+	virtual bool compile(FillPlan::Source_t& source) const = 0;
+#endif
 	/// Create a NULL instance
 	static DataPointer* New ();
 	/// Create from a single value
@@ -60,6 +68,14 @@ public:
 	double get(unsigned index = 0) const;
 	/// Returns array length
 	unsigned length() const { return fLength; }
+	/// Returns a \c new instance pointing to the relocated data
+	DataPointer* clone(const AddressMap& map) const
+		{ return new DataPointerT<T>(&map.Relocate(*fData), fLength); }
+#ifndef __MAKECINT__
+	/// Sets the address, type and length of fData
+	bool compile(FillPlan::Source_t& source) const
+		{ return FillPlan::MakeSource(*fData, source, fLength); }
+#endif
 };
 
 /// Type corresponding to a NULL DataPointer
@@ -70,6 +86,12 @@ public:
 	double get(unsigned index = 0) const;
 	/// Returns zero
 	unsigned length() const { return 0; }
+	/// Returns a \c new NULL instance
+	DataPointer* clone(const AddressMap&) const { return new DataPointerNull(); }
+#ifndef __MAKECINT__
+	/// Returns false, there is no data
+	bool compile(FillPlan::Source_t&) const { return false; }
+#endif
 };
 
 } // namespace rootana
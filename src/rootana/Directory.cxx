@@ -14,7 +14,9 @@
 #include <TObjString.h>
 #include <TDirectory.h>
 #include "utils/ErrorDragon.hxx"
+#include "AddressMap.hxx"
 #include "HistParser.hxx"
+#include "FillPlan.hxx"
 #include "Histos.hxx"
 #include "Directory.hxx"
 
@@ -33,6 +35,9 @@ inline void deleteHist(rootana::HistBase* h) { delete h; }
 
 void rootana::Directory::DeleteHists()
 {
+	for (std::map<uint16_t, FillPlan*>::iterator it = fPlans.begin(); it != fPlans.end(); ++it)
+		delete it->second;
+	fPlans.clear();
 	for (Map_t::iterator it = fHistos.begin(); it != fHistos.end(); ++it) {
 		std::for_each(it->second.begin(), it->second.end(), deleteHist);
 		it->second.clear();
@@ -72,6 +77,7 @@ bool rootana::Directory::IsOpen() const
 
 Int_t rootana::Directory::Write(const char* name, Int_t i, Int_t j)
 {
+	Publish();
 	return fDir->Write(name, i, j);
 }
 
@@ -112,6 +118,38 @@ void rootana::Directory::CreateHists(const char* definitionFile)
 	rootana::HistParser parse (definitionFile);
 	parse.Run();
 	parse.Transfer(this);
+	CompilePlans();
+}
+
+void rootana::Directory::CompilePlans()
+{
+	/*!
+	 * Makes one rootana::FillPlan per event id; histograms which can't be compiled
+	 * are filled by the plan through HistBase::fill().
+	 */
+	size_t compiled = 0, total = 0;
+	for (Map_t::iterator it = fHistos.begin(); it != fHistos.end(); ++it) {
+		FillPlan*& plan = fPlans[it->first];
+		if (!plan) plan = new FillPlan();
+		for (std::list<HistBase*>::iterator ih = it->second.begin(); ih != it->second.end(); ++ih) {
+			if (!(*ih)->compile(*plan)) plan->AddOther(*ih);
+		}
+		compiled += plan->GetNumCompiled();
+		total += plan->GetNumCompiled() + plan->GetNumOthers();
+	}
+	dragon::utils::Info("rootana::Directory")
+		<< "Compiled " << compiled << " of " << total << " histograms into fill plans.";
+}
+
+void rootana::Directory::Fill(uint16_t id)
+{
+	/*!
+	 * Fills through the fill plan of \e id; what was filled is only seen in the
+	 * histograms after Publish() (or Write()).
+	 */
+	std::map<uint16_t, FillPlan*>::iterator it = fPlans.find(id);
+	if (it != fPlans.end())
+		it->second->Fill();
 }
 
 TDirectory* rootana::Directory::CreateSubDirectory(const char* path)
@@ -143,6 +181,100 @@ TDirectory* rootana::Directory::CreateSubDirectory(const char* path)
 	return newDir;
 }
 
+void rootana::Directory::Publish()
+{
+	/*!
+	 * Adds the bins of the fill plans to the histograms, then calls DirectoryShard::Publish()
+	 * for every shard of \c this directory; the histograms then include everything filled
+	 * by Fill(), and what was filled by the worker threads up to their last hand over.
+	 * \attention Call from the thread owning the directory.
+	 */
+	for (std::map<uint16_t, FillPlan*>::iterator it = fPlans.begin(); it != fPlans.end(); ++it)
+		it->second->Publish();
+	for (std::set<DirectoryShard*>::iterator it = fShards.begin(); it != fShards.end(); ++it)
+		(*it)->Publish();
+}
+
+rootana::DirectoryShard::DirectoryShard(Directory& directory, const AddressMap& map, const std::set<uint16_t>& ids):
+	fDirectory(directory), fRequest(0), fReady(0)
+{
+	/*!
+	 * \param directory Directory with the histograms, must outlive the shard
+	 * \param map Relocates the parameters and cuts of the histograms to the worker's event classes
+	 * \param ids Event ids of the histograms to fill
+	 * \attention Call from the thread owning the directory.
+	 * \note Histograms which can't be buffered (rootana::ScalerHist) are skipped with a warning.
+	 */
+	for (std::set<uint16_t>::const_iterator id = ids.begin(); id != ids.end(); ++id) {
+		Directory::Map_t::iterator it = directory.fHistos.find(*id);
+		if (it == directory.fHistos.end()) continue;
+		for (std::list<HistBase*>::iterator ih = it->second.begin(); ih != it->second.end(); ++ih) {
+			HistBuffer* buffer = (*ih)->new_buffer(map);
+			if (!buffer) {
+				dragon::utils::Warning("rootana::DirectoryShard")
+					<< "Histogram \"" << (*ih)->name() << "\" can't be filled in parallel, skipping it.";
+				continue;
+			}
+			fBuffers[*id].push_back(buffer);
+			fAll.push_back(buffer);
+		}
+	}
+	fDirectory.fShards.insert(this);
+}
+
+rootana::DirectoryShard::~DirectoryShard()
+{
+	fDirectory.fShards.erase(this);
+	for (size_t i = 0; i< fAll.size(); ++i)
+		delete fAll[i];
+}
+
+void rootana::DirectoryShard::Fill(uint16_t id)
+{
+	if (fRequest) HandOver();
+	std::map<uint16_t, std::vector<HistBuffer*> >::iterator it = fBuffers.find(id);
+	if (it != fBuffers.end())
+		std::for_each(it->second.begin(), it->second.end(), std::mem_fun(&HistBuffer::fill));
+}
+
+void rootana::DirectoryShard::HandOver()
+{
+	/// \note fReady is set before fRequest is cleared, so Publish() can't ask for another
+	///  set of bins before it has published this one.
+	__sync_synchronize();
+	for (size_t i = 0; i< fAll.size(); ++i)
+		fAll[i]->flip();
+	__sync_synchronize();
+	fReady = 1;
+	__sync_synchronize();
+	fRequest = 0;
+}
+
+void rootana::DirectoryShard::Publish()
+{
+	/// \attention Call from the thread owning the directory.
+	if (fReady) {
+		__sync_synchronize();
+		for (size_t i = 0; i< fAll.size(); ++i)
+			fAll[i]->publish();
+		__sync_synchronize();
+		fReady = 0;
+	}
+	__sync_synchronize();
+	if (!fRequest && !fReady)
+		fRequest = 1;
+}
+
+void rootana::DirectoryShard::Merge()
+{
+	/// \attention Call from the thread owning the directory, after the worker is done filling.
+	__sync_synchronize();
+	for (size_t i = 0; i< fAll.size(); ++i)
+		fAll[i]->publish_all();
+	fRequest = 0;
+	fReady = 0;
+}
+
 rootana::OfflineDirectory::OfflineDirectory(const char* outPath):
 	fOutputPath(outPath)
 {
@@ -7,7 +7,9 @@
 #define ROOTANA_DIRECTORY_HXX
 #include "utils/IntTypes.h"
 #include <map>
+#include <set>
 #include <list>
+#include <vector>
 #include <string>
 #include <memory>
 #include <algorithm>
@@ -17,6 +19,10 @@ class TDirectory;
 namespace rootana {
 
 class HistBase;
+class HistBuffer;
+class AddressMap;
+class FillPlan;
+class DirectoryShard;
 
 /// Abstract rootana directory class.
 /*!
@@ -38,6 +44,12 @@ private:
 	/*! See Map_t typedef */
 	Map_t fHistos;
 
+	/// Compiled fill plans of the histograms, by event id
+	std::map<uint16_t, FillPlan*> fPlans;
+
+	/// Shards filling the histograms from worker threads
+	std::set<DirectoryShard*> fShards;
+
 	/// Internal ROOT directory
 	/*!
 	 * \note Derived classes may set this to a specific type using the Reset() method.
@@ -64,6 +76,10 @@ public:
 	void Reset (TDirectory* newDir) { fDir.reset(newDir); }
 	/// Adds a histogram to \c this directory
 	void AddHist(rootana::HistBase* hist, const char* path, uint16_t eventId);
+	/// Fills all histograms with event id \e id
+	void Fill(uint16_t id);
+	/// Adds what was filled so far by the fill plans and shards of \c this directory to the histograms
+	void Publish();
 	/// Virtual method to open (initialize) the directory
 	virtual bool Open(Int_t, const char*) = 0;
 	/// Virtual method to close (cleanup) the directory
@@ -86,10 +102,14 @@ protected:
 private:
 	/// Creates a sub directory with the given path name
 	TDirectory* CreateSubDirectory(const char* path);
+	/// Compiles the histograms into fill plans
+	void CompilePlans();
 	/// Disallow copying
 	Directory(const Directory& other) { }
 	/// Disallow assignment
 	Directory& operator= (const Directory& other) { return *this; }
+	/// Needs access to fHistos and fShards
+	friend class DirectoryShard;
 
 public:
 	/// Calls a specific member function for all histograms (or all w/ a given ID)
@@ -156,6 +176,66 @@ public:
 	void Close();
 };
 
+/// Buffers of the histograms in a Directory, filled by one worker thread
+/*!
+ * A dense bin buffer (rootana::HistBuffer) is made for each of the histograms
+ * with the given event ids, with parameters and cuts relocated by an AddressMap to
+ * the worker's own event classes. The worker fills the buffers without any locking.
+ *
+ * The thread owning the directory adds the buffers to the histograms with Publish()
+ * while the worker is running, e.g. on a timer or before the histograms are viewed
+ * (Directory::Publish() does this for all shards of a directory), and with Merge()
+ * once it is done. Publish() never waits for the worker: it adds the set of bins
+ * the worker last handed over, and asks for the next one. The worker hands it over
+ * at the start of the next Fill(), by switching all of its buffers to the other set
+ * of bins, so a published snapshot always contains whole events.
+ * \code
+ * std::set<uint16_t> ids;
+ * ids.insert(DRAGON_HEAD_EVENT);
+ * rootana::AddressMap map;
+ * map.Add(rootana::gHead, workerHead);
+ * rootana::DirectoryShard shard(directory, map, ids); // in the main thread
+ * shard.Fill(DRAGON_HEAD_EVENT);                      // in the worker thread
+ * shard.Publish();                                    // in the main thread, any time
+ * shard.Merge();                                      // in the main thread, after the worker is done
+ * \endcode
+ */
+class DirectoryShard {
+public:
+	/// Makes buffers for the histograms of \e directory with the given event ids
+	DirectoryShard(Directory& directory, const AddressMap& map, const std::set<uint16_t>& ids);
+	/// Deletes the buffers
+	~DirectoryShard();
+	/// Fills the buffers of histograms with event id \e id
+	void Fill(uint16_t id);
+	/// Adds the bins handed over by the worker to the histograms
+	void Publish();
+	/// Adds all bins to the histograms
+	void Merge();
+
+private:
+	/// Switches the buffers to the other set of bins (worker thread)
+	void HandOver();
+
+private:
+	/// Directory owning the histograms
+	Directory& fDirectory;
+	/// Buffers, by event id
+	std::map<uint16_t, std::vector<HistBuffer*> > fBuffers;
+	/// All buffers
+	std::vector<HistBuffer*> fAll;
+	/// Set by Publish() to ask for a set of bins, cleared by the worker
+	volatile int fRequest;
+	/// Set by the worker when a set of bins was handed over, cleared by Publish()
+	volatile int fReady;
+
+private:
+	/// Disallow copying
+	DirectoryShard(const DirectoryShard&);
+	/// Disallow assignment
+	DirectoryShard& operator= (const DirectoryShard&);
+};
+
 } // namespace rootana
 
 
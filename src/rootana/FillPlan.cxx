@@ -0,0 +1,369 @@
+/*!
+ * \file FillPlan.cxx
+ * \author G. Christian
+ * \brief Implements FillPlan.hxx
+ */
+#include <algorithm>
+#include <RVersion.h>
+#include <TH1.h>
+#include "utils/Valid.hxx"
+#include "Histos.hxx"
+#include "Cut.hxx"
+#include "FillPlan.hxx"
+
+
+namespace {
+
+typedef rootana::FillPlan FP;
+
+template <class T>
+inline double get(const void* address, unsigned index)
+{
+	return static_cast<const T*>(address)[index];
+}
+
+template <class T>
+inline bool valid(const void* address)
+{
+	return dragon::utils::is_valid(*static_cast<const T*>(address));
+}
+
+/// Value of a parameter converted to double, as DataPointerT<T>::get()
+inline double value(const FP::Source_t& source, unsigned index = 0)
+{
+	switch (source.fType) {
+	case FP::kChar:    return get<Char_t>   (source.fAddress, index);
+	case FP::kShort:   return get<Short_t>  (source.fAddress, index);
+	case FP::kInt:     return get<Int_t>    (source.fAddress, index);
+	case FP::kLong:    return get<Long_t>   (source.fAddress, index);
+	case FP::kLong64:  return get<Long64_t> (source.fAddress, index);
+	case FP::kUChar:   return get<UChar_t>  (source.fAddress, index);
+	case FP::kUShort:  return get<UShort_t> (source.fAddress, index);
+	case FP::kUInt:    return get<UInt_t>   (source.fAddress, index);
+	case FP::kULong:   return get<ULong_t>  (source.fAddress, index);
+	case FP::kULong64: return get<ULong64_t>(source.fAddress, index);
+	case FP::kFloat:   return get<Float_t>  (source.fAddress, index);
+	default:           return get<Double_t> (source.fAddress, index);
+	}
+}
+
+/// Validity of a parameter in its own type, as rootana::Validity
+inline bool is_valid(const FP::Source_t& source)
+{
+	switch (source.fType) {
+	case FP::kChar:    return valid<Char_t>   (source.fAddress);
+	case FP::kShort:   return valid<Short_t>  (source.fAddress);
+	case FP::kInt:     return valid<Int_t>    (source.fAddress);
+	case FP::kLong:    return valid<Long_t>   (source.fAddress);
+	case FP::kLong64:  return valid<Long64_t> (source.fAddress);
+	case FP::kUChar:   return valid<UChar_t>  (source.fAddress);
+	case FP::kUShort:  return valid<UShort_t> (source.fAddress);
+	case FP::kUInt:    return valid<UInt_t>   (source.fAddress);
+	case FP::kULong:   return valid<ULong_t>  (source.fAddress);
+	case FP::kULong64: return valid<ULong64_t>(source.fAddress);
+	case FP::kFloat:   return valid<Float_t>  (source.fAddress);
+	default:           return valid<Double_t> (source.fAddress);
+	}
+}
+
+/// Same as rootana::Condition2D::inside()
+inline bool inside(double xp, double yp, size_t np, const double* x, const double* y)
+{
+	bool oddNodes = false;
+	for (size_t i = 0, j = np - 1; i < np; j = i++) {
+		if ((y[i]<yp && y[j]>=yp) || (y[j]<yp && y[i]>=yp)) {
+			if (x[i]+(yp-y[i])/(y[j]-y[i])*(x[j]-x[i])<xp) {
+				oddNodes = !oddNodes;
+			}
+		}
+	}
+	return oddNodes;
+}
+
+}
+
+
+rootana::FillPlan::FillPlan()
+{
+	;
+}
+
+bool rootana::FillPlan::AddHist(TH1* hist, const Source_t* params, const Condition* cut)
+{
+	/*!
+	 * \param hist Histogram, as filled by rootana::Hist<T>::fill(); its dimension decides
+	 *  the number of parameters used
+	 * \param params Parameters of the x, y and z axes
+	 * \param cut Cut condition, NULL if none
+	 * \returns true if the histogram was added, false if it can't be compiled (then
+	 *  nothing is changed)
+	 */
+	Entry_t entry;
+	entry.fDim = hist->GetDimension();
+	entry.fSummary = false;
+	if (entry.fDim < 1 || entry.fDim > 3) return false;
+	if (!SetBinning(entry, hist)) return false;
+	for (int i = 0; i < entry.fDim; ++i) {
+		if (params[i].fType == kNoType) return false;
+		entry.fParams[i] = params[i];
+	}
+	if (!SetCut(entry, cut)) return false;
+	Append(entry);
+	return true;
+}
+
+bool rootana::FillPlan::AddSummary(TH1* hist, const Source_t& params, const Condition* cut)
+{
+	/*!
+	 * \param hist Two-dimensional histogram, as filled by rootana::SummaryHist::fill()
+	 * \param params Array parameter, one element per y bin
+	 * \param cut Cut condition, NULL if none
+	 * \returns true if the histogram was added, false if it can't be compiled (then
+	 *  nothing is changed)
+	 */
+	Entry_t entry;
+	entry.fDim = hist->GetDimension();
+	entry.fSummary = true;
+	if (entry.fDim != 2) return false;
+	if (!SetBinning(entry, hist)) return false;
+	if (params.fType == kNoType || params.fLength < (unsigned)entry.fAxes[1].fNbins) return false;
+	entry.fParams[0] = params;
+	if (!SetCut(entry, cut)) return false;
+	Append(entry);
+	return true;
+}
+
+bool rootana::FillPlan::SetBinning(Entry_t& entry, TH1* hist)
+{
+	/*!
+	 * Histograms which could change their binning while filling (automatic binning,
+	 * extendable axes) or with variable bin widths are not compiled.
+	 */
+	if (hist->GetBuffer()) return false;
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+	if (hist->CanExtendAllAxes()) return false;
+#else
+	if (hist->TestBit(TH1::kCanRebin)) return false;
+#endif
+
+	const TAxis* axes[3] = { hist->GetXaxis(), hist->GetYaxis(), hist->GetZaxis() };
+	entry.fSize = 1;
+	for (int i = 0; i < 3; ++i) {
+		Axis_t& axis = entry.fAxes[i];
+		axis.fNbins = 1;
+		axis.fMin = 0.;
+		axis.fMax = 1.;
+		if (i >= entry.fDim) continue;
+		if (axes[i]->GetXbins()->GetSize() != 0) return false;
+		axis.fNbins = axes[i]->GetNbins();
+		axis.fMin = axes[i]->GetXmin();
+		axis.fMax = axes[i]->GetXmax();
+		if (axis.fNbins < 1 || !(axis.fMin < axis.fMax)) return false;
+		entry.fSize *= axis.fNbins + 2;
+	}
+	entry.fCells[0] = entry.fAxes[0].fNbins + 2;
+	entry.fCells[1] = entry.fDim > 1 ? entry.fAxes[1].fNbins + 2 : 1;
+	entry.fHist = hist;
+	return true;
+}
+
+bool rootana::FillPlan::SetCut(Entry_t& entry, const Condition* cut)
+{
+	/*! On failure, the instructions already appended by \e cut are removed. */
+	const size_t codeSize = fCode.size(), polygonsSize = fPolygons.size();
+	entry.fCutBegin = entry.fCutEnd = codeSize;
+	if (!cut) return true;
+
+	bool success = cut->compile(*this);
+	int depth = 0, maxDepth = 0;
+	for (size_t i = codeSize; i < fCode.size() && success; ++i) {
+		switch (fCode[i].fCode) {
+		case kNoOp: success = false; break;
+		case kNot: success = depth >= 1; break;
+		case kAnd: case kOr: success = depth >= 2; --depth; break;
+		default: ++depth; break;
+		}
+		maxDepth = std::max(depth, maxDepth);
+	}
+	if (!success || depth != 1) {
+		fCode.resize(codeSize);
+		fPolygons.resize(polygonsSize);
+		return false;
+	}
+
+	entry.fCutEnd = fCode.size();
+	if (fStack.size() < (size_t)maxDepth) fStack.resize(maxDepth);
+	return true;
+}
+
+void rootana::FillPlan::Append(Entry_t& entry)
+{
+	entry.fOffset = fContent.size();
+	entry.fEntries = 0.;
+	std::fill(entry.fStats, entry.fStats + 11, 0.);
+	fContent.resize(fContent.size() + entry.fSize, 0.);
+	fEntries.push_back(entry);
+}
+
+void rootana::FillPlan::AddOp(int code, const Source_t* a, const Source_t* b)
+{
+	/*!
+	 * \param code OpCode_t of the instruction; kNoOp is appended as is, and makes the
+	 *  cut being compiled fail
+	 * \param a First parameter, if any
+	 * \param b Second parameter, if any
+	 */
+	Op_t op;
+	op.fCode = code;
+	op.fA.fAddress = op.fB.fAddress = 0;
+	op.fA.fType = op.fB.fType = kNoType;
+	op.fA.fLength = op.fB.fLength = 0;
+	if (a) op.fA = *a;
+	if (b) op.fB = *b;
+	op.fPolygon = op.fNpoints = 0;
+	if ((a && a->fType == kNoType) || (b && b->fType == kNoType))
+		op.fCode = kNoOp;
+	fCode.push_back(op);
+}
+
+void rootana::FillPlan::AddInside(const Source_t& x, const Source_t& y,
+																	const std::vector<double>& xpoints, const std::vector<double>& ypoints)
+{
+	AddOp(kInside, &x, &y);
+	Op_t& op = fCode.back();
+	op.fPolygon = fPolygons.size();
+	op.fNpoints = std::min(xpoints.size(), ypoints.size());
+	fPolygons.insert(fPolygons.end(), xpoints.begin(), xpoints.begin() + op.fNpoints);
+	fPolygons.insert(fPolygons.end(), ypoints.begin(), ypoints.begin() + op.fNpoints);
+}
+
+bool rootana::FillPlan::ApplyCut(const Entry_t& entry)
+{
+	if (entry.fCutBegin == entry.fCutEnd) return true;
+
+	char* stack = &fStack[0];
+	int n = 0;
+	for (size_t i = entry.fCutBegin; i < entry.fCutEnd; ++i) {
+		const Op_t& op = fCode[i];
+		switch (op.fCode) {
+		case kTrue:         stack[n++] = true; break;
+		case kFalse:        stack[n++] = false; break;
+		case kValid:        stack[n++] = is_valid(op.fA); break;
+		case kLess:         stack[n++] = value(op.fA) <  value(op.fB); break;
+		case kLessEqual:    stack[n++] = value(op.fA) <= value(op.fB); break;
+		case kGreater:      stack[n++] = value(op.fA) >  value(op.fB); break;
+		case kGreaterEqual: stack[n++] = value(op.fA) >= value(op.fB); break;
+		case kEqual:        stack[n++] = value(op.fA) == value(op.fB); break;
+		case kNotEqual:     stack[n++] = value(op.fA) != value(op.fB); break;
+		case kInside:
+			stack[n++] = op.fNpoints &&
+				inside(value(op.fA), value(op.fB), op.fNpoints,
+							 &fPolygons[op.fPolygon], &fPolygons[op.fPolygon + op.fNpoints]);
+			break;
+		case kNot: stack[n-1] = !stack[n-1]; break;
+		case kAnd: --n; stack[n-1] = stack[n-1] && stack[n]; break;
+		case kOr:  --n; stack[n-1] = stack[n-1] || stack[n]; break;
+		default: break;
+		}
+	}
+	return stack[0];
+}
+
+void rootana::FillPlan::Count(Entry_t& entry, double x, double y, double z)
+{
+	/*! Same as TH1::Fill(), TH2::Fill() and TH3::Fill() with unit weight */
+	const Int_t binx = FindBin(entry.fAxes[0], x);
+	const Int_t biny = entry.fDim > 1 ? FindBin(entry.fAxes[1], y) : 0;
+	const Int_t binz = entry.fDim > 2 ? FindBin(entry.fAxes[2], z) : 0;
+	fContent[entry.fOffset + binx + entry.fCells[0] * (biny + entry.fCells[1] * binz)] += 1.;
+	entry.fEntries += 1.;
+
+	const bool inRange = binx > 0 && binx <= entry.fAxes[0].fNbins &&
+		(entry.fDim < 2 || (biny > 0 && biny <= entry.fAxes[1].fNbins)) &&
+		(entry.fDim < 3 || (binz > 0 && binz <= entry.fAxes[2].fNbins));
+	if (!inRange) return;
+	double* s = entry.fStats;
+	s[0] += 1.; s[1] += 1.; s[2] += x; s[3] += x*x;
+	if (entry.fDim < 2) return;
+	s[4] += y; s[5] += y*y; s[6] += x*y;
+	if (entry.fDim < 3) return;
+	s[7] += z; s[8] += z*z; s[9] += x*z; s[10] += y*z;
+}
+
+void rootana::FillPlan::Fill()
+{
+	/*! Same as calling fill() for each histogram of the plan */
+	for (std::vector<Entry_t>::iterator it = fEntries.begin(); it != fEntries.end(); ++it) {
+		Entry_t& entry = *it;
+		if (entry.fSummary) {
+			if (!ApplyCut(entry)) continue;
+			for (Int_t bin = 0; bin < entry.fAxes[1].fNbins; ++bin) {
+				const double x = value(entry.fParams[0], bin);
+				if (dragon::utils::is_valid(x)) Count(entry, x, bin);
+			}
+			continue;
+		}
+
+		const double x = value(entry.fParams[0]);
+		const double y = entry.fDim > 1 ? value(entry.fParams[1]) : 0.;
+		const double z = entry.fDim > 2 ? value(entry.fParams[2]) : 0.;
+		if (!dragon::utils::is_valid(x) ||
+				(entry.fDim > 1 && !dragon::utils::is_valid(y)) ||
+				(entry.fDim > 2 && !dragon::utils::is_valid(z)))
+			continue;
+		if (ApplyCut(entry))
+			Count(entry, x, y, z);
+	}
+
+	for (std::vector<HistBase*>::iterator it = fOthers.begin(); it != fOthers.end(); ++it)
+		(*it)->fill();
+}
+
+void rootana::FillPlan::Publish()
+{
+	/*! \attention The histograms are not updated by Fill(), only by this function. */
+	for (std::vector<Entry_t>::iterator it = fEntries.begin(); it != fEntries.end(); ++it)
+		AddToHist(it->fHist, &fContent[it->fOffset], it->fSize, it->fStats, it->fEntries);
+}
+
+void rootana::FillPlan::AddToHist(TH1* hist, double* content, size_t ncells, double* stats, double& entries)
+{
+	/*!
+	 * \param hist Histogram to add to
+	 * \param content Bin contents, in the order of TH1::GetBin()
+	 * \param ncells Number of bins, including under- and overflow
+	 * \param stats Statistics, as in TH1::GetStats()
+	 * \param entries Number of entries
+	 * \note All contents are assumed to have unit weight, as from TH1::Fill(x).
+	 */
+	if (entries == 0.) return;
+
+	// With a range set on an axis (e.g. zoomed in a canvas), TH1::GetStats() returns
+	// the sums of the bins within the range, not the full range sums which PutStats()
+	// sets; so the ranges are turned off while getting the sums
+	TAxis* axes[3] = { hist->GetXaxis(), hist->GetYaxis(), hist->GetZaxis() };
+	bool ranges[3];
+	for (int i = 0; i < 3; ++i) {
+		ranges[i] = axes[i]->TestBit(TAxis::kAxisRange);
+		axes[i]->SetBit(TAxis::kAxisRange, false);
+	}
+	double sums[11] = { 0. };
+	hist->GetStats(sums);
+	for (int i = 0; i < 3; ++i)
+		axes[i]->SetBit(TAxis::kAxisRange, ranges[i]);
+
+	TArrayD* sumw2 = hist->GetSumw2N() ? hist->GetSumw2() : 0;
+	for (size_t bin = 0; bin < ncells; ++bin) {
+		if (content[bin] == 0.) continue;
+		hist->AddBinContent(bin, content[bin]);
+		if (sumw2) (*sumw2)[bin] += content[bin];
+		content[bin] = 0.;
+	}
+	for (int i = 0; i < 11; ++i) {
+		sums[i] += stats[i];
+		stats[i] = 0.;
+	}
+	hist->PutStats(sums);
+	hist->SetEntries(hist->GetEntries() + entries);
+	entries = 0.;
+}
@@ -0,0 +1,221 @@
+/*!
+ * \file FillPlan.hxx
+ * \author G. Christian
+ * \brief Defines a flat, "compiled" form of the rootana histograms of one event type.
+ */
+#ifndef ROOTANA_FILL_PLAN_HXX
+#define ROOTANA_FILL_PLAN_HXX
+#ifndef __MAKECINT__
+#include <vector>
+#include <cstddef>
+#include <functional>
+#include <Rtypes.h>
+
+class TH1;
+
+namespace rootana {
+
+class HistBase;
+class Condition;
+
+/// Histograms of one event type, compiled into plain arrays that are filled in a single loop
+/*!
+ * Each histogram whose parameters, cut and binning can be described by plain data
+ * is compiled into an entry holding the address and type of its parameters, the range
+ * of its cut in a shared array of instructions (a small stack machine in postfix order),
+ * and its fixed binning. Fill() evaluates all entries in one loop, with no virtual calls,
+ * computes the bin indices directly and counts into one contiguous array of bin contents.
+ * Publish() adds those bins, with the matching statistics and number of entries, to the
+ * ROOT histograms.
+ *
+ * Histograms, cuts and parameters describe themselves through their compile() methods
+ * (HistBase::compile(), Condition::compile(), DataPointer::compile()). Histograms which
+ * can't be compiled (scaler histograms, variable or automatic binning, user-defined
+ * conditions) are filled as before by their own fill() method, from Fill().
+ *
+ * The results are the same as filling each histogram with TH1::Fill(), except that
+ * the ROOT histograms are only updated by Publish().
+ * \code
+ * rootana::FillPlan plan;
+ * for (std::list<rootana::HistBase*>::iterator it = hists.begin(); it != hists.end(); ++it) {
+ *    if (!(*it)->compile(plan))
+ *       plan.AddOther(*it);
+ * }
+ * // for each event:
+ * plan.Fill();
+ * // every so often, and before writing:
+ * plan.Publish();
+ * \endcode
+ */
+class FillPlan {
+public:
+	/// Parameter types (those linked in CutLinkdef.h)
+	enum Type_t {
+		kNoType = -1, kChar, kShort, kInt, kLong, kLong64,
+		kUChar, kUShort, kUInt, kULong, kULong64, kFloat, kDouble
+	};
+
+	/// Cut instructions
+	enum OpCode_t {
+		kNoOp = -1,
+		kTrue,         ///< Push true
+		kFalse,        ///< Push false
+		kValid,        ///< Push dragon::utils::is_valid(a)
+		kLess,         ///< Push a < b
+		kLessEqual,    ///< Push a <= b
+		kGreater,      ///< Push a > b
+		kGreaterEqual, ///< Push a >= b
+		kEqual,        ///< Push a == b
+		kNotEqual,     ///< Push a != b
+		kInside,       ///< Push (a, b) inside polygon
+		kNot,          ///< Pop one, push its negation
+		kAnd,          ///< Pop two, push their AND
+		kOr            ///< Pop two, push their OR
+	};
+
+	/// Address, type and length of a parameter
+	struct Source_t {
+		const void* fAddress; ///< Address of the (first) value
+		int fType;            ///< Type_t of the value
+		unsigned fLength;     ///< Number of values (arrays)
+	};
+
+	/// Type_t of a C++ type, kNoType if not supported
+	template <class T> struct TypeOf { enum { value = kNoType }; };
+	/// OpCode_t of a comparison class (Equivalency), kNoOp if not supported
+	template <class F> struct CompareOf { enum { value = kNoOp }; };
+	/// OpCode_t of a logical class (LogicalCondition), kNoOp if not supported
+	template <class L> struct LogicalOf { enum { value = kNoOp }; };
+
+private:
+	/// One cut instruction
+	struct Op_t {
+		int fCode;          ///< OpCode_t
+		Source_t fA;        ///< First parameter
+		Source_t fB;        ///< Second parameter
+		size_t fPolygon;    ///< Index of the first x point in fPolygons, followed by the y points (kInside)
+		size_t fNpoints;    ///< Number of points (kInside)
+	};
+
+	/// Fixed binning of one axis, as in TAxis
+	struct Axis_t {
+		Int_t fNbins;  ///< Number of bins
+		double fMin;   ///< Low edge
+		double fMax;   ///< High edge
+	};
+
+	/// One compiled histogram
+	struct Entry_t {
+		int fDim;              ///< Dimension, 1 to 3
+		bool fSummary;         ///< Filled as a rootana::SummaryHist
+		Source_t fParams[3];   ///< Parameters, one per axis (only x for summary histograms)
+		size_t fCutBegin;      ///< First instruction of the cut
+		size_t fCutEnd;        ///< One past the last instruction of the cut
+		Axis_t fAxes[3];       ///< Binning
+		Int_t fCells[2];       ///< Number of x and y bins, including under- and overflow
+		size_t fOffset;        ///< Offset of the first bin in fContent
+		size_t fSize;          ///< Number of bins, including under- and overflow
+		double fStats[11];     ///< Sums of weights, x, x^2, etc., as in TH1::GetStats()
+		double fEntries;       ///< Number of entries
+		TH1* fHist;            ///< ROOT histogram
+	};
+
+public:
+	/// Empty plan
+	FillPlan();
+	/// Adds a 1-, 2- or 3-d histogram filled from \e params, if it can be compiled
+	bool AddHist(TH1* hist, const Source_t* params, const Condition* cut);
+	/// Adds a summary histogram filled from the array \e params, if it can be compiled
+	bool AddSummary(TH1* hist, const Source_t& params, const Condition* cut);
+	/// Adds a histogram which couldn't be compiled, filled by its own fill() method
+	void AddOther(HistBase* hist)
+		{ fOthers.push_back(hist); }
+	/// Appends a cut instruction
+	void AddOp(int code, const Source_t* a = 0, const Source_t* b = 0);
+	/// Appends a polygon cut instruction
+	void AddInside(const Source_t& x, const Source_t& y,
+								 const std::vector<double>& xpoints, const std::vector<double>& ypoints);
+	/// Fills all histograms
+	void Fill();
+	/// Adds the bins filled since the last call to the ROOT histograms
+	void Publish();
+	/// Returns the number of compiled histograms
+	size_t GetNumCompiled() const { return fEntries.size(); }
+	/// Returns the number of histograms filled by their own fill() method
+	size_t GetNumOthers() const { return fOthers.size(); }
+
+	/// Sets \e source to the address, type and length of \e value
+	template <class T>
+	static bool MakeSource(const T& value, Source_t& source, unsigned length = 1)
+		{
+			source.fAddress = &value;
+			source.fType = TypeOf<T>::value;
+			source.fLength = length;
+			return source.fType != kNoType;
+		}
+	/// Adds bin contents and statistics to a histogram, and zeroes them
+	static void AddToHist(TH1* hist, double* content, size_t ncells, double* stats, double& entries);
+
+private:
+	/// Copies the binning of \e hist, false if it isn't fixed
+	bool SetBinning(Entry_t& entry, TH1* hist);
+	/// Compiles the cut of \e entry, false if it can't be
+	bool SetCut(Entry_t& entry, const Condition* cut);
+	/// Allocates the bins of \e entry, and appends it
+	void Append(Entry_t& entry);
+	/// Evaluates the cut of \e entry
+	bool ApplyCut(const Entry_t& entry);
+	/// Counts one entry at (x, y, z)
+	void Count(Entry_t& entry, double x, double y = 0., double z = 0.);
+	/// Returns the bin of \e x, as TAxis::FindFixBin()
+	static Int_t FindBin(const Axis_t& axis, double x)
+		{
+			if (x < axis.fMin) return 0;
+			if (!(x < axis.fMax)) return axis.fNbins + 1;
+			return 1 + int(axis.fNbins * (x - axis.fMin) / (axis.fMax - axis.fMin));
+		}
+
+private:
+	/// Compiled histograms
+	std::vector<Entry_t> fEntries;
+	/// Bin contents of all compiled histograms
+	std::vector<double> fContent;
+	/// Cut instructions of all compiled histograms
+	std::vector<Op_t> fCode;
+	/// Polygon points of all kInside instructions
+	std::vector<double> fPolygons;
+	/// Evaluation stack of the cuts
+	std::vector<char> fStack;
+	/// Histograms filled by their own fill() method (not owned)
+	std::vector<HistBase*> fOthers;
+};
+
+#ifndef DOXYGEN_SKIP
+template <> struct FillPlan::TypeOf<Char_t>    { enum { value = kChar }; };
+template <> struct FillPlan::TypeOf<Short_t>   { enum { value = kShort }; };
+template <> struct FillPlan::TypeOf<Int_t>     { enum { value = kInt }; };
+template <> struct FillPlan::TypeOf<Long_t>    { enum { value = kLong }; };
+template <> struct FillPlan::TypeOf<Long64_t>  { enum { value = kLong64 }; };
+template <> struct FillPlan::TypeOf<UChar_t>   { enum { value = kUChar }; };
+template <> struct FillPlan::TypeOf<UShort_t>  { enum { value = kUShort }; };
+template <> struct FillPlan::TypeOf<UInt_t>    { enum { value = kUInt }; };
+template <> struct FillPlan::TypeOf<ULong_t>   { enum { value = kULong }; };
+template <> struct FillPlan::TypeOf<ULong64_t> { enum { value = kULong64 }; };
+template <> struct FillPlan::TypeOf<Float_t>   { enum { value = kFloat }; };
+template <> struct FillPlan::TypeOf<Double_t>  { enum { value = kDouble }; };
+
+template <> struct FillPlan::CompareOf<std::less<double> >          { enum { value = kLess }; };
+template <> struct FillPlan::CompareOf<std::less_equal<double> >    { enum { value = kLessEqual }; };
+template <> struct FillPlan::CompareOf<std::greater<double> >       { enum { value = kGreater }; };
+template <> struct FillPlan::CompareOf<std::greater_equal<double> > { enum { value = kGreaterEqual }; };
+template <> struct FillPlan::CompareOf<std::equal_to<double> >      { enum { value = kEqual }; };
+template <> struct FillPlan::CompareOf<std::not_equal_to<double> >  { enum { value = kNotEqual }; };
+
+template <> struct FillPlan::LogicalOf<std::logical_and<Condition> > { enum { value = kAnd }; };
+template <> struct FillPlan::LogicalOf<std::logical_or<Condition> >  { enum { value = kOr }; };
+#endif
+
+} // namespace rootana
+
+#endif // #ifndef __MAKECINT__
+#endif
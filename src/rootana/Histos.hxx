@@ -9,6 +9,8 @@
 #include <TH2D.h>
 #include <TH3D.h>
 #include <TDirectory.h>
+#include <vector>
+#include <algorithm>
 #include "utils/Valid.hxx"
 #include "DataPointer.hxx"
 #include "Cut.hxx"
@@ -18,6 +20,8 @@
 /// \brief Encloses all rootana-specific classes
 namespace rootana {
 
+class HistBuffer;
+
 /// Abstract interface for Rootana histograms
 /*!
  * Provides a pure virtual interface with functions needed in the standard
@@ -38,6 +42,10 @@ public:
 	void set_cut(const Cut& cut);
   /// Applies the cut condition
 	bool apply_cut();
+protected:
+	/// Returns the cut condition
+	const Cut& get_cut() const { return fCut; }
+public:
 
 	/// Fills the histogram with appropriate data
 	virtual Int_t fill() = 0;
@@ -53,6 +61,12 @@ public:
 	virtual const char* name() const = 0;
 	/// Sets owner TDirectory
 	virtual void set_directory(TDirectory*) = 0;
+	/// Returns a buffer filled from relocated parameters, to be added to the histogram
+	virtual HistBuffer* new_buffer(const AddressMap& map) const = 0;
+#ifndef __MAKECINT__
+	/// Adds the histogram to a fill plan, false if it can't be compiled
+	virtual bool compile(FillPlan& plan) const = 0;
+#endif
 	/// For testing
 	void test() { printf ("test\n"); }
 };
@@ -121,6 +135,12 @@ public:
 			fHist->SetDirectory(directory);
 			fHistOwner = directory;
 		}
+	/// Returns a buffer with the binning of fHist, filled from relocated parameters
+	virtual HistBuffer* new_buffer(const AddressMap& map) const;
+#ifndef __MAKECINT__
+	/// Adds fHist, its parameters and cut to a fill plan
+	virtual bool compile(FillPlan& plan) const;
+#endif
 };
 
 /// Specialized case of TH2D that displays "summary" information
@@ -137,6 +157,12 @@ public:
 	virtual ~SummaryHist() { }
 	/// Override the fill() method to act appropriately for summary histograms
 	virtual Int_t fill();
+	/// Returns a buffer filled like a summary histogram, from relocated parameters
+	virtual HistBuffer* new_buffer(const AddressMap& map) const;
+#ifndef __MAKECINT__
+	/// Adds fHist, its parameter array and cut to a fill plan
+	virtual bool compile(FillPlan& plan) const;
+#endif
 };
 
 
@@ -156,11 +182,109 @@ public:
 	~ScalerHist() { }
 	/// Override fill() method to correspond to scaler display
 	virtual Int_t fill();
+	/// Not supported, scaler histograms depend on the order of all scaler events
+	virtual HistBuffer* new_buffer(const AddressMap&) const
+		{ return 0; }
+#ifndef __MAKECINT__
+	/// Not supported, for the same reason
+	virtual bool compile(FillPlan&) const
+		{ return false; }
+#endif
 private:
 	/// Extend the x-axis
 	void extend(double factor);
 };
 
+/// Dense array of bin contents, filled in place of a histogram by a worker thread
+/*!
+ * Has the binning of the histogram it is made for, and parameters and a cut
+ * relocated to the worker's event classes (see rootana::AddressMap). Filling
+ * only touches the buffer, so needs no locking; the contents are added to the
+ * histogram later by the thread owning it, with publish().
+ *
+ * There are two sets of bins: the worker fills the active one, while the other
+ * one can be published. flip() (worker) swaps them; the caller must make sure
+ * that the set being published is not the one being filled, see
+ * rootana::DirectoryShard. The second set is only allocated at the first flip().
+ *
+ * \note As with TH1::Fill(), statistics (mean, RMS) only count entries within the
+ *  histogram range.
+ */
+class HistBuffer {
+public:
+	/// Copies the binning of \e target, takes ownership of the parameters
+	HistBuffer(TH1* target, const DataPointer* paramx, const DataPointer* paramy, const DataPointer* paramz);
+	/// Frees the parameters
+	virtual ~HistBuffer();
+	/// Sets the cut to a copy of \e cut, with relocated parameters
+	void set_cut(const Cut& cut, const AddressMap& map)
+		{ fCut.reset(cut, map); }
+	/// Fills the active bins from the parameters, if the cut is satisfied
+	virtual Int_t fill();
+	/// Fills the other set of bins from now on
+	void flip();
+	/// Adds the set of bins not being filled to the histogram, and empties it
+	void publish()
+		{ publish(fBins[!fActive]); }
+	/// Adds both sets of bins to the histogram, and empties them
+	void publish_all()
+		{ publish(fBins[0]); publish(fBins[1]); }
+
+protected:
+	/// Applies the cut condition
+	bool apply_cut()
+		{ return !fCut.get() ? true : fCut(); }
+	/// Counts one entry at (x, y, z)
+	void count(double x, double y = 0., double z = 0.);
+
+protected:
+	const DataPointer* fParamx; ///< X-axis parameter
+	const DataPointer* fParamy; ///< Y-axis parameter
+	const DataPointer* fParamz; ///< Z-axis parameter
+	TAxis fXaxis;               ///< X binning of the histogram
+	TAxis fYaxis;               ///< Y binning of the histogram
+	TAxis fZaxis;               ///< Z binning of the histogram
+
+private:
+	/// Bin contents and statistics, as in TH1::GetStats()
+	struct Bins_t {
+		std::vector<double> fContent; ///< Bin contents, in the order of TH1::GetBin()
+		double fStats[11];            ///< Sums of weights, x, x^2, etc.
+		double fEntries;              ///< Number of entries
+	};
+
+private:
+	/// Adds \e bins to the histogram, and empties them
+	void publish(Bins_t& bins);
+	/// Allocates and empties \e bins
+	void reset(Bins_t& bins);
+
+private:
+	TH1* fTarget;    ///< Histogram the buffer is added to
+	Int_t fDim;      ///< Dimension of fTarget
+	Int_t fCellsX;   ///< Number of x bins, including under- and overflow
+	Int_t fCellsY;   ///< Number of y bins, including under- and overflow (1 for 1d)
+	Cut fCut;        ///< Cut (gate) condition
+	Bins_t fBins[2]; ///< Sets of bins
+	int fActive;     ///< Index of the set being filled
+
+private:
+	/// Disallow copy
+	HistBuffer(const HistBuffer&);
+	/// Disallow assign
+	HistBuffer& operator= (const HistBuffer&);
+};
+
+/// Buffer filled like a rootana::SummaryHist
+class SummaryBuffer: public HistBuffer {
+public:
+	/// Calls HistBuffer constructor, with \e paramArray as x parameter
+	SummaryBuffer(TH2D* target, const DataPointer* paramArray):
+		HistBuffer(target, paramArray, DataPointer::New(), DataPointer::New()) { }
+	/// Fills bin-by-bin like SummaryHist::fill()
+	virtual Int_t fill();
+};
+
 
 // INLINE IMPLEMENTATIONS //
 
@@ -188,6 +312,29 @@ inline rootana::Hist<T>::~Hist()
 	delete fParamz;
 }
 
+template <class T>
+inline rootana::HistBuffer* rootana::Hist<T>::new_buffer(const AddressMap& map) const
+{
+	/*! \returns New buffer (owned by the caller) for fHist, with parameters and cut relocated by \e map */
+	HistBuffer* buffer = new HistBuffer(fHist, fParamx->clone(map), fParamy->clone(map), fParamz->clone(map));
+	buffer->set_cut(get_cut(), map);
+	return buffer;
+}
+
+#ifndef __MAKECINT__
+template <class T>
+inline bool rootana::Hist<T>::compile(FillPlan& plan) const
+{
+	/*! \returns true if fHist was added to \e plan, false if it has to be filled by fill() */
+	FillPlan::Source_t params[3];
+	const DataPointer* data[3] = { fParamx, fParamy, fParamz };
+	for (Int_t i = 0; i < fHist->GetDimension() && i < 3; ++i) {
+		if (!data[i]->compile(params[i])) return false;
+	}
+	return plan.AddHist(fHist, params, get_cut().get());
+}
+#endif
+
 template <class T>
 inline rootana::Hist<T>::Hist(const Hist& other)
 {
@@ -350,6 +497,123 @@ inline Int_t rootana::SummaryHist::fill()
 	return filled;
 }
 
+inline rootana::HistBuffer* rootana::SummaryHist::new_buffer(const AddressMap& map) const
+{
+	HistBuffer* buffer = new SummaryBuffer(fHist, fParamx->clone(map));
+	buffer->set_cut(get_cut(), map);
+	return buffer;
+}
+
+#ifndef __MAKECINT__
+inline bool rootana::SummaryHist::compile(FillPlan& plan) const
+{
+	/*! \returns true if fHist was added to \e plan, false if it has to be filled by fill() */
+	FillPlan::Source_t params;
+	return fParamx->compile(params) && plan.AddSummary(fHist, params, get_cut().get());
+}
+#endif
+
+// Hist Buffer //
+
+inline rootana::HistBuffer::HistBuffer(TH1* target, const DataPointer* paramx,
+																			 const DataPointer* paramy, const DataPointer* paramz):
+	fParamx(paramx), fParamy(paramy), fParamz(paramz),
+	fXaxis(*target->GetXaxis()), fYaxis(*target->GetYaxis()), fZaxis(*target->GetZaxis()),
+	fTarget(target), fDim(target->GetDimension()), fCut(0), fActive(0)
+{
+	/*!
+	 * \param target Histogram to add the buffer to, must outlive the buffer
+	 * \param paramx, paramy, paramz Parameters to fill from, as in Hist<T>; unused ones are
+	 *  DataPointerNull
+	 * \attention Call from the thread owning \e target.
+	 */
+	fCellsX = fXaxis.GetNbins() + 2;
+	fCellsY = fDim > 1 ? fYaxis.GetNbins() + 2 : 1;
+	reset(fBins[0]);
+}
+
+inline rootana::HistBuffer::~HistBuffer()
+{
+	delete fParamx;
+	delete fParamy;
+	delete fParamz;
+}
+
+inline void rootana::HistBuffer::reset(Bins_t& bins)
+{
+	const Int_t cellsZ = fDim > 2 ? fZaxis.GetNbins() + 2 : 1;
+	bins.fContent.assign(fCellsX * fCellsY * cellsZ, 0.);
+	std::fill(bins.fStats, bins.fStats + 11, 0.);
+	bins.fEntries = 0.;
+}
+
+inline Int_t rootana::HistBuffer::fill()
+{
+	/*! Fills the bins if the parameters are valid and fCut is satisfied, same as Hist<T>::fill() */
+	switch (fDim) {
+	case 1:
+		if (!dragon::utils::is_valid(fParamx->get()) || !apply_cut()) return 0;
+		count(fParamx->get());
+		return 1;
+	case 2:
+		if (!dragon::utils::is_valid(fParamx->get(), fParamy->get()) || !apply_cut()) return 0;
+		count(fParamx->get(), fParamy->get());
+		return 1;
+	default:
+		if (!dragon::utils::is_valid(fParamx->get(), fParamy->get(), fParamz->get()) || !apply_cut()) return 0;
+		count(fParamx->get(), fParamy->get(), fParamz->get());
+		return 1;
+	}
+}
+
+inline void rootana::HistBuffer::count(double x, double y, double z)
+{
+	Bins_t& bins = fBins[fActive];
+	const Int_t binx = fXaxis.FindFixBin(x);
+	const Int_t biny = fDim > 1 ? fYaxis.FindFixBin(y) : 0;
+	const Int_t binz = fDim > 2 ? fZaxis.FindFixBin(z) : 0;
+	bins.fContent[binx + fCellsX * (biny + fCellsY * binz)] += 1.;
+	bins.fEntries += 1.;
+
+	const bool inRange = binx > 0 && binx <= fXaxis.GetNbins() &&
+		(fDim < 2 || (biny > 0 && biny <= fYaxis.GetNbins())) &&
+		(fDim < 3 || (binz > 0 && binz <= fZaxis.GetNbins()));
+	if (!inRange) return;
+	double* s = bins.fStats;
+	s[0] += 1.; s[1] += 1.; s[2] += x; s[3] += x*x;
+	if (fDim < 2) return;
+	s[4] += y; s[5] += y*y; s[6] += x*y;
+	if (fDim < 3) return;
+	s[7] += z; s[8] += z*z; s[9] += x*z; s[10] += y*z;
+}
+
+inline void rootana::HistBuffer::flip()
+{
+	fActive = !fActive;
+	if (fBins[fActive].fContent.empty())
+		reset(fBins[fActive]);
+}
+
+inline void rootana::HistBuffer::publish(Bins_t& bins)
+{
+	/*! \attention Call from the thread owning the histogram. */
+	FillPlan::AddToHist(fTarget, &bins.fContent[0], bins.fContent.size(), bins.fStats, bins.fEntries);
+}
+
+inline Int_t rootana::SummaryBuffer::fill()
+{
+	/*! If the cut is satisfied, fills bin-by-bin whenever the corresponding param is valid */
+	Int_t filled = 0;
+	if (!apply_cut()) return filled;
+	for (Int_t bin = 0; bin < fYaxis.GetNbins(); ++bin) {
+		if (dragon::utils::is_valid(fParamx->get(bin))) {
+			count(fParamx->get(bin), bin);
+			filled = 1;
+		}
+	}
+	return filled;
+}
+
 } // namespace rootana
 
 #endif
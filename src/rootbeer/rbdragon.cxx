@@ -22,18 +22,20 @@
 #include "utils/Functions.hxx"
 #include "midas/Database.hxx"
 #include "midas/Event.hxx"
+#include "Registry.hxx"
 #include "rbdragon.hxx"
 
 
 //
-// Helper function to process unpacked events
-namespace { void process_events(const std::vector<Int_t>& codes)
-{
-	for (size_t i=0; i< codes.size(); ++i) {
-		rb::Event* event = rb::Rint::gApp()->GetEvent (codes[i]);
-		if(event) event->Process(0, 0);
-	}
-} }
+// Sink passing unpacked events to the corresponding rb::Event
+namespace { class EventSink: public dragon::Unpacker::Sink {
+public:
+	void Fill(int32_t code)
+		{
+			rb::Event* event = rb::Rint::gApp()->GetEvent (code);
+			if(event) event->Process(0, 0);
+		}
+} gEventSink; }
 
 #define G_ERROR_RESET(level) ErrorReset err_reset_dummy_123456789 (level)
 namespace { class ErrorReset {
@@ -47,6 +49,20 @@ public:
 
 namespace { Int_t gAutoZero = 1; bool gAutoZeroOdb = true; }
 
+//
+// Variables reloaded while a run is in progress
+namespace { dragon::CalibrationRegistry& calibration()
+{
+	static dragon::CalibrationRegistry* registry = 0;
+	if(!registry) {
+		registry = new dragon::CalibrationRegistry();
+		registry->Add(rb::Event::Instance<rbdragon::GammaEvent>()->Get());
+		registry->Add(rb::Event::Instance<rbdragon::HeavyIonEvent>()->Get());
+		registry->Add(rb::Event::Instance<rbdragon::CoincEvent>()->Get());
+	}
+	return *registry;
+} }
+
 
 // ============ Free Functions ============ //
 
@@ -76,6 +92,17 @@ bool rbdragon::GetAutoZeroOdb()
 	return gAutoZeroOdb;
 }
 
+bool rbdragon::WatchVariables(const char* source)
+{
+	if(!source || !strlen(source)) {
+		calibration().Unwatch();
+		return true;
+	}
+	if(!strcmp(source, "online"))
+		return calibration().WatchOnline();
+	return calibration().WatchFile(source);
+}
+
 
 
 // ============ Class rbdragon::MidasBuffer ============ //
@@ -94,8 +121,15 @@ rbdragon::MidasBuffer::MidasBuffer():
 {
 	///
 	/// Set transition priorities different from default (750 for stop), set buffer size to 1024*1024,
-	/// initialize fUnpacker w/ rb::Event<> instances.
-	;
+	/// initialize fUnpacker w/ rb::Event<> instances, and have it send all events to their rb::Event.
+	const Int_t codes[] = {
+		DRAGON_HEAD_EVENT, DRAGON_HEAD_SCALER, DRAGON_TAIL_EVENT, DRAGON_TAIL_SCALER,
+		DRAGON_COINC_EVENT, DRAGON_TSTAMP_DIAGNOSTICS, DRAGON_RUN_PARAMETERS,
+		DRAGON_AUX_SCALER, DRAGON_EPICS_EVENT
+	};
+	for (size_t i=0; i< sizeof(codes) / sizeof(codes[0]); ++i)
+		fUnpacker.SetSink(codes[i], &gEventSink);
+	calibration();
 }
 
 
@@ -123,6 +157,10 @@ void rbdragon::MidasBuffer::RunStartTransition(Int_t runnum)
 		midas::Database db("online");
 		ReadVariables(&db);
 
+		// Keep following the ODB during the run, unless watching a file
+		if (calibration().GetSource() != dragon::CalibrationRegistry::kFile)
+			calibration().WatchOnline();
+
 		// Also set auto zero level from "/dragon/rootbeer/AutoZero"
 		{
 			Int_t autoZeroLevel = 0;
@@ -215,24 +253,7 @@ void rbdragon::MidasBuffer::RunStopTransition(Int_t runnum)
 
 	/// - Flush timestamp queue (max 15 seconds for online)
 	Int_t flush_time = fType == ONLINE ? 15 : -1;
-	time_t t_begin = time(0);
-	size_t qsize;
-	while (1) {
-		if (flush_time >= 0 &&
-				(difftime(time(0), t_begin) > flush_time))
-			break;
-
-		fUnpacker.ClearUnpackedCodes();
-		qsize = fUnpacker.FlushQueueIterative(); // Fills classes implicitly
-		if (qsize == 0) break;
-
-		std::vector<Int_t> v = fUnpacker.GetUnpackedCodes();
-		process_events(v);
-	} 
-	if (qsize) {
-		fUnpacker.GetQueue()->FlushTimeoutMessage(flush_time);
-		fUnpacker.GetQueue()->Clear();
-	}
+	fUnpacker.HandleEor(flush_time);
 
 	/// - Print delayed error messages
 	dragon::utils::gDelayedMessageFactory.Flush();
@@ -263,11 +284,17 @@ Bool_t rbdragon::MidasBuffer::UnpackEvent(void* header, char* data)
 	if (phead->fEventId == MIDAS_BOR) {
 		midas::Database db(data, phead->fDataSize);
 		ReadVariables(&db);
+		// A watched file takes precedence over the run's ODB dump
+		if (calibration().GetSource() == dragon::CalibrationRegistry::kFile)
+			calibration().Invalidate();
 	}
 
-	/// - For all other events, delegate to rb::Unpacker, then call the Process() function
-	std::vector<Int_t> v = fUnpacker.UnpackMidasEvent(phead, data);
-	process_events(v);
+	/// - Apply variables which changed since the last event (see rbdragon::WatchVariables())
+	calibration().Update();
+
+	/// - For all other events, delegate to dragon::Unpacker, which calls the Process() function
+	///   of the rb::Event for each unpacked event
+	fUnpacker.HandleMidasEvent(phead, data);
 
 	return kTRUE;
 }
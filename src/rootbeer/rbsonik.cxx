@@ -27,37 +27,25 @@
 
 
 
-rbsonik::MidasBuffer::MidasBuffer():
-	rbdragon::MidasBuffer() { }
-
-Bool_t rbsonik::MidasBuffer::UnpackEvent(void* header, char* data)
-{
-	///
-	/// Does the following:
-
-	midas::Event::Header* phead = reinterpret_cast<midas::Event::Header*>(header);
-
-	/// - If BOR event (ODB dump), set variables from there
-	if (phead->fEventId == MIDAS_BOR) {
-		midas::Database db(data, phead->fDataSize);
-
-		// read variables
-		this->ReadVariables(&db);
-	}
-
-	/// - For all other events, delegate to rb::Unpacker, then call the Process() function
-	std::vector<Int_t> codes = fUnpacker.UnpackMidasEvent(phead, data);
-
-	for (size_t i=0; i< codes.size(); ++i) {
-		rb::Event* event = rb::Rint::gApp()->GetEvent (codes[i]);
-		if(event) event->Process(0, 0);
-
-		if(event && codes[i] == DRAGON_TAIL_EVENT) {
-			rb::Event::Instance<SonikEvent>()->Process(0,0);
+//
+// Tail sink, processes the tail event and then SONIK
+namespace { class SonikSink: public dragon::Unpacker::Sink {
+public:
+	void Fill(int32_t code)
+		{
+			rb::Event* event = rb::Rint::gApp()->GetEvent (code);
+			if(event) {
+				event->Process(0, 0);
+				rb::Event::Instance<rbsonik::SonikEvent>()->Process(0,0);
+			}
 		}
-	}
+} gSonikSink; }
 
-	return kTRUE;
+rbsonik::MidasBuffer::MidasBuffer():
+	rbdragon::MidasBuffer()
+{
+	/// Tail events are also processed as SONIK events
+	fUnpacker.SetSink(DRAGON_TAIL_EVENT, &gSonikSink);
 }
 
 
@@ -35,8 +35,6 @@ public:
 	MidasBuffer();
 	/// No actions needed
 	virtual ~MidasBuffer() { }
-	/// Look at the event id and handle as appropriate.
-	virtual Bool_t UnpackEvent(void* header, char* data);
 };
 
 
@@ -24,6 +24,14 @@ void SetAutoZeroOdb(bool on);
 /// Check SetAutoZeroOdb()
 bool GetAutoZeroOdb();
 
+/// \brief Reload detector variables whenever they change, while the run continues.
+/// \param source Name of an XML file to watch, or "online" to watch the ODB (the default
+///   at the start of online runs if SetAutoZeroOdb() is on). An empty string stops watching.
+/// \returns true if successful
+/// \note Only the ODB directories read by the head, tail and coincidence variables are
+///   watched, and only the ones which changed are read again.
+bool WatchVariables(const char* source = "online");
+
 }
 
 
@@ -3,6 +3,7 @@
 /// \brief Implements parts of ErrorDragon.hxx
 ///
 #include <algorithm>
+#include <pthread.h>
 #include "ErrorDragon.hxx"
 
 
@@ -28,6 +29,18 @@ struct msgPrint {
 struct msgDelete {
 	void operator() (std::pair<const int64_t, dutils::ADelayedMessagePrinter*>& element) { delete element.second;   }
 }; 
+pthread_mutex_t gFactoryMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t gMessageMutex = PTHREAD_MUTEX_INITIALIZER;
+}
+
+void dutils::LockMessages()
+{
+	pthread_mutex_lock(&gMessageMutex);
+}
+
+void dutils::UnlockMessages()
+{
+	pthread_mutex_unlock(&gMessageMutex);
 }
 
 void dutils::DelayedMessageFactory::Flush()
@@ -35,6 +48,16 @@ void dutils::DelayedMessageFactory::Flush()
 	std::for_each(fPrinters.begin(), fPrinters.end(), msgPrint());
 }
 
+void dutils::DelayedMessageFactory::Lock()
+{
+	pthread_mutex_lock(&gFactoryMutex);
+}
+
+void dutils::DelayedMessageFactory::Unlock()
+{
+	pthread_mutex_unlock(&gFactoryMutex);
+}
+
 dutils::DelayedMessageFactory::~DelayedMessageFactory()
 {
 	std::for_each(fPrinters.begin(), fPrinters.end(), msgDelete());
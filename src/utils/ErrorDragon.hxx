@@ -24,6 +24,18 @@ namespace { std::ostream NullStream(0); }
 
 namespace dragon { namespace utils {
 
+/// Take the lock serializing messages printed from several threads
+/*!
+ * All Info, Warning and Error messages are formatted into a private buffer and
+ * written out as a whole while holding this lock, so messages from unpacking threads
+ * (e.g. dragon::UnpackPipeline workers) don't interleave. Code printing directly to
+ * std::cout / std::cerr from threads can take it too.
+ */
+void LockMessages();
+
+/// Release the lock taken by LockMessages()
+void UnlockMessages();
+
 /// Utility to temporarily change the error ignore level
 /*! Enclose in `{ ... }` blocks to get desired bahavior */
 class ChangeErrorIgnore {
@@ -77,7 +89,7 @@ class Strm: public AStrm {
 public:
 	/// Sets the message formatting.
 	Strm(const char* what, const char* where, const char* file, int line, std::ostream& stream, bool ignore):
-		AStrm(&stream), fIgnore(ignore)
+		AStrm(&fBuffer), fOut(stream), fIgnore(ignore)
 		{
 			/*!
 			 * \param what The type of message (error, warning, etc.)
@@ -98,9 +110,17 @@ public:
 			}
 		}
 
-	/// Automatic printing of std::endl
-	virtual ~Strm() { if(!fIgnore) std::endl(*fStream); }
+	/// Automatic printing of std::endl, the message is written out as a whole
+	virtual ~Strm()
+		{
+			if(fIgnore) return;
+			LockMessages();
+			fOut << fBuffer.str() << std::endl;
+			UnlockMessages();
+		}
 private:
+	std::ostringstream fBuffer;
+	std::ostream& fOut;
 	bool fIgnore;
 };
 
@@ -154,6 +174,7 @@ public:
 		{
 			int line = fLine >= 0 ? fLine : __LINE__;
 			const char* file = fLine >= 0 ? fFile.c_str() : __FILE__;
+			LockMessages();
 			if(fUseMidas) {
 				if(gErrorIgnoreLevel <= 1000)
 					cm_msg(MT_INFO, file, line, fWhere.c_str(), "%s",
@@ -164,6 +185,7 @@ public:
 				if(fLine >= 0) rstrm << file << ", " << line << ", ";
 				rstrm << fWhere << ">: " << static_cast<std::stringstream*>(fStream)->str() << "\n";
 			}
+			UnlockMessages();
 			delete fStream;
 		}
 private:
@@ -191,6 +213,7 @@ public:
 		{
 			int line = fLine >= 0 ? fLine : __LINE__;
 			const char* file = fLine >= 0 ? fFile.c_str() : __FILE__;
+			LockMessages();
 			if(fUseMidas) {
 				if(gErrorIgnoreLevel <= 3000)
 					cm_msg(MT_ERROR, file, line, fWhere.c_str(), "%s",
@@ -201,6 +224,7 @@ public:
 				if(fLine >= 0) rstrm << file << ", " << line << ", ";
 				rstrm << fWhere << ">: " << static_cast<std::stringstream*>(fStream)->str() << "\n";
 			}
+			UnlockMessages();
 			delete fStream;
 		}
 private:
@@ -228,6 +252,7 @@ public:
 		{
 			int line = fLine >= 0 ? fLine : __LINE__;
 			const char* file = fLine >= 0 ? fFile.c_str() : __FILE__;
+			LockMessages();
 			if(fUseMidas) {
 				if(gErrorIgnoreLevel <= 2000)
 					cm_msg(MT_ERROR, file, line, fWhere.c_str(), "(Warning) %s",
@@ -238,6 +263,7 @@ public:
 				if(fLine >= 0) rstrm << file << ", " << line << ", ";
 				rstrm << fWhere << ">: " << static_cast<std::stringstream*>(fStream)->str() << "\n";
 			}
+			UnlockMessages();
 			delete fStream;
 		}
 private:
@@ -403,6 +429,12 @@ public:
 	/// Print messages for all registered printers
 	void Flush();
 
+	/// Lock the factory before Get() / Register() / Incr() from multiple threads
+	void Lock();
+
+	/// Release the lock taken by Lock()
+	void Unlock();
+
 private:
 	DelayedMessageFactory(const DelayedMessageFactory&) { }
 	DelayedMessageFactory& operator= (const DelayedMessageFactory&) { return *this; }
@@ -531,6 +531,69 @@ inline void zero_suppress1(T* values, L length, const T2& threshold)
 	}
 }
 
+/// Steps performed by calibrate(), in addition to linear calibration
+enum CalibrateStep_t {
+	CAL_LINEAR    = 0x0, ///< Linear calibration only
+	CAL_PEDESTAL  = 0x1, ///< Pedestal subtraction (before zero suppression and calibration)
+	CAL_THRESHOLD = 0x2  ///< Zero suppression (after pedestal subtraction, before calibration)
+};
+
+#ifndef __MAKECINT__
+#ifndef DOXYGEN_SKIP
+namespace calibrate_impl {
+template <bool B> struct Pedestal {
+	template <class V> static double get(const V&, int) { return 0.; }
+};
+template <> struct Pedestal<true> {
+	template <class V> static double get(const V& variables, int i) { return variables.pedestal[i]; }
+};
+}
+#endif
+
+/// Fused pedestal subtraction, zero suppression and linear calibration of an array
+/*!
+ * Does the same as calling, in order,
+ * \code
+ * pedestal_subtract(array, length, variables); // if Steps & CAL_PEDESTAL
+ * zero_suppress1(array, length, threshold);    // if Steps & CAL_THRESHOLD
+ * linear_calibrate(array, length, variables);
+ * \endcode
+ * with identical results, but in a single pass over the array. The steps are
+ * selected at compile time, and the loop body has no branches (invalid values are
+ * passed through with a select), so that the compiler can vectorize it.
+ *
+ * \tparam Steps Bitwise OR of CalibrateStep_t values
+ * \tparam T type of the values in the array
+ * \tparam L type of the array length identifier
+ * \tparam V variables class, must have public \c slope[] and \c offset[] fields, and
+ *  \c pedestal[] if \e Steps includes CAL_PEDESTAL
+ * \param [out] array Array of values to calibrate
+ * \param [in] length Length of the array
+ * \param [in] variables Calibration variables
+ * \param [in] threshold Zero suppression threshold, used if \e Steps includes CAL_THRESHOLD
+ *
+ * Usage example:
+ * \code
+ * // pedestal subtract, suppress everything below 10, calibrate
+ * utils::calibrate<utils::CAL_PEDESTAL | utils::CAL_THRESHOLD>(ecal, 30, variables.adc, 10.);
+ * \endcode
+ *
+ * \note Any values initially set to dragon::DR_NO_DATA are left untouched
+ */
+template <int Steps, class T, class L, class V>
+inline void calibrate(T* array, L length, const V& variables, T threshold = 0)
+{
+	const T nodata = dragon::NoData<T>::value();
+	for (L i=0; i< length; ++i) {
+		const T raw = array[i];
+		const T ped = raw - calibrate_impl::Pedestal<(Steps & CAL_PEDESTAL) != 0>::get(variables, i);
+		const T sup = (Steps & CAL_THRESHOLD) && ped < threshold ? 0 : ped;
+		const T cal = variables.offset[i] + sup * variables.slope[i];
+		array[i] = raw == nodata ? raw : ped == nodata ? ped : cal;
+	}
+}
+#endif
+
 /// Perform linear calibration on a single value
 /*!
  *  New = slope * Old + offset
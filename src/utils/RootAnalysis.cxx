@@ -7,7 +7,9 @@
 #include <string>
 #include <cassert>
 #include <sstream>
+#include <queue>
 #include <numeric>
+#include <functional>
 #include <algorithm>
 
 #include <TMath.h>
@@ -20,6 +22,8 @@
 #include <TRegexp.h>
 #include <TFitResult.h>
 #include <TDataMember.h>
+#include <TStopwatch.h>
+#include <TChainElement.h>
 #include <TTreeFormula.h>
 
 #include "midas/Database.hxx"
@@ -30,6 +34,7 @@
 #include "LinearFitter.hxx"
 #include "TAtomicMass.h"
 #include "RootAnalysis.hxx"
+#include "TreeCut.hxx"
 
 
 namespace dutils = dragon::utils;
@@ -86,6 +91,16 @@ public:
 	}
 };
 
+//
+// Holds the ROOT lock (TThread::Lock()) until destroyed or released
+class ThreadLock_t {
+	Bool_t fLocked;
+public:
+	ThreadLock_t(): fLocked(kTRUE) { TThread::Lock(); }
+	~ThreadLock_t() { Release(); }
+	void Release() { if(fLocked) TThread::UnLock(); fLocked = kFALSE; }
+};
+
 //
 // Delete a pointer and reset to NULL
 template <class T> void Zap(T*& t) 
@@ -290,7 +305,7 @@ Double_t dragon::MetricPrefix::Get(const char* prefix)
 // ============ Class dragon::TTreeFilter ============ //
 
 dragon::TTreeFilter::TTreeFilter(const char* filename, const char* option, const char* ftitle, Int_t compress):
-	fRunThreaded(kTRUE)
+	fRunThreaded(kTRUE), fNumThreads(0), fTaskEntries(0)
 {
 	/// Create a new TFile to be used for filter output.
 	/// For explanation of parameters, see the <a href = http://root.cern.ch/root/html/TFile.html#TFile:TFile@2>
@@ -303,7 +318,7 @@ dragon::TTreeFilter::TTreeFilter(const char* filename, const char* option, const
 }
 
 dragon::TTreeFilter::TTreeFilter(TDirectory* output):
-	fRunThreaded(kTRUE)
+	fRunThreaded(kTRUE), fNumThreads(0), fTaskEntries(0)
 {
 	/// Create a filter into a currently existing directory (file).
 	/// \param output Currently existing directory in which to place the output tree.
@@ -331,6 +346,9 @@ Bool_t dragon::TTreeFilter::CheckCondition(TTree* tree) const
 	const char* condition = GetFilterCondition(tree);
 	if(!condition) return kFALSE;
 
+	TreeCut cut;
+	if(cut.Compile(tree, condition)) return kTRUE;
+
 	Long64_t N = tree->Draw("1", condition, "goff", 1);
 	return N >= 0;
 }
@@ -414,6 +432,152 @@ void * run_thread(void* input)
 	return (void*)nfiltered;
 } }
 
+namespace {
+struct FilterTask_t {
+	TTree* fIn;             // input tree
+	const char* fCondition; // filter condition
+	Bool_t fReopen;         // read from a new chain over the files of fIn, not from fIn itself
+	Long64_t fFirst;        // first entry
+	Long64_t fEntries;      // number of entries
+	Int_t fCompress;        // compression settings (algorithm and level) of the temporary file
+	TString fTemp;          // temporary file
+	Long64_t fNout;         // number of entries written, -1 if failed
+};
+
+struct FilterQueue_t {
+	std::vector<FilterTask_t>* fTasks;
+	size_t fNext;
+};
+
+//
+// Check if a tree can be read again from its files by reopen_tree()
+Bool_t can_reopen(TTree* in)
+{
+	if(in->GetListOfFriends() && in->GetListOfFriends()->GetSize())
+		return kFALSE;
+	if(in->InheritsFrom(TChain::Class()))
+		return kTRUE;
+	return in->GetCurrentFile() && in->GetDirectory() && !in->GetCurrentFile()->IsWritable();
+}
+
+//
+// New chain over the same files and entries as _in_, with the same aliases
+TChain* reopen_tree(TTree* in)
+{
+	TChain* chain = new TChain(in->GetName(), in->GetTitle());
+	if(in->InheritsFrom(TChain::Class())) {
+		TIter next(static_cast<TChain*>(in)->GetListOfFiles());
+		while(TChainElement* element = static_cast<TChainElement*>(next()))
+			chain->AddFile(element->GetTitle(), element->GetEntries(), element->GetName());
+	}
+	else {
+		TString path = in->GetDirectory()->GetPath(); // "file.root:/subdir"
+		TString tname = path(path.Index(":/") + 2, path.Length());
+		if(tname.Length()) tname += "/";
+		tname += in->GetName();
+		chain->AddFile(in->GetCurrentFile()->GetName(), in->GetEntries(), tname);
+	}
+	if(in->GetListOfAliases()) {
+		TIter next(in->GetListOfAliases());
+		while(TObject* alias = next())
+			chain->SetAlias(alias->GetName(), alias->GetTitle());
+	}
+	return chain;
+}
+
+//
+// Fill the entries [first, first+n) of _in_ passing _condition_ into _out_, as TTree::CopyTree();
+// the cut and formula are made under TThread::Lock(), the entries are read unlocked
+Long64_t filter_entries(TTree* in, TTree* out, const char* condition, Long64_t first, Long64_t n)
+{
+	dragon::TreeCut cut;
+	std::auto_ptr<TTreeFormula> select(0);
+	ThreadLock_t lock;
+	in->LoadTree(first);
+	if(condition && *condition && !cut.Compile(in, condition))
+		select.reset(new TTreeFormula("Selection", condition, in));
+	lock.Release();
+
+	Int_t treenumber = -1;
+	for(Long64_t entry = first; entry< first + n; ++entry) {
+		const Long64_t localEntry = in->LoadTree(entry);
+		if(localEntry < 0) break;
+		if(treenumber != in->GetTreeNumber()) {
+			treenumber = in->GetTreeNumber();
+			ThreadLock_t formulaLock;
+			if(cut.IsCompiled() && !cut.UpdateLeaves()) { // not in this file, use TTreeFormula
+				cut = dragon::TreeCut();
+				select.reset(new TTreeFormula("Selection", condition, in));
+			}
+			if(select.get()) select->UpdateFormulaLeaves();
+		}
+		if(cut.IsCompiled()) {
+			if(!cut.Pass(localEntry)) continue;
+		}
+		else if(select.get()) {
+			Bool_t keep = kFALSE;
+			const Int_t ndata = select->GetNdata();
+			for(Int_t i=0; i< ndata && !keep; ++i)
+				keep = (select->EvalInstance(i) != 0);
+			if(!keep) continue;
+		}
+		in->GetEntry(entry);
+		out->Fill();
+	}
+	return out->GetEntries();
+}
+
+//
+// Thread function: filter tasks into their temporary files until none are left
+void* filter_worker(void* arg)
+{
+	FilterQueue_t* queue = static_cast<FilterQueue_t*>(arg);
+	while(1) {
+		TThread::Lock();
+		size_t itask = queue->fNext++;
+		TThread::UnLock();
+		if(itask >= queue->fTasks->size()) break;
+
+		FilterTask_t& task = queue->fTasks->at(itask);
+
+		TThread::Lock();
+		TDirectory* current = gDirectory;
+		TTree* in = task.fReopen ? reopen_tree(task.fIn) : task.fIn;
+		in->LoadTree(task.fFirst);
+		TFile* temp = new TFile(task.fTemp, "RECREATE", "", task.fCompress);
+		TTree* out = temp->IsZombie() ? 0 : in->CloneTree(0);
+		if(out) out->SetDirectory(temp);
+		if(current) current->cd();
+		TThread::UnLock();
+
+		//
+		// Filter one file at a time: the next file of a chain is opened by LoadTree(),
+		// which has to be under the lock
+		if(out) {
+			task.fNout = 0;
+			const Long64_t end = task.fFirst + task.fEntries;
+			for(Long64_t first = task.fFirst; first< end; ) {
+				TThread::Lock();
+				const Long64_t localEntry = in->LoadTree(first);
+				const Long64_t last = localEntry < 0 ? first :
+					std::min(end, first - localEntry + in->GetTree()->GetEntries());
+				TThread::UnLock();
+				if(last <= first) break;
+				task.fNout = filter_entries(in, out, task.fCondition, first, last - first);
+				first = last;
+			}
+		}
+
+		TThread::Lock();
+		if(out) temp->Write();
+		delete temp;
+		if(task.fReopen) delete in;
+		if(current) current->cd();
+		TThread::UnLock();
+	}
+	return 0;
+} }
+
 Int_t dragon::TTreeFilter::Run()
 {
 	if(IsZombie()) {
@@ -425,9 +589,7 @@ Int_t dragon::TTreeFilter::Run()
 		return -1;
 	}
 
-	std::vector<std::pair<TThread*, ThreadArgs_t*> > threads;
-	threads.reserve(fInputs.size());
-
+	std::vector<Map_t::iterator> inputs;
 	for(Map_t::iterator i = fInputs.begin(); i != fInputs.end(); ++i) {
 		if(CheckCondition(i->first) == kFALSE) {
 			utils::Warning("TTreeFilter::Run", __FILE__, __LINE__) 
@@ -435,67 +597,146 @@ Int_t dragon::TTreeFilter::Run()
 				<< "\" for TTree at " << i->first << ", skipping.";
 			continue;
 		}
-		
-		// Construct arguments
-		ThreadArgs_t *args = new ThreadArgs_t();
-		args->fIn     = i->first;
-		args->fOut    = &(i->second.fTree);
-		args->fOutDir = GetOutDir();
-		args->fCondition = i->second.fCondition;
+		inputs.push_back(i);
+	}
 
-		// Construct thread and add to list
-		TThread *thread =	GetThreaded() ? new TThread(run_thread, args) : 0;
-		threads.push_back(std::make_pair(thread, args));
+	Int_t nthreads = 1;
+	if(GetThreaded()) {
+		nthreads = fNumThreads;
+		if(nthreads <= 0) {
+			SysInfo_t info;
+			nthreads = gSystem->GetSysInfo(&info) == 0 ? info.fCpus : 1;
+		}
+		nthreads = std::max(1, nthreads);
 	}
-	
+
 	//
 	// Initial message
 	std::cout 
 		<< "Running the following filters:\n"
 		<< "\t<tree name>, <num events>, <filter condition>\n";
-	for(size_t i=0; i< threads.size(); ++i)
-		std::cout << "\t" << threads[i].second->fIn->GetName()    << ", "
-							<<         threads[i].second->fIn->GetEntries() << ", \""
-							<<         threads[i].second->fCondition << "\"\n";
+	for(size_t i=0; i< inputs.size(); ++i)
+		std::cout << "\t" << inputs[i]->first->GetName()    << ", "
+							<<         inputs[i]->first->GetEntries() << ", \""
+							<<         inputs[i]->second.fCondition << "\"\n";
 	std::cout << "\nIf there are many events, this may take a while...\n\n";
 
-	//
-	// Run all threads
-	std::vector<void*> nout(threads.size(), 0);
-	for(size_t i=0; i< threads.size(); ++i) {
-		if(GetThreaded())
-			threads[i].first->Run();
-		else
-			nout[i] = run_thread(threads[i].second);
+	std::vector<Long64_t> nout(inputs.size(), 0);
+	if(nthreads == 1) {
+		//
+		// Filter each tree in series, straight into the output directory
+		for(size_t i=0; i< inputs.size(); ++i) {
+			ThreadArgs_t args;
+			args.fIn     = inputs[i]->first;
+			args.fOut    = &(inputs[i]->second.fTree);
+			args.fOutDir = GetOutDir();
+			args.fCondition = inputs[i]->second.fCondition;
+
+			Long64_t* nout64 = (Long64_t*)run_thread(&args);
+			nout[i] = *nout64;
+			delete nout64;
+		}
 	}
-	//
-	// Join all threads
-	if(GetThreaded()) {
+	else {
+		//
+		// Split each input into tasks
+		// Same algorithm and level as the output file, so CopyEntries() can copy the baskets
+		const Int_t compress = GetOutDir()->GetFile() ? GetOutDir()->GetFile()->GetCompressionSettings() : 1;
+		std::vector<FilterTask_t> tasks;
+		std::vector<size_t> firstTask;
+		for(size_t i=0; i< inputs.size(); ++i) {
+			firstTask.push_back(tasks.size());
+
+			FilterTask_t task;
+			task.fIn = inputs[i]->first;
+			task.fCondition = inputs[i]->second.fCondition;
+			task.fReopen = can_reopen(task.fIn);
+			task.fCompress = compress;
+			task.fNout = -1;
+
+			const Long64_t nentries = task.fIn->GetEntries();
+			Long64_t ntask = fTaskEntries > 0 ? fTaskEntries : std::max<Long64_t>(100000, nentries / (4*nthreads) + 1);
+			if(!task.fReopen) ntask = nentries;
+
+			task.fFirst = 0;
+			do {
+				task.fEntries = std::min(ntask, nentries - task.fFirst);
+				tasks.push_back(task);
+				task.fFirst += ntask;
+			} while(task.fFirst < nentries);
+		}
+		firstTask.push_back(tasks.size());
+
+		for(size_t i=0; i< tasks.size(); ++i) {
+			tasks[i].fTemp = "dragon_filter";
+			FILE* f = gSystem->TempFileName(tasks[i].fTemp);
+			if(f) fclose(f);
+		}
+
+		std::cout << "Filtering " << tasks.size() << " task" << (tasks.size() > 1 ? "s" : "")
+							<< " with " << nthreads << " threads...\n";
+
+		//
+		// Run all tasks
+		FilterQueue_t queue;
+		queue.fTasks = &tasks;
+		queue.fNext = 0;
+		TThread::Initialize();
+		std::vector<TThread*> threads;
+		for(Int_t i=0; i< std::min<Int_t>(nthreads, tasks.size()); ++i) {
+			threads.push_back(new TThread(filter_worker, &queue));
+			threads.back()->Run();
+		}
 		for(size_t i=0; i< threads.size(); ++i) {
-			threads[i].first->Join( &(nout[i]) );
+			threads[i]->Join();
+			delete threads[i];
 		}
+
+		//
+		// Append the temporary trees to the output, in order
+		TDirectory* current = gDirectory;
+		for(size_t i=0; i< inputs.size(); ++i) {
+			TTree*& out = inputs[i]->second.fTree;
+			out = 0;
+			for(size_t j = firstTask[i]; j< firstTask[i+1]; ++j) {
+				if(tasks[j].fNout < 0) {
+					utils::Error("TTreeFilter::Run", __FILE__, __LINE__)
+						<< "Failed to filter entries " << tasks[j].fFirst << " to "
+						<< tasks[j].fFirst + tasks[j].fEntries - 1 << " of " << inputs[i]->first->GetName();
+				}
+				else {
+					std::auto_ptr<TFile> temp(TFile::Open(tasks[j].fTemp));
+					TTree* t = temp.get() ? static_cast<TTree*>(temp->Get(inputs[i]->first->GetName())) : 0;
+					if(t) {
+						if(!out) {
+							GetOutDir()->cd();
+							out = t->CloneTree(0);
+							out->SetDirectory(GetOutDir());
+						}
+						out->CopyEntries(t, -1, "fast");
+					}
+				}
+				gSystem->Unlink(tasks[j].fTemp);
+			}
+			if(out) {
+				out->AutoSave();
+				nout[i] = out->GetEntries();
+			}
+		}
+		if(current) current->cd();
 	}
+
 	//
-	// Message & cleanup
+	// Message
 	std::cout << "Done!\nNumber of events written:\n"
 						<< "\t<tree name>, <num events>\n";
-	for(size_t i=0; i< threads.size(); ++i) {
-		Long64_t* nout64 = (Long64_t*) nout[i];
-		Long64_t nnn = nout64 ? *nout64 : 0;
-		std::cout << "\t" << threads[i].second->fIn->GetName() << ", " << nnn << "\n";
-
-		if(GetThreaded()) 
-			delete threads[i].first;
-		if(1)
-			delete threads[i].second;
-		if(nout64)
-			delete nout64;
+	for(size_t i=0; i< inputs.size(); ++i) {
+		std::cout << "\t" << inputs[i]->first->GetName() << ", " << nout[i] << "\n";
 	}
 
 	return 0;
 }
 
-
 // ============ Class dragon::RossumData ============ //
 
 dragon::RossumData::RossumData():
@@ -804,14 +1045,14 @@ TGraph* dragon::RossumData::PlotTransmission(Int_t* runs, Int_t nruns)
 // ============ Class dragon::BeamNorm ============ //
 
 dragon::BeamNorm::BeamNorm():
-	fRunDataTree("t_rundata", ""), fRossum(0)
+	fRunDataTree("t_rundata", ""), fRossum(0), fNumThreads(0), fCache(kTRUE)
 {
 	fRunDataTree.SetMarkerStyle(21);
 	fRunDataTree.Branch("rundata", "dragon::BeamNorm::RunData", &fRunDataBranchAddr);
 }
 
 dragon::BeamNorm::BeamNorm(const char* name, const char* rossumFile):
-	fRunDataTree("t_rundata", ""), fRossum(0)
+	fRunDataTree("t_rundata", ""), fRossum(0), fNumThreads(0), fCache(kTRUE)
 {
 	SetNameTitle(name, rossumFile);
 	ChangeRossumFile(rossumFile);
@@ -850,34 +1091,76 @@ Int_t dragon::BeamNorm::ReadSbCounts(TFile* datafile, Double_t pkLow0, Double_t
 			<< "no rossum file loaded.";
 		return 0;
 	}
-	if(!datafile || datafile->IsZombie()) {
-		dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
-			<< "Invalid datafile: " << datafile;
+
+	Double_t low[NSB] =  { pkLow0,  pkLow1  };
+	Double_t high[NSB] = { pkHigh0, pkHigh1 };
+	FileData data;
+	if(!ReadFileData(datafile, low, high, time, data))
 		return 0;
-	}
 
+	SetFileData(data, time);
+	return data.runnum;
+}
+
+Int_t dragon::BeamNorm::ReadRunNumber(TFile* datafile, const char* where)
+{
+	///
+	/// \returns The run number from the "odbstop" database of _datafile_, or 0 if it
+	///  can't be read (reported as an error in _where_).
 	Bool_t haveRunnum = kFALSE;
 	Int_t runnum = 0;
 	midas::Database* db = static_cast<midas::Database*>(datafile->Get("odbstop"));
 	if(db) haveRunnum = db->ReadValue("/Runinfo/Run number", runnum);
 	if(!db || !haveRunnum) {		 
-		dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
+		dutils::Error(where, __FILE__, __LINE__)
 			<< "couldn't read run number from TFile at " << datafile;
 		return 0;
 	}
+	return runnum;
+}
+
+Bool_t dragon::BeamNorm::ReadFileData(TFile* datafile, const Double_t* pkLow, const Double_t* pkHigh,
+																			Double_t time, FileData& data)
+{
+	///
+	/// Reads everything ReadSbCounts() needs from the event data of a run file.
+	/// Changes nothing in the BeamNorm, so files can be read in parallel.
+	///
+	/// \param datafile Pointer to the run's ROOT file
+	/// \param pkLow Low ends of the SB good peaks, per detector
+	/// \param pkHigh High ends of the SB good peaks, per detector
+	/// \param time Number of seconds at the beginning of the run to use for
+	///  calculating the normalization
+	/// \param [out] data Values read from the file
+	///
+	/// \returns true if successful
+	///
+	/// Reading the keys of the file and setting up the trees is done under
+	/// TThread::Lock(); only the loops over the entries are not.
+
+	if(!datafile || datafile->IsZombie()) {
+		dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
+			<< "Invalid datafile: " << datafile;
+		return kFALSE;
+	}
+
+	ThreadLock_t lock;
+	data.runnum = ReadRunNumber(datafile, "BeamNorm::ReadSbCounts");
+	if(!data.runnum)
+		return kFALSE;
 
 	TTree* t3 = static_cast<TTree*>(datafile->Get("t3"));
 	if(t3 == 0 || t3->GetListOfBranches()->At(0) == 0) {
 		dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
 			<< "no heavy-ion data tree in file" << datafile->GetName();
-		return 0;
+		return kFALSE;
 	}
 
 	TTree* t20 = static_cast<TTree*>(datafile->Get("t20"));
 	if(t20 == 0 || t20->GetListOfBranches()->At(0) == 0) {
 		dutils::Error("BeamNorm::ReadSbCounts", __FILE__, __LINE__)
 			<< "no EPICS tree in file" << datafile->GetName();
-		return 0;
+		return kFALSE;
 	}
 
 	dragon::Tail tail;
@@ -890,39 +1173,41 @@ Int_t dragon::BeamNorm::ReadSbCounts(TFile* datafile, Double_t pkLow0, Double_t
 
 	AutoResetBranchAddresses Rst3_(t3);
 	AutoResetBranchAddresses Rst20_(t20);
-			
-	Long64_t ncounts[NSB];
-	Long64_t ncounts_full[NSB];
-	for(int i=0; i< NSB; ++i) {
-		ncounts[i] = 0;
-		ncounts_full[i] = 0;
-	}
 
 	t3->GetEntry(0);
 	Double_t tstart = pTail->header.fTimeStamp;
-	Double_t low[NSB] =  { pkLow0,  pkLow1  };
-	Double_t high[NSB] = { pkHigh0, pkHigh1 };
 
+	std::string cuts[2*NSB];
+	const char* pcuts[2*NSB];
+	Long64_t counts[2*NSB];
 	for(int i=0; i< NSB; ++i) {
 		std::stringstream cut;
 		cut.precision(20);
-		cut << "sb.ecal[" << i << "] > " << low[i] << " && sb.ecal[" << i << "] < " << high[i];
-		ncounts_full[i] = t3->GetPlayer()->GetEntries(cut.str().c_str());
+		cut << "sb.ecal[" << i << "] > " << pkLow[i] << " && sb.ecal[" << i << "] < " << pkHigh[i];
+		cuts[2*i] = cut.str();
 
 		cut << " && header.fTimeStamp - " << tstart << " < " << time;
-		ncounts[i] = t3->GetPlayer()->GetEntries(cut.str().c_str());
+		cuts[2*i + 1] = cut.str();
+	}
+	for(int i=0; i< 2*NSB; ++i)
+		pcuts[i] = cuts[i].c_str();
+	lock.Release();
+
+	TreeCut::Count(t3, 2*NSB, pcuts, counts); // all in one pass
+	for(int i=0; i< NSB; ++i) {
+		data.sb_counts_full[i] = counts[2*i];
+		data.sb_counts[i] = counts[2*i + 1];
 	}
 
-	UDouble_t live, live_full[3]; // [3]: head,tail,coinc
 	{
 		dragon::LiveTimeCalculator ltc;
 		ltc.SetFile(datafile);
 		ltc.CalculateSub(0, time);
-		live = ltc.GetLivetime("tail");
+		data.live_time = ltc.GetLivetime("tail");
 		ltc.Calculate();
-		live_full[0] = ltc.GetLivetime("head");
-		live_full[1] = ltc.GetLivetime("tail");
-		live_full[2] = ltc.GetLivetime("coinc");
+		data.live_time_full[0] = ltc.GetLivetime("head");
+		data.live_time_full[1] = ltc.GetLivetime("tail");
+		data.live_time_full[2] = ltc.GetLivetime("coinc");
 	}
 
 	t20->GetEntry(0);
@@ -939,34 +1224,40 @@ Int_t dragon::BeamNorm::ReadSbCounts(TFile* datafile, Double_t pkLow0, Double_t
 		}
 	}
 
-	RunData* rundata = GetOrCreateRunData(runnum);
-
-	rundata->time = time;
-	for(int i=0; i< NSB; ++i) {
-		rundata->sb_counts[i] = UDouble_t(ncounts[i]);
-		rundata->sb_counts_full[i] = UDouble_t(ncounts_full[i]);
-	}
 	//
 	// Pressure over SB norm time
 	{
 		const Double_t pressureMean = utils::calculate_mean(pressure.begin(), pressure.begin() + t1);
 		const Double_t pressureSigma = utils::calculate_stddev(pressure.begin(), pressure.begin() + t1, pressureMean);
-		rundata->pressure = UDouble_t (pressureMean, pressureSigma);
+		data.pressure = UDouble_t (pressureMean, pressureSigma);
 	}
 	//
 	// Pressure over full run
 	{
 		const Double_t pressureMean = utils::calculate_mean(pressure.begin(), pressure.end());
 		const Double_t pressureSigma = utils::calculate_stddev(pressure.begin(), pressure.end(), pressureMean);
-		rundata->pressure_full = UDouble_t (pressureMean, pressureSigma);
+		data.pressure_full = UDouble_t (pressureMean, pressureSigma);
 	}
-	
-	rundata->live_time = live;
-	rundata->live_time_head  = live_full[0];
-	rundata->live_time_tail  = live_full[1];
-	rundata->live_time_coinc = live_full[2];
 
-	return runnum;
+	return kTRUE;
+}
+
+void dragon::BeamNorm::SetFileData(const FileData& data, Double_t time)
+{
+	RunData* rundata = GetOrCreateRunData(data.runnum);
+
+	rundata->time = time;
+	for(int i=0; i< NSB; ++i) {
+		rundata->sb_counts[i] = UDouble_t(data.sb_counts[i]);
+		rundata->sb_counts_full[i] = UDouble_t(data.sb_counts_full[i]);
+	}
+	rundata->pressure = data.pressure;
+	rundata->pressure_full = data.pressure_full;
+	
+	rundata->live_time = data.live_time;
+	rundata->live_time_head  = data.live_time_full[0];
+	rundata->live_time_tail  = data.live_time_full[1];
+	rundata->live_time_coinc = data.live_time_full[2];
 }
 
 void dragon::BeamNorm::ReadFC4(Int_t runnum, Double_t skipBegin, Double_t skipEnd)
@@ -1247,41 +1538,56 @@ const UDouble_t& get_livetime(const std::string& treename, const dragon::BeamNor
 } }
 
 
-void dragon::BeamNorm::CalculateRecoils(TFile* datafile, const char* treename, const char* gate)
+namespace {
+// Returns the number of events in _treename_ passing _gate_, or -1 if there is no such tree
+Long64_t count_recoils(TFile* datafile, const char* treename, const char* gate, const TList* aliases)
 {
-	if(datafile == 0 || datafile->IsZombie()) {
-		std::cerr << "Invalid datafile!\n";
-		return;
-	}
+	ThreadLock_t lock;
 	TTree* t = (TTree*)datafile->Get(treename);
 	if(!t || t->IsA() != TTree::Class()) {
 		dutils::Error("BeamNorm::CalculateRecoils", __FILE__, __LINE__)
 			<< "no tree named \"" << treename << "\" in the specified file!";
-		return;
+		return -1;
 	}
 
 	// Copy aliases from chain
-	TChain* chain = (TChain*)gROOT->GetListOfSpecials()->FindObject(treename);
-	if(chain && chain->InheritsFrom(TChain::Class())) {
-		if(chain->GetListOfAliases()) {
-			for(Int_t i=0; i< chain->GetListOfAliases()->GetEntries(); ++i) {
-				TObject* alias = chain->GetListOfAliases()->At(i);
-				if(alias) t->SetAlias(alias->GetName(), alias->GetTitle());
-			}
+	if(aliases) {
+		for(Int_t i=0; i< aliases->GetEntries(); ++i) {
+			TObject* alias = aliases->At(i);
+			if(alias) t->SetAlias(alias->GetName(), alias->GetTitle());
 		}
 	}
+	lock.Release();
 
-	Bool_t haveRunnum = kFALSE;
-	Int_t runnum = 0;
-	midas::Database* db = static_cast<midas::Database*>(datafile->Get("odbstop"));
-	if(db) haveRunnum = db->ReadValue("/Runinfo/Run number", runnum);
-	if(!db || !haveRunnum) {
-		dutils::Error("BeamNorm::CalculateRecoils", __FILE__, __LINE__)
-			<< "couldn't read run number from TFile at " << datafile;
+	return dragon::TreeCut::Count(t, gate);
+} }
+
+void dragon::BeamNorm::CalculateRecoils(TFile* datafile, const char* treename, const char* gate)
+{
+	if(datafile == 0 || datafile->IsZombie()) {
+		std::cerr << "Invalid datafile!\n";
 		return;
 	}
 
-	UDouble_t nrecoil (t->GetPlayer()->GetEntries(gate));
+	TList* aliases = 0;
+	TChain* chain = (TChain*)gROOT->GetListOfSpecials()->FindObject(treename);
+	if(chain && chain->InheritsFrom(TChain::Class()))
+		aliases = chain->GetListOfAliases();
+
+	Long64_t nrecoil = count_recoils(datafile, treename, gate, aliases);
+	if(nrecoil < 0)
+		return;
+
+	Int_t runnum = ReadRunNumber(datafile, "BeamNorm::CalculateRecoils");
+	if(!runnum)
+		return;
+
+	SetRecoils(runnum, treename, nrecoil);
+}
+
+void dragon::BeamNorm::SetRecoils(Int_t runnum, const char* treename, Long64_t n)
+{
+	UDouble_t nrecoil (n);
 
 	RunData* rundata = GetOrCreateRunData(runnum);
 	try {
@@ -1315,30 +1621,234 @@ Long64_t dragon::BeamNorm::Draw(const char* varexp, const char* selection, Optio
 	return fRunDataTree.Draw(varexp, selection, option, nentries, firstentry);
 }
 
+void dragon::BeamNorm::ClearCache()
+{
+	fFileCache.clear();
+	fRecoilCache.clear();
+}
+
+namespace {
+struct BeamNormJob_t {
+	std::string fFile; // run file
+	Bool_t fGood;      // values read successfully
+	Bool_t fCached;    // all values found in the cache
+	Double_t fTime;    // seconds spent on the file
+	dragon::BeamNorm::FileData fData;
+	Long64_t fRecoils; // number of recoils, -1 if not counted
+};
+
+struct BeamNormQueue_t {
+	dragon::BeamNorm* fNorm;
+	std::vector<BeamNormJob_t>* fJobs;
+	size_t fNext;
+	const Double_t* fLow;    // SB peak low ends
+	const Double_t* fHigh;   // SB peak high ends
+	Double_t fTime;          // SB norm time
+	std::string fFileKey;    // cache key of the SB peaks and time
+	const char* fTree;       // recoil tree name
+	const char* fGate;       // recoil gate, or NULL
+	const TList* fAliases;   // aliases of the recoil chain
+	std::string fRecoilKey;  // cache key of the recoil tree, gate and aliases
+}; }
+
+void* dragon::BeamNorm::BatchWorker(void* arg)
+{
+	BeamNormQueue_t* queue = static_cast<BeamNormQueue_t*>(arg);
+	BeamNorm* norm = queue->fNorm;
+	while(1) {
+		TThread::Lock();
+		size_t ijob = queue->fNext++;
+		TThread::UnLock();
+		if(ijob >= queue->fJobs->size()) break;
+
+		BeamNormJob_t& job = queue->fJobs->at(ijob);
+		TStopwatch timer;
+		timer.Start();
+
+		//
+		// Identify the file by its path, size and modification time
+		std::string stamp;
+		FileStat_t stat;
+		if(norm->fCache && gSystem->GetPathInfo(job.fFile.c_str(), stat) == 0) {
+			std::stringstream sstamp;
+			sstamp << job.fFile << " " << stat.fSize << " " << stat.fMtime;
+			stamp = sstamp.str();
+		}
+
+		Bool_t haveData = kFALSE, haveRecoils = (queue->fGate == 0);
+		if(!stamp.empty()) {
+			TThread::Lock();
+			std::map<std::string, FileData>::iterator itData = norm->fFileCache.find(stamp + queue->fFileKey);
+			if(itData != norm->fFileCache.end()) {
+				job.fData = itData->second;
+				haveData = kTRUE;
+			}
+			std::map<std::string, Long64_t>::iterator itRecoils = norm->fRecoilCache.find(stamp + queue->fRecoilKey);
+			if(queue->fGate && itRecoils != norm->fRecoilCache.end()) {
+				job.fRecoils = itRecoils->second;
+				haveRecoils = kTRUE;
+			}
+			TThread::UnLock();
+		}
+		job.fCached = haveData && haveRecoils;
+
+		//
+		// Read whatever isn't cached
+		if(!job.fCached) {
+			TThread::Lock();
+			std::auto_ptr<TFile> file (TFile::Open(job.fFile.c_str()));
+			TThread::UnLock();
+			if(!haveData) {
+				haveData = ReadFileData(file.get(), queue->fLow, queue->fHigh, queue->fTime, job.fData);
+			}
+			if(haveData && !haveRecoils) {
+				job.fRecoils = count_recoils(file.get(), queue->fTree, queue->fGate, queue->fAliases);
+				haveRecoils = job.fRecoils >= 0;
+			}
+			TThread::Lock();
+			file.reset();
+			TThread::UnLock();
+
+			if(!stamp.empty()) {
+				TThread::Lock();
+				if(haveData)    norm->fFileCache[stamp + queue->fFileKey] = job.fData;
+				if(haveRecoils && queue->fGate) norm->fRecoilCache[stamp + queue->fRecoilKey] = job.fRecoils;
+				TThread::UnLock();
+			}
+		}
+		job.fGood = haveData;
+
+		timer.Stop();
+		job.fTime = timer.RealTime();
+
+		if(job.fGood) {
+			TThread::Lock();
+			std::cout << job.fData.runnum << "... ";
+			std::flush(std::cout);
+			TThread::UnLock();
+		}
+	}
+	return 0;
+}
+
 void dragon::BeamNorm::BatchCalculate(TChain* chain, Int_t chargeBeam, Double_t pkLow0, Double_t pkHigh0,
 																			Double_t pkLow1, Double_t pkHigh1,
 																			const char* recoilGate,
 																			Double_t time, Double_t skipBegin, Double_t skipEnd)
 {
+	///
+	/// Reads the files of _chain_ in parallel, GetNumThreads() at a time, and then
+	/// calculates the normalization of each run in the order of the chain.
+	///
+	/// Unless disabled with SetCache(), the values read from each file (SB counts, live
+	/// times, pressures and recoil counts) are kept, keyed by the path, size and modification
+	/// time of the file, the SB peaks and time, and the recoil gate and chain aliases. Calling
+	/// BatchCalculate() again, e.g. after changing efficiencies or the transmission correction,
+	/// then only redoes the calculation, and files are only read for new peaks, times or gates.
+	///
+	/// For the parameters, see ReadSbCounts(), ReadFC4() and CalculateRecoils().
+
+	if(!HaveRossumFile()) {
+		dutils::Error("BeamNorm::BatchCalculate", __FILE__, __LINE__)
+			<< "no rossum file loaded.";
+		return;
+	}
+
 	TObjArray* flist = chain->GetListOfFiles();
-	for(Int_t i=0; i< flist->GetEntries(); ++i) {
-		if(!i) 
-			std::cout << "Calculating normalization for runs ";
+	std::vector<BeamNormJob_t> jobs(flist->GetEntries());
+	if(jobs.empty()) return;
+	for(size_t i=0; i< jobs.size(); ++i) {
+		jobs[i].fFile = flist->At(i)->GetTitle();
+		jobs[i].fGood = kFALSE;
+		jobs[i].fCached = kFALSE;
+		jobs[i].fTime = 0;
+		jobs[i].fRecoils = -1;
+	}
 
-		std::auto_ptr<TFile> file (TFile::Open(flist->At(i)->GetTitle()));
-		Int_t runnum = ReadSbCounts(file.get(), pkLow0, pkHigh0, pkLow1, pkHigh1, time);
-		if(!runnum) continue;
+	Double_t low[NSB] =  { pkLow0,  pkLow1  };
+	Double_t high[NSB] = { pkHigh0, pkHigh1 };
 
-		std::cout << runnum << "... ";
-		std::flush(std::cout);
+	BeamNormQueue_t queue;
+	queue.fNorm = this;
+	queue.fJobs = &jobs;
+	queue.fNext = 0;
+	queue.fLow = low;
+	queue.fHigh = high;
+	queue.fTime = time;
+	queue.fTree = chain->GetName();
+	queue.fGate = recoilGate;
+	queue.fAliases = chain->GetListOfAliases();
+	{
+		std::stringstream key;
+		key.precision(20);
+		for(int i=0; i< NSB; ++i)
+			key << " " << low[i] << " " << high[i];
+		key << " " << time;
+		queue.fFileKey = key.str();
+		key.str("");
+		key << " " << chain->GetName() << " " << (recoilGate ? recoilGate : "");
+		if(queue.fAliases) { // the gate may use them
+			TIter next(queue.fAliases);
+			while(TObject* alias = next())
+				key << " " << alias->GetName() << "=" << alias->GetTitle();
+		}
+		queue.fRecoilKey = key.str();
+	}
 
+	Int_t nthreads = fNumThreads;
+	if(nthreads <= 0) {
+		SysInfo_t info;
+		nthreads = gSystem->GetSysInfo(&info) == 0 ? info.fCpus : 1;
+	}
+	nthreads = std::max(1, std::min<Int_t>(nthreads, jobs.size()));
+
+	TStopwatch timer;
+	timer.Start();
+	std::cout << "Calculating normalization for runs ";
+	if(nthreads == 1) {
+		BatchWorker(&queue);
+	}
+	else {
+		TThread::Initialize();
+		std::vector<TThread*> threads;
+		for(Int_t i=0; i< nthreads; ++i) {
+			threads.push_back(new TThread(BatchWorker, &queue));
+			threads.back()->Run();
+		}
+		for(size_t i=0; i< threads.size(); ++i) {
+			threads[i]->Join();
+			delete threads[i];
+		}
+	}
+	std::cout << "\n";
+
+	//
+	// Calculate, in chain order
+	for(size_t i=0; i< jobs.size(); ++i) {
+		if(!jobs[i].fGood) continue;
+		const Int_t runnum = jobs[i].fData.runnum;
+		SetFileData(jobs[i].fData, time);
 		ReadFC4(runnum, skipBegin, skipEnd);
 		CalculateNorm(runnum, chargeBeam);
-		if(recoilGate) {
-			CalculateRecoils(file.get(), chain->GetName(), recoilGate);
+		if(recoilGate && jobs[i].fRecoils >= 0) {
+			SetRecoils(runnum, chain->GetName(), jobs[i].fRecoils);
 		}
 	}
-	std::cout << "\n";
+	timer.Stop();
+
+	//
+	// Timing
+	std::cout << "Time per run:\n"
+						<< "\t<run>, <file>, <real time [s]>\n";
+	for(size_t i=0; i< jobs.size(); ++i) {
+		std::cout << "\t";
+		if(jobs[i].fGood) std::cout << jobs[i].fData.runnum;
+		else              std::cout << "FAILED";
+		std::cout << ", " << jobs[i].fFile << ", " << jobs[i].fTime
+							<< (jobs[i].fCached ? " (cached)" : "") << "\n";
+	}
+	std::cout << "Total: " << timer.RealTime() << " s with " << nthreads
+						<< " thread" << (nthreads > 1 ? "s" : "") << "\n";
 }
 
 
@@ -1442,13 +1952,13 @@ UDouble_t dragon::BeamNorm::CalculateYield(Int_t whichSb, Int_t type, Bool_t pri
 // ================ Class LiveTimeCalculator ================ //
 
 dragon::LiveTimeCalculator::LiveTimeCalculator():
-	fFile(0)
+	fFile(0), fCache(kFALSE)
 {
 	Reset();
 }
 
 dragon::LiveTimeCalculator::LiveTimeCalculator(TFile* file, Bool_t calculate): 
-	fFile(file)
+	fFile(file), fCache(kFALSE)
 {
 	/// \param file Pointer to TFile containing run data. Takes no ownership.
 	/// \param calculate If set to true, performs a full-run live time calculation
@@ -1504,26 +2014,26 @@ Double_t dragon::LiveTimeCalculator::GetLivetime(const char* which) const
 	return get_from_array(fLivetime, which, "GetLivetime");
 }
 
-Bool_t dragon::LiveTimeCalculator::CheckFile(TTree*& t1, TTree*& t3, midas::Database*& db)
+Bool_t dragon::LiveTimeCalculator::CheckFile(TFile* file, TTree*& t1, TTree*& t3, midas::Database*& db)
 {
 	///
 	/// Also sets tree and DB pointers
 
-	if(!fFile || fFile->IsZombie()) {
+	if(!file || file->IsZombie()) {
 		dutils::Error("LiveTimeCalculator::CheckFile", __FILE__, __LINE__)
 			<< "Invalid or no file loaded.";
 		return kFALSE;
 	}
 	Bool_t okay = kTRUE;
-	if(okay) okay = fFile->Get("t1") && fFile->Get("t1")->IsA() == TTree::Class();
-	if(okay) okay = fFile->Get("t3") && fFile->Get("t3")->IsA() == TTree::Class();
+	if(okay) okay = file->Get("t1") && file->Get("t1")->IsA() == TTree::Class();
+	if(okay) okay = file->Get("t3") && file->Get("t3")->IsA() == TTree::Class();
 	if(!okay) {
 		dutils::Error("LiveTimeCalculator::CheckFile", __FILE__, __LINE__)
 			<< "missing necessary trees in loaded file";
 		return kFALSE;
 	} else {
-		t1 = static_cast<TTree*>(fFile->Get("t1"));
-		t3 = static_cast<TTree*>(fFile->Get("t3"));
+		t1 = static_cast<TTree*>(file->Get("t1"));
+		t3 = static_cast<TTree*>(file->Get("t3"));
 	}
 
 	if(okay) okay = t1->GetLeaf("io32.busy_time");
@@ -1542,14 +2052,14 @@ Bool_t dragon::LiveTimeCalculator::CheckFile(TTree*& t1, TTree*& t3, midas::Data
 		return kFALSE;
 	}
 
-	okay = fFile->Get("odbstop") && fFile->Get("odbstop")->InheritsFrom(midas::Database::Class());
+	okay = file->Get("odbstop") && file->Get("odbstop")->InheritsFrom(midas::Database::Class());
 	if(!okay) {
 		dutils::Error("LiveTimeCalculator::CheckFile", __FILE__, __LINE__)
 			<< "Loaded file is missing database \"odbstop\"";
 		return kFALSE;
 	}
 
-	db = static_cast<midas::Database*>(fFile->Get("odbstop"));
+	db = static_cast<midas::Database*>(file->Get("odbstop"));
 	return kTRUE;
 }
 
@@ -1638,7 +2148,34 @@ inline Double_t correct_rollover_fe_bug(TBranch* trigBranch, Double_t& trig_time
 	}
 	
 	return rollCorrect;
-} }
+}
+
+// order by the first member of a pair
+struct compare_first {
+	template <class T>
+	bool operator() (const T& lhs, const T& rhs) const
+		{ return lhs.first < rhs.first; }
+};
+}
+
+const dragon::BusytimeSummary* dragon::LiveTimeCalculator::GetSummary()
+{
+	///
+	/// The summary is read (or built) once per file, and kept until
+	/// the file changes.
+	/// \returns Summary of the present file, or NULL if it can't be read
+
+	if(!fFile) {
+		utils::Error("LiveTimeCalculator::GetSummary", __FILE__, __LINE__)
+			<< "No file loaded.";
+		return 0;
+	}
+	if(!fSummary.get() || fSummaryFile != fFile->GetName()) {
+		fSummary.reset(BusytimeSummary::Get(fFile->GetName(), fFile, fCache));
+		fSummaryFile = fFile->GetName();
+	}
+	return fSummary.get();
+}
 
 void dragon::LiveTimeCalculator::DoCalculate(Double_t tbegin, Double_t tend)
 {
@@ -1665,68 +2202,22 @@ void dragon::LiveTimeCalculator::DoCalculate(Double_t tbegin, Double_t tend)
 		return;
 	}
 
-	// Initialize midas database, TTrees, etc
-	midas::Database* db = 0;
-	TTree* trees[2] = { 0, 0 };
-	if(!CheckFile(trees[0], trees[1], db)) { // CheckFile now sets trees[i], db if they're valid
+	const BusytimeSummary* summary = GetSummary();
+	if(!summary) {
 		utils::Error("LiveTimeCalculator::DoCalculate", __FILE__, __LINE__)
 			<< "Invalid file or trees";
 		return;
 	}
-	size_t nentries = trees[0]->GetEntries() + trees[1]->GetEntries();
-	CoincBusytime coincBusy(nentries);
-
-	// Ensure to reset branch addresses when done
-	AutoResetBranchAddresses Rst_(trees, 2);
-
-	// Get run times
-	double trigStart[3], trigStop[3];
-	CalculateRuntime(db, "head",  trigStart[0], trigStop[0]);
-	CalculateRuntime(db, "tail",  trigStart[1], trigStop[1]);
-	CalculateRuntime(db, "coinc", trigStart[2], trigStop[2]);
-
-	// Loop over trees
-	for(int i=0; i< 2; ++i) {
-		// Set MakeClass to 1 (resets at end of loop or return)
-		SetMakeClass_t dummy(trees[i], 1);
-
-		// Find branches
-		UInt_t busy_time;
-		Double_t trig_time;
-		TBranch* trigBranch = get_branch(trees[i], trig_time, "io32.tsc4.trig_time", "LiveTimeCalculator::DoCalculate");
-		TBranch* busyBranch = get_branch(trees[i], busy_time, "io32.busy_time", "LiveTimeCalculator::DoCalculate");
-		if(!trigBranch || !busyBranch) return;
-
-		// Correct TSC4 rollover for early runs taken with a frontend bug
-		Double_t rollCorrect = correct_rollover_fe_bug(trigBranch, trig_time);
-		
-		Long64_t busyTotal = 0;
-		Long64_t nentries = trees[i]->GetEntries();
-		for(Long64_t entry = 0; entry< nentries; ++entry) {
-
-			// read entries
-			trigBranch->GetEntry(entry);
-			busyBranch->GetEntry(entry);
-			const Double_t trigtime = trig_time - rollCorrect - trigStart[i];
-
-			// check cut condition
-			if (!isFull && !(trigtime > tbegin*1e6 && trigtime < tend*1e6))
-				continue;
-
-			// accuulate busy time
-			busyTotal += busy_time;
-			coincBusy.AddEvent(trigtime, busy_time/20.);
-		}
+	SetResults(*summary, isFull ? -1 : tbegin, isFull ? -1 : tend);
+}
 
-		// calculate variables
-		fBusytime[i] = busyTotal / 20e6;
-		fRuntime[i]  = isFull ? trigStop[i] - trigStart[i] : tend - tbegin;
+void dragon::LiveTimeCalculator::SetResults(const BusytimeSummary& summary, Double_t tbegin, Double_t tend)
+{
+	for(int i=0; i< 3; ++i) {
+		fBusytime[i] = summary.GetBusytime(i, tbegin, tend);
+		fRuntime[i]  = summary.GetRuntime(i, tbegin, tend);
 		fLivetime[i] = (fRuntime[i] - fBusytime[i]) / fRuntime[i];
 	}
-
-	fRuntime[2]  = isFull ? trigStop[2] - trigStart[2] : tend - tbegin;
-	fBusytime[2] = coincBusy.Calculate();
-	fLivetime[2] = (fRuntime[2] - fBusytime[2]) / fRuntime[2];
 }
 
 void dragon::LiveTimeCalculator::Calculate()
@@ -1764,24 +2255,22 @@ void dragon::LiveTimeCalculator::CalculateChain(TChain* chain)
 	/// For this, the sum of running time and busy time across
 	/// the chain are calculated and then used to figure out the
 	/// live time fraction.
+	///
+	/// With SetCache(kTRUE), run files are only opened when their busy time
+	/// summary isn't cached yet (see BusytimeSummary::Get()).
 
-	TFile* file0 = GetFile(); if(file0) { }
+	Reset();
 	Double_t sumbusy[3] = {0,0,0}, sumrun[3] = {0,0,0};
 
 	for (Int_t i=0; i< chain->GetListOfFiles()->GetEntries(); ++i) {
-		TFile* f = TFile::Open ( chain->GetListOfFiles()->At(i)->GetTitle() );
-		if(f->IsZombie()) { f->Close(); continue; }
-
-		SetFile(f);
-		Calculate();
-		sumrun[0]  += GetRuntime("head");
-		sumrun[1]  += GetRuntime("tail");
-		sumrun[2]  += GetRuntime("coinc");
-		sumbusy[0] += GetBusytime("head");
-		sumbusy[1] += GetBusytime("tail");
-		sumbusy[2] += GetBusytime("coinc");
+		const char* fname = chain->GetListOfFiles()->At(i)->GetTitle();
+		std::auto_ptr<BusytimeSummary> summary(BusytimeSummary::Get(fname, 0, fCache));
+		if(!summary.get()) continue;
 
-		f->Close();
+		for(int j=0; j< 3; ++j) {
+			sumrun[j]  += summary->GetRuntime(j);
+			sumbusy[j] += summary->GetBusytime(j);
+		}
 	}
 
 	for(int i=0; i< 3; ++i) {
@@ -1792,49 +2281,311 @@ void dragon::LiveTimeCalculator::CalculateChain(TChain* chain)
 }
 
 
-// ============ class dragon::CoincBusytime ============ //
+// ============ class dragon::BusytimeSummary ============ //
 
-// ====== Helper class ====== // 
-namespace {
-struct AccumulateBusy {
-	struct Output_t {
-		Double_t fEnd;
-		Double_t fTotalBusy;
-	};
+dragon::BusytimeSummary::BusytimeSummary():
+	TNamed("busysummary", ""), fFileSize(0), fFileTime(0)
+{
+	std::fill_n(fTrigStart, 3, 0.);
+	std::fill_n(fTrigStop,  3, 0.);
+}
 
-	Output_t operator() (const Output_t& current, const dragon::CoincBusytime::Event& additional);
-};
+Bool_t dragon::BusytimeSummary::Build(TFile* file)
+{
+	///
+	/// \param file Run file, with the "t1" and "t3" trees and the "odbstop" database
+	/// \returns true if successful
+	/// \note Reading the keys of the file and setting up the branches is done under
+	///  TThread::Lock(), so summaries of different files can be built in parallel.
+
+	ThreadLock_t lock;
+	midas::Database* db = 0;
+	TTree* trees[2] = { 0, 0 };
+	if(!LiveTimeCalculator::CheckFile(file, trees[0], trees[1], db))
+		return kFALSE;
+
+	// Get run times
+	LiveTimeCalculator::CalculateRuntime(db, "head",  fTrigStart[0], fTrigStop[0]);
+	LiveTimeCalculator::CalculateRuntime(db, "tail",  fTrigStart[1], fTrigStop[1]);
+	LiveTimeCalculator::CalculateRuntime(db, "coinc", fTrigStart[2], fTrigStop[2]);
+	lock.Release();
+
+	// Ensure to reset branch addresses when done
+	AutoResetBranchAddresses Rst_(trees, 2);
+
+	std::vector<Double_t>* triggers[2] = { &fHeadTrigger, &fTailTrigger };
+	std::vector<UInt_t>*   busys[2]    = { &fHeadBusy,    &fTailBusy };
+	for(int i=0; i< 2; ++i) {
+		// Set MakeClass to 1 (resets at end of loop or return)
+		SetMakeClass_t dummy(trees[i], 1);
+
+		// Find branches
+		UInt_t busy_time;
+		Double_t trig_time;
+		TThread::Lock();
+		TBranch* trigBranch = get_branch(trees[i], trig_time, "io32.tsc4.trig_time", "BusytimeSummary::Build");
+		TBranch* busyBranch = get_branch(trees[i], busy_time, "io32.busy_time", "BusytimeSummary::Build");
 
-inline AccumulateBusy::Output_t AccumulateBusy::operator()
-	(const Output_t& current, const dragon::CoincBusytime::Event& additional)
+		// Correct TSC4 rollover for early runs taken with a frontend bug
+		Double_t rollCorrect = trigBranch ? correct_rollover_fe_bug(trigBranch, trig_time) : 0;
+		TThread::UnLock();
+		if(!trigBranch || !busyBranch) return kFALSE;
+
+		Long64_t nentries = trees[i]->GetEntries();
+		std::vector<Double_t>& trigger = *triggers[i];
+		std::vector<UInt_t>&   busy    = *busys[i];
+		trigger.resize(nentries);
+		busy.resize(nentries);
+		for(Long64_t entry = 0; entry< nentries; ++entry) {
+			trigBranch->GetEntry(entry);
+			busyBranch->GetEntry(entry);
+			trigger[entry] = trig_time - rollCorrect - fTrigStart[i];
+			busy[entry]    = busy_time;
+		}
+
+		// The trees are normally in trigger order already
+		if(std::adjacent_find(trigger.begin(), trigger.end(), std::greater<Double_t>()) != trigger.end()) {
+			std::vector<std::pair<Double_t, UInt_t> > events(nentries);
+			for(Long64_t j=0; j< nentries; ++j)
+				events[j] = std::make_pair(trigger[j], busy[j]);
+			std::stable_sort(events.begin(), events.end(), compare_first());
+			for(Long64_t j=0; j< nentries; ++j) {
+				trigger[j] = events[j].first;
+				busy[j]    = events[j].second;
+			}
+		}
+	}
+
+	SetTitle(file->GetName());
+	Index();
+	return kTRUE;
+}
+
+void dragon::BusytimeSummary::Index()
 {
-	Output_t out = current;
+	const std::vector<UInt_t>* busys[2] = { &fHeadBusy, &fTailBusy };
+	std::vector<Long64_t>* sums[2] = { &fHeadSum, &fTailSum };
+	for(int i=0; i< 2; ++i) {
+		sums[i]->assign(busys[i]->size() + 1, 0);
+		for(size_t j=0; j< busys[i]->size(); ++j)
+			(*sums[i])[j+1] = (*sums[i])[j] + (*busys[i])[j];
+	}
+
+	// Merge head and tail events by trigger time
+	const size_t nhead = fHeadTrigger.size(), ntail = fTailTrigger.size();
+	fCoincTrigger.resize(nhead + ntail);
+	fCoincBusy.resize(nhead + ntail);
+	for(size_t k=0, h=0, t=0; k< nhead + ntail; ++k) {
+		if(t == ntail || (h < nhead && !(fTailTrigger[t] < fHeadTrigger[h]))) {
+			fCoincTrigger[k] = fHeadTrigger[h];
+			fCoincBusy[k] = fHeadBusy[h++] / 20.;
+		} else {
+			fCoincTrigger[k] = fTailTrigger[t];
+			fCoincBusy[k] = fTailBusy[t++] / 20.;
+		}
+	}
 
-	if( current.fEnd < additional.fTrigger ) { // no overlap
-		out.fTotalBusy += additional.fBusy;
-		out.fEnd = additional.End();
+	// Accumulate the busy time ignoring overlap, as in CoincBusytime::Calculate()
+	fCoincEnd.resize(nhead + ntail);
+	fCoincSum.resize(nhead + ntail);
+	CoincBusytime::Accumulator accum;
+	for(size_t k=0; k< fCoincTrigger.size(); ++k) {
+		accum.Add(fCoincTrigger[k], fCoincBusy[k]);
+		fCoincEnd[k] = accum.GetEnd();
+		fCoincSum[k] = accum.GetTotal();
 	}
-	else if( current.fEnd < additional.End() ) { // incomplete overlap
-		out.fTotalBusy += (additional.End() - current.fEnd);
-		out.fEnd = additional.End();
+}
+
+Double_t dragon::BusytimeSummary::GetCoincBusy(Double_t tbegin, Double_t tend) const
+{
+	///
+	/// Same as CoincBusytime::Calculate() of the events triggered in (tbegin, tend).
+	/// Starting from the first of those events, the busy time is accumulated event
+	/// by event until the latest end of busy is the same as for the full run (i.e.
+	/// until no earlier event overlaps); after that, the sums of the full run apply.
+
+	const std::vector<Double_t>& trig = fCoincTrigger;
+	const size_t lo = std::upper_bound(trig.begin(), trig.end(), tbegin) - trig.begin();
+	const size_t hi = std::lower_bound(trig.begin(), trig.end(), tend) - trig.begin();
+	CoincBusytime::Accumulator accum;
+	for(size_t k = lo; k< hi; ++k) {
+		accum.Add(trig[k], fCoincBusy[k]);
+		if(accum.GetEnd() == fCoincEnd[k])
+			return accum.GetTotal() + fCoincSum[hi-1] - fCoincSum[k];
 	}
-	else { // complete overlap
-		;
+	return accum.GetTotal();
+}
+
+Double_t dragon::BusytimeSummary::GetBusytime(Int_t which, Double_t tbegin, Double_t tend) const
+{
+	///
+	/// \param which 0 (head), 1 (tail) or 2 (coinc)
+	/// \param tbegin Beginning of the window, in seconds since the trigger start
+	/// \param tend End of the window, in seconds since the trigger start
+	/// \returns Sum of the busy times of the events triggered in (tbegin, tend), or
+	///  of all events if tbegin or tend is negative. For "coinc", the time during
+	///  which the head _or_ tail is busy.
+
+	const Bool_t isFull = (tbegin < 0 || tend < 0);
+	if(which == 2) {
+		if(isFull)
+			return fCoincSum.empty() ? 0 : fCoincSum.back() / 1e6;
+		return GetCoincBusy(tbegin*1e6, tend*1e6) / 1e6;
+	}
+	if(which != 0 && which != 1) {
+		utils::Error("BusytimeSummary::GetBusytime", __FILE__, __LINE__)
+			<< "Invalid \"which\" specification: " << which << ", must be 0 (head), 1 (tail), or 2 (coinc)";
+		return 0;
 	}
 
-	return out;
-} }
+	const std::vector<Double_t>& trig = which == 0 ? fHeadTrigger : fTailTrigger;
+	const std::vector<Long64_t>& sum  = which == 0 ? fHeadSum : fTailSum;
+	if(isFull)
+		return sum.back() / 20e6;
+	const size_t lo = std::upper_bound(trig.begin(), trig.end(), tbegin*1e6) - trig.begin();
+	const size_t hi = std::lower_bound(trig.begin(), trig.end(), tend*1e6) - trig.begin();
+	return lo < hi ? (sum[hi] - sum[lo]) / 20e6 : 0;
+}
+
+Double_t dragon::BusytimeSummary::GetRuntime(Int_t which, Double_t tbegin, Double_t tend) const
+{
+	///
+	/// \returns Run time from the "odbstop" database, or _tend_ - _tbegin_ for a window
+	if(which < 0 || which > 2) {
+		utils::Error("BusytimeSummary::GetRuntime", __FILE__, __LINE__)
+			<< "Invalid \"which\" specification: " << which << ", must be 0 (head), 1 (tail), or 2 (coinc)";
+		return 0;
+	}
+	return (tbegin < 0 || tend < 0) ? fTrigStop[which] - fTrigStart[which] : tend - tbegin;
+}
+
+Long64_t dragon::BusytimeSummary::GetEntries(Int_t which) const
+{
+	return which == 0 ? fHeadTrigger.size() : which == 1 ? fTailTrigger.size() : 0;
+}
+
+TString dragon::BusytimeSummary::GetSidecarName(const char* filename)
+{
+	///
+	/// \returns _filename_ with "_busy" inserted before the ".root" extension
+	TString name = filename;
+	if(name.EndsWith(".root")) name.Remove(name.Length() - 5);
+	return name + "_busy.root";
+}
+
+dragon::BusytimeSummary* dragon::BusytimeSummary::Get(const char* filename, TFile* file, Bool_t cache)
+{
+	///
+	/// \param filename Name of the run file
+	/// \param file The run file, if already open; otherwise it is only opened if needed
+	/// \param cache If true, read the summary from the sidecar file if it was made from
+	///  the present run file (same size and modification time), otherwise write it there
+	/// \returns New summary (owned by the caller), or NULL if it can't be read or built
+
+	FileStat_t stat;
+	if(gSystem->GetPathInfo(filename, stat) != 0) {
+		utils::Error("BusytimeSummary::Get", __FILE__, __LINE__)
+			<< "Cannot access file \"" << filename << "\"";
+		return 0;
+	}
+
+	const TString sidecar = GetSidecarName(filename);
+	if(cache && !gSystem->AccessPathName(sidecar)) {
+		ThreadLock_t lock;
+		std::auto_ptr<TFile> fsidecar(TFile::Open(sidecar));
+		BusytimeSummary* summary = 0;
+		if(fsidecar.get() && !fsidecar->IsZombie())
+			fsidecar->GetObject("busysummary", summary);
+		if(summary && summary->fFileSize == stat.fSize && summary->fFileTime == stat.fMtime) {
+			summary->Index();
+			return summary;
+		}
+		delete summary;
+	}
+
+	std::auto_ptr<TFile> owned;
+	if(!file) {
+		TThread::Lock();
+		owned.reset(TFile::Open(filename));
+		TThread::UnLock();
+		file = owned.get();
+	}
+	std::auto_ptr<BusytimeSummary> summary(new BusytimeSummary());
+	const Bool_t built = summary->Build(file);
+	TThread::Lock();
+	owned.reset();
+	TThread::UnLock();
+	if(!built)
+		return 0;
+	summary->fFileSize = stat.fSize;
+	summary->fFileTime = stat.fMtime;
+
+	if(cache) {
+		ThreadLock_t lock;
+		TDirectory* current = gDirectory;
+		std::auto_ptr<TFile> fsidecar(TFile::Open(sidecar, "RECREATE"));
+		if(fsidecar.get() && !fsidecar->IsZombie()) {
+			summary->Write("busysummary");
+			utils::Info("BusytimeSummary::Get")
+				<< "Saved busy time summary of \"" << filename << "\" in \"" << sidecar << "\"";
+		}
+		if(current) current->cd();
+	}
+	return summary.release();
+}
+
+
+// ============ class dragon::CoincBusytime ============ //
+
+namespace {
+// reads events back from a temporary file written by CoincBusytime::Spill()
+class FileSource: public dragon::CoincBusytime::Source {
+public:
+	FileSource(FILE* file): fFile(file), fBuffer(4096), fPos(0), fN(0)
+		{ rewind(fFile); }
+	Bool_t Next(dragon::CoincBusytime::Event& evt)
+		{
+			if(fPos == fN) {
+				fN = fread(&fBuffer[0], sizeof(dragon::CoincBusytime::Event), fBuffer.size(), fFile);
+				fPos = 0;
+				if(fN == 0) return kFALSE;
+			}
+			evt = fBuffer[fPos++];
+			return kTRUE;
+		}
+private:
+	FILE* fFile;
+	std::vector<dragon::CoincBusytime::Event> fBuffer;
+	size_t fPos;
+	size_t fN;
+};
+
+// orders (event, source index) pairs by descending trigger time, for std::priority_queue
+struct LaterTrigger {
+	typedef std::pair<dragon::CoincBusytime::Event, size_t> Item_t;
+	bool operator() (const Item_t& lhs, const Item_t& rhs) const
+		{
+			if(lhs.first.fTrigger != rhs.first.fTrigger)
+				return lhs.first.fTrigger > rhs.first.fTrigger;
+			return lhs.second > rhs.second;
+		}
+}; }
 
 dragon::CoincBusytime::CoincBusytime(size_t reserve):
-	fIsSorted(false)
+	fIsSorted(false), fMaxEvents(1 << 24)
 {
 	///
 	/// \param reserve If nonzero, reserve memory space for this many events
-	/// (calls std::vector::reserve()).
+	/// (calls std::vector::reserve()), up to GetMaxEvents().
 
-	if(reserve) fEvents.reserve(reserve);
+	if(reserve) fEvents.reserve(std::min(reserve, fMaxEvents));
 }
 
+dragon::CoincBusytime::~CoincBusytime()
+{
+	for(size_t i=0; i< fSpills.size(); ++i)
+		fclose(fSpills[i]); // tmpfile() removes them
+}
 
 void dragon::CoincBusytime::AddEvent(Double_t trigger, Double_t busy)
 {
@@ -1852,6 +2603,8 @@ void dragon::CoincBusytime::AddEvent(Double_t trigger, Double_t busy)
 			<< trigger << ", " << busy;
 		throw err;
 	}
+	if(fMaxEvents && fEvents.size() >= fMaxEvents && !Spill())
+		fMaxEvents = 0;
 }
 
 void dragon::CoincBusytime::Sort()
@@ -1860,6 +2613,58 @@ void dragon::CoincBusytime::Sort()
 	fIsSorted = true;
 }
 
+Bool_t dragon::CoincBusytime::Spill()
+{
+	///
+	/// \returns false if the temporary file can't be written, the events then stay in memory
+	Sort();
+	FILE* file = tmpfile();
+	if(!file || fwrite(&fEvents[0], sizeof(Event), fEvents.size(), file) != fEvents.size()) {
+		utils::Warning("CoincBusytime::Spill", __FILE__, __LINE__)
+			<< "Cannot write temporary file, keeping all events in memory.";
+		if(file) fclose(file);
+		return kFALSE;
+	}
+	fSpills.push_back(file);
+	fEvents.clear();
+	return kTRUE;
+}
+
+Double_t dragon::CoincBusytime::Merge(Source* const* sources, size_t n)
+{
+	///
+	/// \param sources Streams of events, each sorted by trigger time
+	/// \param n Number of sources
+	/// \returns Total "coincidence busy time" in seconds, as from Calculate(),
+	///  or -1 if a source is not sorted by trigger time.
+	///
+	/// Makes a single pass over all sources, keeping one event per source in memory.
+
+	typedef LaterTrigger::Item_t Item_t;
+	std::priority_queue<Item_t, std::vector<Item_t>, LaterTrigger> queue;
+	Event evt;
+	for(size_t i=0; i< n; ++i) {
+		if(sources[i]->Next(evt))
+			queue.push(Item_t(evt, i));
+	}
+
+	Accumulator accum;
+	while(!queue.empty()) {
+		const Item_t item = queue.top();
+		queue.pop();
+		accum.Add(item.first);
+		if(sources[item.second]->Next(evt)) {
+			if(evt.fTrigger < item.first.fTrigger) {
+				utils::Error("CoincBusytime::Merge", __FILE__, __LINE__)
+					<< "Source " << item.second << " is not sorted by trigger time: "
+					<< evt.fTrigger << " after " << item.first.fTrigger;
+				return -1;
+			}
+			queue.push(Item_t(evt, item.second));
+		}
+	}
+	return accum.GetTotal() / 1e6;
+}
 
 Double_t dragon::CoincBusytime::Calculate()
 {
@@ -1868,54 +2673,57 @@ Double_t dragon::CoincBusytime::Calculate()
 	///
 	/// Calcluation of the busy time is done as follows:
 	/// First, sort the collection of events by the trigger time. Then sum up all of
-	/// the busy times, but ignoring any overlap. To accomplish this, use the
-	/// `std::accumulate` algorithm, with a custom "accumulator" function which
-  /// ignores overlap by storing the last "end time" of an event and removing
-	/// any overlap between the begin time of the present event and the previous
-	/// end time. The code below shows how this is accomplished.
+	/// the busy times, but ignoring any overlap. To accomplish this, use an
+	/// "accumulator" (CoincBusytime::Accumulator) which ignores overlap by storing
+	/// the last "end time" of an event and removing any overlap between the begin
+	/// time of the present event and the previous end time:
 	/// \code
-  /// struct AccumulateBusy {
-  /// 	struct Output_t {
-  /// 		Double_t fEnd;
-  /// 		Double_t fTotalBusy;
-  /// 	};
-  /// 
-  /// 	Output_t operator() (const Output_t& current, const dragon::CoincBusytime::Event& additional);
-  /// };
-  /// 
-  /// AccumulateBusy::Output_t AccumulateBusy::operator() (const Output_t& current, const dragon::CoincBusytime::Event& additional)
-  /// {
-  /// 	Output_t out = current;
-  /// 
-  /// 	if( current.fEnd < additional.fTrigger ) { // no overlap
-  /// 		out.fTotalBusy += additional.fBusy;
-  /// 		out.fEnd = additional.End();
-  /// 	}
-  /// 	else if( current.fEnd < additional.End() ) { // incomplete overlap
-  /// 		out.fTotalBusy += (additional.End() - current.fEnd);
-  /// 		out.fEnd = additional.End();
-  /// 	}
-  /// 	else { // complete overlap
-  /// 		;
-  /// 	}
-  /// 
-  /// 	return out;
-  /// }
-	///
-	/// Double_t dragon::CoincBusytime::Calculate()
+	/// void Accumulator::Add(Double_t trigger, Double_t busy)
 	/// {
-	///   if(!fIsSorted) Sort();
-	///   AccumulateBusy::Output_t accum = { 0., 0. };
-	///   accum = std::accumulate(fEvents.begin(), fEvents.end(), accum, AccumulateBusy());
-	///   return accum.fTotalBusy / 1e6;
+	///   const Double_t end = trigger + busy;
+	///   if(fEnd < trigger) { // no overlap
+	///     fTotal += busy;
+	///     fEnd = end;
+	///   }
+	///   else if(fEnd < end) { // incomplete overlap
+	///     fTotal += (end - fEnd);
+	///     fEnd = end;
+	///   }
+	///   else { // complete overlap
+	///     ;
+	///   }
 	/// }
 	/// \endcode
 	///
+	/// If events were moved to temporary files, the remaining ones are moved as
+	/// well, and the sorted files are merged with Merge().
+
+	if(fSpills.empty()) {
+		if(!fIsSorted) Sort();
+		Accumulator accum;
+		for(Container_t::const_iterator it = fEvents.begin(); it != fEvents.end(); ++it)
+			accum.Add(*it);
+		return accum.GetTotal() / 1e6;
+	}
+
+	if(!fEvents.empty() && !Spill()) {
+		// keep the rest in memory, merged as one more source
+		if(!fIsSorted) Sort();
+	}
+	std::vector<FileSource> files(fSpills.begin(), fSpills.end());
+	std::vector<Source*> sources;
+	for(size_t i=0; i< files.size(); ++i)
+		sources.push_back(&files[i]);
+
+	std::vector<Double_t> trigger, busy;
+	for(Container_t::const_iterator it = fEvents.begin(); it != fEvents.end(); ++it) {
+		trigger.push_back(it->fTrigger);
+		busy.push_back(it->fBusy);
+	}
+	ArraySource rest(trigger.empty() ? 0 : &trigger[0], busy.empty() ? 0 : &busy[0], trigger.size());
+	sources.push_back(&rest);
 
-	if(!fIsSorted) Sort();
-	AccumulateBusy::Output_t accum = { 0., 0. };
-	accum = std::accumulate(fEvents.begin(), fEvents.end(), accum, AccumulateBusy());
-	return accum.fTotalBusy / 1e6;
+	return Merge(&sources[0], sources.size());
 }
 
 
@@ -7,6 +7,8 @@
 #ifndef DRAGON_ROOT_ANALYSIS_HEADER
 #define DRAGON_ROOT_ANALYSIS_HEADER
 #include <map>
+#include <vector>
+#include <cstdio>
 #include <memory>
 #include <fstream>
 #ifndef __MAKECINT__
@@ -112,10 +114,17 @@ public:
  *  filter.Close();
  *  \endcode
  *
- *  To speed things up, by default each input tree is filtered in a
- *  different thread (one thread per input). To turn off threading, call
- *  SetThreaded(kFALSE) before calling Run(). This will cause each input
- *  tree to be filtered in series rather than in parallel.
+ *  To speed things up, by default each input tree is split into tasks of
+ *  consecutive entries (see SetTaskEntries()), which are filtered in parallel
+ *  by a pool of threads (see SetNumThreads()). Each task writes its entries
+ *  into a temporary file, and the temporary trees are appended to the output
+ *  in order, so the output entries are in the same order as in the input.
+ *  Trees which can't be read from their files again (trees in memory or in
+ *  writable files, and trees with friends) are filtered in a single task.
+ *
+ *  To turn off threading, call SetThreaded(kFALSE) before calling Run().
+ *  This will cause each input tree to be filtered in series rather than in
+ *  parallel, directly into the output directory.
  */
 class TTreeFilter {
 public:
@@ -157,13 +166,25 @@ public:
 	void SetFilterCondition(TTree* tree, const char* condition);
 	/// Set output directory
 	void SetOutDir(TDirectory* directory);
-	/// Turn on/off threading for different trees, default is on
+	/// Turn on/off threading, default is on
 	void SetThreaded(Bool_t on) { fRunThreaded = on; }
+	/// Get the number of threads filtering in parallel
+	Int_t GetNumThreads() const { return fNumThreads; }
+	/// Set the number of threads filtering in parallel, 0 for one per CPU
+	void SetNumThreads(Int_t n) { fNumThreads = n; }
+	/// Get the number of entries per task
+	Long64_t GetTaskEntries() const { return fTaskEntries; }
+	/// Set the number of entries per task, 0 to choose from the input size
+	void SetTaskEntries(Long64_t n) { fTaskEntries = n; }
 	/// Check if output directory is valid.
 	Bool_t IsZombie() const;
 private:
-	/// Use separate threads for each tree?
+	/// Use separate threads?
 	Bool_t fRunThreaded;
+	/// Number of threads
+	Int_t fNumThreads;
+	/// Number of entries per task
+	Long64_t fTaskEntries;
 	/// File (directory) owning the output tree
 	TDirectory* fDirectory;
 	/// Do we take ownership of fFile or not?
@@ -350,6 +371,23 @@ public:
 				std::fill_n(fc4, 3, UDouble_t(0));
 			}
 	};
+	/// Values read from the event data of a run file, cached between calculations
+	struct FileData {
+		/// The run number
+		Int_t runnum;
+		/// Number of surface barrier counts in the norm period, per detector
+		Long64_t sb_counts[dragon::SurfaceBarrier::MAX_CHANNELS];
+		/// Number of sb counts in the whole run
+		Long64_t sb_counts_full[dragon::SurfaceBarrier::MAX_CHANNELS];
+		/// Tail live time in the norm period
+		UDouble_t live_time;
+		/// Head, tail and coinc live times across the whole run
+		UDouble_t live_time_full[3];
+		/// Average pressure in the norm period
+		UDouble_t pressure;
+		/// Average pressure across the whole run
+		UDouble_t pressure_full;
+	};
 
 public:
 	//// Dummy constructor
@@ -378,6 +416,14 @@ public:
 		}
 	/// Calculate the number of recoils per run
 	void CalculateRecoils(TFile* datafile, const char* tree, const char* gate);
+	/// Set the number of files read in parallel by BatchCalculate(), 0 for one per CPU
+	void SetNumThreads(Int_t n) { fNumThreads = n; }
+	/// Get the number of files read in parallel by BatchCalculate()
+	Int_t GetNumThreads() const { return fNumThreads; }
+	/// Set whether BatchCalculate() reuses values read before from the same files
+	void SetCache(Bool_t cache) { fCache = cache; }
+	/// Forget all values cached by BatchCalculate()
+	void ClearCache();
 	/// Integrate the surface barrier counts at the beginning and end of a run
 	Int_t ReadSbCounts(TFile* datafile, Double_t pkLow0, Double_t pkHigh0,
 										 Double_t pkLow1, Double_t pkHigh1,Double_t time = 120.);
@@ -419,6 +465,17 @@ private:
 	RunData* GetOrCreateRunData(Int_t runnum);
 	Bool_t HaveRossumFile() { return fRossum.get(); }
 	UInt_t GetParams(const char* param, std::vector<Double_t> *runnum, std::vector<UDouble_t> *parval);
+	/// Read the run number, SB counts, live times and pressures of a run file
+	static Bool_t ReadFileData(TFile* datafile, const Double_t* pkLow, const Double_t* pkHigh,
+														 Double_t time, FileData& data);
+	/// Read the run number of a run file
+	static Int_t ReadRunNumber(TFile* datafile, const char* where);
+	/// Store values read by ReadFileData()
+	void SetFileData(const FileData& data, Double_t time);
+	/// Store the number of recoils, and calculate the yield
+	void SetRecoils(Int_t runnum, const char* treename, Long64_t nrecoil);
+	/// Thread function of BatchCalculate()
+	static void* BatchWorker(void* arg);
 	BeamNorm(const BeamNorm&) { }
 	BeamNorm& operator= (const BeamNorm&) { return *this; }
 
@@ -429,6 +486,14 @@ private:
 	std::map<Int_t, RunData> fRunData;
 	dragon::utils::AutoPtr<RossumData> fRossum;
 	std::map<std::string, UDouble_t> fEfficiencies;
+	/// Number of files read in parallel by BatchCalculate()
+	Int_t fNumThreads; //!
+	/// Cache values read by BatchCalculate()
+	Bool_t fCache; //!
+	/// Values read by ReadFileData(), by "<path> <size> <modification time> <peaks> <time>"
+	std::map<std::string, FileData> fFileCache; //!
+	/// Numbers of recoils, by "<path> <size> <modification time> <tree> <gate>"
+	std::map<std::string, Long64_t> fRecoilCache; //!
 
 	ClassDef(BeamNorm, 2);
 };
@@ -533,6 +598,81 @@ private:
 };
 
 
+/// Summary of the trigger and busy times of a run
+/*!
+ * Holds everything needed to calculate the live time of a run, or of any time
+ * window within it, without reading the event trees again: the head and tail
+ * trigger times (relative to the trigger start, in microseconds) and busy times
+ * (IO32 clock ticks) of all events, sorted by trigger time, and the trigger
+ * start and stop times from the "odbstop" database.
+ *
+ * Prefix sums of the busy times, and of the coincidence busy time (head _or_ tail
+ * busy, see dragon::CoincBusytime), are made when the summary is built or read
+ * back, so GetBusytime() answers any window with two binary searches. Results are
+ * the same as from reading the trees, up to rounding in the coincidence sums.
+ *
+ * Summaries can be cached in a small "sidecar" file next to the run file (e.g.
+ * `run123_busy.root` for `run123.root`), see Get(); the sidecar is rebuilt when
+ * the run file changes. This is off by default, as it writes to the data directory.
+ */
+class BusytimeSummary: public TNamed {
+public:
+	/// Empty summary
+	BusytimeSummary();
+	/// Read the trigger and busy times from the trees of a run file
+	Bool_t Build(TFile* file);
+	/// Returns the busy time in a window of the run, in seconds
+	Double_t GetBusytime(Int_t which, Double_t tbegin = -1, Double_t tend = -1) const;
+	/// Returns the run time, or the length of a window, in seconds
+	Double_t GetRuntime(Int_t which, Double_t tbegin = -1, Double_t tend = -1) const;
+	/// Returns the number of head (0) or tail (1) events
+	Long64_t GetEntries(Int_t which) const;
+
+public:
+	/// Read the summary of a run file from its sidecar, or build it
+	static BusytimeSummary* Get(const char* filename, TFile* file = 0, Bool_t cache = kFALSE);
+	/// Returns the name of the sidecar file of a run file
+	static TString GetSidecarName(const char* filename);
+
+private:
+	/// Make the prefix sums
+	void Index();
+	/// Coincidence busy time of the events triggered in (tbegin, tend), in microseconds
+	Double_t GetCoincBusy(Double_t tbegin, Double_t tend) const;
+
+private:
+	/// Size of the run file the summary was made from
+	Long64_t fFileSize;
+	/// Modification time of the run file the summary was made from
+	Long_t fFileTime;
+	/// Trigger start times (head, tail, coinc), as from LiveTimeCalculator::CalculateRuntime()
+	Double_t fTrigStart[3];
+	/// Trigger stop times (head, tail, coinc), as from LiveTimeCalculator::CalculateRuntime()
+	Double_t fTrigStop[3];
+	/// Head trigger times [us], sorted
+	std::vector<Double_t> fHeadTrigger;
+	/// Head busy times [20 MHz ticks], in the order of fHeadTrigger
+	std::vector<UInt_t> fHeadBusy;
+	/// Tail trigger times [us], sorted
+	std::vector<Double_t> fTailTrigger;
+	/// Tail busy times [20 MHz ticks], in the order of fTailTrigger
+	std::vector<UInt_t> fTailBusy;
+	/// Sums of the head busy times before each event
+	std::vector<Long64_t> fHeadSum; //!
+	/// Sums of the tail busy times before each event
+	std::vector<Long64_t> fTailSum; //!
+	/// Head and tail trigger times [us], merged in order
+	std::vector<Double_t> fCoincTrigger; //!
+	/// Busy times [us], in the order of fCoincTrigger
+	std::vector<Double_t> fCoincBusy; //!
+	/// Latest end of busy up to each event in fCoincTrigger
+	std::vector<Double_t> fCoincEnd; //!
+	/// Coincidence busy time up to and including each event in fCoincTrigger
+	std::vector<Double_t> fCoincSum; //!
+
+	ClassDef(BusytimeSummary, 1);
+};
+
 /// Live time calculator
 /*!
  * Calculates the live time by looking at the measured
@@ -545,6 +685,10 @@ private:
  * run or a chain of runs. This class also calculates the live
  * time for coincidences. For more information about how this is
  * done, see the dragon::CoincBusytime class documentation
+ *
+ * The trees of each run are read once, into a dragon::BusytimeSummary
+ * which is kept for further calculations on the same file, and can be
+ * cached in a sidecar file (see SetCache()).
  */
 class LiveTimeCalculator {
 public:
@@ -577,6 +721,10 @@ public:
 	/// \brief Change the run file
 	/// \atention Does not clear previous calculations
 	void SetFile(TFile* file) { fFile = file; }
+	/// Enable or disable reading and writing busy time summaries in sidecar files (default off)
+	void SetCache(Bool_t cache) { fCache = cache; }
+	/// Returns the busy time summary of the present file, reading it if necessary
+	const BusytimeSummary* GetSummary();
 
 	/// Reset all stored data (livetimes, etc.) to zero
 	void Reset();
@@ -589,15 +737,25 @@ public:
 	static Double_t CalculateRuntime(midas::Database* db, const char* which) 
 		{ Double_t a,b; return CalculateRuntime(db, which, a, b); } // seconds (static function)
 
+public:
+	/// Make sure a run file has the trees and database needed for live time calculations
+	static Bool_t CheckFile(TFile* file, TTree*& t1, TTree*& t3, midas::Database*& db);
+
 private:
-	/// Make sure fFile is valid
-	Bool_t CheckFile(TTree*& t1, TTree*& t3, midas::Database*& db);
 	/// Does the work of live time calculations
 	void DoCalculate(Double_t tbegin, Double_t tend);
+	/// Set the results from a summary
+	void SetResults(const BusytimeSummary& summary, Double_t tbegin, Double_t tend);
 
 private:
 	/// Run file (no ownership)
 	TFile* fFile;
+	/// Use sidecar files
+	Bool_t fCache;
+	/// Summary of fFile
+	dragon::utils::AutoPtr<BusytimeSummary> fSummary;
+	/// Name of the file fSummary was made from
+	TString fSummaryFile;
 	/// Run times
 	Double_t fRuntime [3];
 	/// Busy times
@@ -625,17 +783,29 @@ private:
  *
  * For information about how the busy time is calculated in practice, see the documentation on
  * the Calculate() member funcion.
+ *
+ * Events can be given in any order with AddEvent(); when more than GetMaxEvents() are stored,
+ * they are sorted and moved to a temporary file, and Calculate() merges the sorted files, so
+ * memory use stays bounded. Inputs which are already sorted by trigger time (e.g. the head and
+ * tail trees) are better given as Source objects to Merge(), which makes a single pass over them
+ * in constant memory:
+ * \code
+ * dragon::CoincBusytime::ArraySource head(&headTrig[0], &headBusy[0], headTrig.size());
+ * dragon::CoincBusytime::ArraySource tail(&tailTrig[0], &tailBusy[0], tailTrig.size());
+ * dragon::CoincBusytime::Source* sources[2] = { &head, &tail };
+ * Double_t busy = dragon::CoincBusytime::Merge(sources, 2); // seconds
+ * \endcode
  */
 class CoincBusytime {
 public:
 	/// Helper class to store relevant information about a triggered event.
 	class Event {
- public:
+public:
 		/// Trigger time
 		Double_t fTrigger;
 		/// Busy time
 		Double_t fBusy;
- public:
+public:
 		/// Initialize data
 		Event(Double_t trig = 0, Double_t busy = 0):
 			fTrigger(trig), fBusy(busy) { }
@@ -646,17 +816,92 @@ public:
 			{	return lhs.fTrigger < rhs.fTrigger;	}
 	};
 
+	/// Sums busy times ignoring overlap, for events added in order of trigger time
+	class Accumulator {
+public:
+		/// Start from zero
+		Accumulator(): fEnd(0), fTotal(0) { }
+		/// Add the next event (trigger, busy in microseconds)
+		void Add(Double_t trigger, Double_t busy)
+			{
+				const Double_t end = trigger + busy;
+				if(fEnd < trigger) { // no overlap
+					fTotal += busy;
+					fEnd = end;
+				}
+				else if(fEnd < end) { // incomplete overlap
+					fTotal += (end - fEnd);
+					fEnd = end;
+				}
+			}
+		/// Add the next event
+		void Add(const Event& evt) { Add(evt.fTrigger, evt.fBusy); }
+		/// Latest end of busy so far
+		Double_t GetEnd() const { return fEnd; }
+		/// Busy time so far, in microseconds
+		Double_t GetTotal() const { return fTotal; }
+private:
+		Double_t fEnd;
+		Double_t fTotal;
+	};
+
+	/// Abstract stream of events, sorted by trigger time
+	class Source {
+public:
+		/// Empty
+		virtual ~Source() { }
+		/// Read the next event, false at the end
+		virtual Bool_t Next(Event& evt) = 0;
+	};
+
+	/// Source reading events from arrays of trigger times and busy times
+	class ArraySource: public Source {
+public:
+		/// Arrays of trigger times [us] and busy times [us], not copied
+		ArraySource(const Double_t* trigger, const Double_t* busy, size_t n):
+			fTrigger(trigger), fBusy(busy), fN(n), fPos(0) { }
+		/// Read the next event, false at the end
+		Bool_t Next(Event& evt)
+			{
+				if(fPos == fN) return kFALSE;
+				evt = Event(fTrigger[fPos], fBusy[fPos]);
+				++fPos;
+				return kTRUE;
+			}
+private:
+		const Double_t* fTrigger; //!
+		const Double_t* fBusy; //!
+		size_t fN;
+		size_t fPos;
+	};
+
 public:	
 	/// Set flag specifying that events are not yet sorted by trigger time
 	CoincBusytime(size_t reserve = 0);
+	/// Remove temporary files
+	~CoincBusytime();
 	/// Insert event into the colletion of triggered events
 	void AddEvent(Double_t trigger, Double_t busy);
 	/// Calculate the total time during which the head or tail is busy
 	Double_t Calculate(); // seconds
+	/// Returns the number of events kept in memory before moving them to a temporary file
+	size_t GetMaxEvents() const { return fMaxEvents; }
+	/// Set the number of events kept in memory (0: no limit)
+	void SetMaxEvents(size_t max) { fMaxEvents = max; }
+
+public:
+	/// Calculate the busy time of events merged from sources sorted by trigger time
+	static Double_t Merge(Source* const* sources, size_t n); // seconds
 
 private:
 	/// Sort events by the trigger time.
 	void Sort();
+	/// Sort the events in memory and move them to a temporary file
+	Bool_t Spill();
+	/// Disallow copy
+	CoincBusytime(const CoincBusytime&) { }
+	/// Disallow assign
+	CoincBusytime& operator= (const CoincBusytime&) { return *this; }
 
 public:
 		/// Type of the event collection
@@ -667,6 +912,10 @@ private:
 	Container_t fEvents;
 	/// Flag specifying whether or not events are sorted
 	Bool_t fIsSorted;
+	/// Maximum number of events in fEvents
+	size_t fMaxEvents;
+	/// Temporary files of sorted events
+	std::vector<FILE*> fSpills; //!
 };
 
 
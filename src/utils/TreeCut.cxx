@@ -0,0 +1,461 @@
+///
+/// \file TreeCut.cxx
+/// \brief Implements TreeCut.hxx
+///
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <TTree.h>
+#include <TLeaf.h>
+#include <TBranch.h>
+#include <TThread.h>
+#include <TVirtualTreePlayer.h>
+#include "ErrorDragon.hxx"
+#include "TreeCut.hxx"
+
+
+namespace {
+
+// Maximum nesting of aliases
+const Int_t kMaxDepth = 32;
+
+void skip_space(const char*& p)
+{
+	while(isspace(*p)) ++p;
+}
+
+// Skip over _op_ (and leading space) if it's next
+bool match(const char*& p, const char* op)
+{
+	skip_space(p);
+	const size_t len = strlen(op);
+	if(strncmp(p, op, len)) return false;
+	p += len;
+	return true;
+}
+
+bool is_name_start(char c) { return isalpha(c) || c == '_'; }
+
+bool is_name_char(char c) { return isalnum(c) || c == '_'; }
+
+// Read a name like "head.bgo.ecal" or "TMath::Abs"
+std::string read_name(const char*& p)
+{
+	const char* begin = p;
+	while(is_name_char(*p)) ++p;
+	while(1) {
+		if(p[0] == '.' && is_name_start(p[1]))
+			++p;
+		else if(p[0] == ':' && p[1] == ':' && is_name_start(p[2]))
+			p += 2;
+		else
+			break;
+		while(is_name_char(*p)) ++p;
+	}
+	return std::string(begin, p);
+}
+
+// Instruction of a function name, -1 if not supported
+Int_t function_code(const std::string& name)
+{
+	if(name == "abs" || name == "fabs" || name == "TMath::Abs")
+		return dragon::TreeCut::kAbs;
+	if(name == "sqrt" || name == "TMath::Sqrt")
+		return dragon::TreeCut::kSqrt;
+	return -1;
+}
+
+} // namespace
+
+
+dragon::TreeCut::TreeCut():
+	fTree(0), fCompiled(kFALSE)
+{ }
+
+Bool_t dragon::TreeCut::Compile(TTree* tree, const char* expression)
+{
+	///
+	/// \param tree Tree (or chain) to read; for a chain, leaves are looked up in
+	///  the current tree, which is loaded if there is none yet
+	/// \param expression Cut expression, as for TTree::Draw(); empty passes all entries
+	/// \returns true if successful, false if the expression isn't supported (see the
+	///  class description) or doesn't match the tree
+
+	fTree = tree;
+	fExpression = expression ? expression : "";
+	fCompiled = kFALSE;
+	fCode.clear();
+	fLeaves.clear();
+	fBranches.clear();
+	if(!fTree) return kFALSE;
+	if(!fTree->GetTree() && fTree->LoadTree(0) < 0) return kFALSE;
+
+	const char* p = fExpression.c_str();
+	skip_space(p);
+	if(*p == 0)
+		AddOp(kConst, 1);
+	else if(!ParseExpression(p, 0)) {
+		fCode.clear();
+		fLeaves.clear();
+		return kFALSE;
+	}
+
+	size_t depth = 0, maxDepth = 0;
+	for(size_t i=0; i< fCode.size(); ++i) {
+		if(fCode[i].fCode == kConst || fCode[i].fCode == kLeaf)
+			++depth;
+		else if(fCode[i].fCode >= kAdd)
+			--depth;
+		maxDepth = std::max(depth, maxDepth);
+	}
+	fStack.resize(maxDepth);
+
+	fCompiled = UpdateLeaves();
+	return fCompiled;
+}
+
+Bool_t dragon::TreeCut::UpdateLeaves()
+{
+	///
+	/// \returns false if a leaf is missing from the current tree
+	fBranches.clear();
+	TTree* tree = fTree ? fTree->GetTree() : 0;
+	if(!tree) return kFALSE;
+
+	for(size_t i=0; i< fLeaves.size(); ++i) {
+		fLeaves[i].fLeaf = tree->FindLeaf(fLeaves[i].fName.c_str());
+		if(!fLeaves[i].fLeaf) return kFALSE;
+
+		TBranch* branch = fLeaves[i].fLeaf->GetBranch();
+		if(std::find(fBranches.begin(), fBranches.end(), branch) == fBranches.end())
+			fBranches.push_back(branch);
+	}
+	return kTRUE;
+}
+
+Bool_t dragon::TreeCut::Pass(Long64_t localEntry)
+{
+	///
+	/// \param localEntry Entry number in the current tree, as returned by TTree::LoadTree()
+	/// \returns true if the expression is nonzero for the entry
+	for(size_t i=0; i< fBranches.size(); ++i)
+		fBranches[i]->GetEntry(localEntry);
+	return Evaluate();
+}
+
+Bool_t dragon::TreeCut::Evaluate()
+{
+	Double_t* s = &fStack[0];
+	size_t n = 0;
+	for(std::vector<Op_t>::const_iterator op = fCode.begin(); op != fCode.end(); ++op) {
+		switch(op->fCode) {
+		case kConst:        s[n++] = op->fValue; break;
+		case kLeaf:         s[n++] = fLeaves[op->fLeaf].fLeaf->GetValue(fLeaves[op->fLeaf].fIndex); break;
+		case kNeg:          s[n-1] = -s[n-1]; break;
+		case kNot:          s[n-1] = (s[n-1] == 0); break;
+		case kAbs:          s[n-1] = fabs(s[n-1]); break;
+		case kSqrt:         s[n-1] = sqrt(fabs(s[n-1])); break;
+		case kAdd:          --n; s[n-1] += s[n]; break;
+		case kSub:          --n; s[n-1] -= s[n]; break;
+		case kMul:          --n; s[n-1] *= s[n]; break;
+		case kDiv:          --n; s[n-1] = (s[n] == 0) ? 0 : s[n-1] / s[n]; break;
+		case kLess:         --n; s[n-1] = (s[n-1] <  s[n]); break;
+		case kLessEqual:    --n; s[n-1] = (s[n-1] <= s[n]); break;
+		case kGreater:      --n; s[n-1] = (s[n-1] >  s[n]); break;
+		case kGreaterEqual: --n; s[n-1] = (s[n-1] >= s[n]); break;
+		case kEqual:        --n; s[n-1] = (s[n-1] == s[n]); break;
+		case kNotEqual:     --n; s[n-1] = (s[n-1] != s[n]); break;
+		case kAnd:          --n; s[n-1] = (s[n-1] != 0 && s[n] != 0); break;
+		case kOr:           --n; s[n-1] = (s[n-1] != 0 || s[n] != 0); break;
+		default: break;
+		}
+	}
+	return s[0] != 0;
+}
+
+Long64_t dragon::TreeCut::Count(TTree* tree, const char* expression)
+{
+	///
+	/// Same as `tree->GetPlayer()->GetEntries(expression)`, which is used if
+	/// the expression can't be compiled.
+	Long64_t count = 0;
+	Count(tree, 1, &expression, &count);
+	return count;
+}
+
+void dragon::TreeCut::Count(TTree* tree, Int_t n, const char* const* expressions, Long64_t* counts)
+{
+	///
+	/// \param tree Tree (or chain) to read
+	/// \param n Number of expressions
+	/// \param expressions Cut expressions
+	/// \param [out] counts Number of entries passing each cut
+	///
+	/// Expressions which can't be compiled are counted with TTreeFormula, through
+	/// TVirtualTreePlayer::GetEntries().
+	///
+	/// Compiling, and counting with TTreeFormula, is done under TThread::Lock(), so
+	/// trees of different files can be counted in parallel. The files of a chain are
+	/// opened while looping over the entries, so chains can't.
+
+	std::vector<TreeCut> cuts(n);
+	std::vector<Int_t> compiled;
+	TThread::Lock();
+	for(Int_t i=0; i< n; ++i) {
+		counts[i] = 0;
+		if(cuts[i].Compile(tree, expressions[i]))
+			compiled.push_back(i);
+		else
+			counts[i] = tree->GetPlayer()->GetEntries(expressions[i]);
+	}
+	TThread::UnLock();
+
+	Int_t treenumber = -1;
+	std::vector<TBranch*> branches; // of all cuts, each read once per entry
+	for(Long64_t entry = 0; !compiled.empty(); ++entry) {
+		const Long64_t localEntry = tree->LoadTree(entry);
+		if(localEntry < 0) break;
+		if(treenumber != tree->GetTreeNumber()) {
+			treenumber = tree->GetTreeNumber();
+			branches.clear();
+			for(size_t i=0; i< compiled.size(); ++i) {
+				if(cuts[compiled[i]].UpdateLeaves()) {
+					const std::vector<TBranch*>& b = cuts[compiled[i]].fBranches;
+					for(size_t j=0; j< b.size(); ++j) {
+						if(std::find(branches.begin(), branches.end(), b[j]) == branches.end())
+							branches.push_back(b[j]);
+					}
+					continue;
+				}
+
+				utils::Warning("TreeCut::Count", __FILE__, __LINE__)
+					<< "Leaves of \"" << expressions[compiled[i]] << "\" missing from tree "
+					<< treenumber << " of \"" << tree->GetName() << "\", using TTreeFormula.";
+				TThread::Lock();
+				for(size_t j=0; j< compiled.size(); ++j)
+					counts[compiled[j]] = tree->GetPlayer()->GetEntries(expressions[compiled[j]]);
+				TThread::UnLock();
+				return;
+			}
+		}
+		for(size_t i=0; i< branches.size(); ++i)
+			branches[i]->GetEntry(localEntry);
+		for(size_t i=0; i< compiled.size(); ++i) {
+			if(cuts[compiled[i]].Evaluate())
+				++counts[compiled[i]];
+		}
+	}
+}
+
+Bool_t dragon::TreeCut::ParseExpression(const char* expression, Int_t depth)
+{
+	if(depth > kMaxDepth) return kFALSE;
+	const char* p = expression;
+	if(!ParseOr(p, depth)) return kFALSE;
+	skip_space(p);
+	return *p == 0;
+}
+
+Bool_t dragon::TreeCut::ParseOr(const char*& p, Int_t depth)
+{
+	if(!ParseAnd(p, depth)) return kFALSE;
+	while(match(p, "||")) {
+		if(!ParseAnd(p, depth)) return kFALSE;
+		AddOp(kOr);
+	}
+	return kTRUE;
+}
+
+Bool_t dragon::TreeCut::ParseAnd(const char*& p, Int_t depth)
+{
+	if(!ParseEquality(p, depth)) return kFALSE;
+	while(match(p, "&&")) {
+		if(!ParseEquality(p, depth)) return kFALSE;
+		AddOp(kAnd);
+	}
+	return kTRUE;
+}
+
+Bool_t dragon::TreeCut::ParseEquality(const char*& p, Int_t depth)
+{
+	if(!ParseRelation(p, depth)) return kFALSE;
+	while(1) {
+		Int_t code;
+		if(match(p, "==")) code = kEqual;
+		else if(match(p, "!=")) code = kNotEqual;
+		else break;
+		if(!ParseRelation(p, depth)) return kFALSE;
+		AddOp(code);
+	}
+	return kTRUE;
+}
+
+Bool_t dragon::TreeCut::ParseRelation(const char*& p, Int_t depth)
+{
+	if(!ParseSum(p, depth)) return kFALSE;
+	while(1) {
+		Int_t code;
+		if(match(p, "<<") || match(p, ">>")) return kFALSE; // shifts
+		else if(match(p, "<=")) code = kLessEqual;
+		else if(match(p, ">=")) code = kGreaterEqual;
+		else if(match(p, "<")) code = kLess;
+		else if(match(p, ">")) code = kGreater;
+		else break;
+		if(!ParseSum(p, depth)) return kFALSE;
+		AddOp(code);
+	}
+	return kTRUE;
+}
+
+Bool_t dragon::TreeCut::ParseSum(const char*& p, Int_t depth)
+{
+	if(!ParseProduct(p, depth)) return kFALSE;
+	while(1) {
+		Int_t code;
+		if(match(p, "+")) code = kAdd;
+		else if(match(p, "-")) code = kSub;
+		else break;
+		if(!ParseProduct(p, depth)) return kFALSE;
+		AddOp(code);
+	}
+	return kTRUE;
+}
+
+Bool_t dragon::TreeCut::ParseProduct(const char*& p, Int_t depth)
+{
+	if(!ParseUnary(p, depth)) return kFALSE;
+	while(1) {
+		Int_t code;
+		if(match(p, "**")) return kFALSE; // power
+		else if(match(p, "*")) code = kMul;
+		else if(match(p, "/")) code = kDiv;
+		else break;
+		if(!ParseUnary(p, depth)) return kFALSE;
+		AddOp(code);
+	}
+	return kTRUE;
+}
+
+Bool_t dragon::TreeCut::ParseUnary(const char*& p, Int_t depth)
+{
+	if(match(p, "-")) {
+		if(!ParseUnary(p, depth)) return kFALSE;
+		AddOp(kNeg);
+		return kTRUE;
+	}
+	if(match(p, "+"))
+		return ParseUnary(p, depth);
+	skip_space(p);
+	if(p[0] == '!' && p[1] != '=') {
+		++p;
+		if(!ParseUnary(p, depth)) return kFALSE;
+		AddOp(kNot);
+		return kTRUE;
+	}
+	return ParsePrimary(p, depth);
+}
+
+Bool_t dragon::TreeCut::ParsePrimary(const char*& p, Int_t depth)
+{
+	skip_space(p);
+
+	//
+	// Parentheses
+	if(*p == '(') {
+		++p;
+		if(!ParseOr(p, depth)) return kFALSE;
+		return match(p, ")");
+	}
+
+	//
+	// Number
+	if(isdigit(*p) || (p[0] == '.' && isdigit(p[1]))) {
+		if(p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) return kFALSE;
+		char* end;
+		const Double_t value = strtod(p, &end);
+		if(is_name_char(*end) || *end == '.') return kFALSE;
+		p = end;
+		AddOp(kConst, value);
+		return kTRUE;
+	}
+
+	if(!is_name_start(*p)) return kFALSE;
+	const std::string name = read_name(p);
+
+	//
+	// Function
+	const char* q = p;
+	if(match(q, "(")) {
+		const Int_t code = function_code(name);
+		if(code < 0) return kFALSE;
+		p = q;
+		if(!ParseOr(p, depth) || !match(p, ")")) return kFALSE;
+		AddOp(code);
+		return kTRUE;
+	}
+
+	//
+	// Alias or leaf, with constant indices
+	std::vector<Int_t> indices;
+	while(*p == '[') {
+		char* end;
+		const long index = strtol(p + 1, &end, 10);
+		if(end == p + 1) return kFALSE;
+		p = end;
+		if(!match(p, "]")) return kFALSE;
+		indices.push_back(index);
+	}
+	if(*p == '.' || *p == '$') return kFALSE;
+
+	const char* alias = indices.empty() ? fTree->GetAlias(name.c_str()) : 0;
+	if(alias) {
+		if(fTree->GetTree()->FindLeaf(name.c_str())) return kFALSE; // ambiguous
+		return ParseExpression(alias, depth + 1);
+	}
+
+	return AddLeaf(name, indices);
+}
+
+Bool_t dragon::TreeCut::AddLeaf(const std::string& name, const std::vector<Int_t>& indices)
+{
+	///
+	/// \returns false unless the leaf has a fixed size, with one index per dimension
+	TLeaf* leaf = fTree->GetTree()->FindLeaf(name.c_str());
+	if(!leaf || leaf->GetLeafCount() || leaf->InheritsFrom("TLeafC") || leaf->InheritsFrom("TLeafObject"))
+		return kFALSE;
+
+	//
+	// Dimensions from the title, e.g. "ecal[30]"
+	std::vector<Int_t> dims;
+	Int_t len = 1;
+	const char* t = strchr(leaf->GetTitle(), '[');
+	while(t && *t == '[') {
+		char* end;
+		const long dim = strtol(t + 1, &end, 10);
+		if(end == t + 1 || *end != ']') return kFALSE;
+		dims.push_back(dim);
+		len *= dim;
+		t = end + 1;
+	}
+	if(dims.size() != indices.size() || len != leaf->GetLenStatic())
+		return kFALSE;
+
+	Int_t index = 0;
+	for(size_t i=0; i< dims.size(); ++i) {
+		if(indices[i] < 0 || indices[i] >= dims[i]) return kFALSE;
+		index = index * dims[i] + indices[i];
+	}
+
+	Leaf_t newLeaf = { name, index, leaf };
+	fLeaves.push_back(newLeaf);
+	AddOp(kLeaf, 0, fLeaves.size() - 1);
+	return kTRUE;
+}
+
+void dragon::TreeCut::AddOp(Int_t code, Double_t value, size_t leaf)
+{
+	Op_t op = { code, value, leaf };
+	fCode.push_back(op);
+}
@@ -0,0 +1,159 @@
+///
+/// \file TreeCut.hxx
+/// \brief Defines a class to evaluate cut (gate) expressions on TTree entries
+///  without interpreting them through TTreeFormula.
+///
+#ifndef DRAGON_TREE_CUT_HXX
+#define DRAGON_TREE_CUT_HXX
+#ifndef __MAKECINT__
+#include <string>
+#include <vector>
+#include <Rtypes.h>
+
+class TTree;
+class TLeaf;
+class TBranch;
+
+namespace dragon {
+
+/// Cut expression compiled into a flat list of instructions
+/*!
+ *  Compiles the usual gate strings, e.g.
+ *  \code
+ *  "sb.ecal[0] > 100 && sb.ecal[0] < 1500 && header.fTimeStamp - 1.3e9 < 120"
+ *  \endcode
+ *  into instructions for a small stack machine (in postfix order), which
+ *  reads only the branches of the leaves used in the expression. The results
+ *  are the same as with TTreeFormula, for the expressions it accepts:
+ *   - Numbers, and leaves of the tree with constant indices for each dimension
+ *     of fixed size arrays, e.g. `bgo.ecal[0]` or `header.fTimeStamp`
+ *   - Aliases of the tree (TTree::SetAlias()), which are compiled in place
+ *   - Operators `||`, `&&`, `==`, `!=`, `<`, `<=`, `>`, `>=`, `+`, `-`, `*`, `/`, `!`
+ *     with the precedence and associativity of C, and parentheses
+ *   - Functions `abs()`, `fabs()`, `TMath::Abs()`, `sqrt()` and `TMath::Sqrt()`
+ *
+ *  As in TFormula, division by zero gives zero. Compile() returns false for
+ *  anything else (e.g. arrays without indices or of variable size, `Entry$`,
+ *  other functions), in which case the expression should be evaluated with
+ *  TTreeFormula as before; Count() does so automatically.
+ *
+ *  Example:
+ *  \code
+ *  dragon::TreeCut cut;
+ *  if(cut.Compile(t3, "sb.ecal[0] > 100")) {
+ *    Int_t treenumber = -1;
+ *    for(Long64_t entry = 0; t3->LoadTree(entry) >= 0; ++entry) {
+ *      if(treenumber != t3->GetTreeNumber()) { // new file of a TChain
+ *        treenumber = t3->GetTreeNumber();
+ *        cut.UpdateLeaves();
+ *      }
+ *      if(cut.Pass(t3->GetReadEntry())) ...
+ *    }
+ *  }
+ *  \endcode
+ */
+class TreeCut {
+public:
+	/// Instructions
+	enum OpCode_t {
+		kConst,        ///< Push a number
+		kLeaf,         ///< Push the value of a leaf
+		kNeg,          ///< Pop one, push its negative
+		kNot,          ///< Pop one, push its logical negation
+		kAbs,          ///< Pop one, push its absolute value
+		kSqrt,         ///< Pop one, push its square root
+		kAdd,          ///< Pop two, push a + b
+		kSub,          ///< Pop two, push a - b
+		kMul,          ///< Pop two, push a * b
+		kDiv,          ///< Pop two, push a / b (0 if b is 0)
+		kLess,         ///< Pop two, push a < b
+		kLessEqual,    ///< Pop two, push a <= b
+		kGreater,      ///< Pop two, push a > b
+		kGreaterEqual, ///< Pop two, push a >= b
+		kEqual,        ///< Pop two, push a == b
+		kNotEqual,     ///< Pop two, push a != b
+		kAnd,          ///< Pop two, push a && b
+		kOr            ///< Pop two, push a || b
+	};
+
+public:
+	/// Empty cut
+	TreeCut();
+	/// Compile an expression over the leaves of a tree (or chain)
+	Bool_t Compile(TTree* tree, const char* expression);
+	/// Check if the last Compile() succeeded
+	Bool_t IsCompiled() const { return fCompiled; }
+	/// Get the expression
+	const char* GetExpression() const { return fExpression.c_str(); }
+	/// Find the leaves in the current tree, call when the tree of a chain changes
+	Bool_t UpdateLeaves();
+	/// Check if an entry of the current tree passes the cut
+	Bool_t Pass(Long64_t localEntry);
+
+public:
+	/// Count the entries of a tree passing a cut
+	static Long64_t Count(TTree* tree, const char* expression);
+	/// Count the entries of a tree passing each of several cuts, in a single pass
+	static void Count(TTree* tree, Int_t n, const char* const* expressions, Long64_t* counts);
+
+private:
+	/// One instruction
+	struct Op_t {
+		Int_t fCode;     ///< OpCode_t
+		Double_t fValue; ///< Number (kConst)
+		size_t fLeaf;    ///< Index in fLeaves (kLeaf)
+	};
+	/// One leaf used in the expression
+	struct Leaf_t {
+		std::string fName; ///< Name, without indices
+		Int_t fIndex;      ///< Index of the value, flattened over all dimensions
+		TLeaf* fLeaf;      ///< Leaf in the current tree
+	};
+
+private:
+	/// Parse `||` expressions
+	Bool_t ParseOr(const char*& p, Int_t depth);
+	/// Parse `&&` expressions
+	Bool_t ParseAnd(const char*& p, Int_t depth);
+	/// Parse `==` and `!=` expressions
+	Bool_t ParseEquality(const char*& p, Int_t depth);
+	/// Parse `<`, `<=`, `>` and `>=` expressions
+	Bool_t ParseRelation(const char*& p, Int_t depth);
+	/// Parse `+` and `-` expressions
+	Bool_t ParseSum(const char*& p, Int_t depth);
+	/// Parse `*` and `/` expressions
+	Bool_t ParseProduct(const char*& p, Int_t depth);
+	/// Parse unary `-`, `+` and `!`
+	Bool_t ParseUnary(const char*& p, Int_t depth);
+	/// Parse numbers, names, functions and parentheses
+	Bool_t ParsePrimary(const char*& p, Int_t depth);
+	/// Parse a complete expression (or alias)
+	Bool_t ParseExpression(const char* expression, Int_t depth);
+	/// Add a leaf, false if it isn't a single value
+	Bool_t AddLeaf(const std::string& name, const std::vector<Int_t>& indices);
+	/// Append an instruction
+	void AddOp(Int_t code, Double_t value = 0, size_t leaf = 0);
+	/// Evaluate the expression on the values read
+	Bool_t Evaluate();
+
+private:
+	/// Tree (or chain) read
+	TTree* fTree;
+	/// Expression
+	std::string fExpression;
+	/// Compiled successfully
+	Bool_t fCompiled;
+	/// Instructions
+	std::vector<Op_t> fCode;
+	/// Leaves used
+	std::vector<Leaf_t> fLeaves;
+	/// Branches of the leaves used, each once
+	std::vector<TBranch*> fBranches;
+	/// Evaluation stack
+	std::vector<Double_t> fStack;
+};
+
+} // namespace dragon
+
+#endif // #ifndef __MAKECINT__
+#endif
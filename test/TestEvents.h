@@ -0,0 +1,201 @@
+///
+/// \file TestEvents.h
+/// \brief Builds synthetic MIDAS events (and files) for the test programs.
+///
+/// Events are built as arrays of 32-bit words: the MIDAS event header,
+/// followed by a bank header and 16-bit bank headers ("flags" == 1).
+/// The helper functions return the data words of the banks read by the
+/// DRAGON unpacking classes, in the format written by the frontends.
+/// Streams of events with TSC banks can be pushed through the timestamp
+/// queues, recording the singles and coincidences they handle.
+///
+#ifndef DRAGON_TEST_EVENTS_H
+#define DRAGON_TEST_EVENTS_H
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "utils/IntTypes.h"
+#include "utils/definitions.h"
+#include "midas/Event.hxx"
+#include "TStamp.hxx"
+
+namespace test {
+
+typedef std::vector<uint32_t> Words_t;
+
+/// Builds one MIDAS event
+class EventBuilder {
+public:
+	/// Starts an event with the given header
+	EventBuilder(uint16_t id, uint32_t serial, uint32_t timestamp = 0)
+		{
+			const uint16_t hdr[2] = { id, 0 };
+			uint32_t h0; memcpy(&h0, hdr, 4);
+			fWords.push_back(h0);        // event id, trigger mask
+			fWords.push_back(serial);
+			fWords.push_back(timestamp);
+			fWords.push_back(0);         // data size (Finish())
+			fWords.push_back(0);         // bank header: size (Finish())
+			fWords.push_back(1);         // bank header: flags (16-bit banks)
+		}
+	/// Appends a bank of 32-bit words (TID_DWORD)
+	EventBuilder& Add(const char* name, const Words_t& words, uint16_t type = 6)
+		{
+			uint32_t bkname; memcpy(&bkname, name, 4);
+			fWords.push_back(bkname);
+			fWords.push_back(type | uint32_t(words.size()*4) << 16);
+			fWords.insert(fWords.end(), words.begin(), words.end());
+			if (words.size() % 2) fWords.push_back(0); // banks are 8-byte aligned
+			return *this;
+		}
+	/// Sets the sizes in the headers, returns the event (header + data)
+	const Words_t& Finish()
+		{
+			fWords[4] = (fWords.size() - 6) * 4;
+			fWords[3] = (fWords.size() - 4) * 4;
+			return fWords;
+		}
+	/// Pointer to the event header (after Finish())
+	const void* Header() const { return &fWords[0]; }
+	/// Pointer to the event data (after Finish())
+	const void* Data() const { return &fWords[4]; }
+	/// Size of the event data in bytes (after Finish())
+	int DataSize() const { return fWords[3]; }
+private:
+	Words_t fWords;
+};
+
+/// TSC4 bank with \e clock as the first trigger channel value
+inline Words_t tsc_bank(uint64_t clock)
+{
+	const uint32_t upper = uint32_t(clock >> 29) << 1; // bits 35..28, bit 29 repeated
+	Words_t words;
+	words.push_back(0x01130215);               // firmware version
+	words.push_back(0);                        // write timestamp
+	words.push_back(0);                        // routing
+	words.push_back(1 | (upper & 0xff) << 16); // one channel, upper bits
+	words.push_back(upper >> 8);               // rollover
+	words.push_back(uint32_t(clock & 0x3fffffff)); // channel 0
+	return words;
+}
+
+/// IO32 bank
+inline Words_t io32_bank(uint32_t count, uint32_t trigTime)
+{
+	Words_t words;
+	words.push_back(0xaaaa0020);
+	words.push_back(count);
+	words.push_back(trigTime);
+	words.push_back(trigTime + 10); // readout start
+	words.push_back(trigTime + 30); // readout end
+	words.push_back(10);
+	words.push_back(20);
+	words.push_back(30);
+	words.push_back(1);             // trigger latch
+	return words;
+}
+
+/// V792 / V785 bank with values for the channels in \e data that are >= 0
+inline Words_t v792_bank(const int* data, int nch, uint32_t count)
+{
+	Words_t words;
+	int n = 0;
+	for (int ch = 0; ch < nch; ++ch) if (data[ch] >= 0) ++n;
+	words.push_back((0x2u << 24) | (n << 6));                // header
+	for (int ch = 0; ch < nch; ++ch) {
+		if (data[ch] < 0) continue;
+		words.push_back((uint32_t(ch) << 16) | (data[ch] & 0x1fff)); // data, bit 12 = overflow
+	}
+	words.push_back((0x4u << 24) | (count & 0xffffff));      // footer
+	return words;
+}
+
+/// V1190 hit
+struct Hit_t {
+	uint32_t fChannel; ///< Channel
+	uint32_t fEdge;    ///< 0 leading, 1 trailing
+	uint32_t fValue;   ///< Measurement
+};
+
+/// V1190 bank with the hits given
+inline Words_t v1190_bank(const std::vector<Hit_t>& hits, uint32_t eventId)
+{
+	Words_t words;
+	words.push_back((8u << 27) | ((eventId & 0x3fffff) << 5));      // global header
+	words.push_back((1u << 27) | ((eventId & 0xfff) << 12));         // TDC header
+	for (size_t i = 0; i < hits.size(); ++i)
+		words.push_back((hits[i].fEdge << 26) | (hits[i].fChannel << 19) | (hits[i].fValue & 0x7ffff));
+	words.push_back((3u << 27) | ((eventId & 0xfff) << 12) | (hits.size() + 2)); // TDC trailer
+	words.push_back((0x10u << 27) | ((hits.size() + 4) << 5));      // global trailer
+	return words;
+}
+
+/// Writes events (header + data) to a MIDAS file
+inline bool write_file(const char* path, const std::vector<Words_t>& events)
+{
+	FILE* f = fopen(path, "wb");
+	if (!f) return false;
+	for (size_t i = 0; i < events.size(); ++i)
+		fwrite(&events[i][0], 4, events[i].size(), f);
+	return fclose(f) == 0;
+}
+
+/// Singles (serial, serial) and coincidence (serial1, serial2) events, in order handled
+typedef std::vector<std::pair<uint32_t, uint32_t> > Output_t;
+
+/// Timestamp queue recording its output
+template <class Q>
+class Recorder: public Q {
+public:
+	mutable Output_t fSingles;
+	mutable Output_t fCoinc;
+	Recorder(double maxDelta): Q(maxDelta) { }
+	~Recorder() { }
+private:
+	void HandleSingle(const midas::Event& e) const
+		{ fSingles.push_back(std::make_pair(e.GetSerialNumber(), e.GetSerialNumber())); }
+	void HandleCoinc(const midas::Event& e1, const midas::Event& e2) const
+		{ fCoinc.push_back(std::make_pair(e1.GetSerialNumber(), e2.GetSerialNumber())); }
+};
+
+/// Event stream: trigger times in us, pushed in the order given
+struct Stream_t {
+	std::vector<double> fTimes;
+	std::vector<uint16_t> fIds;
+	void Add(double time, uint16_t id) { fTimes.push_back(time); fIds.push_back(id); }
+	/// Delays each event by up to \e jitter in arrival order
+	void Shuffle(double jitter)
+		{
+			std::vector<std::pair<double, size_t> > arrival;
+			for (size_t i = 0; i < fTimes.size(); ++i)
+				arrival.push_back(std::make_pair(fTimes[i] + jitter * (rand() / (RAND_MAX + 1.)), i));
+			std::sort(arrival.begin(), arrival.end());
+			Stream_t shuffled;
+			for (size_t i = 0; i < arrival.size(); ++i)
+				shuffled.Add(fTimes[arrival[i].second], fIds[arrival[i].second]);
+			*this = shuffled;
+		}
+	/// Queues events [begin, end) with serial numbers their index in the stream, flushes the queue
+	template <class Q>
+	void Run(Q& queue, double window, size_t begin, size_t end) const
+		{
+			for (size_t i = begin; i < end; ++i) {
+				EventBuilder event(fIds[i], i);
+				const Words_t& buf = event.Add("TSCH", tsc_bank(uint64_t(fTimes[i] * DRAGON_TSC_FREQ))).Finish();
+				midas::Event e(&buf[0], &buf[4], buf[3], "TSCH", window);
+				queue.Push(e);
+			}
+			queue.Flush();
+		}
+	/// Queues all events, flushes the queue
+	template <class Q>
+	void Run(Q& queue, double window) const
+		{ Run(queue, window, 0, fTimes.size()); }
+};
+
+}
+
+#endif
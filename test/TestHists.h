@@ -0,0 +1,112 @@
+///
+/// \file TestHists.h
+/// \brief Random event parameters and rootana histograms for the histogram filling tests.
+///
+/// make_hists() makes the same set of histograms (1d and 2d, with and without
+/// cuts, summary, and one with variable bins, which isn't compiled into fill
+/// plans) on the parameters of any Params_t; compare() checks that two ROOT
+/// histograms have the same bins, entries and statistics.
+///
+#ifndef DRAGON_TEST_HISTS_H
+#define DRAGON_TEST_HISTS_H
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <TH1D.h>
+#include <TH2D.h>
+#include "rootana/Histos.hxx"
+#include "rootana/Cut.hxx"
+#include "TestUtil.h"
+
+namespace test {
+
+/// Parameters of one event
+struct Params_t {
+	Double_t fX;       ///< Filled into [0, 1000)
+	Int_t fY;          ///< Filled into [0, 60)
+	Float_t fArray[8]; ///< Filled into summary histograms, [0, 1000)
+	Short_t fGate;     ///< Used by the cuts only
+	/// Random values, with some invalid (-1), below, above and on the edges of the ranges
+	void Randomize()
+		{
+			fX = rand() % 10 ? -200. + 1400. * (rand() / (RAND_MAX + 1.)) : rand() % 2 ? -1. : 1000.;
+			fY = rand() % 70 - 5;
+			for (int i = 0; i < 8; ++i)
+				fArray[i] = rand() % 8 ? -100. + 1200. * (rand() / (RAND_MAX + 1.)) : -1.;
+			fGate = rand() % 100;
+		}
+};
+
+/// Limits of the cuts
+const Short_t kGateLow = 30;
+const Double_t kXHigh = 600.;
+
+/// Appends new histograms filled from \e params to \e hists; the caller owns them
+inline void make_hists(Params_t& params, std::vector<rootana::HistBase*>& hists)
+{
+	using namespace rootana;
+	hists.push_back(new Hist<TH1D>(new TH1D("x", "", 100, 0., 1000.), DataPointer::New(params.fX)));
+
+	Hist<TH1D>* gated = new Hist<TH1D>(new TH1D("x_gated", "", 100, 0., 1000.), DataPointer::New(params.fX));
+	gated->set_cut(GreaterEqual(params.fGate, kGateLow));
+	hists.push_back(gated);
+
+	hists.push_back(new Hist<TH1D>(new TH1D("y", "", 60, 0., 60.), DataPointer::New(params.fY)));
+
+	Hist<TH2D>* xy = new Hist<TH2D>(new TH2D("xy", "", 50, 0., 1000., 60, 0., 60.),
+																	DataPointer::New(params.fX), DataPointer::New(params.fY));
+	xy->set_cut(Less(params.fX, kXHigh) || !IsValid(params.fY) || Less(params.fGate, kGateLow));
+	hists.push_back(xy);
+
+	hists.push_back(new SummaryHist(new TH1D("summary", "", 100, 0., 1000.), DataPointer::New(params.fArray, 8)));
+
+	SummaryHist* gatedSummary =
+		new SummaryHist(new TH1D("summary_gated", "", 100, 0., 1000.), DataPointer::New(params.fArray, 8));
+	gatedSummary->set_cut(GreaterEqual(params.fGate, kGateLow));
+	hists.push_back(gatedSummary);
+
+	const Double_t edges[] = { 0., 10., 50., 100., 500., 1000. };
+	hists.push_back(new Hist<TH1D>(new TH1D("x_variable", "", 5, edges), DataPointer::New(params.fX)));
+}
+
+/// Deletes the histograms made by make_hists()
+inline void delete_hists(std::vector<rootana::HistBase*>& hists)
+{
+	for (size_t i = 0; i < hists.size(); ++i)
+		delete hists[i];
+	hists.clear();
+}
+
+/// ROOT histogram of a histogram made by make_hists()
+inline TH1* get_hist(rootana::HistBase* hist)
+{
+	rootana::Hist<TH1D>* hist1d = dynamic_cast<rootana::Hist<TH1D>*>(hist);
+	if (hist1d) return hist1d->get();
+	return dynamic_cast<rootana::Hist<TH2D>&>(*hist).get();
+}
+
+/// Checks that \e actual has the same bin contents, entries and statistics as \e expected
+inline void compare(TH1* expected, TH1* actual, const char* what)
+{
+	bool contents = expected->GetNbinsX() == actual->GetNbinsX() && expected->GetNbinsY() == actual->GetNbinsY();
+	const Int_t ncells = (expected->GetNbinsX() + 2) * (expected->GetNbinsY() + 2) * (expected->GetNbinsZ() + 2);
+	for (Int_t bin = 0; contents && bin < ncells; ++bin)
+		contents = expected->GetBinContent(bin) == actual->GetBinContent(bin);
+
+	Double_t stats1[11] = { 0. }, stats2[11] = { 0. };
+	expected->GetStats(stats1);
+	actual->GetStats(stats2);
+	bool stats = true;
+	for (int i = 0; i < 11; ++i) // sums in a different order
+		stats = stats && fabs(stats1[i] - stats2[i]) <= 1e-9 * (1. + fabs(stats1[i]));
+
+	const std::string name = std::string(what) + ", \"" + expected->GetName() + "\": ";
+	check(contents, (name + "same bin contents").c_str());
+	check(expected->GetEntries() == actual->GetEntries(), (name + "same number of entries").c_str());
+	check(stats, (name + "same statistics").c_str());
+}
+
+}
+
+#endif
@@ -0,0 +1,38 @@
+///
+/// \file TestUtil.h
+/// \brief Checks and summary shared by the test programs.
+///
+/// Each check prints "PASS" or "FAIL" and what was checked; main() ends with
+/// `return test::report();`, which prints "ALL PASSED" or "FAILED" and
+/// returns non-zero if any check failed.
+///
+#ifndef DRAGON_TEST_UTIL_H
+#define DRAGON_TEST_UTIL_H
+#include <cstdio>
+
+namespace test {
+
+/// Number of failed checks
+inline int& failures()
+{
+	static int n = 0;
+	return n;
+}
+
+/// Prints the result of one check
+inline void check(bool condition, const char* what)
+{
+	printf("%s: %s\n", condition ? "PASS" : "FAIL", what);
+	if (!condition) ++failures();
+}
+
+/// Prints the summary, returns the exit code of the test program
+inline int report()
+{
+	printf("%s\n", failures() ? "FAILED" : "ALL PASSED");
+	return failures() != 0;
+}
+
+}
+
+#endif
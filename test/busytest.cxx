@@ -0,0 +1,135 @@
+///
+/// \file busytest.cxx
+/// \brief Checks dragon::CoincBusytime against collecting and sorting all events.
+///
+/// Random head and tail events (sparse, dense with much overlap, and with many
+/// equal trigger times) are given to CoincBusytime::AddEvent(), with all events
+/// kept in memory and with few enough allowed to be moved to temporary files
+/// (Spill()) and merged back; and as sorted streams to CoincBusytime::Merge(),
+/// split among several sources, some of them empty. The busy time must be that
+/// of sorting all events by trigger time and summing the busy times ignoring
+/// overlap, as CoincBusytime::Calculate() did before events could be spilled.
+///
+/// Build with `make test/busytest`; returns non-zero on failure.
+///
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "utils/RootAnalysis.hxx"
+#include "TestUtil.h"
+
+namespace {
+
+using test::check;
+
+typedef dragon::CoincBusytime::Event Event_t;
+
+bool same(Double_t a, Double_t b)
+{
+	return fabs(a - b) <= 1e-9 * fabs(a);
+}
+
+/// Busy time in seconds, by sorting all events and summing the busy times ignoring overlap
+Double_t collect_then_sort(std::vector<Event_t> events)
+{
+	std::sort(events.begin(), events.end(), Event_t::TriggerCompare);
+	Double_t end = 0, total = 0;
+	for (size_t i = 0; i < events.size(); ++i) {
+		if (end < events[i].fTrigger) { // no overlap
+			total += events[i].fBusy;
+			end = events[i].End();
+		}
+		else if (end < events[i].End()) { // incomplete overlap
+			total += events[i].End() - end;
+			end = events[i].End();
+		}
+	}
+	return total / 1e6;
+}
+
+/// \e n events with trigger times in [0, range) us, rounded to \e step, and busy times up to 150 us
+std::vector<Event_t> random_events(int n, Double_t range, Double_t step)
+{
+	std::vector<Event_t> events;
+	for (int i = 0; i < n; ++i) {
+		const Double_t trigger = step * floor(range / step * (rand() / (RAND_MAX + 1.)));
+		events.push_back(Event_t(trigger, 0.05 * (rand() % 3000)));
+	}
+	return events;
+}
+
+/// Merges \e events, sorted, each given to one of \e nsources sources at random; every third source is empty
+Double_t merge(std::vector<Event_t> events, size_t nsources)
+{
+	std::sort(events.begin(), events.end(), Event_t::TriggerCompare);
+	std::vector<std::vector<Double_t> > trigger(nsources), busy(nsources);
+	for (size_t i = 0; i < events.size(); ++i) {
+		size_t src = rand() % nsources;
+		if (nsources > 2 && src % 3 == 2) src = 0;
+		trigger[src].push_back(events[i].fTrigger);
+		busy[src].push_back(events[i].fBusy);
+	}
+	std::vector<dragon::CoincBusytime::ArraySource> arrays;
+	for (size_t src = 0; src < nsources; ++src)
+		arrays.push_back(dragon::CoincBusytime::ArraySource(trigger[src].empty() ? 0 : &trigger[src][0],
+																												busy[src].empty() ? 0 : &busy[src][0],
+																												trigger[src].size()));
+	std::vector<dragon::CoincBusytime::Source*> sources;
+	for (size_t src = 0; src < nsources; ++src)
+		sources.push_back(&arrays[src]);
+	return dragon::CoincBusytime::Merge(&sources[0], nsources);
+}
+
+void test_events(const std::vector<Event_t>& events, const char* what)
+{
+	const Double_t expected = collect_then_sort(events);
+	printf("%s: %lu events, busy time %g s\n", what, (unsigned long)events.size(), expected);
+	char label[256];
+
+	dragon::CoincBusytime memory;
+	for (size_t i = 0; i < events.size(); ++i)
+		memory.AddEvent(events[i].fTrigger, events[i].fBusy);
+	sprintf(label, "%s: events in memory", what);
+	check(same(memory.Calculate(), expected), label);
+
+	const size_t maxEvents[] = { 100, 1000, 7000 };
+	for (size_t m = 0; m < sizeof(maxEvents)/sizeof(maxEvents[0]); ++m) {
+		dragon::CoincBusytime spilled;
+		spilled.SetMaxEvents(maxEvents[m]);
+		for (size_t i = 0; i < events.size(); ++i)
+			spilled.AddEvent(events[i].fTrigger, events[i].fBusy);
+		const Double_t busy = spilled.Calculate();
+		sprintf(label, "%s: at most %lu events in memory", what, (unsigned long)maxEvents[m]);
+		check(same(busy, expected), label);
+		sprintf(label, "%s: at most %lu events in memory, calculated twice", what, (unsigned long)maxEvents[m]);
+		check(spilled.Calculate() == busy, label);
+	}
+
+	const size_t nsources[] = { 1, 2, 7 };
+	for (size_t s = 0; s < sizeof(nsources)/sizeof(nsources[0]); ++s) {
+		sprintf(label, "%s: merged from %lu sources", what, (unsigned long)nsources[s]);
+		check(same(merge(events, nsources[s]), expected), label);
+	}
+}
+
+}
+
+int main()
+{
+	srand(1);
+	test_events(random_events(20000, 1e7, 0.05), "sparse");
+	test_events(random_events(20000, 1e5, 0.05), "dense");
+	test_events(random_events(5000, 1e4, 10.), "equal trigger times");
+	test_events(random_events(1, 1e4, 0.05), "one event");
+	test_events(std::vector<Event_t>(), "no events");
+
+	printf("(an error message about an unsorted source is expected below)\n");
+	const Double_t trigger[3] = { 1, 5, 2 }, busy[3] = { 1, 1, 1 };
+	dragon::CoincBusytime::ArraySource unsorted(trigger, busy, 3);
+	dragon::CoincBusytime::Source* source = &unsorted;
+	check(dragon::CoincBusytime::Merge(&source, 1) == -1, "unsorted source: Merge() fails");
+
+	return test::report();
+}
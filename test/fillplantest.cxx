@@ -0,0 +1,80 @@
+///
+/// \file fillplantest.cxx
+/// \brief Checks that histograms filled through rootana::FillPlan are the same
+/// as when filled with TH1::Fill().
+///
+/// Makes two sets of the same histograms on the same parameters: one compiled
+/// into a fill plan (the histogram with variable bins isn't, and is filled by
+/// the plan through Hist<T>::fill()), the other filled by Hist<T>::fill(), i.e.
+/// TH1::Fill(). Random events, with invalid values, values below, above and on
+/// the edges of the ranges, and cuts on other parameters, are given to both;
+/// after each FillPlan::Publish() (at uneven intervals, one of them with a range
+/// set on an axis) the bin contents, numbers of entries and statistics must be
+/// the same.
+///
+/// Build with `make test/fillplantest`; returns non-zero on failure.
+///
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <TH1.h>
+#include "rootana/Histos.hxx"
+#include "rootana/FillPlan.hxx"
+#include "TestHists.h"
+#include "TestUtil.h"
+
+namespace {
+
+using test::check;
+
+void compare_all(const std::vector<rootana::HistBase*>& expected, const std::vector<rootana::HistBase*>& actual,
+								 const char* what)
+{
+	for (size_t h = 0; h < expected.size(); ++h)
+		test::compare(test::get_hist(expected[h]), test::get_hist(actual[h]), what);
+}
+
+}
+
+int main()
+{
+	srand(1);
+	TH1::AddDirectory(kFALSE);
+	test::Params_t params;
+	std::vector<rootana::HistBase*> expected, actual;
+	test::make_hists(params, expected);
+	test::make_hists(params, actual);
+
+	rootana::FillPlan plan;
+	for (size_t h = 0; h < actual.size(); ++h) {
+		if (!actual[h]->compile(plan)) plan.AddOther(actual[h]);
+	}
+	check(plan.GetNumCompiled() == actual.size() - 1, "all histograms with fixed bins compiled");
+	check(plan.GetNumOthers() == 1, "histogram with variable bins filled through fill()");
+
+	const size_t publish[] = { 1, 17, 1000, 5000, 5001, 20000 };
+	char label[256];
+	size_t event = 0;
+	for (size_t p = 0; p < sizeof(publish)/sizeof(publish[0]); ++p) {
+		for (; event < publish[p]; ++event) {
+			params.Randomize();
+			plan.Fill();
+			for (size_t h = 0; h < expected.size(); ++h)
+				expected[h]->fill();
+		}
+		// A range set on an axis (e.g. zoomed in a canvas) must not change the statistics added
+		const bool zoom = publish[p] == 5000;
+		if (zoom) test::get_hist(actual[0])->GetXaxis()->SetRange(10, 20);
+		plan.Publish();
+		if (zoom) test::get_hist(actual[0])->GetXaxis()->SetRange();
+		sprintf(label, "published after %lu events%s", (unsigned long)event, zoom ? " (x range set)" : "");
+		compare_all(expected, actual, label);
+	}
+
+	plan.Publish();
+	compare_all(expected, actual, "published twice");
+
+	test::delete_hists(expected);
+	test::delete_hists(actual);
+	return test::report();
+}
@@ -0,0 +1,152 @@
+///
+/// \file filtertest.cxx
+/// \brief Checks that dragon::TTreeFilter with threads gives the same trees as TTree::CopyTree().
+///
+/// Writes run files of a tree with scalar and array branches (one of them empty),
+/// and filters a chain of them, a single tree, and a chain with a friend (which
+/// is filtered by one thread from the original chain) with several numbers of
+/// threads and of entries per task, so that tasks begin and end within files
+/// and span several of them. The entries written must be those of CopyTree() of
+/// the same condition, in the same order.
+///
+/// Build with `make test/filtertest`; returns non-zero on failure.
+///
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <unistd.h>
+#include <TFile.h>
+#include <TTree.h>
+#include <TChain.h>
+#include "utils/RootAnalysis.hxx"
+#include "TestUtil.h"
+
+namespace {
+
+using test::check;
+
+std::string temp_name()
+{
+	char path[] = "/tmp/filtertestXXXXXX";
+	int fd = mkstemp(path);
+	if (fd >= 0) close(fd);
+	return path;
+}
+
+/// Run file with \e n entries of tree "t", serial numbers from \e first
+void write_file(const std::string& path, Int_t first, Int_t n)
+{
+	TFile file(path.c_str(), "RECREATE");
+	TTree tree("t", "filtertest");
+	Int_t serial;
+	Double_t x, ecal[4];
+	tree.Branch("serial", &serial, "serial/I");
+	tree.Branch("x", &x, "x/D");
+	tree.Branch("ecal", ecal, "ecal[4]/D");
+	for (Int_t i = 0; i < n; ++i) {
+		serial = first + i;
+		x = rand() / (RAND_MAX + 1.);
+		for (int j = 0; j < 4; ++j)
+			ecal[j] = rand() % 5 ? rand() % 1000 : -1;
+		tree.Fill();
+	}
+	tree.Write();
+}
+
+/// Serial numbers of the entries of \e tree, in order
+std::vector<Int_t> serials(TTree* tree)
+{
+	std::vector<Int_t> out;
+	if (!tree) return out;
+	Int_t serial;
+	tree->SetBranchAddress("serial", &serial);
+	for (Long64_t i = 0; i < tree->GetEntries(); ++i) {
+		tree->GetEntry(i);
+		out.push_back(serial);
+	}
+	tree->ResetBranchAddresses();
+	return out;
+}
+
+void test_filter(TTree* in, const char* condition, const char* what)
+{
+	std::string refPath = temp_name();
+	std::vector<Int_t> expected;
+	{
+		TFile ref(refPath.c_str(), "RECREATE");
+		expected = serials(in->CopyTree(condition));
+	}
+	unlink(refPath.c_str());
+	printf("%s, \"%s\": %lld entries, %lu pass\n", what, condition, in->GetEntries(),
+				 (unsigned long)expected.size());
+
+	const Int_t nthreads[] = { 2, 4 };
+	const Long64_t ntask[] = { 0, 777 };
+	for (size_t t = 0; t < sizeof(nthreads)/sizeof(nthreads[0]); ++t) {
+		for (size_t k = 0; k < sizeof(ntask)/sizeof(ntask[0]); ++k) {
+			std::string outPath = temp_name();
+			std::vector<Int_t> filtered;
+			{
+				TFile out(outPath.c_str(), "RECREATE");
+				dragon::TTreeFilter filter(&out);
+				filter.SetThreaded(kTRUE);
+				filter.SetNumThreads(nthreads[t]);
+				filter.SetTaskEntries(ntask[k]);
+				filter.SetFilterCondition(in, condition);
+				filter.Run();
+				filtered = serials(static_cast<TTree*>(out.Get(in->GetName())));
+			}
+			unlink(outPath.c_str());
+
+			char label[256];
+			sprintf(label, "%s, \"%s\", %d threads, %lld entries per task: same entries as CopyTree(), in order",
+							what, condition, nthreads[t], ntask[k]);
+			check(filtered == expected, label);
+		}
+	}
+}
+
+}
+
+int main()
+{
+	srand(1);
+	const Int_t nentries[] = { 5000, 0, 3000, 4321 };
+	std::vector<std::string> files;
+	Int_t serial = 0;
+	for (size_t i = 0; i < sizeof(nentries)/sizeof(nentries[0]); ++i) {
+		files.push_back(temp_name());
+		write_file(files.back(), serial, nentries[i]);
+		serial += nentries[i];
+	}
+
+	const char* conditions[] = { "x > 0.3 && ecal[1] < 500", "ecal[] > 900", "" };
+	const size_t nconditions = sizeof(conditions)/sizeof(conditions[0]);
+
+	TChain chain("t");
+	for (size_t i = 0; i < files.size(); ++i)
+		chain.Add(files[i].c_str());
+	for (size_t c = 0; c < nconditions; ++c)
+		test_filter(&chain, conditions[c], "chain");
+
+	{
+		TFile file(files[0].c_str());
+		TTree* tree = static_cast<TTree*>(file.Get("t"));
+		for (size_t c = 0; c < nconditions; ++c)
+			test_filter(tree, conditions[c], "single tree");
+	}
+
+	TChain friended("t"), other("t");
+	for (size_t i = 0; i < files.size(); ++i) {
+		friended.Add(files[i].c_str());
+		other.Add(files[i].c_str());
+	}
+	friended.AddFriend(&other, "f");
+	test_filter(&friended, "f.x > 0.5 && ecal[0] < 100", "chain with a friend");
+
+	for (size_t i = 0; i < files.size(); ++i)
+		unlink(files[i].c_str());
+
+	return test::report();
+}
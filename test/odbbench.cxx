@@ -0,0 +1,107 @@
+///
+/// \file odbbench.cxx
+/// \brief Benchmark of beginning-of-run setup from an ODB dump.
+///
+/// Times parsing an ODB (XML or .mid file) into a midas::Database, and
+/// dragon::Unpacker::HandleBor() with that database, which reads the variables
+/// of all detector and scaler classes (what is done at every BOR, online or
+/// in mid2root). Prints a checksum of the variables read, so results can be
+/// compared between versions.
+///
+/// Build with `make test/odbbench`; usage: test/odbbench <odb file> [niterations]
+///
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+#include "midas/Database.hxx"
+#include "TStamp.hxx"
+#include "Dragon.hxx"
+#include "Unpack.hxx"
+
+namespace {
+
+double now()
+{
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/// FNV-1a over a range of bytes
+uint64_t hash(uint64_t h, const void* p, size_t n)
+{
+	const unsigned char* c = reinterpret_cast<const unsigned char*>(p);
+	for (size_t i = 0; i < n; ++i) { h ^= c[i]; h *= 1099511628211ULL; }
+	return h;
+}
+
+template <class T> uint64_t hash_array(uint64_t h, const T& array)
+{
+	return hash(h, &array, sizeof(array));
+}
+
+/// Checksum of a sample of variables from each class
+uint64_t checksum(const dragon::Head& head, const dragon::Tail& tail,
+									const dragon::Scaler& schead, const dragon::Scaler& sctail)
+{
+	uint64_t h = 14695981039346656037ULL;
+	h = hash_array(h, head.bgo.variables.adc.channel);
+	h = hash_array(h, head.bgo.variables.adc.pedestal);
+	h = hash_array(h, head.bgo.variables.adc.slope);
+	h = hash_array(h, head.bgo.variables.adc.offset);
+	h = hash_array(h, head.bgo.variables.tdc.slope);
+	h = hash_array(h, head.bgo.variables.pos.x);
+	h = hash_array(h, head.variables.bk_tsc);
+	h = hash_array(h, tail.dsssd.variables.adc.channel);
+	h = hash_array(h, tail.dsssd.variables.adc.slope);
+	h = hash_array(h, tail.ic.variables.adc.offset);
+	h = hash_array(h, tail.mcp.variables.adc.slope);
+	h = hash_array(h, tail.nai.variables.adc.pedestal);
+	h = hash_array(h, tail.variables.bk_tsc);
+	h = hash_array(h, schead.variables.bk_sum);
+	h = hash_array(h, sctail.variables.bk_sum);
+	for (int i = 0; i < dragon::Scaler::MAX_CHANNELS; ++i) {
+		h = hash(h, schead.variables.names[i].data(), schead.variables.names[i].size());
+		h = hash(h, sctail.variables.names[i].data(), sctail.variables.names[i].size());
+	}
+	return h;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <odb file> [niterations]\n", argv[0]);
+		return 1;
+	}
+	const int niter = argc > 2 ? atoi(argv[2]) : 100;
+
+	dragon::Head head;
+	dragon::Tail tail;
+	dragon::Coinc coinc;
+	dragon::Epics epics;
+	dragon::Scaler schead, sctail, scaux;
+	dragon::RunParameters runpar;
+	tstamp::Diagnostics diag;
+	dragon::Unpacker unpacker(&head, &tail, &coinc, &epics, &schead, &sctail, &scaux, &runpar, &diag, true);
+
+	double tparse = 0, tbor = 0;
+	for (int i = 0; i < niter; ++i) {
+		const double t0 = now();
+		midas::Database db(argv[1]);
+		const double t1 = now();
+		if (db.IsZombie()) return 1;
+		unpacker.HandleBor(db);
+		const double t2 = now();
+		tparse += t1 - t0;
+		tbor   += t2 - t1;
+	}
+
+	printf("parse: %9.1f us / run\n", 1e6 * tparse / niter);
+	printf("bor:   %9.1f us / run\n", 1e6 * tbor / niter);
+	printf("total: %9.1f us / run\n", 1e6 * (tparse + tbor) / niter);
+	printf("checksum: %016llx\n", (unsigned long long)checksum(head, tail, schead, sctail));
+	return 0;
+}
@@ -0,0 +1,253 @@
+///
+/// \file pipelinetest.cxx
+/// \brief Checks that dragon::UnpackPipeline gives the same output as serial unpacking.
+///
+/// Writes a MIDAS file of synthetic head and tail events (with overlapping
+/// coincidences, some malformed banks and events of other types), unpacks it
+/// with the serial loop of mid2root (Unpacker::HandleMidasEvent() and
+/// HandleEor()) and with the pipeline for several numbers of threads, and
+/// compares the sequence of event codes and unpacked values passed to the sinks.
+/// The error messages printed for the malformed banks are expected, and must
+/// not be garbled by the worker threads.
+///
+/// Build with `make test/pipelinetest`; usage: test/pipelinetest [nevents];
+/// returns non-zero on failure.
+///
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include "midas/libMidasInterface/TMidasFile.h"
+#include "Dragon.hxx"
+#include "Unpack.hxx"
+#include "Pipeline.hxx"
+#include "TestEvents.h"
+#include "TestUtil.h"
+
+namespace {
+
+using test::check;
+
+/// Event code and unpacked values passed to a sink
+struct Record_t {
+	int32_t fCode;
+	std::vector<uint64_t> fValues;
+	bool operator== (const Record_t& other) const
+		{ return fCode == other.fCode && fValues == other.fValues; }
+};
+
+/// Classes filled by one unpacker
+struct Classes_t {
+	dragon::Head head;
+	dragon::Tail tail;
+	dragon::Coinc coinc;
+	dragon::Epics epics;
+	dragon::Scaler schead, sctail, scaux;
+	dragon::RunParameters runpar;
+	tstamp::Diagnostics diag;
+};
+
+/// Appends the bit pattern of a value
+template <class T>
+void add(std::vector<uint64_t>& values, const T& t)
+{
+	uint64_t bits = 0;
+	memcpy(&bits, &t, sizeof(T) < 8 ? sizeof(T) : 8);
+	values.push_back(bits);
+}
+
+void add_head(std::vector<uint64_t>& v, const dragon::Head& head)
+{
+	add(v, head.header.fEventId);
+	add(v, head.header.fSerialNumber);
+	add(v, head.io32.tstamp);
+	add(v, head.io32.tsc4.trig_time);
+	for (int ch = 0; ch < vme::V792::MAX_CHANNELS; ++ch) add(v, head.v792.data[ch]);
+	for (int ch = 0; ch < vme::V1190::MAX_CHANNELS; ++ch) add(v, head.v1190.get_data(ch));
+	for (int i = 0; i < dragon::Bgo::MAX_CHANNELS; ++i) add(v, head.bgo.ecal[i]);
+	add(v, head.bgo.sum);
+	add(v, head.bgo.x0);
+	add(v, head.tcal0);
+	add(v, head.tcalx);
+	add(v, head.tcal_rf);
+}
+
+void add_tail(std::vector<uint64_t>& v, const dragon::Tail& tail)
+{
+	add(v, tail.header.fEventId);
+	add(v, tail.header.fSerialNumber);
+	add(v, tail.io32.tstamp);
+	add(v, tail.io32.tsc4.trig_time);
+	for (int i = 0; i < dragon::Tail::NUM_ADC; ++i)
+		for (int ch = 0; ch < vme::V792::MAX_CHANNELS; ++ch) add(v, tail.v785[i].data[ch]);
+	for (int ch = 0; ch < vme::V1190::MAX_CHANNELS; ++ch) add(v, tail.v1190.get_data(ch));
+	add(v, tail.tcal0);
+	add(v, tail.tcalx);
+}
+
+/// Records what the sinks of an unpacker are given
+class Recorder: public dragon::Unpacker::Sink {
+public:
+	Recorder(const Classes_t& classes): fClasses(classes) { }
+	void Fill(int32_t code)
+		{
+			Record_t r;
+			r.fCode = code;
+			switch (code) {
+			case DRAGON_HEAD_EVENT: add_head(r.fValues, fClasses.head); break;
+			case DRAGON_TAIL_EVENT: add_tail(r.fValues, fClasses.tail); break;
+			case DRAGON_COINC_EVENT:
+				add_head(r.fValues, fClasses.coinc.head);
+				add_tail(r.fValues, fClasses.coinc.tail);
+				add(r.fValues, fClasses.coinc.xtrig);
+				add(r.fValues, fClasses.coinc.xtofh);
+				add(r.fValues, fClasses.coinc.xtoft);
+				break;
+			case DRAGON_TSTAMP_DIAGNOSTICS:
+				add(r.fValues, fClasses.diag.size);
+				add(r.fValues, fClasses.diag.n_coinc);
+				add(r.fValues, fClasses.diag.time_diff);
+				add(r.fValues, fClasses.diag.n_singles[DRAGON_HEAD_EVENT]);
+				add(r.fValues, fClasses.diag.n_singles[DRAGON_TAIL_EVENT]);
+				break;
+			default: break;
+			}
+			fRecords.push_back(r);
+		}
+	std::vector<Record_t> fRecords;
+private:
+	const Classes_t& fClasses;
+};
+
+/// Unpacker with its own classes and a recorder on each sink
+struct Run_t {
+	Classes_t fClasses;
+	dragon::Unpacker fUnpacker;
+	Recorder fRecorder;
+	Run_t(bool singles):
+		fUnpacker(&fClasses.head, &fClasses.tail, &fClasses.coinc, &fClasses.epics,
+							&fClasses.schead, &fClasses.sctail, &fClasses.scaux, &fClasses.runpar,
+							&fClasses.diag, singles),
+		fRecorder(fClasses)
+		{
+			fUnpacker.SetSink(DRAGON_HEAD_EVENT, &fRecorder);
+			fUnpacker.SetSink(DRAGON_TAIL_EVENT, &fRecorder);
+			fUnpacker.SetSink(DRAGON_COINC_EVENT, &fRecorder);
+			fUnpacker.SetSink(DRAGON_TSTAMP_DIAGNOSTICS, &fRecorder);
+			fUnpacker.HandleBor((const char*)0);
+		}
+};
+
+/// Passes pipeline output to the sinks, as mid2root does
+struct Output: public dragon::UnpackPipeline::Output {
+	dragon::Unpacker* fUnpacker;
+	void Fill(const std::vector<int32_t>& codes, midas::Event*)
+		{ fUnpacker->Dispatch(codes); }
+};
+
+/// Head or tail event at trigger time \e time (us)
+test::Words_t make_event(uint16_t id, uint32_t serial, double time)
+{
+	const bool head = id == DRAGON_HEAD_EVENT;
+	test::EventBuilder event(id, serial, 1000000000 + uint32_t(time / 1e6));
+	event.Add(head ? "TSCH" : "TSCT", test::tsc_bank(uint64_t(time * DRAGON_TSC_FREQ)));
+	event.Add(head ? "VTRH" : "VTRT", test::io32_bank(serial, uint32_t(time)));
+
+	const int nadc = head ? 1 : 2;
+	for (int i = 0; i < nadc; ++i) {
+		int data[vme::V792::MAX_CHANNELS];
+		for (int ch = 0; ch < vme::V792::MAX_CHANNELS; ++ch)
+			data[ch] = rand() % 3 ? rand() % 5000 : -1;
+		test::Words_t words = test::v792_bank(data, vme::V792::MAX_CHANNELS, serial);
+		if (rand() % 1000 == 0) words.insert(words.begin() + 1, 0x6u << 24); // invalid word: error message
+		event.Add(head ? "ADC0" : (i == 0 ? "TLQ0" : "TLQ1"), words);
+	}
+
+	std::vector<test::Hit_t> hits(rand() % 20);
+	for (size_t i = 0; i < hits.size(); ++i) {
+		hits[i].fChannel = rand() % vme::V1190::MAX_CHANNELS;
+		hits[i].fEdge = rand() % 2;
+		hits[i].fValue = rand() % 500000;
+	}
+	event.Add(head ? "TDC0" : "TLT0", test::v1190_bank(hits, serial));
+	return event.Finish();
+}
+
+void test_pipeline(const char* path, bool singles, bool ring, int nevents)
+{
+	// Serial loop
+	Run_t serial(singles);
+	if (ring) serial.fUnpacker.SetCoincMode(dragon::Unpacker::kRingQueue);
+	{
+		TMidasFile fin;
+		fin.Open(path);
+		TMidasEvent temp;
+		while (fin.ReadInPlace(&temp))
+			serial.fUnpacker.HandleMidasEvent(temp.GetEventHeader(), temp.GetData());
+		serial.fUnpacker.HandleEor();
+	}
+
+	int ncoinc = 0;
+	for (size_t i = 0; i < serial.fRecorder.fRecords.size(); ++i)
+		if (serial.fRecorder.fRecords[i].fCode == DRAGON_COINC_EVENT) ++ncoinc;
+	printf("%s%s: %lu records, %d coincidences\n", singles ? "singles" : "coincidence",
+				 ring ? " (ring queue)" : "", (unsigned long)serial.fRecorder.fRecords.size(), ncoinc);
+
+	const int nthreads[] = { 1, 2, 4, 7 };
+	for (size_t t = 0; t < sizeof(nthreads)/sizeof(int); ++t) {
+		Run_t threaded(singles);
+		if (ring) threaded.fUnpacker.SetCoincMode(dragon::Unpacker::kRingQueue);
+		TMidasFile fin;
+		fin.Open(path);
+		Output output;
+		output.fUnpacker = &threaded.fUnpacker;
+		dragon::UnpackPipeline pipeline(threaded.fUnpacker, nthreads[t]);
+		const int64_t nread = pipeline.Run(fin, output);
+
+		char what[256];
+		sprintf(what, "%s%s, %d threads: all events read", singles ? "singles" : "coincidence",
+						ring ? " (ring queue)" : "", nthreads[t]);
+		check(nread == nevents, what);
+		sprintf(what, "%s%s, %d threads: same output as serial unpacking", singles ? "singles" : "coincidence",
+						ring ? " (ring queue)" : "", nthreads[t]);
+		check(threaded.fRecorder.fRecords == serial.fRecorder.fRecords, what);
+	}
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	const int nevents = argc > 1 ? atoi(argv[1]) : 20000;
+	srand(1);
+
+	std::vector<test::Words_t> events;
+	double time = 1000.;
+	for (int i = 0; i < nevents; ++i) {
+		time += 30. * (rand() / (RAND_MAX + 1.));
+		const uint16_t id = rand() % 2 ? DRAGON_HEAD_EVENT : DRAGON_TAIL_EVENT;
+		if (rand() % 500 == 0) { // event unpacked by the writer (EPICS, with no bank)
+			test::EventBuilder other(20, i);
+			events.push_back(other.Finish());
+			continue;
+		}
+		// tail events are read out of time order
+		events.push_back(make_event(id, i, time + (id == DRAGON_TAIL_EVENT ? -200. * (rand() / (RAND_MAX + 1.)) : 0.)));
+	}
+
+	char path[] = "/tmp/pipelinetestXXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0 || !test::write_file(path, events)) {
+		fprintf(stderr, "Couldn't write \"%s\"\n", path);
+		return 1;
+	}
+	close(fd);
+
+	test_pipeline(path, false, false, nevents);
+	test_pipeline(path, false, true, nevents);
+	test_pipeline(path, true, false, nevents);
+	unlink(path);
+
+	return test::report();
+}
@@ -0,0 +1,153 @@
+///
+/// \file queuetest.cxx
+/// \brief Compares the output of tstamp::RingQueue to that of tstamp::Queue.
+///
+/// Pushes the same streams of events (with TSC banks, arriving slightly out of
+/// time order) through both queue implementations and compares the singles and
+/// coincidence events they handle:
+///   - Isolated coincidences (no other event within a few coincidence windows):
+///     the same singles and coincidences must be handled in the same order, except
+///     that the two events of a pair are taken in time order by tstamp::RingQueue
+///     and in order of insertion by tstamp::Queue.
+///   - Overlapping coincidences (several events within one window): every event
+///     must be handled once as a singles event by both queues, and every
+///     coincidence found by tstamp::Queue must also be found by tstamp::RingQueue.
+///     The std::multiset ordering can miss pairs, or pair events further apart
+///     than the window; the ring queue reports only pairs inside it.
+///
+/// Build with `make test/queuetest`; returns non-zero on failure.
+///
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "utils/definitions.h"
+#include "TStamp.hxx"
+#include "TestEvents.h"
+#include "TestUtil.h"
+
+namespace {
+
+using test::check;
+using test::Output_t;
+using test::Recorder;
+using test::Stream_t;
+
+/// Unordered pair
+std::pair<uint32_t, uint32_t> unordered(const std::pair<uint32_t, uint32_t>& p)
+{
+	return std::make_pair(std::min(p.first, p.second), std::max(p.first, p.second));
+}
+
+/// Coincidences as a set of unordered pairs
+std::set<std::pair<uint32_t, uint32_t> > pairs(const Output_t& coinc)
+{
+	std::set<std::pair<uint32_t, uint32_t> > out;
+	for (size_t i = 0; i < coinc.size(); ++i)
+		out.insert(unordered(coinc[i]));
+	return out;
+}
+
+/// Singles events, sorted
+Output_t sorted(const Output_t& singles)
+{
+	Output_t out(singles);
+	std::sort(out.begin(), out.end());
+	return out;
+}
+
+void test_isolated()
+{
+	const double window = 10., maxDelta = 2000.;
+	Stream_t stream;
+	double t = 100.;
+	for (int i = 0; i < 20000; ++i) {
+		t += 5 * window + 100. * (rand() / (RAND_MAX + 1.));
+		const int kind = rand() % 3;
+		if (kind == 0) stream.Add(t, 1);      // head single
+		else if (kind == 1) stream.Add(t, 3); // tail single
+		else {                                // coincidence
+			stream.Add(t, 1);
+			stream.Add(t + (2. * rand() / (RAND_MAX + 1.) - 1.) * 0.9 * window, 3);
+		}
+	}
+	stream.Shuffle(500.);
+
+	Recorder<tstamp::Queue> multiset(maxDelta);
+	Recorder<tstamp::RingQueue> ring(maxDelta);
+	stream.Run(multiset, window);
+	stream.Run(ring, window);
+
+	printf("isolated: %lu events, %lu coincidences\n", (unsigned long)stream.fTimes.size(),
+				 (unsigned long)multiset.fCoinc.size());
+	check(multiset.fSingles.size() == stream.fTimes.size(), "isolated: multiset handles every event once");
+	check(!multiset.fCoinc.empty(), "isolated: coincidences found");
+	check(sorted(ring.fSingles) == sorted(multiset.fSingles), "isolated: same singles");
+
+	// Same coincidences in the same order; the two events of a pair are handled
+	// in time order by the ring, in order of insertion by the multiset
+	bool same = ring.fCoinc.size() == multiset.fCoinc.size();
+	for (size_t i = 0; same && i < ring.fCoinc.size(); ++i)
+		same = unordered(ring.fCoinc[i]) == unordered(multiset.fCoinc[i]);
+	check(same, "isolated: same coincidences, in the same order");
+
+	// Same order of singles, up to the order within a coincidence pair
+	std::vector<uint32_t> partner(stream.fTimes.size());
+	for (size_t i = 0; i < partner.size(); ++i) partner[i] = i;
+	for (size_t i = 0; i < multiset.fCoinc.size(); ++i) {
+		partner[multiset.fCoinc[i].first] = std::min(multiset.fCoinc[i].first, multiset.fCoinc[i].second);
+		partner[multiset.fCoinc[i].second] = partner[multiset.fCoinc[i].first];
+	}
+	same = ring.fSingles.size() == multiset.fSingles.size();
+	for (size_t i = 0; same && i < ring.fSingles.size(); ++i)
+		same = partner[ring.fSingles[i].first] == partner[multiset.fSingles[i].first];
+	check(same, "isolated: same order of singles");
+}
+
+void test_overlapping()
+{
+	const double window = 10., maxDelta = 2000.;
+	Stream_t stream;
+	double t = 100.;
+	for (int i = 0; i < 20000; ++i) {
+		t += 40. * (rand() / (RAND_MAX + 1.)); // often several events per window
+		stream.Add(t, rand() % 2 ? 1 : 3);
+	}
+	stream.Shuffle(500.);
+
+	Recorder<tstamp::Queue> multiset(maxDelta);
+	Recorder<tstamp::RingQueue> ring(maxDelta);
+	stream.Run(multiset, window);
+	stream.Run(ring, window);
+
+	typedef std::set<std::pair<uint32_t, uint32_t> > PairSet_t;
+	const PairSet_t pairs1 = pairs(multiset.fCoinc), pairs2 = pairs(ring.fCoinc);
+	PairSet_t inside1, inside2;
+	for (PairSet_t::const_iterator it = pairs1.begin(); it != pairs1.end(); ++it)
+		if (fabs(stream.fTimes[it->first] - stream.fTimes[it->second]) < window) inside1.insert(*it);
+	for (PairSet_t::const_iterator it = pairs2.begin(); it != pairs2.end(); ++it)
+		if (fabs(stream.fTimes[it->first] - stream.fTimes[it->second]) < window + 1. / DRAGON_TSC_FREQ) inside2.insert(*it);
+
+	printf("overlapping: %lu events, coincidences: %lu multiset (%lu outside the window), %lu ring\n",
+				 (unsigned long)stream.fTimes.size(), (unsigned long)pairs1.size(),
+				 (unsigned long)(pairs1.size() - inside1.size()), (unsigned long)pairs2.size());
+	check(multiset.fSingles.size() == stream.fTimes.size(), "overlapping: multiset handles every event once");
+	check(sorted(ring.fSingles) == sorted(multiset.fSingles), "overlapping: same singles");
+	check(pairs2.size() == ring.fCoinc.size(), "overlapping: ring reports each pair once");
+	check(inside2 == pairs2, "overlapping: ring coincidences are inside the window");
+	check(std::includes(pairs2.begin(), pairs2.end(), inside1.begin(), inside1.end()),
+				"overlapping: ring finds every multiset coincidence inside the window");
+}
+
+}
+
+int main()
+{
+	srand(1);
+	test_isolated();
+	test_overlapping();
+	return test::report();
+}
@@ -0,0 +1,115 @@
+///
+/// \file shardtest.cxx
+/// \brief Checks that histograms filled through rootana::DirectoryShard are the
+/// same as when filled serially.
+///
+/// Splits a stream of random events between two shards of a directory (each
+/// filling its own copy of the parameters, relocated by an AddressMap), with
+/// Directory::Publish() called every few thousand events, as the main thread of
+/// anaDragon -j does. After each publish, the histograms must hold exactly the
+/// events each shard had filled at the previous publish (handed over, by
+/// switching its rootana::HistBuffer bins, at its next Fill()); after Merge(),
+/// the histograms must be the same as those filled serially with Hist<T>::fill(),
+/// and merging again must add nothing.
+///
+/// Build with `make test/shardtest`; returns non-zero on failure.
+///
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <vector>
+#include <memory>
+#include <TH1.h>
+#include "rootana/AddressMap.hxx"
+#include "rootana/Histos.hxx"
+#include "rootana/Directory.hxx"
+#include "TestHists.h"
+#include "TestUtil.h"
+
+namespace {
+
+const uint16_t kEventId = 1;
+
+/// Compares \e actual to histograms filled serially with the first \e nevents events of each shard
+void compare_serial(const std::vector<test::Params_t>& events, const std::vector<size_t>* shard,
+										const size_t* nevents, const std::vector<rootana::HistBase*>& actual,
+										const char* what)
+{
+	test::Params_t params;
+	std::vector<rootana::HistBase*> expected;
+	test::make_hists(params, expected);
+	for (int k = 0; k < 2; ++k) {
+		for (size_t i = 0; i < nevents[k]; ++i) {
+			params = events[shard[k][i]];
+			for (size_t h = 0; h < expected.size(); ++h)
+				expected[h]->fill();
+		}
+	}
+	for (size_t h = 0; h < expected.size(); ++h)
+		test::compare(test::get_hist(expected[h]), test::get_hist(actual[h]), what);
+	test::delete_hists(expected);
+}
+
+}
+
+int main()
+{
+	srand(1);
+	TH1::AddDirectory(kFALSE);
+	const size_t nevents = 20000, publishEvery = 3000;
+	std::vector<test::Params_t> events(nevents);
+	for (size_t i = 0; i < nevents; ++i)
+		events[i].Randomize();
+
+	// Histograms on the parameters of the main thread, as on rootana::gHead
+	test::Params_t params;
+	rootana::OnlineDirectory directory;
+	directory.Open(0, "");
+	std::vector<rootana::HistBase*> hists;
+	test::make_hists(params, hists);
+	for (size_t h = 0; h < hists.size(); ++h)
+		directory.AddHist(hists[h], "shardtest", kEventId);
+
+	std::set<uint16_t> ids;
+	ids.insert(kEventId);
+	test::Params_t workerParams[2];
+	std::auto_ptr<rootana::DirectoryShard> shards[2];
+	for (int k = 0; k < 2; ++k) {
+		rootana::AddressMap map;
+		map.Add(params, workerParams[k]);
+		shards[k].reset(new rootana::DirectoryShard(directory, map, ids));
+	}
+
+	std::vector<size_t> filled[2]; // events filled by each shard, in order
+	size_t handedOver[2] = { 0, 0 }; // events filled by each shard at the last publish
+	char label[256];
+	for (size_t i = 0; i < nevents; ++i) {
+		const int k = rand() % 2;
+		workerParams[k] = events[i];
+		shards[k]->Fill(kEventId);
+		filled[k].push_back(i);
+
+		if ((i + 1) % publishEvery) continue;
+		// Each shard filled some events since the last publish, so it handed over
+		// the bins filled before it
+		directory.Publish();
+		sprintf(label, "published after %lu events", (unsigned long)(i + 1));
+		compare_serial(events, filled, handedOver, hists, label);
+		for (int s = 0; s < 2; ++s)
+			handedOver[s] = filled[s].size();
+	}
+
+	const size_t all[2] = { filled[0].size(), filled[1].size() };
+	for (int k = 0; k < 2; ++k)
+		shards[k]->Merge();
+	compare_serial(events, filled, all, hists, "merged");
+	for (int k = 0; k < 2; ++k)
+		shards[k]->Merge();
+	directory.Publish();
+	compare_serial(events, filled, all, hists, "merged twice, published");
+
+	for (int k = 0; k < 2; ++k)
+		shards[k].reset();
+	directory.Close();
+	return test::report();
+}
@@ -0,0 +1,121 @@
+///
+/// \file splittest.cxx
+/// \brief Checks that runs split by tstamp::find_split_points() give the same
+/// singles and coincidences as when queued as a whole.
+///
+/// Pushes streams of head and tail events (arriving out of time order, with
+/// bursts separated by gaps both shorter and longer than the queue time) through
+/// one tstamp::Queue, and separately through a new queue for each part returned
+/// by find_split_points(), flushed at the end of the part, as the chunk workers
+/// of anaDragon -j do. The concatenated output of the parts must be the same,
+/// in the same order, as that of the whole run.
+///
+/// Build with `make test/splittest`; returns non-zero on failure.
+///
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "utils/definitions.h"
+#include "TStamp.hxx"
+#include "TestEvents.h"
+#include "TestUtil.h"
+
+namespace {
+
+using test::check;
+using test::Output_t;
+using test::Stream_t;
+
+typedef test::Recorder<tstamp::Queue> Recorder_t;
+
+/// Compares the split runs to the whole run, returns the number of parts
+size_t test_stream(const Stream_t& stream, double window, double maxDelta, size_t nparts, const char* what)
+{
+	Recorder_t whole(maxDelta);
+	stream.Run(whole, window);
+	const Output_t& singles = whole.fSingles;
+	const Output_t& coinc = whole.fCoinc;
+
+	const std::vector<size_t> splits = tstamp::find_split_points(stream.fTimes, maxDelta, window, nparts);
+	Output_t splitSingles, splitCoinc;
+	bool gaps = splits.size() <= nparts && splits.size() > 0 && splits[0] == 0;
+	for (size_t part = 0; part < splits.size(); ++part) {
+		const size_t end = part + 1 < splits.size() ? splits[part+1] : stream.fTimes.size();
+		Recorder_t queue(maxDelta);
+		stream.Run(queue, window, splits[part], end);
+		splitSingles.insert(splitSingles.end(), queue.fSingles.begin(), queue.fSingles.end());
+		splitCoinc.insert(splitCoinc.end(), queue.fCoinc.begin(), queue.fCoinc.end());
+		// Every event after the split is later than every event before it by more than maxDelta
+		if (part == 0) continue;
+		const double before = *std::max_element(stream.fTimes.begin(), stream.fTimes.begin() + splits[part]);
+		const double after = *std::min_element(stream.fTimes.begin() + splits[part], stream.fTimes.end());
+		gaps = gaps && after - before > maxDelta;
+	}
+
+	char label[256];
+	printf("%s, up to %lu parts: %lu parts, %lu singles, %lu coincidences\n", what, (unsigned long)nparts,
+				 (unsigned long)splits.size(), (unsigned long)singles.size(), (unsigned long)coinc.size());
+	sprintf(label, "%s, up to %lu parts: splits at gaps longer than the queue time", what, (unsigned long)nparts);
+	check(gaps, label);
+	sprintf(label, "%s, up to %lu parts: same singles, in the same order", what, (unsigned long)nparts);
+	check(splitSingles == singles, label);
+	sprintf(label, "%s, up to %lu parts: same coincidences, in the same order", what, (unsigned long)nparts);
+	check(splitCoinc == coinc, label);
+	return splits.size();
+}
+
+}
+
+int main()
+{
+	srand(1);
+	const double window = 10., maxDelta = 2000.;
+	const size_t nparts[] = { 2, 4, 16, 64 };
+
+	// Bursts of events, often several per coincidence window, separated by gaps
+	// around the queue time: some can be split at, some can't
+	Stream_t bursts;
+	double t = 100.;
+	for (int burst = 0; burst < 200; ++burst) {
+		const int nevents = 1 + rand() % 100;
+		for (int i = 0; i < nevents; ++i) {
+			t += 30. * (rand() / (RAND_MAX + 1.));
+			bursts.Add(t, rand() % 2 ? DRAGON_HEAD_EVENT : DRAGON_TAIL_EVENT);
+		}
+		t += maxDelta * (0.5 + rand() / (RAND_MAX + 1.));
+	}
+	bursts.Shuffle(500.);
+	bool split = true;
+	for (size_t i = 0; i < sizeof(nparts)/sizeof(nparts[0]); ++i)
+		split = test_stream(bursts, window, maxDelta, nparts[i], "bursts") > 1 && split;
+	check(split, "bursts: runs are split");
+
+	// Events arriving later than the queue time: no gap is long enough once they
+	// are taken into account, except where the late events are
+	Stream_t late;
+	t = 100.;
+	for (int burst = 0; burst < 100; ++burst) {
+		for (int i = 0; i < 50; ++i) {
+			t += 30. * (rand() / (RAND_MAX + 1.));
+			late.Add(t, rand() % 2 ? DRAGON_HEAD_EVENT : DRAGON_TAIL_EVENT);
+		}
+		t += 1.5 * maxDelta;
+	}
+	late.Shuffle(3. * maxDelta);
+	for (size_t i = 0; i < sizeof(nparts)/sizeof(nparts[0]); ++i)
+		test_stream(late, window, maxDelta, nparts[i], "late events");
+
+	// No gaps at all
+	Stream_t dense;
+	t = 100.;
+	for (int i = 0; i < 5000; ++i) {
+		t += 30. * (rand() / (RAND_MAX + 1.));
+		dense.Add(t, rand() % 2 ? DRAGON_HEAD_EVENT : DRAGON_TAIL_EVENT);
+	}
+	dense.Shuffle(500.);
+	check(test_stream(dense, window, maxDelta, 16, "no gaps") == 1, "no gaps: run is not split");
+
+	return test::report();
+}
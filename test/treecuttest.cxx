@@ -0,0 +1,174 @@
+///
+/// \file treecuttest.cxx
+/// \brief Checks that dragon::TreeCut counts the same entries as TTreeFormula.
+///
+/// Writes run files with a tail tree (as made by mid2root) and counts the
+/// entries passing the surface barrier gates of dragon::BeamNorm, and gates
+/// with aliases, indexed leaves, arithmetic on `header.fTimeStamp`, division
+/// by zero and square roots of negative values, with TreeCut::Count() (one
+/// gate at a time and all in a single pass) and with
+/// `tree->GetPlayer()->GetEntries()`. Compiled gates must give the same counts,
+/// for a single tree and for a chain. A chain whose second file has no
+/// `sb.ecal` leaf must fall back to TTreeFormula for gates using it.
+///
+/// Build with `make test/treecuttest`; returns non-zero on failure.
+///
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <unistd.h>
+#include <TFile.h>
+#include <TTree.h>
+#include <TChain.h>
+#include <TVirtualTreePlayer.h>
+#include "utils/TreeCut.hxx"
+#include "Dragon.hxx"
+#include "TestUtil.h"
+
+namespace {
+
+using test::check;
+
+const UInt_t kStart = 1300000000; // timestamp of the first event
+
+std::string temp_name()
+{
+	char path[] = "/tmp/treecuttestXXXXXX";
+	int fd = mkstemp(path);
+	if (fd >= 0) close(fd);
+	return path;
+}
+
+/// Run file with a tail tree "t3" of \e n events
+void write_tail(const std::string& path, Int_t n)
+{
+	TFile file(path.c_str(), "RECREATE");
+	TTree t3("t3", "Tail");
+	dragon::Tail tail, *pTail = &tail;
+	t3.Branch("tail", "dragon::Tail", &pTail);
+	for (Int_t i = 0; i < n; ++i) {
+		tail.reset();
+		tail.header.fTimeStamp = kStart + i / 50;
+		for (int ch = 0; ch < dragon::SurfaceBarrier::MAX_CHANNELS; ++ch)
+			tail.sb.ecal[ch] = rand() % 10 ? rand() % 2100 - 100 : 0.;
+		t3.Fill();
+	}
+	t3.Write();
+}
+
+/// Run file with a tree "t3" of head events: has `header.fTimeStamp`, but no `sb.ecal`
+void write_head(const std::string& path, Int_t n)
+{
+	TFile file(path.c_str(), "RECREATE");
+	TTree t3("t3", "Head");
+	dragon::Head head, *pHead = &head;
+	t3.Branch("head", "dragon::Head", &pHead);
+	for (Int_t i = 0; i < n; ++i) {
+		head.reset();
+		head.header.fTimeStamp = kStart + i / 50;
+		t3.Fill();
+	}
+	t3.Write();
+}
+
+void set_aliases(TTree* tree)
+{
+	tree->SetAlias("sb0", "sb.ecal[0]");
+	tree->SetAlias("sb1", "sb.ecal[1]");
+	tree->SetAlias("sbgate", "sb0 > 300 && sb0 < 1500");
+	tree->SetAlias("trun", "header.fTimeStamp - 1300000000");
+}
+
+/// Counts each gate with TreeCut::Count() and TTreeFormula; all gates must compile
+void test_gates(TTree* tree, const std::vector<std::string>& gates, const char* what)
+{
+	std::vector<const char*> pgates;
+	for (size_t i = 0; i < gates.size(); ++i)
+		pgates.push_back(gates[i].c_str());
+	std::vector<Long64_t> counts(gates.size());
+	dragon::TreeCut::Count(tree, (Int_t)gates.size(), &pgates[0], &counts[0]);
+
+	for (size_t i = 0; i < gates.size(); ++i) {
+		const Long64_t expected = tree->GetPlayer()->GetEntries(pgates[i]);
+		const Long64_t count = dragon::TreeCut::Count(tree, pgates[i]);
+		printf("%s, \"%s\": %lld of %lld entries\n", what, pgates[i], expected, tree->GetEntries());
+
+		char label[512];
+		dragon::TreeCut cut;
+		sprintf(label, "%s, \"%s\": compiled", what, pgates[i]);
+		check(cut.Compile(tree, pgates[i]), label);
+		sprintf(label, "%s, \"%s\": same count as TTreeFormula", what, pgates[i]);
+		check(count == expected, label);
+		sprintf(label, "%s, \"%s\": same count when counted with all gates", what, pgates[i]);
+		check(counts[i] == expected, label);
+	}
+}
+
+}
+
+int main()
+{
+	srand(1);
+	std::vector<std::string> gates;
+	// dragon::BeamNorm::ReadSbCounts()
+	for (int ch = 0; ch < dragon::SurfaceBarrier::MAX_CHANNELS; ++ch) {
+		char gate[256];
+		sprintf(gate, "sb.ecal[%d] > %g && sb.ecal[%d] < %g", ch, 300. + 100 * ch, ch, 1500.);
+		gates.push_back(gate);
+		sprintf(gate, "sb.ecal[%d] > %g && sb.ecal[%d] < %g && header.fTimeStamp - %u < %g",
+						ch, 300. + 100 * ch, ch, 1500., kStart, 120.);
+		gates.push_back(gate);
+	}
+	// aliases
+	gates.push_back("sbgate");
+	gates.push_back("sbgate && !(sb1 < 200)");
+	gates.push_back("sb0 * 2 > sb1 || trun >= 100");
+	// timestamps
+	gates.push_back("header.fTimeStamp - 1.3e9 < 60");
+	gates.push_back("(header.fTimeStamp - 1300000000) / 60 >= 2");
+	gates.push_back("header.fTimeStamp == 1300000010 || trun > 350");
+	// division by zero, square roots of negative values
+	gates.push_back("sb.ecal[0] / sb.ecal[1] > 1");
+	gates.push_back("sb.ecal[0] / (sb.ecal[1] - sb.ecal[1]) == 0");
+	gates.push_back("sqrt(sb.ecal[0] - 500) > 20");
+	gates.push_back("TMath::Sqrt(-sb.ecal[1]) < 5 && abs(sb.ecal[0] - 1000) < fabs(-300)");
+	gates.push_back("-sb.ecal[0] + 2*sb.ecal[1] <= -(100 - 50)");
+
+	std::vector<std::string> files;
+	for (int i = 0; i < 2; ++i) {
+		files.push_back(temp_name());
+		write_tail(files.back(), 20000);
+	}
+
+	{
+		TFile file(files[0].c_str());
+		TTree* t3 = static_cast<TTree*>(file.Get("t3"));
+		set_aliases(t3);
+		test_gates(t3, gates, "tree");
+	}
+
+	TChain chain("t3");
+	for (size_t i = 0; i < files.size(); ++i)
+		chain.Add(files[i].c_str());
+	set_aliases(&chain);
+	test_gates(&chain, gates, "chain");
+
+	// Second file without the sb.ecal leaf
+	files.push_back(temp_name());
+	write_head(files.back(), 5000);
+	TChain mixed("t3");
+	mixed.Add(files[0].c_str());
+	mixed.Add(files[2].c_str());
+	mixed.Add(files[1].c_str());
+	std::vector<std::string> fallback;
+	fallback.push_back(gates[0]);
+	fallback.push_back("header.fTimeStamp - 1300000000 < 60");
+	printf("(warnings about leaves missing from tree 1 are expected below)\n");
+	test_gates(&mixed, fallback, "chain with a head file");
+
+	for (size_t i = 0; i < files.size(); ++i)
+		unlink(files[i].c_str());
+
+	return test::report();
+}
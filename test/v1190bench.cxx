@@ -0,0 +1,115 @@
+///
+/// \file v1190bench.cxx
+/// \brief Micro-benchmark of vme::V1190 unpacking.
+///
+/// Builds a MIDAS event holding a single V1190 bank with a random set of hits,
+/// then times reset() + unpack() (the per-event cost in Head / Tail unpacking),
+/// and the cost of copying the module (as done by the multithreaded pipeline).
+/// Prints a checksum of get_data(), get_leading() and get_trailing() so results
+/// can be compared between versions.
+///
+/// Build with `make test/v1190bench`; usage: test/v1190bench [nevents] [nhits]
+///
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sys/time.h>
+#include "midas/Event.hxx"
+#include "Vme.hxx"
+
+namespace {
+
+double now()
+{
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/// Event header + bank header + one 16-bit bank named "TDC0"
+std::vector<uint32_t> make_event(int nhits)
+{
+	std::vector<uint32_t> bank;
+	bank.push_back((8u<<27) | (1u<<5));    // global header
+	bank.push_back((1u<<27) | (1u<<12));   // TDC header
+	for (int i = 0; i < nhits; ++i) {
+		uint32_t edge = rand() % 2;
+		uint32_t ch   = rand() % vme::V1190::MAX_CHANNELS;
+		bank.push_back((edge<<26) | (ch<<19) | (rand() % 500000));
+	}
+	bank.push_back((3u<<27) | (1u<<12) | (nhits + 2)); // TDC trailer
+	bank.push_back((0x10u<<27) | ((nhits + 4)<<5));   // global trailer
+
+	std::vector<uint32_t> event;
+	const uint16_t hdr[2] = { 1, 0 };
+	uint32_t h0; memcpy(&h0, hdr, 4);
+	event.push_back(h0);  // event id, trigger mask
+	event.push_back(0);   // serial number
+	event.push_back(0);   // time stamp
+	event.push_back(0);   // data size (below)
+	event.push_back(0);   // bank header: size (below)
+	event.push_back(1);   // bank header: flags (16-bit banks)
+	uint32_t name; memcpy(&name, "TDC0", 4);
+	event.push_back(name);
+	event.push_back(6 | (bank.size()*4) << 16); // TID_DWORD
+	event.insert(event.end(), bank.begin(), bank.end());
+	if (bank.size() % 2) event.push_back(0);
+
+	event[4] = (event.size() - 6) * 4;
+	event[3] = (event.size() - 4) * 4;
+	return event;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	const int nevents = argc > 1 ? atoi(argv[1]) : 1000000;
+	const int nhits   = argc > 2 ? atoi(argv[2]) : 40;
+	srand(1);
+
+	const int nsamples = 64;
+	std::vector<std::vector<uint32_t> > buffers;
+	for (int i = 0; i < nsamples; ++i)
+		buffers.push_back(make_event(nhits));
+
+	std::vector<midas::EventView*> events;
+	for (int i = 0; i < nsamples; ++i)
+		events.push_back(new midas::EventView(&buffers[i][0], &buffers[i][4]));
+
+	vme::V1190 tdc;
+	int64_t sum = 0;
+	double t0 = now();
+	for (int i = 0; i < nevents; ++i) {
+		tdc.reset();
+		tdc.unpack(*events[i % nsamples], "TDC0");
+		sum += tdc.get_data(i % vme::V1190::MAX_CHANNELS);
+	}
+	double t1 = now();
+
+	for (int i = 0; i < nsamples; ++i) {
+		tdc.reset();
+		tdc.unpack(*events[i], "TDC0");
+		for (int ch = 0; ch < vme::V1190::MAX_CHANNELS; ++ch) {
+			sum += tdc.get_data(ch);
+			for (int hit = 0; hit < 4; ++hit)
+				sum += tdc.get_leading(ch, hit) + tdc.get_trailing(ch, hit);
+		}
+	}
+
+	std::vector<vme::V1190> copies(2);
+	double t2 = now();
+	for (int i = 0; i < nevents; ++i)
+		copies[i % 2] = tdc;
+	double t3 = now();
+
+	printf("%d events, %d hits per event\n", nevents, nhits);
+	printf("reset + unpack: %8.1f ns/event\n", (t1 - t0) / nevents * 1e9);
+	printf("copy:           %8.1f ns/event\n", (t3 - t2) / nevents * 1e9);
+	printf("checksum:       %lld\n", (long long)sum);
+
+	for (int i = 0; i < nsamples; ++i)
+		delete events[i];
+	return 0;
+}
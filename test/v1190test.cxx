@@ -0,0 +1,98 @@
+///
+/// \file v1190test.cxx
+/// \brief Checks vme::V1190 unpacking against the hits written into the bank.
+///
+/// Unpacks synthetic V1190 banks and compares get_data(), get_leading() and
+/// get_trailing() of every channel and hit to the hits of the bank, taken in
+/// readout order. A bank with more than vme::V1190::MAX_HITS hits must keep the
+/// first MAX_HITS hits, drop the rest, and report it.
+///
+/// Build with `make test/v1190test`; returns non-zero on failure.
+///
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "midas/Event.hxx"
+#include "Vme.hxx"
+#include "TestEvents.h"
+#include "TestUtil.h"
+
+namespace {
+
+using test::check;
+
+std::vector<test::Hit_t> random_hits(size_t n)
+{
+	std::vector<test::Hit_t> hits(n);
+	for (size_t i = 0; i < n; ++i) {
+		hits[i].fChannel = rand() % vme::V1190::MAX_CHANNELS;
+		hits[i].fEdge    = rand() % 2;
+		hits[i].fValue   = rand() % 500000;
+	}
+	return hits;
+}
+
+/// Unpacks \e hits, returns false if any hit or channel differs from the first \e nkept hits
+bool unpack_and_compare(const std::vector<test::Hit_t>& hits, size_t nkept, vme::V1190& tdc, bool& ret)
+{
+	test::EventBuilder event(1, 0);
+	event.Add("TDC0", test::v1190_bank(hits, 0));
+	event.Finish();
+	midas::EventView view(event.Header(), event.Data(), 0, 0.);
+	tdc.reset();
+	ret = tdc.unpack(view, "TDC0");
+
+	// Reference: hits of each channel and edge, in readout order
+	std::vector<int32_t> expected[2][vme::V1190::MAX_CHANNELS];
+	for (size_t i = 0; i < nkept; ++i)
+		expected[hits[i].fEdge][hits[i].fChannel].push_back(hits[i].fValue);
+
+	bool same = tdc.fNumHits == nkept;
+	for (int ch = 0; ch < vme::V1190::MAX_CHANNELS; ++ch) {
+		const std::vector<int32_t>& leading = expected[0][ch];
+		const std::vector<int32_t>& trailing = expected[1][ch];
+		same = same && tdc.channel[ch].nleading == (int32_t)leading.size();
+		same = same && tdc.channel[ch].ntrailing == (int32_t)trailing.size();
+		same = same && tdc.get_data(ch) == (leading.empty() ? dragon::NoData<int32_t>::value() : leading[0]);
+		for (size_t h = 0; h < leading.size(); ++h)
+			same = same && tdc.get_leading(ch, h) == leading[h];
+		for (size_t h = 0; h < trailing.size(); ++h)
+			same = same && tdc.get_trailing(ch, h) == trailing[h];
+		same = same && tdc.get_leading(ch, leading.size()) == -1;
+		same = same && tdc.get_trailing(ch, trailing.size()) == -1;
+	}
+	return same;
+}
+
+}
+
+int main()
+{
+	srand(1);
+	vme::V1190 tdc;
+
+	bool same = true, ret = true, allret = true;
+	for (int i = 0; i < 2000; ++i) {
+		const std::vector<test::Hit_t> hits = random_hits(rand() % 200);
+		same = same && unpack_and_compare(hits, hits.size(), tdc, ret);
+		allret = allret && ret;
+	}
+	check(same, "random events: all hits in readout order");
+	check(allret, "random events: unpack() succeeds");
+	check(tdc.fNumDropped == 0, "random events: no hits dropped");
+
+	const std::vector<test::Hit_t> full = random_hits(vme::V1190::MAX_HITS);
+	check(unpack_and_compare(full, full.size(), tdc, ret) && ret && tdc.fNumDropped == 0,
+				"MAX_HITS hits: all kept");
+
+	printf("(an error message about %d dropped hits is expected below)\n", 100);
+	const std::vector<test::Hit_t> over = random_hits(vme::V1190::MAX_HITS + 100);
+	check(unpack_and_compare(over, vme::V1190::MAX_HITS, tdc, ret), "MAX_HITS + 100 hits: first MAX_HITS kept");
+	check(!ret, "MAX_HITS + 100 hits: unpack() reports failure");
+	check(tdc.fNumDropped == 100, "MAX_HITS + 100 hits: 100 hits dropped and counted");
+
+	check(unpack_and_compare(random_hits(10), 10, tdc, ret) && ret && tdc.fNumDropped == 0,
+				"after reset(): no hits dropped");
+
+	return test::report();
+}
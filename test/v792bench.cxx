@@ -0,0 +1,138 @@
+///
+/// \file v792bench.cxx
+/// \brief Validation and micro-benchmark of the vme::V792 (V785) decoders.
+///
+/// Reads all events of a MIDAS file into memory, unpacks the given ADC banks
+/// with every decoder supported on this machine and checks that the results
+/// are identical to the scalar decoder. Then times each decoder over the
+/// whole file.
+///
+/// Build with `make test/v792bench`; usage:
+/// test/v792bench <file.mid> [nrepeat] [bank1 bank2 ...]
+/// (default banks: ADC0 TLQ0 TLQ1)
+///
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <sys/time.h>
+#include "midas/libMidasInterface/TMidasFile.h"
+#include "midas/Event.hxx"
+#include "Vme.hxx"
+
+namespace {
+
+double now()
+{
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+bool same(const vme::V792& a, const vme::V792& b)
+{
+	return a.n_ch == b.n_ch && a.count == b.count &&
+		a.overflow == b.overflow && a.underflow == b.underflow &&
+		!memcmp(a.data, b.data, sizeof(a.data));
+}
+
+const char* name(vme::V792::Decoder_t d)
+{
+	switch (d) {
+	case vme::V792::SSE2: return "sse2";
+	case vme::V792::AVX2: return "avx2";
+	default: return "scalar";
+	}
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <file.mid> [nrepeat] [bank1 bank2 ...]\n", argv[0]);
+		return 1;
+	}
+	const int nrepeat = argc > 2 ? atoi(argv[2]) : 10;
+	std::vector<std::string> banks;
+	for (int i = 3; i < argc; ++i)
+		banks.push_back(argv[i]);
+	if (banks.empty()) {
+		banks.push_back("ADC0");
+		banks.push_back("TLQ0");
+		banks.push_back("TLQ1");
+	}
+
+	TMidasFile file;
+	if (!file.Open(argv[1])) {
+		fprintf(stderr, "Couldn't open \"%s\"\n", argv[1]);
+		return 1;
+	}
+	std::vector<std::vector<char> > buffers;
+	TMidasEvent event;
+	while (file.ReadInPlace(&event)) {
+		if (event.GetEventId() & 0x8000) // BOR, EOR (ODB dumps, no banks)
+			continue;
+		const size_t hsize = sizeof(TMidas_EVENT_HEADER);
+		std::vector<char> buf(hsize + event.GetDataSize());
+		memcpy(&buf[0], event.GetEventHeader(), hsize);
+		memcpy(&buf[hsize], event.GetData(), event.GetDataSize());
+		buffers.push_back(buf);
+	}
+	std::vector<midas::EventView*> events;
+	for (size_t i = 0; i < buffers.size(); ++i)
+		events.push_back(new midas::EventView(&buffers[i][0]));
+
+	std::vector<vme::V792::Decoder_t> decoders;
+	decoders.push_back(vme::V792::SCALAR);
+	if (vme::V792::have_decoder(vme::V792::SSE2)) decoders.push_back(vme::V792::SSE2);
+	if (vme::V792::have_decoder(vme::V792::AVX2)) decoders.push_back(vme::V792::AVX2);
+
+	// Validate against the scalar decoder
+	long nbanks = 0, nbad = 0;
+	std::vector<vme::V792> adc(decoders.size());
+	for (size_t i = 0; i < events.size(); ++i) {
+		for (size_t b = 0; b < banks.size(); ++b) {
+			int len = 0;
+			if (!events[i]->GetBankPointer<uint32_t>(banks[b].c_str(), &len))
+				continue;
+			++nbanks;
+			for (size_t d = 0; d < decoders.size(); ++d) {
+				vme::V792::set_decoder(decoders[d]);
+				adc[d].reset();
+				adc[d].unpack(*events[i], banks[b].c_str());
+				if (d && !same(adc[0], adc[d])) {
+					++nbad;
+					printf("Mismatch: event %lu, bank %s, decoder %s\n",
+								 (unsigned long)i, banks[b].c_str(), name(decoders[d]));
+				}
+			}
+		}
+	}
+	printf("%lu events, %ld ADC banks, %ld mismatches\n", (unsigned long)events.size(), nbanks, nbad);
+
+	// Time each decoder
+	for (size_t d = 0; d < decoders.size(); ++d) {
+		vme::V792::set_decoder(decoders[d]);
+		vme::V792 tmp;
+		long sum = 0;
+		double t0 = now();
+		for (int r = 0; r < nrepeat; ++r) {
+			for (size_t i = 0; i < events.size(); ++i) {
+				for (size_t b = 0; b < banks.size(); ++b) {
+					tmp.reset();
+					tmp.unpack(*events[i], banks[b].c_str());
+					sum += tmp.data[0];
+				}
+			}
+		}
+		double t1 = now();
+		printf("%-6s: %8.1f ns/bank (checksum %ld)\n", name(decoders[d]),
+					 nbanks ? (t1 - t0) / (nbanks * nrepeat) * 1e9 : 0., sum);
+	}
+
+	for (size_t i = 0; i < events.size(); ++i)
+		delete events[i];
+	return nbad ? 1 : 0;
+}
@@ -0,0 +1,374 @@
+///
+/// \file xmltest.cxx
+/// \brief Checks midas::Xml key lookups against lookups in the mxml tree,
+/// and the round trip of ODBs through binary snapshots.
+///
+/// For every key and keyarray of an ODB, compares what midas::Xml reads
+/// through its key index (HasKey(), GetValue(), GetArray(), GetArrayLength()
+/// and FindKey() / FindKeyArray()) to what is found by searching the mxml tree
+/// with an XPath and streaming the text of the value nodes, which is how the
+/// values used to be read. Paths that are not keys (directories, keys asked
+/// for as arrays and vice versa, missing keys) must not be found either way.
+///
+/// Each ODB is then converted into a snapshot with MakeSnapshot(), and loaded
+/// back from the snapshot buffer, both as Xml(char*, int) does and as after
+/// reading from a ROOT file. The XML regenerated from the snapshot (Dump()) must
+/// be the same as the original text, the reloaded ODB must pass the lookup
+/// checks above, and a snapshot of the regenerated XML must have the same bytes.
+///
+/// Uses a built-in ODB covering all key types and some corner cases, and
+/// optionally an ODB dump (.xml or .mid file) given on the command line.
+///
+/// Build with `make test/xmltest`; usage: test/xmltest [odb file];
+/// returns non-zero on failure.
+///
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <vector>
+#include "midas/Xml.hxx"
+#include "TestUtil.h"
+
+namespace {
+
+using test::check;
+
+const char* gOdb =
+	"<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n"
+	"<odb root=\"/\" filename=\"test.xml\">\n"
+	"  <dir name=\"dragon\">\n"
+	"    <dir name=\"bgo\">\n"
+	"      <dir name=\"variables\">\n"
+	"        <keyarray name=\"channel\" type=\"INT\" num_values=\"4\">\n"
+	"          <value index=\"0\">0</value>\n"
+	"          <value index=\"1\">-1</value>\n"
+	"          <value index=\"2\">2147483647</value>\n"
+	"          <value index=\"3\">-2147483648</value>\n"
+	"        </keyarray>\n"
+	"        <keyarray name=\"slope\" type=\"DOUBLE\" num_values=\"3\">\n"
+	"          <value index=\"0\">1.5</value>\n"
+	"          <value index=\"1\">-0.000125</value>\n"
+	"          <value index=\"2\">6.0221e+23</value>\n"
+	"        </keyarray>\n"
+	"        <keyarray name=\"offset\" type=\"FLOAT\" num_values=\"2\">\n"
+	"          <value index=\"0\">0.1</value>\n"
+	"          <value index=\"1\">3.4028235e+38</value>\n"
+	"        </keyarray>\n"
+	"        <key name=\"threshold\" type=\"DWORD\">4294967295</key>\n"
+	"        <key name=\"big\" type=\"INT64\">-9223372036854775807</key>\n"
+	"        <key name=\"enabled\" type=\"BOOL\">y</key>\n"
+	"        <key name=\"disabled\" type=\"BOOL\">n</key>\n"
+	"      </dir>\n"
+	"    </dir>\n"
+	"    <dir name=\"scaler\">\n"
+	"      <dir name=\"head\">\n"
+	"        <keyarray name=\"names\" type=\"STRING\" size=\"32\" num_values=\"3\">\n"
+	"          <value index=\"0\">triggers presented</value>\n"
+	"          <value index=\"1\">acquired</value>\n"
+	"          <value index=\"2\"></value>\n"
+	"        </keyarray>\n"
+	"        <key name=\"bank name\" type=\"STRING\" size=\"32\">SCH0 with spaces</key>\n"
+	"        <keyarray name=\"flags\" type=\"BOOL\" num_values=\"2\">\n"
+	"          <value index=\"0\">n</value>\n"
+	"          <value index=\"1\">y</value>\n"
+	"        </keyarray>\n"
+	"      </dir>\n"
+	"      <dir name=\"tail\">\n"
+	"        <keyarray name=\"names\" type=\"STRING\" size=\"32\" num_values=\"1\">\n"
+	"          <value index=\"0\">tail</value>\n"
+	"        </keyarray>\n"
+	"        <key name=\"head\" type=\"INT\">17</key>\n"
+	"      </dir>\n"
+	"    </dir>\n"
+	"    <keyarray name=\"empty\" type=\"WORD\" num_values=\"0\">\n"
+	"    </keyarray>\n"
+	"    <keyarray name=\"single\" type=\"WORD\" num_values=\"1\">\n"
+	"      <value index=\"0\">65535</value>\n"
+	"    </keyarray>\n"
+	"  </dir>\n"
+	"  <dir name=\"Experiment\">\n"
+	"    <key name=\"Name\" type=\"STRING\" size=\"32\">dragon</key>\n"
+	"    <key name=\"Empty\" type=\"STRING\" size=\"32\"></key>\n"
+	"  </dir>\n"
+	"</odb>\n";
+
+/// Key or keyarray of the mxml tree
+struct Key_t {
+	std::string fPath;
+	bool fIsArray;
+};
+
+/// Lists the keys below \e dir, in tree order
+void list_keys(PMXML_NODE dir, const std::string& path, std::vector<Key_t>& keys)
+{
+	for (int i = 0; i < dir->n_children; ++i) {
+		PMXML_NODE child = dir->child + i;
+		const char* name = mxml_get_attribute(child, "name");
+		if (!name) continue;
+		if (!strcmp(child->name, "dir")) {
+			list_keys(child, path + name + "/", keys);
+		}
+		else if (!strcmp(child->name, "key") || !strcmp(child->name, "keyarray")) {
+			Key_t key = { path + name, !strcmp(child->name, "keyarray") };
+			keys.push_back(key);
+		}
+	}
+}
+
+/// XPath of a key, as formerly used by midas::Xml::FindKey()
+std::string xml_path(const std::string& path, bool isArray)
+{
+	std::string out;
+	std::string::size_type begin = 0, end;
+	while ((end = path.find('/', begin)) != std::string::npos) {
+		out += "/dir[@name=" + path.substr(begin, end - begin) + "]";
+		begin = end + 1;
+	}
+	out += (isArray ? "/keyarray[@name=" : "/key[@name=") + path.substr(begin) + "]";
+	return out;
+}
+
+/// Value of a node, converted as formerly done by midas::Xml
+template <class T> T convert(PMXML_NODE node)
+{
+	T value = T(); // streaming an empty text used to leave it uninitialized
+	std::stringstream val;
+	val << node->value;
+	val >> value;
+	return value;
+}
+
+template <> bool convert<bool>(PMXML_NODE node)
+{
+	return !strcmp("y", node->value);
+}
+
+template <> std::string convert<std::string>(PMXML_NODE node)
+{
+	return node->value;
+}
+
+/// Same bits, so that NaN compares equal
+template <class T> bool equal(const T& a, const T& b)
+{
+	return a == b;
+}
+
+template <> bool equal<double>(const double& a, const double& b)
+{
+	return !memcmp(&a, &b, sizeof(double));
+}
+
+template <> bool equal<float>(const float& a, const float& b)
+{
+	return !memcmp(&a, &b, sizeof(float));
+}
+
+/// Compares GetValue<T>() to the mxml lookup
+template <class T> bool compare_value(midas::Xml& xml, PMXML_NODE odb, const std::string& path)
+{
+	PMXML_NODE node = mxml_find_node(odb, xml_path(path, false).c_str());
+	bool success = false;
+	const T value = xml.GetValue<T>(path.c_str(), &success);
+	if (!success || !node) return false;
+	if (!equal(value, convert<T>(node))) {
+		printf("  %s: mismatch\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+/// Compares GetArray<T>() (both versions) to the mxml lookup
+template <class T> bool compare_array(midas::Xml& xml, PMXML_NODE odb, const std::string& path)
+{
+	PMXML_NODE node = mxml_find_node(odb, xml_path(path, true).c_str());
+	if (!node) return false;
+	const int size = atoi(mxml_get_attribute(node, "num_values"));
+	std::vector<T> expected;
+	for (int i = 0; i < size; ++i) {
+		std::stringstream valPath;
+		valPath << "/value[" << i+1 << "]";
+		PMXML_NODE valNode = mxml_find_node(node, valPath.str().c_str());
+		if (!valNode) return false;
+		if (typeid(T) == typeid(std::string)) { // array strings were always streamed
+			std::stringstream val;
+			val << valNode->value;
+			T value = T();
+			val >> value;
+			expected.push_back(value);
+		}
+		else expected.push_back(convert<T>(valNode));
+	}
+
+	bool success = false;
+	const std::vector<T> array = xml.GetArray<T>(path.c_str(), &success);
+	bool same = success && xml.GetArrayLength(path.c_str()) == size && array.size() == expected.size();
+	for (size_t i = 0; same && i < array.size(); ++i)
+		same = equal<T>(array[i], expected[i]);
+
+	T* fixed = new T[size + 1];
+	xml.GetArray<T>(path.c_str(), size, fixed, &success);
+	same = same && success;
+	for (int i = 0; same && i < size; ++i)
+		same = equal<T>(fixed[i], expected[i]);
+	delete[] fixed;
+
+	if (!same) printf("  %s: mismatch\n", path.c_str());
+	return same;
+}
+
+/// Checks all keys of \e xml against its own mxml tree, labels the checks with \e what
+void test_odb(midas::Xml& xml, const char* what)
+{
+	PMXML_NODE odb = xml.fOdb;
+	std::vector<Key_t> keys;
+	list_keys(odb, "", keys);
+	printf("%s: %lu keys\n", what, (unsigned long)keys.size());
+
+	bool found = true, nodes = true, values = true, arrays = true, missing = true;
+	for (size_t i = 0; i < keys.size(); ++i) {
+		const std::string& path = keys[i].fPath;
+		const bool isArray = keys[i].fIsArray;
+		found = found && xml.HasKey(path.c_str()) && xml.HasKey(("/" + path).c_str());
+
+		PMXML_NODE node = mxml_find_node(odb, xml_path(path, isArray).c_str());
+		nodes = nodes && node &&
+			(isArray ? xml.FindKeyArray(path.c_str(), true) : xml.FindKey(path.c_str(), true)) == node;
+		nodes = nodes &&
+			(isArray ? xml.FindKey(path.c_str(), true) : xml.FindKeyArray(path.c_str(), true)) == 0;
+
+		if (!isArray) {
+			values = values && compare_value<int>(xml, odb, path);
+			values = values && compare_value<unsigned int>(xml, odb, path);
+			values = values && compare_value<short>(xml, odb, path);
+			values = values && compare_value<unsigned short>(xml, odb, path);
+			values = values && compare_value<long long>(xml, odb, path);
+			values = values && compare_value<unsigned long long>(xml, odb, path);
+			values = values && compare_value<double>(xml, odb, path);
+			values = values && compare_value<float>(xml, odb, path);
+			values = values && compare_value<bool>(xml, odb, path);
+			values = values && compare_value<std::string>(xml, odb, path);
+			bool success = true;
+			std::vector<int> array = xml.GetArray<int>(path.c_str(), &success);
+			missing = missing && !success && xml.GetArrayLength(path.c_str()) == -1;
+		}
+		else {
+			arrays = arrays && compare_array<int>(xml, odb, path);
+			arrays = arrays && compare_array<unsigned int>(xml, odb, path);
+			arrays = arrays && compare_array<long long>(xml, odb, path);
+			arrays = arrays && compare_array<double>(xml, odb, path);
+			arrays = arrays && compare_array<float>(xml, odb, path);
+			arrays = arrays && compare_array<bool>(xml, odb, path);
+			arrays = arrays && compare_array<std::string>(xml, odb, path);
+			bool success = true;
+			xml.GetValue<int>(path.c_str(), &success);
+			missing = missing && !success;
+		}
+
+		// Parent directory and a sibling that doesn't exist
+		const std::string::size_type slash = path.rfind('/');
+		if (slash != std::string::npos) {
+			const std::string dir = path.substr(0, slash);
+			missing = missing && !xml.HasKey(dir.c_str()) && !xml.HasKey((dir + "/").c_str());
+		}
+		missing = missing && !xml.HasKey((path + "x").c_str()) && !xml.HasKey((path + "/x").c_str());
+	}
+	bool success = true;
+	xml.GetValue<int>("no/such/key", &success);
+	missing = missing && !success && !xml.HasKey("") && !xml.HasKey("/");
+
+	std::string label(what);
+	check(found,   (label + ": HasKey() finds all keys").c_str());
+	check(nodes,   (label + ": FindKey() / FindKeyArray() return the mxml nodes").c_str());
+	check(values,  (label + ": GetValue() matches the mxml values").c_str());
+	check(arrays,  (label + ": GetArray() and GetArrayLength() match the mxml values").c_str());
+	check(missing, (label + ": paths which are not keys are not found").c_str());
+}
+
+/// XML text of \e xml, from the root element on, without trailing whitespace
+std::string dump(const midas::Xml& xml)
+{
+	std::ostringstream strm;
+	xml.Dump(strm);
+	std::string text = strm.str();
+	const std::string::size_type start = text.find("<odb");
+	text.erase(0, start == std::string::npos ? text.size() : start);
+	while (!text.empty() && isspace(text[text.size() - 1])) text.resize(text.size() - 1);
+	return text;
+}
+
+/// Checks the round trip of \e xml through a snapshot
+void test_snapshot(midas::Xml& xml, const char* what)
+{
+	const std::string label(what);
+	const std::string text = dump(xml);
+	const uint64_t checksum = xml.Checksum("");
+
+	check(xml.MakeSnapshot() && xml.IsSnapshot() && xml.fBuffer == 0,
+				(label + ": snapshot made, XML text released").c_str());
+	check(dump(xml) == text, (label + ": XML from the snapshot is the same as the original").c_str());
+	check(xml.Checksum("") == checksum, (label + ": same keys and values after MakeSnapshot()").c_str());
+	const std::vector<char> snapshot(xml.fSnapshot, xml.fSnapshot + xml.fSnapshotLength);
+
+	// As read by Xml(char*, int)
+	std::vector<char> buf(snapshot);
+	midas::Xml loaded(&buf[0], buf.size());
+	check(!loaded.IsZombie() && loaded.IsSnapshot() && loaded.fTree == 0,
+				(label + ": snapshot loaded without parsing XML").c_str());
+	check(loaded.Checksum("") == checksum, (label + ": same keys and values in the loaded snapshot").c_str());
+	check(dump(loaded) == text, (label + ": XML from the loaded snapshot is the same as the original").c_str());
+	loaded.FindKey("no/such/key", true); // rebuilds the mxml tree
+	if (loaded.fOdb) test_odb(loaded, (label + " (from snapshot)").c_str());
+	check(loaded.fOdb != 0 && loaded.IsSnapshot() && dump(loaded) == text,
+				(label + ": tree rebuilt from the snapshot, which is kept").c_str());
+
+	// As read from a ROOT file: default constructor, then the streamer sets fSnapshot
+	midas::Xml streamed;
+	streamed.fSnapshotLength = snapshot.size();
+	streamed.fSnapshot = new char[snapshot.size()];
+	memcpy(streamed.fSnapshot, &snapshot[0], snapshot.size());
+	check(streamed.Checksum("") == checksum && dump(streamed) == text,
+				(label + ": snapshot read by the streamer").c_str());
+
+	// Snapshot of the regenerated XML
+	std::vector<char> xmlText(text.begin(), text.end());
+	midas::Xml reparsed(&xmlText[0], xmlText.size());
+	reparsed.MakeSnapshot();
+	check(reparsed.fSnapshotLength == snapshot.size() &&
+				!memcmp(reparsed.fSnapshot, &snapshot[0], snapshot.size()),
+				(label + ": snapshot of the regenerated XML has the same bytes").c_str());
+
+	// A damaged snapshot is rejected
+	std::vector<char> bad(snapshot.begin(), snapshot.begin() + snapshot.size() / 2);
+	midas::Xml truncated(&bad[0], bad.size());
+	check(truncated.IsZombie() && !truncated.HasKey("dragon"), (label + ": truncated snapshot rejected").c_str());
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	gErrorIgnoreLevel = 5000; // lookups of missing keys print errors
+
+	std::vector<char> buf(gOdb, gOdb + strlen(gOdb));
+	midas::Xml xml(&buf[0], buf.size());
+	check(!xml.IsZombie(), "built-in ODB parsed");
+	if (!xml.IsZombie()) {
+		test_odb(xml, "built-in ODB");
+		test_snapshot(xml, "built-in ODB");
+	}
+
+	if (argc > 1) {
+		midas::Xml file(argv[1]);
+		check(!file.IsZombie(), argv[1]);
+		if (!file.IsZombie()) {
+			test_odb(file, argv[1]);
+			test_snapshot(file, argv[1]);
+		}
+	}
+
+	return test::report();
+}